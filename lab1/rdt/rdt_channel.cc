@@ -0,0 +1,453 @@
+/*
+ * FILE: rdt_channel.cc
+ * DESCRIPTION: Pluggable channel models for the reliable data transfer
+ *              simulator.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <immintrin.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rdt_channel.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  delay distributions
+  []------------------------------------------------------------------------[]*/
+
+/* number of packets whose random decisions are drawn in one go */
+#define CHANNEL_BATCH 64
+
+/* shape of the pareto jitter tail: finite mean and variance, heavy tail */
+#define PARETO_SHAPE 2.5
+
+static const char *delay_names[] = {"fixed", "uniform", "normal", "pareto"};
+
+int delay_kind_from_name(const char *name)
+{
+    for (int i=0; i<(int)(sizeof(delay_names)/sizeof(delay_names[0])); i++) {
+	if (strcmp(name, delay_names[i])==0) return i;
+    }
+    return -1;
+}
+
+DelayModel::DelayModel(int kind, double latency, double jitter,
+		       double outoforder_rate, RdtRandom *rng)
+{
+    this->kind = kind;
+    this->latency = latency;
+    this->jitter = jitter;
+    this->outoforder_rate = outoforder_rate;
+    this->rng = rng;
+}
+
+double DelayModel::sample()
+{
+    double d;
+
+    switch (kind) {
+    case DELAY_UNIFORM:
+	/* latency +/- jitter */
+	d = latency + jitter*(2.0*rng->uniform() - 1.0);
+	break;
+
+    case DELAY_NORMAL:
+	{
+	    /* Box-Muller transform, jitter is the standard deviation */
+	    double u1 = rng->uniform(), u2 = rng->uniform();
+	    if (u1<1e-12) u1 = 1e-12;
+	    d = latency + jitter*sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+	}
+	break;
+
+    case DELAY_PARETO:
+	{
+	    /* latency plus a pareto distributed queueing delay whose mean is
+	       jitter */
+	    double u = rng->uniform();
+	    if (u<1e-12) u = 1e-12;
+	    double xm = jitter*(PARETO_SHAPE-1.0)/PARETO_SHAPE;
+	    d = latency + xm*pow(u, -1.0/PARETO_SHAPE);
+	}
+	break;
+
+    case DELAY_FIXED:
+    default:
+	if (rng->uniform()<outoforder_rate)
+	    d = latency*2.0*rng->uniform();
+	else
+	    d = latency;
+	break;
+    }
+
+    return (d<0) ? 0 : d;
+}
+
+double DelayModel::min_delay() const
+{
+    double d;
+
+    switch (kind) {
+    case DELAY_UNIFORM:
+	d = latency - jitter;
+	break;
+
+    case DELAY_NORMAL:
+	/* unbounded below, then clamped */
+	d = (jitter>0) ? 0 : latency;
+	break;
+
+    case DELAY_PARETO:
+	d = latency + jitter*(PARETO_SHAPE-1.0)/PARETO_SHAPE;
+	break;
+
+    case DELAY_FIXED:
+    default:
+	/* an out-of-order packet may arrive right away */
+	d = (outoforder_rate>0) ? 0 : latency;
+	break;
+    }
+
+    return (d<0) ? 0 : d;
+}
+
+static void describe_delay(FILE *fp, const DelayModel &delay)
+{
+    if (delay.kind==DELAY_FIXED)
+	fprintf(fp, "latency %.3fs (out-of-order %.2f%%)", delay.latency,
+		delay.outoforder_rate*100.0);
+    else
+	fprintf(fp, "%s latency %.3fs jitter %.3fs", delay_names[delay.kind],
+		delay.latency, delay.jitter);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  Bernoulli channel
+  []------------------------------------------------------------------------[]*/
+
+BernoulliChannel::BernoulliChannel(double loss_rate, double corrupt_rate,
+				   const DelayModel &delay,
+				   RdtRandom *rng)
+    : delay(delay)
+{
+    this->loss_rate = loss_rate;
+    this->corrupt_rate = corrupt_rate;
+    this->rng = rng;
+}
+
+void BernoulliChannel::next_fate(struct channel_fate *fate)
+{
+    /* packet lost at rate "loss_rate" */
+    fate->lost = (rng->uniform()<loss_rate);
+    if (fate->lost) return;
+
+    /* packet corrupted at rate "corrupt_rate" */
+    fate->corrupted = (rng->uniform()<corrupt_rate);
+    fate->delay = delay.sample();
+}
+
+void BernoulliChannel::next_fates(struct channel_fate *fates, int n)
+{
+    /* the classic fixed delay draws one or two extra numbers per packet, the
+       jitter distributions are sampled one by one */
+    if (delay.kind!=DELAY_FIXED) {
+	Channel::next_fates(fates, n);
+	return;
+    }
+
+    /* four decisions per packet: loss, corruption, out-of-order and the
+       out-of-order latency */
+    double draws[4*CHANNEL_BATCH];
+    while (n>0) {
+	int m = (n<CHANNEL_BATCH) ? n : CHANNEL_BATCH;
+	rng->fill_uniform(draws, 4*m);
+
+	for (int i=0; i<m; i++) {
+	    const double *d = &draws[4*i];
+	    fates[i].lost = (d[0]<loss_rate);
+	    fates[i].corrupted = (d[1]<corrupt_rate);
+	    fates[i].delay = (d[2]<delay.outoforder_rate)
+		? delay.latency*2.0*d[3] : delay.latency;
+	}
+
+	fates += m;
+	n -= m;
+    }
+}
+
+void BernoulliChannel::describe(FILE *fp)
+{
+    fprintf(fp, "bernoulli: loss %.2f%%, corrupt %.2f%%, ",
+	    loss_rate*100.0, corrupt_rate*100.0);
+    describe_delay(fp, delay);
+    fprintf(fp, "\n");
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  Gilbert-Elliott channel
+  []------------------------------------------------------------------------[]*/
+
+GilbertElliottChannel::GilbertElliottChannel(double p, double r,
+					     double loss_good,
+					     double loss_bad,
+					     double corrupt_rate,
+					     const DelayModel &delay,
+					     RdtRandom *rng)
+    : delay(delay)
+{
+    this->p = p;
+    this->r = r;
+    this->loss_good = loss_good;
+    this->loss_bad = loss_bad;
+    this->corrupt_rate = corrupt_rate;
+    this->rng = rng;
+
+    /* start in the stationary distribution */
+    bad = (p+r>0) && (rng->uniform()<p/(p+r));
+}
+
+void GilbertElliottChannel::next_fate(struct channel_fate *fate)
+{
+    /* state transition happens before every packet */
+    if (bad) {
+	if (rng->uniform()<r) bad = false;
+    }
+    else {
+	if (rng->uniform()<p) bad = true;
+    }
+
+    fate->lost = (rng->uniform()<(bad ? loss_bad : loss_good));
+    if (fate->lost) return;
+
+    fate->corrupted = (rng->uniform()<corrupt_rate);
+    fate->delay = delay.sample();
+}
+
+void GilbertElliottChannel::describe(FILE *fp)
+{
+    double pi_bad = (p+r>0) ? p/(p+r) : 0;
+    fprintf(fp, "gilbert-elliott: p %.4f, r %.4f, loss good/bad %.2f%%/%.2f%% "
+	    "(mean loss %.2f%%, mean burst %.1f pkts), corrupt %.2f%%, ",
+	    p, r, loss_good*100.0, loss_bad*100.0,
+	    (pi_bad*loss_bad + (1-pi_bad)*loss_good)*100.0,
+	    (r>0) ? 1.0/r : 0.0, corrupt_rate*100.0);
+    describe_delay(fp, delay);
+    fprintf(fp, "\n");
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  trace-driven channel
+  []------------------------------------------------------------------------[]*/
+
+TraceFile::TraceFile()
+{
+    path = NULL;
+    base = NULL;
+    length = 0;
+    records = NULL;
+    count = 0;
+}
+
+TraceFile::~TraceFile()
+{
+    if (base!=NULL) munmap(base, length);
+}
+
+bool TraceFile::open(const char *path)
+{
+    this->path = path;
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd<0) {
+	fprintf(stderr, "cannot open trace file %s\n", path);
+	return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)<0 || st.st_size<(off_t)sizeof(struct trace_header)) {
+	fprintf(stderr, "trace file %s is too short\n", path);
+	close(fd);
+	return false;
+    }
+
+    length = st.st_size;
+    base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base==MAP_FAILED) {
+	fprintf(stderr, "cannot map trace file %s\n", path);
+	base = NULL;
+	return false;
+    }
+    /* records are replayed front to back */
+    madvise(base, length, MADV_SEQUENTIAL);
+
+    const struct trace_header *hdr = (const struct trace_header *)base;
+    if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic))!=0 ||
+	hdr->version!=TRACE_VERSION) {
+	fprintf(stderr, "%s is not a version %d rdt trace\n", path,
+		TRACE_VERSION);
+	return false;
+    }
+    if (hdr->count==0 ||
+	length < sizeof(*hdr) + (size_t)hdr->count*sizeof(struct trace_record)) {
+	fprintf(stderr, "trace file %s is truncated or empty\n", path);
+	return false;
+    }
+
+    records = (const struct trace_record *)(hdr+1);
+    count = hdr->count;
+    return true;
+}
+
+TraceChannel::TraceChannel(const TraceFile *trace, uint32_t start)
+{
+    this->trace = trace;
+    cursor = start % trace->count;
+}
+
+void TraceChannel::next_fate(struct channel_fate *fate)
+{
+    const struct trace_record *rec = &trace->records[cursor];
+    if (++cursor==trace->count) cursor = 0;
+
+    fate->lost = (rec->fate==TRACE_LOST);
+    fate->corrupted = (rec->fate==TRACE_CORRUPTED);
+    fate->delay = rec->delay_us*1e-6;
+}
+
+double TraceChannel::min_delay()
+{
+    uint32_t least = trace->records[0].delay_us;
+    for (uint32_t i=1; i<trace->count; i++) {
+	if (trace->records[i].delay_us<least) least = trace->records[i].delay_us;
+    }
+    return least*1e-6;
+}
+
+void TraceChannel::describe(FILE *fp)
+{
+    fprintf(fp, "trace: %s (%u records, starting at record %u)\n",
+	    trace->path, trace->count, cursor);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  bottleneck queue
+  []------------------------------------------------------------------------[]*/
+
+Bottleneck::Bottleneck(double rate, int limit)
+{
+    this->rate = rate;
+    this->limit = limit;
+    drops = 0;
+    arrivals = 0;
+    occupancy_sum = 0;
+    max_occupancy = 0;
+}
+
+int64_t Bottleneck::enqueue(int64_t now, int size)
+{
+    arrivals++;
+    if (rate<=0) return now;
+
+    /* forget the packets that have left by now */
+    while (!departures.empty() && departures.front()<=now)
+	departures.pop_front();
+
+    int occupancy = (int) departures.size();
+    occupancy_sum += occupancy;
+    if (occupancy>max_occupancy) max_occupancy = occupancy;
+
+    if (occupancy>=limit) {
+	drops++;
+	return -1;
+    }
+
+    int64_t start = departures.empty() ? now : departures.back();
+    int64_t done = start + llround(size*1e9/rate);
+    departures.push_back(done);
+    return done;
+}
+
+void Bottleneck::describe(FILE *fp)
+{
+    if (rate<=0)
+	fprintf(fp, "unlimited rate\n");
+    else
+	fprintf(fp, "%.0f bytes/s, drop-tail queue of %d packets\n", rate,
+		limit);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  packet corruption
+  []------------------------------------------------------------------------[]*/
+
+/* a random byte r is mapped to the shift ((r*21)>>8) - 10, which covers
+   [-10,10] like the original per-byte myrandom()*20 - 10 */
+static void corrupt_packets_scalar(struct packet **pkts, int n,
+				   const uint8_t *noise)
+{
+    for (int k=0; k<n; k++) {
+	char *data = pkts[k]->data;
+	const uint8_t *r = noise + k*RDT_PKTSIZE;
+	for (int i=0; i<RDT_PKTSIZE; i++)
+	    data[i] = (char)(data[i] + (int)((r[i]*21) >> 8) - 10);
+    }
+}
+
+__attribute__((target("avx2")))
+static void corrupt_packets_avx2(struct packet **pkts, int n,
+				 const uint8_t *noise)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mul = _mm256_set1_epi16(21);
+    const __m256i bias = _mm256_set1_epi8(10);
+
+    for (int k=0; k<n; k++) {
+	char *data = pkts[k]->data;
+	const uint8_t *r = noise + k*RDT_PKTSIZE;
+	for (int i=0; i<RDT_PKTSIZE; i+=32) {
+	    __m256i rv = _mm256_loadu_si256((const __m256i *)(r+i));
+	    /* widen to 16 bits, scale to [0,20] and narrow again; unpack and
+	       pack work within 128-bit lanes, so the byte order is kept */
+	    __m256i lo = _mm256_srli_epi16(
+		_mm256_mullo_epi16(_mm256_unpacklo_epi8(rv, zero), mul), 8);
+	    __m256i hi = _mm256_srli_epi16(
+		_mm256_mullo_epi16(_mm256_unpackhi_epi8(rv, zero), mul), 8);
+	    __m256i shift = _mm256_sub_epi8(_mm256_packus_epi16(lo, hi), bias);
+
+	    __m256i dv = _mm256_loadu_si256((const __m256i *)(data+i));
+	    _mm256_storeu_si256((__m256i *)(data+i), _mm256_add_epi8(dv, shift));
+	}
+    }
+}
+
+void corrupt_packets(struct packet **pkts, int n, RdtRandom *rng)
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    uint8_t noise[CHANNEL_BATCH*RDT_PKTSIZE];
+
+    while (n>0) {
+	int m = (n<CHANNEL_BATCH) ? n : CHANNEL_BATCH;
+	rng->fill_bytes(noise, m*RDT_PKTSIZE);
+
+	if (has_avx2)
+	    corrupt_packets_avx2(pkts, m, noise);
+	else
+	    corrupt_packets_scalar(pkts, m, noise);
+
+	pkts += m;
+	n -= m;
+    }
+}
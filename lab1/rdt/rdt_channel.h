@@ -0,0 +1,254 @@
+/*
+ * FILE: rdt_channel.h
+ * DESCRIPTION: Pluggable channel models for the reliable data transfer
+ *              simulator.  A channel decides, for every packet passed to the
+ *              lower layer, whether the packet is lost or corrupted and how
+ *              long it takes to reach the other side.  Each direction of the
+ *              link owns its own channel instance.
+ */
+
+
+#ifndef _RDT_CHANNEL_H_
+#define _RDT_CHANNEL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+
+#include "rdt_struct.h"
+#include "rdt_random.h"
+
+
+/* the fate of a single packet passed through a channel */
+struct channel_fate {
+    bool lost;          /* the packet never reaches the other side */
+    bool corrupted;     /* the packet is delivered with corrupted content */
+    double delay;       /* one-way delivery latency (in seconds) */
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  delay distributions
+  []------------------------------------------------------------------------[]*/
+
+enum {DELAY_FIXED=0, DELAY_UNIFORM, DELAY_NORMAL, DELAY_PARETO};
+
+/* one-way delay distribution: a base latency plus a jitter term.
+   DELAY_FIXED keeps the classic behavior of the simulator: packets take the
+   base latency, except that a fraction "outoforder_rate" of them is delivered
+   after a random latency in [0, 2*latency). */
+class DelayModel
+{
+public:
+    int kind;               /* one of DELAY_* */
+    double latency;         /* base one-way latency (in seconds) */
+    double jitter;          /* jitter scale (in seconds) */
+    double outoforder_rate; /* only used by DELAY_FIXED */
+    RdtRandom *rng;
+
+public:
+    DelayModel(int kind, double latency, double jitter,
+	       double outoforder_rate, RdtRandom *rng);
+
+    /* draw the latency of the next packet (never negative) */
+    double sample();
+
+    /* the least latency "sample" can draw */
+    double min_delay() const;
+};
+
+/* parse a delay distribution name, return -1 if unknown */
+int delay_kind_from_name(const char *name);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  channel models
+  []------------------------------------------------------------------------[]*/
+
+/* channel model base class */
+class Channel
+{
+public:
+    virtual ~Channel() {}
+
+    /* decide the fate of the next packet sent through this channel */
+    virtual void next_fate(struct channel_fate *fate) = 0;
+
+    /* decide the fates of the next "n" packets at once; models that can draw
+       their random decisions in bulk override this */
+    virtual void next_fates(struct channel_fate *fates, int n) {
+	for (int i=0; i<n; i++) next_fate(&fates[i]);
+    }
+
+    /* print a one-line description of the model */
+    virtual void describe(FILE *fp) = 0;
+
+    /* the least delay a packet can take through the channel (in seconds),
+       which bounds how far ahead the two ends can run on their own */
+    virtual double min_delay() = 0;
+};
+
+/* independent (memoryless) loss: every packet is lost with "loss_rate" and
+   corrupted with "corrupt_rate", regardless of what happened before */
+class BernoulliChannel : public Channel
+{
+public:
+    double loss_rate;
+    double corrupt_rate;
+    DelayModel delay;
+    RdtRandom *rng;
+
+public:
+    BernoulliChannel(double loss_rate, double corrupt_rate,
+		     const DelayModel &delay, RdtRandom *rng);
+
+    void next_fate(struct channel_fate *fate);
+    void next_fates(struct channel_fate *fates, int n);
+    void describe(FILE *fp);
+    double min_delay() { return delay.min_delay(); }
+};
+
+/* two-state Gilbert-Elliott burst loss: the channel alternates between a
+   good and a bad state, with per-packet transition probabilities p (good to
+   bad) and r (bad to good), and a different loss probability in each state.
+   the mean burst length is 1/r packets and the stationary probability of
+   being in the bad state is p/(p+r). */
+class GilbertElliottChannel : public Channel
+{
+public:
+    double p;               /* P(good -> bad) per packet */
+    double r;               /* P(bad -> good) per packet */
+    double loss_good;       /* loss probability in the good state */
+    double loss_bad;        /* loss probability in the bad state */
+    double corrupt_rate;
+    bool bad;               /* current state */
+    DelayModel delay;
+    RdtRandom *rng;
+
+public:
+    GilbertElliottChannel(double p, double r, double loss_good,
+			  double loss_bad, double corrupt_rate,
+			  const DelayModel &delay, RdtRandom *rng);
+
+    void next_fate(struct channel_fate *fate);
+    void describe(FILE *fp);
+    double min_delay() { return delay.min_delay(); }
+};
+
+/* trace-driven channel: per-packet fate and delay are replayed from a binary
+   trace recorded on a real link.  the file is mapped read-only and shared by
+   every channel replaying it; each channel keeps its own cursor and wraps
+   around at the end of the trace.
+
+   trace file layout (all fields little-endian):
+
+       |<- 8 bytes ->|<- 4 bytes ->|<- 4 bytes ->|<- 8 bytes each ...   ->|
+       |  "RDTTRACE" |   version   | record count|  records               |
+
+   each record is
+
+       |<-   4 bytes   ->|<- 1 byte ->|<- 3 bytes ->|
+       | delay (in usec) |    fate    |   padding   |
+
+   where fate is one of TRACE_DELIVERED, TRACE_LOST or TRACE_CORRUPTED. */
+
+#define TRACE_MAGIC "RDTTRACE"
+#define TRACE_VERSION 1
+
+enum {TRACE_DELIVERED=0, TRACE_LOST, TRACE_CORRUPTED};
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+};
+
+struct trace_record {
+    uint32_t delay_us;
+    uint8_t fate;
+    uint8_t pad[3];
+};
+
+/* a read-only mapping of a trace file */
+class TraceFile
+{
+public:
+    const char *path;
+    void *base;             /* start of the mapping */
+    size_t length;          /* length of the mapping */
+    const struct trace_record *records;
+    uint32_t count;
+
+public:
+    TraceFile();
+    ~TraceFile();
+
+    /* map the trace file, return false (with a message on stderr) if the
+       file cannot be mapped or is not a valid trace */
+    bool open(const char *path);
+};
+
+class TraceChannel : public Channel
+{
+public:
+    const TraceFile *trace;
+    uint32_t cursor;        /* next record to replay */
+
+public:
+    TraceChannel(const TraceFile *trace, uint32_t start);
+
+    void next_fate(struct channel_fate *fate);
+    void describe(FILE *fp);
+    double min_delay();
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  bottleneck queue
+  []------------------------------------------------------------------------[]*/
+
+/* a drop-tail queue in front of a link of limited bandwidth.  packets leave
+   the queue one after the other at the link rate, and a packet that finds
+   "limit" packets queued (the one on the link included) is dropped.  the
+   queue sits before the channel model: a packet that made it through the
+   queue may still be lost or corrupted further on.  a rate of 0 stands for
+   a link fast enough never to queue. */
+class Bottleneck
+{
+public:
+    double rate;            /* link rate (in bytes per second) */
+    int limit;              /* queue capacity (in packets) */
+    std::deque<int64_t> departures; /* when the queued packets leave (ns) */
+    long long drops;        /* packets dropped at the tail */
+
+    /* the occupancy arriving packets find, the one on the link included */
+    long long arrivals;
+    long long occupancy_sum;
+    int max_occupancy;
+
+public:
+    Bottleneck(double rate, int limit);
+
+    /* offer a packet of "size" bytes at time "now" (in nanoseconds); return
+       when it is fully on the link, or -1 if the queue drops it */
+    int64_t enqueue(int64_t now, int size);
+
+    /* mean occupancy seen by the arriving packets */
+    double mean_occupancy() const {
+	return (arrivals>0) ? (double) occupancy_sum/arrivals : 0.0;
+    }
+
+    void describe(FILE *fp);
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  packet corruption
+  []------------------------------------------------------------------------[]*/
+
+/* corrupt the content of "n" packets: every byte of every packet is shifted
+   by a random amount in [-10,10].  the random bytes are drawn in bulk and
+   applied with AVX2 when the CPU supports it. */
+void corrupt_packets(struct packet **pkts, int n, RdtRandom *rng);
+
+#endif  /* _RDT_CHANNEL_H_ */
@@ -0,0 +1,356 @@
+/*
+ * FILE: rdt_compress.cc
+ * DESCRIPTION: Optional compression stage of the reliable data transfer
+ *              simulator.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdt_compress.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  LZ77 codec
+  []------------------------------------------------------------------------[]*/
+
+/* the compressed payload is a series of sequences, each
+
+       | token | literal length+ | literals | offset (2 bytes) | match length+ |
+
+   the high nibble of the token is the literal count, the low nibble the
+   match length minus LZ_MIN_MATCH; a nibble of 15 is continued by bytes of
+   255 and a final byte below 255.  the last sequence stops after its
+   literals, once the message is complete. */
+
+/* the history is slid back to LZ_WINDOW bytes when it reaches twice that */
+#define LZ_HISTORY_MAX (2*LZ_WINDOW)
+
+static inline uint32_t read32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v*2654435761U) >> (32-LZ_HASH_BITS);
+}
+
+static char *put_length(char *p, int len)
+{
+    while (len>=255) {
+	*p++ = (char) 255;
+	len -= 255;
+    }
+    *p++ = (char) len;
+    return p;
+}
+
+static char *put_sequence(char *p, const char *literals, int nb_literals,
+			  int offset, int match)
+{
+    char *token = p++;
+    int lit_nibble = (nb_literals<15) ? nb_literals : 15;
+    int match_nibble = 0;
+    if (nb_literals>=15) p = put_length(p, nb_literals-15);
+    memcpy(p, literals, nb_literals);
+    p += nb_literals;
+
+    if (match>0) {
+	uint16_t off = (uint16_t) offset;
+	memcpy(p, &off, 2);
+	p += 2;
+	int m = match - LZ_MIN_MATCH;
+	match_nibble = (m<15) ? m : 15;
+	if (m>=15) p = put_length(p, m-15);
+    }
+    *token = (char) ((lit_nibble<<4) | match_nibble);
+    return p;
+}
+
+LzCompressor::LzCompressor()
+{
+    history_base = 0;
+    table.assign(1<<LZ_HASH_BITS, -1);
+}
+
+int LzCompressor::compress(const char *src, int len, char *dst)
+{
+    /* keep LZ_WINDOW bytes of history in front of the new ones */
+    if (history.size()+len > LZ_HISTORY_MAX && history.size() > LZ_WINDOW) {
+	size_t drop = history.size() - LZ_WINDOW;
+	history.erase(history.begin(), history.begin() + drop);
+	history_base += drop;
+    }
+    size_t start = history.size();
+    history.insert(history.end(), src, src + len);
+
+    const char *buf = history.data();
+    size_t pos = start, anchor = start, end = start + len;
+    char *p = dst;
+
+    while (pos+LZ_MIN_MATCH <= end) {
+	uint32_t v = read32(buf + pos);
+	uint32_t h = lz_hash(v);
+	int64_t candidate = table[h];
+	table[h] = history_base + pos;
+
+	if (candidate>=(int64_t) history_base &&
+	    history_base+pos-candidate <= LZ_WINDOW) {
+	    size_t c = candidate - history_base;
+	    if (read32(buf + c)==v) {
+		size_t match = LZ_MIN_MATCH;
+		while (pos+match<end && buf[c+match]==buf[pos+match]) match++;
+
+		p = put_sequence(p, buf + anchor, pos - anchor, pos - c, match);
+		pos += match;
+		anchor = pos;
+		continue;
+	    }
+	}
+	pos++;
+    }
+
+    /* the trailing literals */
+    p = put_sequence(p, buf + anchor, end - anchor, 0, 0);
+    return p - dst;
+}
+
+void LzDecompressor::slide(int len)
+{
+    if (history.size()+len > LZ_HISTORY_MAX && history.size() > LZ_WINDOW)
+	history.erase(history.begin(), history.end() - LZ_WINDOW);
+}
+
+const char *LzDecompressor::append(const char *src, int len)
+{
+    slide(len);
+    size_t start = history.size();
+    history.insert(history.end(), src, src + len);
+    return history.data() + start;
+}
+
+const char *LzDecompressor::decompress(const char *src, int srclen, int len)
+{
+    slide(len);
+    size_t start = history.size();
+    history.resize(start + len);
+    char *out = history.data() + start;
+    char *out_end = out + len;
+    const char *in = src, *in_end = src + srclen;
+
+    for (;;) {
+	if (in>=in_end) goto malformed;
+	int token = (unsigned char) *in++;
+
+	/* literals */
+	int nb_literals = token>>4;
+	if (nb_literals==15) {
+	    int b;
+	    do {
+		if (in>=in_end) goto malformed;
+		b = (unsigned char) *in++;
+		nb_literals += b;
+	    } while (b==255);
+	}
+	if (nb_literals>in_end-in || nb_literals>out_end-out) goto malformed;
+	memcpy(out, in, nb_literals);
+	in += nb_literals;
+	out += nb_literals;
+	if (out==out_end) break;
+
+	/* match */
+	if (in_end-in<2) goto malformed;
+	uint16_t offset;
+	memcpy(&offset, in, 2);
+	in += 2;
+	int match = (token & 15) + LZ_MIN_MATCH;
+	if ((token & 15)==15) {
+	    int b;
+	    do {
+		if (in>=in_end) goto malformed;
+		b = (unsigned char) *in++;
+		match += b;
+	    } while (b==255);
+	}
+	if (offset==0 || offset>out-history.data() || match>out_end-out)
+	    goto malformed;
+
+	/* byte by byte, as the match may overlap its own output */
+	const char *from = out - offset;
+	for (int i=0; i<match; i++) out[i] = from[i];
+	out += match;
+    }
+    if (in!=in_end) goto malformed;
+    return history.data() + start;
+
+malformed:
+    history.resize(start);
+    return NULL;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  frames
+  []------------------------------------------------------------------------[]*/
+
+static char *put_varint(char *p, uint32_t v)
+{
+    while (v>=128) {
+	*p++ = (char) (v | 128);
+	v >>= 7;
+    }
+    *p++ = (char) v;
+    return p;
+}
+
+/* parse a varint from [*p, end), return false if incomplete */
+static bool get_varint(const char **p, const char *end, uint32_t *v)
+{
+    *v = 0;
+    for (int shift=0; shift<35; shift+=7) {
+	if (*p>=end) return false;
+	int b = (unsigned char) *(*p)++;
+	*v |= (uint32_t) (b & 127) << shift;
+	if (b<128) return true;
+    }
+    return false;
+}
+
+CompressSender::CompressSender(RdtSenderHost *host, RdtSender *inner)
+    : RdtSender(host)
+{
+    this->inner = inner;
+    memset(&stats, 0, sizeof(stats));
+}
+
+CompressSender::~CompressSender()
+{
+    for (size_t i=0; i<contexts.size(); i++) delete contexts[i];
+    delete inner;
+}
+
+void CompressSender::frame(int stream, struct message *msg,
+			   struct message *framed)
+{
+    if (stream>=(int) contexts.size()) contexts.resize(stream+1, NULL);
+    if (contexts[stream]==NULL) contexts[stream] = new LzCompressor;
+
+    framed->data = (char *) malloc(FRAME_BOUND(msg->size));
+    ASSERT(framed->data!=NULL);
+    char *lz = (char *) malloc(FRAME_BOUND(msg->size));
+    ASSERT(lz!=NULL);
+
+    /* the history takes the message either way, so that the receiver, which
+       appends raw messages to its own, stays in step */
+    int lz_size = contexts[stream]->compress(msg->data, msg->size, lz);
+
+    char header[16];
+    char *h = put_varint(header + 1, msg->size);
+    char *hlz = put_varint(h, lz_size);
+
+    stats.msgs++;
+    stats.chars_in += msg->size;
+    if ((hlz-header) + lz_size < (h-header) + msg->size) {
+	header[0] = FRAME_LZ;
+	memcpy(framed->data, header, hlz - header);
+	memcpy(framed->data + (hlz - header), lz, lz_size);
+	framed->size = (hlz - header) + lz_size;
+	stats.chars_lz_in += msg->size;
+	stats.chars_lz_out += lz_size;
+    }
+    else {
+	/* incompressible: opt out */
+	header[0] = FRAME_RAW;
+	memcpy(framed->data, header, h - header);
+	memcpy(framed->data + (h - header), msg->data, msg->size);
+	framed->size = (h - header) + msg->size;
+	stats.msgs_raw++;
+    }
+    stats.chars_out += framed->size;
+    free(lz);
+}
+
+void CompressSender::from_upper_layer(struct message *msg)
+{
+    struct message framed;
+    frame(0, msg, &framed);
+    inner->from_upper_layer(&framed);
+    free(framed.data);
+}
+
+void CompressSender::from_upper_layer_stream(int stream, struct message *msg)
+{
+    struct message framed;
+    frame(stream, msg, &framed);
+    inner->from_upper_layer_stream(stream, &framed);
+    free(framed.data);
+}
+
+CompressReceiver::CompressReceiver(RdtReceiverHost *host,
+				   const struct rdt_protocol *p)
+    : RdtReceiver(host)
+{
+    inner = p->create_receiver(this);
+    malformed = false;
+}
+
+CompressReceiver::~CompressReceiver()
+{
+    for (size_t i=0; i<contexts.size(); i++) delete contexts[i];
+    delete inner;
+}
+
+/* collect frame bytes of a stream (-1 for the engines that do not know
+   streams) and deliver every message completed */
+void CompressReceiver::unframe(int stream, struct message *msg)
+{
+    int index = (stream<0) ? 0 : stream;
+    if (index>=(int) contexts.size()) contexts.resize(index+1, NULL);
+    if (contexts[index]==NULL) contexts[index] = new struct context;
+    struct context *c = contexts[index];
+
+    c->pending.insert(c->pending.end(), msg->data, msg->data + msg->size);
+
+    size_t done = 0;
+    while (!malformed) {
+	const char *p = c->pending.data() + done;
+	const char *end = c->pending.data() + c->pending.size();
+	if (p>=end) break;
+
+	int kind = (unsigned char) *p++;
+	uint32_t size, lz_size;
+	if (!get_varint(&p, end, &size)) break;
+	if (kind==FRAME_LZ && !get_varint(&p, end, &lz_size)) break;
+	uint32_t payload = (kind==FRAME_LZ) ? lz_size : size;
+	if ((uint32_t) (end-p) < payload) break;
+
+	const char *data = NULL;
+	if (kind==FRAME_RAW)
+	    data = c->lz.append(p, size);
+	else if (kind==FRAME_LZ)
+	    data = c->lz.decompress(p, lz_size, size);
+	if (data==NULL) {
+	    /* cannot happen over a reliable engine; stop delivering, which
+	       the verification at the upper layer will notice */
+	    fprintf(stderr, "malformed compression frame\n");
+	    malformed = true;
+	    break;
+	}
+
+	struct message out;
+	out.size = size;
+	out.data = (char *) data;
+	if (stream<0)
+	    host->to_upper_layer(&out);
+	else
+	    host->to_upper_layer_stream(stream, &out);
+
+	done = (p + payload) - c->pending.data();
+    }
+    c->pending.erase(c->pending.begin(), c->pending.begin() + done);
+}
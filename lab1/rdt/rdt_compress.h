@@ -0,0 +1,149 @@
+/*
+ * FILE: rdt_compress.h
+ * DESCRIPTION: Optional compression stage of the reliable data transfer
+ *              simulator.  It sits between the upper layers and any protocol
+ *              engine: the sender side compresses every message into a frame
+ *              before the engine packetizes it, and the receiver side
+ *              reassembles frames from the byte stream the engine delivers
+ *              and hands the original messages up.
+ *
+ *              The compressor is a small LZ77 in the style of LZ4.  It is
+ *              streaming: matches may reach back into earlier messages of
+ *              the same stream (up to LZ_WINDOW bytes), which is what makes
+ *              short messages compressible at all.  A message that does not
+ *              shrink is sent raw in its frame.
+ */
+
+
+#ifndef _RDT_COMPRESS_H_
+#define _RDT_COMPRESS_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_protocol.h"
+
+
+/* the history matches can refer to, and the hash table of 4-byte sequences */
+#define LZ_WINDOW 65535
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+
+/* a frame is
+
+       |<- 1 byte ->|<-  varint  ->|<-   varint   ->|<-    the rest    ->|
+       |    kind    | message size | payload size * |<-    payload     ->|
+
+   where the payload size is only present for compressed frames (the
+   payload of a raw frame is the message itself), and varints are
+   little-endian base-128 */
+enum {FRAME_RAW=0, FRAME_LZ};
+
+/* largest frame of a message of "size" bytes */
+#define FRAME_BOUND(size) ((size) + (size)/255 + 32)
+
+class LzCompressor
+{
+public:
+    std::vector<char> history;      /* recent bytes of the stream */
+    uint64_t history_base;          /* stream offset of history[0] */
+    std::vector<int64_t> table;     /* hash -> stream offset, -1 if none */
+
+public:
+    LzCompressor();
+
+    /* append "len" bytes to the history and compress them into "dst", which
+       has room for FRAME_BOUND(len) bytes; return the compressed size */
+    int compress(const char *src, int len, char *dst);
+};
+
+class LzDecompressor
+{
+public:
+    std::vector<char> history;
+
+public:
+    /* decompress "srclen" bytes into the "len" bytes that follow the
+       history; return a pointer to them, or NULL if the input is
+       malformed */
+    const char *decompress(const char *src, int srclen, int len);
+
+    /* append bytes that were sent raw */
+    const char *append(const char *src, int len);
+
+private:
+    void slide(int len);
+};
+
+/* compression statistics of a sender */
+struct compress_stats {
+    long long msgs;
+    long long msgs_raw;             /* sent raw, as they did not shrink */
+    long long chars_in;             /* message bytes */
+    long long chars_lz_in;          /* message bytes of compressed frames */
+    long long chars_lz_out;         /* payload bytes of compressed frames */
+    long long chars_out;            /* frame bytes, headers included */
+};
+
+/* the sender side: frames every message before passing it to the engine */
+class CompressSender : public RdtSender
+{
+public:
+    RdtSender *inner;
+    std::vector<LzCompressor *> contexts;   /* one per stream */
+    struct compress_stats stats;
+
+public:
+    CompressSender(RdtSenderHost *host, RdtSender *inner);
+    ~CompressSender();
+
+    void init() { inner->init(); }
+    void final() { inner->final(); }
+    void from_upper_layer(struct message *msg);
+    void from_upper_layer_stream(int stream, struct message *msg);
+    void from_lower_layer(struct packet *pkt) { inner->from_lower_layer(pkt); }
+    void timeout() { inner->timeout(); }
+
+private:
+    void frame(int stream, struct message *msg, struct message *framed);
+};
+
+/* the receiver side: the engine is created with the receiver as its host, so
+   that the frames it delivers come back here */
+class CompressReceiver : public RdtReceiver, public RdtReceiverHost
+{
+public:
+    struct context {
+	std::vector<char> pending;  /* frame bytes not decoded yet */
+	LzDecompressor lz;
+    };
+
+    RdtReceiver *inner;
+    std::vector<struct context *> contexts; /* one per stream */
+    bool malformed;
+
+public:
+    CompressReceiver(RdtReceiverHost *host, const struct rdt_protocol *p);
+    ~CompressReceiver();
+
+    void init() { inner->init(); }
+    void final() { inner->final(); }
+    void from_lower_layer(struct packet *pkt) { inner->from_lower_layer(pkt); }
+
+    /* services to the engine */
+    double time() { return host->time(); }
+    int id() { return host->id(); }
+    void to_lower_layer(struct packet *pkts, int n) {
+	host->to_lower_layer(pkts, n);
+    }
+    void to_upper_layer(struct message *msg) { unframe(-1, msg); }
+    void to_upper_layer_stream(int stream, struct message *msg) {
+	unframe(stream, msg);
+    }
+
+private:
+    void unframe(int stream, struct message *msg);
+};
+
+#endif  /* _RDT_COMPRESS_H_ */
@@ -0,0 +1,644 @@
+/*
+ * FILE: rdt_dpdk.cc
+ * DESCRIPTION: The reliable data transfer protocols over DPDK instead of the
+ *              simulated link.  The sender and the receiver engines run in
+ *              one polling loop on the main lcore, each on a port of its
+ *              own: every packet travels as the payload of a UDP datagram,
+ *              whose headers are built the way construct_udp_pkt() of
+ *              lab2/basicfwd.c builds them, and the sender timer is a
+ *              deadline on the TSC.  Messages come from the workloads of the
+ *              simulator and are verified and timed at the receiver in the
+ *              same way, so the goodput and the message latency are measured
+ *              end to end over the real packet path.
+ *
+ *              The two ports are joined back to back.  With no device, the
+ *              program joins a pair of net_ring ports over two rings of its
+ *              own, which needs no NIC:
+ *
+ *                  rdt_dpdk --no-huge -m 256 -- 10 0.0001 1000 --protocol=sr
+ *
+ *              otherwise it takes ports 0 (sender) and 1 (receiver), e.g.
+ *              two NICs cabled to each other.  The arguments are those of
+ *              rdt_sim, without the channel: the time the source runs, the
+ *              mean message interval and the mean message size.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <rte_eal.h>
+#include <rte_ethdev.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_ring.h>
+#include <rte_eth_ring.h>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_workload.h"
+#include "rdt_protocol.h"
+#include "rdt_stream.h"
+#include "rdt_compress.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  parameters and statistics
+  []------------------------------------------------------------------------[]*/
+
+/* UDP port of both ends, that of lab2/basicfwd.c */
+#define RDT_UDP_PORT 777
+
+/* ports, their rings and the mbuf pool; every packet is one small mbuf */
+#define RX_RING_SIZE 1024
+#define TX_RING_SIZE 1024
+#define LINK_RING_SIZE 1024
+#define NUM_MBUFS 8191
+#define MBUF_CACHE_SIZE 250
+
+/* packets received, or built for the lower layer, at once */
+#define RDT_BURST 32
+
+#define NSEC_PER_SEC 1000000000LL
+
+/* the time the source runs (in seconds), its mean message interval (in
+   seconds) and mean message size (in bytes) */
+double src_time;
+double msg_arrivalint;
+int msg_size;
+
+/* workload, protocol and reporting, as in rdt_sim */
+const char *arrival_dist = "uniform";
+const char *size_dist = "uniform";
+const char *payload_path = NULL;
+const char *protocol_name = "rdt";
+int nb_streams = 1;
+bool compress_mode = false;
+long long max_backlog = 0;
+double report_interval = 0;
+unsigned long long rdt_seed = 0;
+
+/* how long the transfer may go on once the source stops (in seconds), for
+   the last messages to be delivered */
+double drain_time = 10;
+
+/* the ports of the sender and the receiver, and the pool of both */
+uint16_t sender_port = 0;
+uint16_t receiver_port = 1;
+struct rte_mempool *mbuf_pool;
+
+/* TSC at the start and its frequency */
+uint64_t start_tsc;
+uint64_t tsc_hz;
+
+static volatile bool force_quit = false;
+
+/* the workload, the protocol and what the receiver got */
+Workload *workload = NULL;
+RdtRandom workload_rng;
+const struct rdt_protocol *protocol = NULL;
+StreamTable *streams = NULL;
+bool message_verfication_passed = true;
+
+long long tot_chars_sent = 0;
+long long tot_chars_delivered = 0;
+long long tot_msgs_blocked = 0;
+long long tot_data_pkts_sent = 0;
+long long tot_ack_pkts_sent = 0;
+long long tot_pkts_received = 0;
+long long tot_tx_dropped = 0;   /* the TX ring was full */
+long long tot_rx_foreign = 0;   /* not an rdt datagram */
+int64_t last_delivery = 0;      /* (in nanoseconds) */
+
+/* nanoseconds since the start */
+static inline int64_t now_nsec()
+{
+    return (int64_t) ((rte_rdtsc() - start_tsc)*(double) NSEC_PER_SEC/tsc_hz);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  packets over UDP
+  []------------------------------------------------------------------------[]*/
+
+/* the headers in front of a packet */
+#define RDT_HDR_LEN (sizeof(struct rte_ether_hdr) + \
+		     sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr))
+
+/* fill a fresh mbuf with an rdt packet as the payload of a UDP datagram
+   from "port", built from the payload outwards as construct_udp_pkt() does;
+   the acks go the other way, from the receiver's address to the sender's */
+static void construct_rdt_pkt(uint16_t port, struct rte_mbuf *m,
+			      const struct packet *pkt, bool ack)
+{
+    char *content = rte_pktmbuf_append(m, RDT_PKTSIZE);
+    memcpy(content, pkt->data, RDT_PKTSIZE);
+
+    /* the length contains both the UDP header and the data */
+    unsigned int udp_pkt_len = RDT_PKTSIZE + sizeof(struct rte_udp_hdr);
+    struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)
+	rte_pktmbuf_prepend(m, sizeof(struct rte_udp_hdr));
+    udp_hdr->src_port = rte_cpu_to_be_16(RDT_UDP_PORT);
+    udp_hdr->dst_port = rte_cpu_to_be_16(RDT_UDP_PORT);
+    udp_hdr->dgram_len = rte_cpu_to_be_16(udp_pkt_len);
+    udp_hdr->dgram_cksum = 0;
+
+    uint32_t sender_ip = RTE_IPV4(192, 168, 80, 10);
+    uint32_t receiver_ip = RTE_IPV4(192, 168, 80, 1);
+    struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)
+	rte_pktmbuf_prepend(m, sizeof(struct rte_ipv4_hdr));
+    memset(ip_hdr, 0, sizeof(*ip_hdr));
+    ip_hdr->dst_addr = rte_cpu_to_be_32(ack ? sender_ip : receiver_ip);
+    ip_hdr->src_addr = rte_cpu_to_be_32(ack ? receiver_ip : sender_ip);
+    ip_hdr->version_ihl = 0x45;
+    ip_hdr->total_length =
+	rte_cpu_to_be_16(udp_pkt_len + sizeof(struct rte_ipv4_hdr));
+    ip_hdr->next_proto_id = IPPROTO_UDP;
+    ip_hdr->time_to_live = 0xa;
+    ip_hdr->hdr_checksum = rte_ipv4_cksum(ip_hdr);
+
+    /* back to back, the other end takes any destination address */
+    struct rte_ether_hdr *ether_hdr = (struct rte_ether_hdr *)
+	rte_pktmbuf_prepend(m, sizeof(struct rte_ether_hdr));
+    ether_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+    rte_eth_macaddr_get(port, &ether_hdr->s_addr);
+    rte_eth_macaddr_get(port==sender_port ? receiver_port : sender_port,
+			&ether_hdr->d_addr);
+}
+
+/* pass "n" packets to the lower layer on "port", in bursts; what does not
+   fit in the TX ring is dropped, as a full queue on a link would */
+static void send_pkts(uint16_t port, struct packet *pkts, int n, bool ack)
+{
+    struct rte_mbuf *bufs[RDT_BURST];
+
+    while (n>0) {
+	int m = (n<RDT_BURST) ? n : RDT_BURST;
+	if (rte_pktmbuf_alloc_bulk(mbuf_pool, bufs, m)!=0) {
+	    tot_tx_dropped += n;
+	    return;
+	}
+	for (int i=0; i<m; i++)
+	    construct_rdt_pkt(port, bufs[i], &pkts[i], ack);
+
+	uint16_t nb_tx = rte_eth_tx_burst(port, 0, bufs, m);
+	if (nb_tx<m) {
+	    tot_tx_dropped += m - nb_tx;
+	    rte_pktmbuf_free_bulk(&bufs[nb_tx], m - nb_tx);
+	}
+	pkts += m;
+	n -= m;
+    }
+}
+
+/* take the packet out of a received datagram, return false if it is not
+   one of ours */
+static bool parse_rdt_pkt(struct rte_mbuf *m, struct packet *pkt)
+{
+    if (m->data_len<RDT_HDR_LEN + RDT_PKTSIZE) return false;
+
+    struct rte_ether_hdr *ether_hdr =
+	rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
+    struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *) (ether_hdr + 1);
+    struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *) (ip_hdr + 1);
+    if (ether_hdr->ether_type!=rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) ||
+	ip_hdr->version_ihl!=0x45 || ip_hdr->next_proto_id!=IPPROTO_UDP ||
+	udp_hdr->dst_port!=rte_cpu_to_be_16(RDT_UDP_PORT) ||
+	udp_hdr->dgram_len!=rte_cpu_to_be_16(RDT_PKTSIZE +
+					      sizeof(struct rte_udp_hdr)))
+	return false;
+
+    memcpy(pkt->data, udp_hdr + 1, RDT_PKTSIZE);
+    return true;
+}
+
+/* receive a burst on "port" and hand every packet in it to "handle" */
+template <class F>
+static int poll_port(uint16_t port, F handle)
+{
+    struct rte_mbuf *bufs[RDT_BURST];
+    struct packet pkt;
+
+    uint16_t nb_rx = rte_eth_rx_burst(port, 0, bufs, RDT_BURST);
+    for (uint16_t i=0; i<nb_rx; i++) {
+	if (parse_rdt_pkt(bufs[i], &pkt)) handle(&pkt);
+	else tot_rx_foreign++;
+	rte_pktmbuf_free(bufs[i]);
+    }
+    return nb_rx;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  services to the protocol engines
+  []------------------------------------------------------------------------[]*/
+
+class DpdkSenderHost : public RdtSenderHost
+{
+public:
+    uint64_t deadline;      /* TSC of the timeout, 0 if the timer is not set */
+
+public:
+    DpdkSenderHost() { deadline = 0; }
+
+    double time() { return now_nsec()*1e-9; }
+    int receivers() { return 1; }
+    void to_lower_layer(struct packet *pkts, int n) {
+	tot_data_pkts_sent += n;
+	send_pkts(sender_port, pkts, n, false);
+    }
+    void start_timer(double timeout) {
+	deadline = rte_rdtsc() + (uint64_t) (timeout*tsc_hz);
+	if (deadline==0) deadline = 1;
+    }
+    void stop_timer() { deadline = 0; }
+    bool is_timer_set() { return deadline!=0; }
+};
+
+class DpdkReceiverHost : public RdtReceiverHost
+{
+public:
+    double time() { return now_nsec()*1e-9; }
+    int id() { return 0; }
+    void to_lower_layer(struct packet *pkts, int n) {
+	tot_ack_pkts_sent += n;
+	send_pkts(receiver_port, pkts, n, true);
+    }
+    void to_upper_layer(struct message *msg) {
+	int64_t now = now_nsec();
+	delivered(msg, streams->deliver_ordered(msg->data, msg->size, now,
+						workload->payload), now);
+    }
+    void to_upper_layer_stream(int stream, struct message *msg) {
+	int64_t now = now_nsec();
+	delivered(msg, streams->deliver(stream, msg->data, msg->size, now,
+					workload->payload), now);
+    }
+
+private:
+    void delivered(const struct message *msg, bool ok, int64_t now) {
+	if (!ok) message_verfication_passed = false;
+	tot_chars_delivered += msg->size;
+	last_delivery = now;
+    }
+};
+
+DpdkSenderHost sender_host;
+DpdkReceiverHost receiver_host;
+
+/* the routines of rdt_sender.h and rdt_receiver.h, which the original
+   engine calls, lead to the hosts as in rdt_sim */
+double GetSimulationTime()
+{
+    return now_nsec()*1e-9;
+}
+
+void Sender_StartTimer(double timeout)
+{
+    rdt_legacy_sender_host->start_timer(timeout);
+}
+
+void Sender_StopTimer()
+{
+    rdt_legacy_sender_host->stop_timer();
+}
+
+bool Sender_isTimerSet()
+{
+    return rdt_legacy_sender_host->is_timer_set();
+}
+
+void Sender_ToLowerLayer(struct packet *pkt)
+{
+    Sender_ToLowerLayerBatch(pkt, 1);
+}
+
+void Sender_ToLowerLayerBatch(struct packet *pkts, int n)
+{
+    rdt_legacy_sender_host->to_lower_layer(pkts, n);
+}
+
+void Receiver_ToLowerLayer(struct packet *pkt)
+{
+    Receiver_ToLowerLayerBatch(pkt, 1);
+}
+
+void Receiver_ToLowerLayerBatch(struct packet *pkts, int n)
+{
+    rdt_legacy_receiver_host->to_lower_layer(pkts, n);
+}
+
+void Receiver_ToUpperLayer(struct message *msg)
+{
+    rdt_legacy_receiver_host->to_upper_layer(msg);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  ports
+  []------------------------------------------------------------------------[]*/
+
+/* a pair of net_ring ports whose rings cross: what one sends, the other
+   receives */
+static void create_ring_pair()
+{
+    struct rte_ring *a = rte_ring_create("rdt_a", LINK_RING_SIZE,
+					 rte_socket_id(),
+					 RING_F_SP_ENQ | RING_F_SC_DEQ);
+    struct rte_ring *b = rte_ring_create("rdt_b", LINK_RING_SIZE,
+					 rte_socket_id(),
+					 RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (a==NULL || b==NULL)
+	rte_exit(EXIT_FAILURE, "cannot create the rings of the link\n");
+
+    if (rte_eth_from_rings("rdt_sender", &b, 1, &a, 1, rte_socket_id())<0 ||
+	rte_eth_from_rings("rdt_receiver", &a, 1, &b, 1, rte_socket_id())<0)
+	rte_exit(EXIT_FAILURE, "cannot create the ports of the link\n");
+}
+
+/* one RX and one TX queue, as the skeleton of lab2 sets them up */
+static void port_init(uint16_t port)
+{
+    struct rte_eth_conf port_conf;
+    uint16_t nb_rxd = RX_RING_SIZE, nb_txd = TX_RING_SIZE;
+
+    memset(&port_conf, 0, sizeof(port_conf));
+    port_conf.rxmode.max_rx_pkt_len = RTE_ETHER_MAX_LEN;
+    if (rte_eth_dev_configure(port, 1, 1, &port_conf)!=0 ||
+	rte_eth_dev_adjust_nb_rx_tx_desc(port, &nb_rxd, &nb_txd)!=0 ||
+	rte_eth_rx_queue_setup(port, 0, nb_rxd, rte_eth_dev_socket_id(port),
+			       NULL, mbuf_pool)<0 ||
+	rte_eth_tx_queue_setup(port, 0, nb_txd, rte_eth_dev_socket_id(port),
+			       NULL)<0 ||
+	rte_eth_dev_start(port)<0)
+	rte_exit(EXIT_FAILURE, "cannot init port %u\n", port);
+    rte_eth_promiscuous_enable(port);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  the polling loop
+  []------------------------------------------------------------------------[]*/
+
+/* pass the next message of the workload to the sender, or refuse it when
+   the backlog is full */
+static void next_message(RdtSender *sender)
+{
+    int size = workload->next_size();
+    if (max_backlog>0 && tot_chars_sent-tot_chars_delivered>=max_backlog) {
+	tot_msgs_blocked++;
+	return;
+    }
+
+    int stream = streams->pick();
+    struct message msg;
+    msg.size = size;
+    msg.data = (char *) malloc(size);
+    ASSERT(msg.data!=NULL);
+    workload->payload.fill(msg.data, streams->send(stream, size, now_nsec()),
+			   size);
+    tot_chars_sent += size;
+
+    if (protocol->multistream) sender->from_upper_layer_stream(stream, &msg);
+    else sender->from_upper_layer(&msg);
+    free(msg.data);
+}
+
+/* run the source for "src_time" seconds, then until everything is
+   delivered, the link stays quiet for "drain_time" seconds or the program is
+   interrupted */
+static void run(RdtSender *sender, RdtReceiver *receiver)
+{
+    const uint64_t src_end = start_tsc + (uint64_t) (src_time*tsc_hz);
+    const uint64_t drain_cycles = (uint64_t) (drain_time*tsc_hz);
+    const uint64_t report_cycles = (uint64_t) (report_interval*tsc_hz);
+    uint64_t next_msg = start_tsc, next_report = start_tsc + report_cycles;
+    uint64_t last_progress = start_tsc;
+    long long last_report_chars = 0;
+
+    while (!force_quit) {
+	uint64_t now = rte_rdtsc();
+
+	/* the messages due, all of them if the loop fell behind */
+	while (next_msg<=now && next_msg<src_end) {
+	    next_message(sender);
+	    next_msg += (uint64_t) (workload->next_interval()*tsc_hz);
+	}
+
+	/* the data packets at the receiver, then the acks at the sender */
+	int nb = poll_port(receiver_port, [&](struct packet *pkt) {
+		tot_pkts_received++;
+		receiver->from_lower_layer(pkt);
+	    });
+	nb += poll_port(sender_port, [&](struct packet *pkt) {
+		sender->from_lower_layer(pkt);
+	    });
+	if (nb>0) last_progress = now;
+
+	if (sender_host.deadline!=0 && now>=sender_host.deadline) {
+	    sender_host.deadline = 0;
+	    sender->timeout();
+	}
+
+	if (report_cycles>0 && now>=next_report) {
+	    fprintf(stdout, "## report time=%.3f delivered=%lld sent=%lld "
+		    "interval_goodput=%.1f backlog=%lld blocked_msgs=%lld\n",
+		    (double) (now - start_tsc)/tsc_hz, tot_chars_delivered,
+		    tot_chars_sent,
+		    (tot_chars_delivered-last_report_chars)/report_interval,
+		    tot_chars_sent-tot_chars_delivered, tot_msgs_blocked);
+	    fflush(stdout);
+	    last_report_chars = tot_chars_delivered;
+	    next_report += report_cycles;
+	}
+
+	if (now>=src_end &&
+	    (tot_chars_delivered==tot_chars_sent ||
+	     now-last_progress>=drain_cycles))
+	    break;
+    }
+}
+
+static void signal_handler(int signum)
+{
+    if (signum==SIGINT || signum==SIGTERM) force_quit = true;
+}
+
+/* return the value of an optional "--name=value" argument, or NULL if the
+   argument is not the named option */
+static const char *option_value(const char *arg, const char *name)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len)!=0 || arg[len]!='=') return NULL;
+    return arg + len + 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = rte_eal_init(argc, argv);
+    if (ret<0) rte_exit(EXIT_FAILURE, "error with EAL initialization\n");
+    argc -= ret;
+    argv += ret;
+
+    if (argc<4) {
+	fprintf(stderr, "usage: %s [EAL options] -- <src_time> "
+		"<mean_msg_arrivalint> <mean_msg_size> [options]\n"
+		"options:\n"
+		"\t--arrival=uniform|poisson|onoff|pareto\n"
+		"\t--size=uniform|fixed|poisson|pareto  --payload=<file>\n"
+		"\t--protocol=rdt|gbn|sr|tcp-lite|tcp-pace|mux|nak  --seed=<n>\n"
+		"\t--streams=<n>  --compress  --max-backlog=<bytes>\n"
+		"\t--report-interval=<seconds>  --drain=<seconds>\n",
+		argv[0]);
+	exit(-1);
+    }
+    src_time = atof(argv[1]);
+    msg_arrivalint = atof(argv[2]);
+    msg_size = atoi(argv[3]);
+    if (src_time<=0 || msg_arrivalint<=0 || msg_size<=0) {
+	fprintf(stderr, "invalid <src_time>, <msg_arrivalint> or "
+		"<msg_size>\n");
+	exit(-1);
+    }
+    for (int i=4; i<argc; i++) {
+	const char *v;
+	if ((v=option_value(argv[i], "--arrival"))!=NULL)
+	    arrival_dist = v;
+	else if ((v=option_value(argv[i], "--size"))!=NULL)
+	    size_dist = v;
+	else if ((v=option_value(argv[i], "--payload"))!=NULL)
+	    payload_path = v;
+	else if ((v=option_value(argv[i], "--protocol"))!=NULL)
+	    protocol_name = v;
+	else if ((v=option_value(argv[i], "--seed"))!=NULL)
+	    rdt_seed = strtoull(v, NULL, 10);
+	else if ((v=option_value(argv[i], "--streams"))!=NULL)
+	    nb_streams = atoi(v);
+	else if (strcmp(argv[i], "--compress")==0)
+	    compress_mode = true;
+	else if ((v=option_value(argv[i], "--max-backlog"))!=NULL)
+	    max_backlog = atoll(v);
+	else if ((v=option_value(argv[i], "--report-interval"))!=NULL)
+	    report_interval = atof(v);
+	else if ((v=option_value(argv[i], "--drain"))!=NULL)
+	    drain_time = atof(v);
+	else {
+	    fprintf(stderr, "unknown option %s\n", argv[i]);
+	    exit(-1);
+	}
+    }
+    if (arrival_kind_from_name(arrival_dist)<0 ||
+	size_kind_from_name(size_dist)<0) {
+	fprintf(stderr, "invalid --arrival or --size\n");
+	exit(-1);
+    }
+    if (nb_streams<1 || nb_streams>1024 || max_backlog<0 ||
+	report_interval<0 || drain_time<0) {
+	fprintf(stderr, "invalid --streams, --max-backlog, --report-interval "
+		"or --drain\n");
+	exit(-1);
+    }
+    protocol = rdt_find_protocol(protocol_name);
+    if (protocol==NULL) {
+	fprintf(stderr, "unknown protocol %s\n", protocol_name);
+	exit(-1);
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    /* the two ends of the link */
+    if (rte_eth_dev_count_avail()==0) create_ring_pair();
+    if (rte_eth_dev_count_avail()<2)
+	rte_exit(EXIT_FAILURE, "two ports are needed, or none\n");
+    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS,
+					MBUF_CACHE_SIZE, 0,
+					RTE_MBUF_DEFAULT_BUF_SIZE,
+					rte_socket_id());
+    if (mbuf_pool==NULL) rte_exit(EXIT_FAILURE, "cannot create mbuf pool\n");
+    port_init(sender_port);
+    port_init(receiver_port);
+
+    /* the workload and the engines */
+    if (rdt_seed==0) rdt_seed = getpid()+getppid();
+    workload_rng.seed(rdt_seed);
+    workload = new Workload(arrival_kind_from_name(arrival_dist),
+			    size_kind_from_name(size_dist), msg_arrivalint,
+			    msg_size, &workload_rng);
+    if (payload_path!=NULL) {
+	if (!workload->payload.use_file(payload_path)) exit(-1);
+    }
+    else
+	workload->payload.use_pattern();
+    streams = new StreamTable(nb_streams, !protocol->multistream);
+
+    RdtSender *sender = protocol->create_sender(&sender_host);
+    RdtReceiver *receiver;
+    if (compress_mode) {
+	sender = new CompressSender(&sender_host, sender);
+	receiver = new CompressReceiver(&receiver_host, protocol);
+    }
+    else
+	receiver = protocol->create_receiver(&receiver_host);
+
+    fprintf(stdout, "## Reliable data transfer over DPDK, port %u to port "
+	    "%u, on lcore %u\n", sender_port, receiver_port, rte_lcore_id());
+    fprintf(stdout, "## Workload: ");
+    workload->describe(stdout);
+    fprintf(stdout, "## Protocol: %s (%s)\n", protocol->name,
+	    protocol->description);
+
+    tsc_hz = rte_get_tsc_hz();
+    start_tsc = rte_rdtsc();
+    sender->init();
+    receiver->init();
+    run(sender, receiver);
+    double elapsed = now_nsec()*1e-9;
+    sender->final();
+    receiver->final();
+
+    /* goodput up to the last delivery, which leaves the drain out */
+    double span = last_delivery*1e-9;
+    const LatencyHistogram &h = streams->latency;
+    fprintf(stdout, "\n");
+    fprintf(stdout, "## Transfer completed at time %.2fs with\n"
+	    "\t%lld characters sent\n"
+	    "\t%lld characters delivered\n"
+	    "\t%lld data packets and %lld acks sent, %lld received, %lld "
+	    "dropped on a full TX ring, %lld foreign\n"
+	    "\t%.1f characters/s goodput (%.3f Mbit/s) over %.2fs\n"
+	    "\t%.1fus mean, %.1fus p50, %.1fus p99, %.1fus max message "
+	    "latency\n",
+	    elapsed, tot_chars_sent, tot_chars_delivered, tot_data_pkts_sent,
+	    tot_ack_pkts_sent, tot_pkts_received, tot_tx_dropped,
+	    tot_rx_foreign, (span>0) ? tot_chars_delivered/span : 0.0,
+	    (span>0) ? tot_chars_delivered*8/span/1e6 : 0.0, span,
+	    h.mean()/1e3, h.quantile(0.5)/1e3, h.quantile(0.99)/1e3,
+	    h.max/1e3);
+    if (max_backlog>0)
+	fprintf(stdout, "\t%lld messages refused at the source\n",
+		tot_msgs_blocked);
+    if (nb_streams>1) streams->report(stdout);
+
+    if (message_verfication_passed && tot_chars_delivered==tot_chars_sent)
+	fprintf(stdout, "## Congratulations! This session is error-free, loss-free, and in order.\n");
+    else
+	fprintf(stdout, "## Something is wrong! This session is NOT error-free, loss-free, and in order.\n");
+
+    delete sender;
+    delete receiver;
+    delete streams;
+    delete workload;
+    rte_eal_cleanup();
+    return 0;
+}
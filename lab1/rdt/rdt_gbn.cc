@@ -0,0 +1,137 @@
+/*
+ * FILE: rdt_gbn.cc
+ * DESCRIPTION: Reference go-back-N engine.  The sender keeps up to
+ *              GBN_WINDOW_SIZE packets in flight under a single timer and
+ *              resends all of them when it expires; the receiver only accepts
+ *              the next packet in order and acknowledges cumulatively with
+ *              the number of the packet it expects next.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+
+#include "rdt_struct.h"
+#include "rdt_protocol.h"
+
+
+#define GBN_WINDOW_SIZE 16
+#define GBN_TIMEOUT 0.3
+
+
+class GbnSender : public RdtSender
+{
+public:
+    /* packets from "base" on: the first next_seq-base are in flight, the rest
+       wait for the window to open */
+    std::deque<struct packet> queue;
+    uint32_t base;
+    uint32_t next_seq;
+
+public:
+    GbnSender(RdtSenderHost *host) : RdtSender(host) {
+	base = 0;
+	next_seq = 0;
+    }
+
+    void from_upper_layer(struct message *msg) {
+	uint32_t seq = base + queue.size();
+	for (int cursor=0; cursor<msg->size; cursor+=RDT_MAX_PAYLOAD) {
+	    int size = msg->size - cursor;
+	    if (size>RDT_MAX_PAYLOAD) size = RDT_MAX_PAYLOAD;
+
+	    struct packet pkt;
+	    rdt_make_packet(&pkt, seq++, msg->data + cursor, size);
+	    queue.push_back(pkt);
+	}
+	send_window();
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t ack;
+	int size;
+	if (!rdt_parse_packet(pkt, &ack, &size) || size!=0) return;
+
+	/* ignore acks that do not move the window */
+	if ((int32_t)(ack-base)<=0 || (int32_t)(ack-next_seq)>0) return;
+
+	queue.erase(queue.begin(), queue.begin() + (ack-base));
+	base = ack;
+
+	if (base==next_seq)
+	    host->stop_timer();
+	else
+	    host->start_timer(GBN_TIMEOUT);
+
+	send_window();
+    }
+
+    void timeout() {
+	/* go back: resend everything in flight */
+	resend(0, next_seq-base);
+	if (next_seq!=base) host->start_timer(GBN_TIMEOUT);
+    }
+
+private:
+    /* send queued packets [from, to) (relative to base) as one burst */
+    void resend(uint32_t from, uint32_t to) {
+	struct packet burst[GBN_WINDOW_SIZE];
+	int n = 0;
+	for (uint32_t i=from; i<to; i++) burst[n++] = queue[i];
+	if (n>0) host->to_lower_layer(burst, n);
+    }
+
+    void send_window() {
+	uint32_t limit = base + queue.size();
+	if ((int32_t)(limit-(base+GBN_WINDOW_SIZE))>0)
+	    limit = base + GBN_WINDOW_SIZE;
+	if (next_seq==limit) return;
+
+	resend(next_seq-base, limit-base);
+	if (next_seq==base) host->start_timer(GBN_TIMEOUT);
+	next_seq = limit;
+    }
+};
+
+class GbnReceiver : public RdtReceiver
+{
+public:
+    uint32_t expected;
+
+public:
+    GbnReceiver(RdtReceiverHost *host) : RdtReceiver(host) {
+	expected = 0;
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t seq;
+	int size;
+	if (!rdt_parse_packet(pkt, &seq, &size) || size==0) return;
+
+	if (seq==expected) {
+	    struct message msg;
+	    msg.size = size;
+	    msg.data = pkt->data + RDT_HEADER_SIZE;
+	    host->to_upper_layer(&msg);
+	    expected++;
+	}
+
+	/* acknowledge cumulatively, also for out-of-order and duplicate
+	   packets so that a lost ack is repaired */
+	struct packet ack;
+	rdt_make_packet(&ack, expected, NULL, 0);
+	host->to_lower_layer(&ack, 1);
+    }
+};
+
+RdtSender *gbn_create_sender(RdtSenderHost *host)
+{
+    return new GbnSender(host);
+}
+
+RdtReceiver *gbn_create_receiver(RdtReceiverHost *host)
+{
+    return new GbnReceiver(host);
+}
@@ -0,0 +1,275 @@
+/*
+ * FILE: rdt_mux.cc
+ * DESCRIPTION: Reference multiplexed engine.  One session carries many
+ *              logical streams.  Acknowledgement and congestion control are
+ *              shared: the sender numbers all packets in one session sequence,
+ *              retransmits them selectively on per-packet deadlines, and keeps
+ *              an AIMD window over the whole session.  Ordering is not: every
+ *              packet also carries its stream and its number within the
+ *              stream, and the receiver reassembles each stream on its own,
+ *              so a lost packet only holds back the stream it belongs to.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_protocol.h"
+
+
+/* data packets start their payload with the stream header:
+
+       |<-  2 bytes  ->|<-  4 bytes  ->|<-       the rest       ->|
+       |    stream     | stream number |<-  the stream's bytes  ->|  */
+#define MUX_STREAM_HEADER 6
+#define MUX_MAX_DATA (RDT_MAX_PAYLOAD - MUX_STREAM_HEADER)
+#define MUX_MAX_STREAMS 65536
+
+/* the window never drops below MUX_MIN_WINDOW: random channel losses are not
+   a sign of congestion, and a window of one packet per round trip cannot keep
+   up with the message source */
+#define MUX_MIN_WINDOW 16
+#define MUX_INITIAL_WINDOW 16
+#define MUX_MAX_WINDOW 64
+#define MUX_TIMEOUT 0.3
+
+
+class MuxSender : public RdtSender
+{
+public:
+    struct entry {
+	struct packet pkt;
+	bool acked;
+	double deadline;    /* retransmission time, valid while in flight */
+    };
+
+    /* packets from "base" on: the first next_seq-base are sent, the rest
+       wait for the window to open.  "in_flight" of the sent ones are not
+       acknowledged yet; the congestion window limits them, while the span
+       from base to next_seq is limited by MUX_MAX_WINDOW, which bounds what
+       the receiver holds */
+    std::deque<struct entry> queue;
+    uint32_t base;
+    uint32_t next_seq;
+    uint32_t in_flight;
+
+    /* next number of every stream used so far */
+    std::vector<uint32_t> stream_seq;
+
+    double cwnd;            /* session window (in packets) */
+    double ssthresh;
+    uint32_t recover;       /* losses before this were already reacted to */
+
+public:
+    MuxSender(RdtSenderHost *host) : RdtSender(host) {
+	base = 0;
+	next_seq = 0;
+	in_flight = 0;
+	cwnd = MUX_INITIAL_WINDOW;
+	ssthresh = MUX_MAX_WINDOW;
+	recover = 0;
+    }
+
+    void from_upper_layer(struct message *msg) {
+	from_upper_layer_stream(0, msg);
+    }
+
+    void from_upper_layer_stream(int stream, struct message *msg) {
+	ASSERT(stream>=0 && stream<MUX_MAX_STREAMS);
+	if (stream>=(int) stream_seq.size()) stream_seq.resize(stream+1, 0);
+
+	uint32_t seq = base + queue.size();
+	char payload[RDT_MAX_PAYLOAD];
+	uint16_t id = (uint16_t) stream;
+	memcpy(payload, &id, 2);
+
+	for (int cursor=0; cursor<msg->size; cursor+=MUX_MAX_DATA) {
+	    int size = msg->size - cursor;
+	    if (size>MUX_MAX_DATA) size = MUX_MAX_DATA;
+
+	    memcpy(payload + 2, &stream_seq[stream], 4);
+	    stream_seq[stream]++;
+	    memcpy(payload + MUX_STREAM_HEADER, msg->data + cursor, size);
+
+	    struct entry e;
+	    rdt_make_packet(&e.pkt, seq++, payload, MUX_STREAM_HEADER + size);
+	    e.acked = false;
+	    e.deadline = 0;
+	    queue.push_back(e);
+	}
+	send_window();
+	arm_timer();
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t ack;
+	int size;
+	if (!rdt_parse_packet(pkt, &ack, &size) || size!=0) return;
+
+	/* only packets in flight can be acknowledged */
+	if ((int32_t)(ack-base)<0 || (int32_t)(ack-next_seq)>=0) return;
+	struct entry &e = queue[ack-base];
+	if (e.acked) return;
+	e.acked = true;
+	in_flight--;
+
+	/* open the window: slow start, then additive increase */
+	if (cwnd<ssthresh)
+	    cwnd += 1;
+	else
+	    cwnd += 1/cwnd;
+	if (cwnd>MUX_MAX_WINDOW) cwnd = MUX_MAX_WINDOW;
+
+	/* slide the window over the acknowledged prefix */
+	while (next_seq!=base && queue.front().acked) {
+	    queue.pop_front();
+	    base++;
+	}
+
+	send_window();
+	arm_timer();
+    }
+
+    void timeout() {
+	double now = host->time();
+	struct packet burst[MUX_MAX_WINDOW];
+	int n = 0;
+	bool new_loss = false;
+
+	/* resend every packet whose own deadline has passed */
+	for (uint32_t i=0; i<next_seq-base; i++) {
+	    struct entry &e = queue[i];
+	    if (!e.acked && e.deadline<=now+1e-9) {
+		burst[n++] = e.pkt;
+		e.deadline = now + MUX_TIMEOUT;
+		if ((int32_t)(base+i-recover)>=0) new_loss = true;
+	    }
+	}
+
+	/* multiplicative decrease, once per window of data */
+	if (new_loss) {
+	    ssthresh = cwnd/2;
+	    if (ssthresh<MUX_MIN_WINDOW) ssthresh = MUX_MIN_WINDOW;
+	    cwnd = ssthresh;
+	    recover = next_seq;
+	}
+	if (n>0) host->to_lower_layer(burst, n);
+
+	arm_timer();
+    }
+
+private:
+    void send_window() {
+	double now = host->time();
+	uint32_t window = (uint32_t) cwnd;
+	struct packet burst[MUX_MAX_WINDOW];
+	int n = 0;
+
+	while (in_flight<window && next_seq-base<MUX_MAX_WINDOW &&
+	       next_seq-base<queue.size()) {
+	    struct entry &e = queue[next_seq-base];
+	    burst[n++] = e.pkt;
+	    e.deadline = now + MUX_TIMEOUT;
+	    next_seq++;
+	    in_flight++;
+	}
+	if (n>0) host->to_lower_layer(burst, n);
+    }
+
+    /* arm the timer for the earliest deadline in flight */
+    void arm_timer() {
+	double earliest = -1;
+	for (uint32_t i=0; i<next_seq-base; i++) {
+	    const struct entry &e = queue[i];
+	    if (!e.acked && (earliest<0 || e.deadline<earliest))
+		earliest = e.deadline;
+	}
+
+	if (earliest<0) {
+	    host->stop_timer();
+	    return;
+	}
+
+	double wait = earliest - host->time();
+	host->start_timer((wait>0) ? wait : 0);
+    }
+};
+
+class MuxReceiver : public RdtReceiver
+{
+public:
+    struct stream {
+	uint32_t expected;                      /* next number to deliver */
+	std::map<uint32_t, struct packet> held; /* arrived out of order */
+    };
+
+    std::vector<struct stream> streams;
+
+public:
+    MuxReceiver(RdtReceiverHost *host) : RdtReceiver(host) {}
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t seq;
+	int size;
+	if (!rdt_parse_packet(pkt, &seq, &size) || size<=MUX_STREAM_HEADER)
+	    return;
+
+	/* acknowledge every packet, also duplicates whose ack was lost; the
+	   session window keeps the held packets bounded */
+	struct packet ack;
+	rdt_make_packet(&ack, seq, NULL, 0);
+	host->to_lower_layer(&ack, 1);
+
+	uint16_t id;
+	uint32_t number;
+	memcpy(&id, pkt->data + RDT_HEADER_SIZE, 2);
+	memcpy(&number, pkt->data + RDT_HEADER_SIZE + 2, 4);
+	if (id>=streams.size()) {
+	    struct stream empty;
+	    empty.expected = 0;
+	    streams.resize(id+1, empty);
+	}
+	struct stream &st = streams[id];
+
+	/* already delivered */
+	if ((int32_t)(number-st.expected)<0) return;
+
+	if (number!=st.expected) {
+	    st.held.insert(std::make_pair(number, *pkt));
+	    return;
+	}
+
+	/* deliver this packet and whatever it unblocks in its stream only */
+	deliver(id, pkt);
+	st.expected++;
+	std::map<uint32_t, struct packet>::iterator it;
+	while ((it = st.held.find(st.expected))!=st.held.end()) {
+	    deliver(id, &it->second);
+	    st.held.erase(it);
+	    st.expected++;
+	}
+    }
+
+private:
+    void deliver(int stream, struct packet *pkt) {
+	struct message msg;
+	msg.size = (unsigned char) pkt->data[0] - MUX_STREAM_HEADER;
+	msg.data = pkt->data + RDT_HEADER_SIZE + MUX_STREAM_HEADER;
+	host->to_upper_layer_stream(stream, &msg);
+    }
+};
+
+RdtSender *mux_create_sender(RdtSenderHost *host)
+{
+    return new MuxSender(host);
+}
+
+RdtReceiver *mux_create_receiver(RdtReceiverHost *host)
+{
+    return new MuxReceiver(host);
+}
@@ -0,0 +1,289 @@
+/*
+ * FILE: rdt_nak.cc
+ * DESCRIPTION: Reference one-to-many engine with negative acknowledgements.
+ *              The sender sends every data packet once to all receivers and
+ *              never retransmits on a timer.  Receivers report what they
+ *              miss: right away when a gap shows up in the sequence, and in
+ *              the status they return for every heartbeat the sender sends
+ *              while data is outstanding.  The sender aggregates the reports
+ *              and repairs a packet once for all the receivers that missed
+ *              it: reports that reach it within NAK_HOLDOFF of the last
+ *              repair of a packet are absorbed by that repair.  A report
+ *              gets at most NAK_MAX_REPAIRS repairs, the oldest first, and
+ *              the rest wait for the next report.  The status
+ *              also carries each receiver's cumulative ack, and the sender
+ *              window slides along the slowest receiver.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_protocol.h"
+
+
+/* every packet starts its payload with a type:
+     NAK_DATA       number is the sequence number, then the data
+     NAK_HEARTBEAT  number is the next sequence number the sender will use
+     NAK_STATUS     number is the receiver's cumulative ack (the next packet
+                    it expects), then the receiver id (2 bytes), the count
+                    of missing ranges (1 byte) and the ranges (first missing
+                    number, 4 bytes, and length, 2 bytes, each) */
+enum {NAK_DATA=0, NAK_HEARTBEAT, NAK_STATUS};
+
+#define NAK_MAX_DATA (RDT_MAX_PAYLOAD - 1)
+#define NAK_STATUS_HEADER 4
+#define NAK_RANGE_SIZE 6
+#define NAK_MAX_RANGES ((RDT_MAX_PAYLOAD - NAK_STATUS_HEADER) / NAK_RANGE_SIZE)
+
+#define NAK_WINDOW_SIZE 64
+#define NAK_HEARTBEAT_INTERVAL 0.2
+
+/* a repair answers every report sent before it could reach the receivers,
+   i.e. within a round trip (twice the 100ms link latency) */
+#define NAK_HOLDOFF 0.25
+
+/* repairs sent for one report at most: a whole window of them in one burst
+   would overflow any short queue on the way and be dropped over again */
+#define NAK_MAX_REPAIRS (NAK_WINDOW_SIZE/4)
+
+
+class NakSender : public RdtSender
+{
+public:
+    struct entry {
+	struct packet pkt;
+	double last_repair;     /* (in seconds), never repaired if negative */
+    };
+
+    /* packets from "base" on: the first next_seq-base are sent, the rest
+       wait for the window to open; base is the cumulative ack of the
+       slowest receiver */
+    std::deque<struct entry> queue;
+    uint32_t base;
+    uint32_t next_seq;
+
+    /* cumulative ack of every receiver */
+    std::vector<uint32_t> acked;
+
+public:
+    NakSender(RdtSenderHost *host) : RdtSender(host) {
+	base = 0;
+	next_seq = 0;
+    }
+
+    void init() {
+	acked.assign(host->receivers(), 0);
+    }
+
+    void from_upper_layer(struct message *msg) {
+	uint32_t seq = base + queue.size();
+	char payload[RDT_MAX_PAYLOAD];
+	payload[0] = NAK_DATA;
+
+	for (int cursor=0; cursor<msg->size; cursor+=NAK_MAX_DATA) {
+	    int size = msg->size - cursor;
+	    if (size>NAK_MAX_DATA) size = NAK_MAX_DATA;
+	    memcpy(payload + 1, msg->data + cursor, size);
+
+	    struct entry e;
+	    rdt_make_packet(&e.pkt, seq++, payload, 1 + size);
+	    e.last_repair = -NAK_HOLDOFF;
+	    queue.push_back(e);
+	}
+	send_window();
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t ack;
+	int size;
+	if (!rdt_parse_packet(pkt, &ack, &size)) return;
+	if (size<NAK_STATUS_HEADER || pkt->data[RDT_HEADER_SIZE]!=NAK_STATUS)
+	    return;
+
+	const char *p = pkt->data + RDT_HEADER_SIZE + 1;
+	uint16_t id;
+	memcpy(&id, p, 2);
+	int nb_ranges = (unsigned char) p[2];
+	if (id>=acked.size() ||
+	    size!=NAK_STATUS_HEADER + nb_ranges*NAK_RANGE_SIZE) return;
+
+	/* slide the window along the slowest receiver */
+	if ((int32_t)(ack-acked[id])>0 && (int32_t)(ack-next_seq)<=0) {
+	    acked[id] = ack;
+	    uint32_t slowest = acked[0];
+	    for (size_t i=1; i<acked.size(); i++) {
+		if ((int32_t)(acked[i]-slowest)<0) slowest = acked[i];
+	    }
+	    if ((int32_t)(slowest-base)>0) {
+		queue.erase(queue.begin(), queue.begin() + (slowest-base));
+		base = slowest;
+	    }
+	}
+
+	/* repair what is missing, unless a repair is already on its way, up to
+	   NAK_MAX_REPAIRS; the ranges come in order, so the oldest go first */
+	double now = host->time();
+	struct packet burst[NAK_MAX_REPAIRS];
+	int n = 0;
+	p += 3;
+	for (int r=0; r<nb_ranges && n<NAK_MAX_REPAIRS; r++, p+=NAK_RANGE_SIZE) {
+	    uint32_t first;
+	    uint16_t length;
+	    memcpy(&first, p, 4);
+	    memcpy(&length, p + 4, 2);
+	    for (uint32_t seq=first; seq!=first+length && n<NAK_MAX_REPAIRS;
+		 seq++) {
+		if ((int32_t)(seq-base)<0 || (int32_t)(seq-next_seq)>=0)
+		    continue;
+		struct entry &e = queue[seq-base];
+		if (e.last_repair>=0 && now - e.last_repair < NAK_HOLDOFF)
+		    continue;
+		e.last_repair = now;
+		burst[n++] = e.pkt;
+	    }
+	}
+	if (n>0) host->to_lower_layer(burst, n);
+
+	send_window();
+    }
+
+    void timeout() {
+	/* nothing outstanding any more */
+	if (base==next_seq) return;
+
+	/* ask every receiver for its status, which also reveals a lost tail */
+	struct packet hb;
+	char type = NAK_HEARTBEAT;
+	rdt_make_packet(&hb, next_seq, &type, 1);
+	host->to_lower_layer(&hb, 1);
+	host->start_timer(NAK_HEARTBEAT_INTERVAL);
+    }
+
+private:
+    void send_window() {
+	struct packet burst[NAK_WINDOW_SIZE];
+	int n = 0;
+
+	while (next_seq-base<NAK_WINDOW_SIZE && next_seq-base<queue.size())
+	    burst[n++] = queue[next_seq++ - base].pkt;
+	if (n>0) host->to_lower_layer(burst, n);
+
+	if (base!=next_seq) {
+	    if (!host->is_timer_set()) host->start_timer(NAK_HEARTBEAT_INTERVAL);
+	}
+	else
+	    host->stop_timer();
+    }
+};
+
+class NakReceiver : public RdtReceiver
+{
+public:
+    uint32_t expected;      /* next packet to deliver */
+    uint32_t highest;       /* past the highest number known to exist */
+    std::map<uint32_t, struct packet> held;
+
+public:
+    NakReceiver(RdtReceiverHost *host) : RdtReceiver(host) {
+	expected = 0;
+	highest = 0;
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t seq;
+	int size;
+	if (!rdt_parse_packet(pkt, &seq, &size) || size<1) return;
+
+	if (pkt->data[RDT_HEADER_SIZE]==NAK_HEARTBEAT) {
+	    if ((int32_t)(seq-highest)>0) highest = seq;
+	    send_status(expected, highest);
+	    return;
+	}
+	if (pkt->data[RDT_HEADER_SIZE]!=NAK_DATA || size<2) return;
+
+	/* a packet beyond everything seen so far reveals the gap before it:
+	   report it right away */
+	if ((int32_t)(seq-highest)>0) {
+	    uint32_t gap = highest;
+	    highest = seq + 1;
+	    send_status(gap, seq);
+	}
+	else if ((int32_t)(seq-highest)==0)
+	    highest = seq + 1;
+
+	/* duplicate */
+	if ((int32_t)(seq-expected)<0 || held.count(seq)>0) return;
+
+	if (seq!=expected) {
+	    held.insert(std::make_pair(seq, *pkt));
+	    return;
+	}
+
+	deliver(pkt);
+	expected++;
+	std::map<uint32_t, struct packet>::iterator it;
+	while ((it = held.find(expected))!=held.end()) {
+	    deliver(&it->second);
+	    held.erase(it);
+	    expected++;
+	}
+    }
+
+private:
+    void deliver(struct packet *pkt) {
+	struct message msg;
+	msg.size = (unsigned char) pkt->data[0] - 1;
+	msg.data = pkt->data + RDT_HEADER_SIZE + 1;
+	host->to_upper_layer(&msg);
+    }
+
+    /* report the cumulative ack and the packets missing in [from, to) */
+    void send_status(uint32_t from, uint32_t to) {
+	char payload[RDT_MAX_PAYLOAD];
+	char *p = payload + NAK_STATUS_HEADER;
+	int nb_ranges = 0;
+
+	if ((int32_t)(from-expected)<0) from = expected;
+	uint32_t seq = from;
+	while ((int32_t)(seq-to)<0 && nb_ranges<NAK_MAX_RANGES) {
+	    if (held.count(seq)>0) {
+		seq++;
+		continue;
+	    }
+	    uint32_t first = seq;
+	    while ((int32_t)(seq-to)<0 && held.count(seq)==0 &&
+		   seq-first<0xffff)
+		seq++;
+	    uint16_t length = (uint16_t) (seq-first);
+	    memcpy(p, &first, 4);
+	    memcpy(p + 4, &length, 2);
+	    p += NAK_RANGE_SIZE;
+	    nb_ranges++;
+	}
+
+	payload[0] = NAK_STATUS;
+	uint16_t id = (uint16_t) host->id();
+	memcpy(payload + 1, &id, 2);
+	payload[3] = (char) nb_ranges;
+
+	struct packet status;
+	rdt_make_packet(&status, expected, payload, p - payload);
+	host->to_lower_layer(&status, 1);
+    }
+};
+
+RdtSender *nak_create_sender(RdtSenderHost *host)
+{
+    return new NakSender(host);
+}
+
+RdtReceiver *nak_create_receiver(RdtReceiverHost *host)
+{
+    return new NakReceiver(host);
+}
@@ -0,0 +1,161 @@
+/*
+ * FILE: rdt_protocol.cc
+ * DESCRIPTION: Protocol registry, the adapter for the original rdt engine, and
+ *              helpers shared by the reference engines.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_protocol.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  registry
+  []------------------------------------------------------------------------[]*/
+
+const struct rdt_protocol rdt_protocols[] = {
+    {"rdt", "selective repeat with window refill (rdt_sender.cc/rdt_receiver.cc)",
+     true, false, false, rdt_legacy_create_sender, rdt_legacy_create_receiver},
+    {"gbn", "go-back-N with cumulative acks",
+     false, false, false, gbn_create_sender, gbn_create_receiver},
+    {"sr", "selective repeat with per-packet timers",
+     false, false, false, sr_create_sender, sr_create_receiver},
+    {"tcp-lite", "cumulative acks, fast retransmit, adaptive RTO and AIMD window",
+     false, false, false, tcplite_create_sender, tcplite_create_receiver},
+    {"tcp-pace", "tcp-lite with its window paced over the smoothed RTT",
+     false, false, false, tcppace_create_sender, tcplite_create_receiver},
+    {"mux", "multiplexed streams over selective repeat with an AIMD window",
+     false, true, false, mux_create_sender, mux_create_receiver},
+    {"nak", "one-to-many with aggregated negative acks and heartbeats",
+     false, false, true, nak_create_sender, nak_create_receiver},
+    {NULL, NULL, false, false, false, NULL, NULL}
+};
+
+const struct rdt_protocol *rdt_find_protocol(const char *name)
+{
+    for (const struct rdt_protocol *p = rdt_protocols; p->name!=NULL; p++) {
+	if (strcmp(p->name, name)==0) return p;
+    }
+    return NULL;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  the original engine
+  []------------------------------------------------------------------------[]*/
+
+/* the engine in rdt_sender.cc and rdt_receiver.cc keeps its state in globals
+   and calls the simulator through the free functions of rdt_sender.h and
+   rdt_receiver.h, which the simulator routes to the hosts below */
+
+RdtSenderHost *rdt_legacy_sender_host = NULL;
+RdtReceiverHost *rdt_legacy_receiver_host = NULL;
+
+class LegacySender : public RdtSender
+{
+public:
+    LegacySender(RdtSenderHost *host) : RdtSender(host) {
+	rdt_legacy_sender_host = host;
+    }
+
+    void init() { Sender_Init(); }
+    void final() { Sender_Final(); }
+    void from_upper_layer(struct message *msg) { Sender_FromUpperLayer(msg); }
+    void from_lower_layer(struct packet *pkt) { Sender_FromLowerLayer(pkt); }
+    void timeout() { Sender_Timeout(); }
+};
+
+class LegacyReceiver : public RdtReceiver
+{
+public:
+    LegacyReceiver(RdtReceiverHost *host) : RdtReceiver(host) {
+	rdt_legacy_receiver_host = host;
+    }
+
+    void init() { Receiver_Init(); }
+    void final() { Receiver_Final(); }
+    void from_lower_layer(struct packet *pkt) { Receiver_FromLowerLayer(pkt); }
+};
+
+RdtSender *rdt_legacy_create_sender(RdtSenderHost *host)
+{
+    return new LegacySender(host);
+}
+
+RdtReceiver *rdt_legacy_create_receiver(RdtReceiverHost *host)
+{
+    return new LegacyReceiver(host);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  helpers
+  []------------------------------------------------------------------------[]*/
+
+/* the table of the reflected CRC-32 polynomial */
+struct crc32_table {
+    uint32_t entry[256];
+
+    crc32_table() {
+	for (uint32_t i=0; i<256; i++) {
+	    uint32_t c = i;
+	    for (int k=0; k<8; k++)
+		c = (c & 1) ? (0xedb88320U ^ (c >> 1)) : (c >> 1);
+	    entry[i] = c;
+	}
+    }
+};
+
+uint32_t rdt_crc32(const void *data, int len)
+{
+    /* built once, on first use, which is thread-safe for a local static */
+    static const crc32_table table;
+
+    const uint8_t *p = (const uint8_t *) data;
+    uint32_t crc = 0xffffffffU;
+    for (int i=0; i<len; i++)
+	crc = table.entry[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffU;
+}
+
+/* CRC over the size and number fields followed by the payload */
+static uint32_t packet_crc(const struct packet *pkt, int size)
+{
+    char buf[RDT_PKTSIZE];
+    memcpy(buf, pkt->data, 5);
+    memcpy(buf + 5, pkt->data + RDT_HEADER_SIZE, size);
+    return rdt_crc32(buf, 5 + size);
+}
+
+void rdt_make_packet(struct packet *pkt, uint32_t number, const char *payload,
+		     int size)
+{
+    ASSERT(size>=0 && size<=RDT_MAX_PAYLOAD);
+
+    pkt->data[0] = (char) size;
+    memcpy(pkt->data + 1, &number, 4);
+    if (size>0) memcpy(pkt->data + RDT_HEADER_SIZE, payload, size);
+
+    uint32_t crc = packet_crc(pkt, size);
+    memcpy(pkt->data + 5, &crc, 4);
+}
+
+bool rdt_parse_packet(const struct packet *pkt, uint32_t *number, int *size)
+{
+    int sz = (unsigned char) pkt->data[0];
+    if (sz>RDT_MAX_PAYLOAD) return false;
+
+    uint32_t crc;
+    memcpy(&crc, pkt->data + 5, 4);
+    if (crc!=packet_crc(pkt, sz)) return false;
+
+    memcpy(number, pkt->data + 1, 4);
+    *size = sz;
+    return true;
+}
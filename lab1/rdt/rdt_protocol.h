@@ -0,0 +1,182 @@
+/*
+ * FILE: rdt_protocol.h
+ * DESCRIPTION: The protocol engine interface of the reliable data transfer
+ *              simulator.  A protocol is a pair of sender and receiver engines
+ *              selected at run time by name.  Engines talk to the simulator
+ *              only through a host object, the per-instance counterpart of the
+ *              "routines that you can call" in rdt_sender.h and
+ *              rdt_receiver.h, so several engines can live in one process.
+ */
+
+
+#ifndef _RDT_PROTOCOL_H_
+#define _RDT_PROTOCOL_H_
+
+#include <stdint.h>
+
+#include "rdt_struct.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  services offered by the simulator
+  []------------------------------------------------------------------------[]*/
+
+/* what a sender engine can call */
+class RdtSenderHost
+{
+public:
+    virtual ~RdtSenderHost() {}
+
+    /* get simulation time (in seconds) */
+    virtual double time() = 0;
+
+    /* number of receivers reached by to_lower_layer(), 1 unless the
+       protocol is "multicast" */
+    virtual int receivers() = 0;
+
+    /* pass "n" consecutive packets to the lower layer */
+    virtual void to_lower_layer(struct packet *pkts, int n) = 0;
+
+    /* start (or restart) the timer, stop it, and check whether it is set */
+    virtual void start_timer(double timeout) = 0;
+    virtual void stop_timer() = 0;
+    virtual bool is_timer_set() = 0;
+};
+
+/* what a receiver engine can call */
+class RdtReceiverHost
+{
+public:
+    virtual ~RdtReceiverHost() {}
+
+    /* get simulation time (in seconds) */
+    virtual double time() = 0;
+
+    /* number of this receiver among those of a multicast sender, from 0 */
+    virtual int id() = 0;
+
+    /* pass "n" consecutive packets to the lower layer */
+    virtual void to_lower_layer(struct packet *pkts, int n) = 0;
+
+    /* deliver a message to the upper layer */
+    virtual void to_upper_layer(struct message *msg) = 0;
+
+    /* deliver a message of logical stream "stream" to the upper layer, for
+       engines that order every stream on its own */
+    virtual void to_upper_layer_stream(int stream, struct message *msg) = 0;
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  protocol engines
+  []------------------------------------------------------------------------[]*/
+
+class RdtSender
+{
+public:
+    RdtSenderHost *host;
+
+public:
+    RdtSender(RdtSenderHost *host) { this->host = host; }
+    virtual ~RdtSender() {}
+
+    virtual void init() {}
+    virtual void final() {}
+
+    /* event handlers, see rdt_sender.h */
+    virtual void from_upper_layer(struct message *msg) = 0;
+    virtual void from_upper_layer_stream(int stream, struct message *msg) {
+	from_upper_layer(msg);
+    }
+    virtual void from_lower_layer(struct packet *pkt) = 0;
+    virtual void timeout() = 0;
+};
+
+class RdtReceiver
+{
+public:
+    RdtReceiverHost *host;
+
+public:
+    RdtReceiver(RdtReceiverHost *host) { this->host = host; }
+    virtual ~RdtReceiver() {}
+
+    virtual void init() {}
+    virtual void final() {}
+
+    /* event handler, see rdt_receiver.h */
+    virtual void from_lower_layer(struct packet *pkt) = 0;
+};
+
+/* a protocol: its name and the factories of its two engines.  protocols whose
+   engines keep global state ("single_instance") can only have one sender and
+   one receiver per process.  "multistream" protocols take the stream of every
+   message and deliver each stream in its own order; the others deliver all
+   bytes in one order whatever stream they belong to.  the sender engine of a
+   "multicast" protocol serves all receivers at once: what it passes to the
+   lower layer reaches every receiver, and what any receiver passes to the
+   lower layer reaches it. */
+struct rdt_protocol {
+    const char *name;
+    const char *description;
+    bool single_instance;
+    bool multistream;
+    bool multicast;
+    RdtSender *(*create_sender)(RdtSenderHost *host);
+    RdtReceiver *(*create_receiver)(RdtReceiverHost *host);
+};
+
+/* all registered protocols, terminated by an entry with a NULL name */
+extern const struct rdt_protocol rdt_protocols[];
+
+/* look a protocol up by name, return NULL if unknown */
+const struct rdt_protocol *rdt_find_protocol(const char *name);
+
+/* the hosts of the original engine, which the routines of rdt_sender.h and
+   rdt_receiver.h lead to; set when its engines are created */
+extern RdtSenderHost *rdt_legacy_sender_host;
+extern RdtReceiverHost *rdt_legacy_receiver_host;
+
+/* the engines of each protocol, defined in their own files */
+RdtSender *rdt_legacy_create_sender(RdtSenderHost *host);
+RdtReceiver *rdt_legacy_create_receiver(RdtReceiverHost *host);
+RdtSender *gbn_create_sender(RdtSenderHost *host);
+RdtReceiver *gbn_create_receiver(RdtReceiverHost *host);
+RdtSender *sr_create_sender(RdtSenderHost *host);
+RdtReceiver *sr_create_receiver(RdtReceiverHost *host);
+RdtSender *tcplite_create_sender(RdtSenderHost *host);
+RdtReceiver *tcplite_create_receiver(RdtReceiverHost *host);
+RdtSender *tcppace_create_sender(RdtSenderHost *host);
+RdtSender *mux_create_sender(RdtSenderHost *host);
+RdtReceiver *mux_create_receiver(RdtReceiverHost *host);
+RdtSender *nak_create_sender(RdtSenderHost *host);
+RdtReceiver *nak_create_receiver(RdtReceiverHost *host);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  helpers shared by the engines
+  []------------------------------------------------------------------------[]*/
+
+/* CRC-32 (IEEE 802.3) of "len" bytes */
+uint32_t rdt_crc32(const void *data, int len);
+
+/* the packet layout used by the reference engines (gbn, sr, tcp-lite):
+
+       |<-  1 byte  ->|<-  4 bytes  ->|<-  4 bytes ->|<-    the rest    ->|
+       | payload size |    number     |    CRC-32    |<-    payload     ->|
+
+   data packets carry a payload size in [1, RDT_MAX_PAYLOAD] and their
+   sequence number; acks carry a payload size of 0 and the acknowledged
+   number.  the CRC covers the first five bytes and the payload. */
+#define RDT_HEADER_SIZE 9
+#define RDT_MAX_PAYLOAD (RDT_PKTSIZE - RDT_HEADER_SIZE)
+
+/* fill in a packet (data if size>0, ack otherwise) */
+void rdt_make_packet(struct packet *pkt, uint32_t number, const char *payload,
+		     int size);
+
+/* check the CRC and the size of a packet, and extract its fields; return
+   false if the packet is corrupted */
+bool rdt_parse_packet(const struct packet *pkt, uint32_t *number, int *size);
+
+#endif  /* _RDT_PROTOCOL_H_ */
@@ -0,0 +1,77 @@
+/*
+ * FILE: rdt_random.h
+ * DESCRIPTION: The pseudo random number generator of the simulator.  It is a
+ *              xoshiro256** generator whose whole state is four 64-bit words,
+ *              so it is cheap enough to be drawn in bulk on the packet path
+ *              and can be saved and restored with the rest of the simulation.
+ */
+
+
+#ifndef _RDT_RANDOM_H_
+#define _RDT_RANDOM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+
+class RdtRandom
+{
+public:
+    uint64_t s[4];
+
+public:
+    RdtRandom() { seed(0); }
+
+    /* expand a 64-bit seed into the generator state with splitmix64 */
+    void seed(uint64_t seed) {
+	for (int i=0; i<4; i++) {
+	    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+	    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	    s[i] = z ^ (z >> 31);
+	}
+    }
+
+    /* next 64 random bits */
+    inline uint64_t next() {
+	uint64_t result = rotl(s[1]*5, 7)*9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+    }
+
+    /* a random number in [0,1) */
+    inline double uniform() {
+	return (next() >> 11) * (1.0/9007199254740992.0);
+    }
+
+    /* draw "n" random numbers in [0,1) at once */
+    void fill_uniform(double *out, int n) {
+	for (int i=0; i<n; i++) out[i] = uniform();
+    }
+
+    /* draw "n" random bytes at once */
+    void fill_bytes(uint8_t *out, int n) {
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+	    uint64_t r = next();
+	    memcpy(out+i, &r, 8);
+	}
+	if (i<n) {
+	    uint64_t r = next();
+	    for (; i<n; i++, r>>=8) out[i] = (uint8_t)r;
+	}
+    }
+
+private:
+    static inline uint64_t rotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+    }
+};
+
+#endif  /* _RDT_RANDOM_H_ */
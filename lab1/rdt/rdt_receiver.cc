@@ -33,6 +33,9 @@
 #include "rdt_struct.h"
 #include "rdt_receiver.h"
 
+// ------------------------- 常量定义 -------------------------
+#define RECEIVER_BUFFER_SIZE 1024 // 乱序缓冲区最多保存的数据包数量
+
 // ------------------------- 全局变量 -------------------------
 std::vector<packet> receiver_packet_buffer; // 数据包缓冲区
 int expected_sequence_number = 0;           // 期望的数据包序列号
@@ -82,10 +85,33 @@ void Receiver_FromLowerLayer(struct packet *pkt)
         receive_mutex.lock();
         // fprintf(stdout, "At %.2fs: receiver: lock %d\n", GetSimulationTime(), sequence_number);
 
-        /* send ack to the sender */
+        /* if the buffer is full, drop an out-of-order packet without ack,
+           the sender will retransmit it */
+        bool buffered = false;
+        if (sequence_number > expected_sequence_number)
+        {
+            for (auto it = receiver_packet_buffer.begin(); it != receiver_packet_buffer.end(); it++)
+            {
+                if (*(int *)(it->data + 1) == sequence_number)
+                {
+                    buffered = true;
+                    break;
+                }
+            }
+            if (!buffered && receiver_packet_buffer.size() >= RECEIVER_BUFFER_SIZE)
+            {
+                receive_mutex.unlock();
+                return;
+            }
+        }
+
+        /* send ack to the sender, the ack carries a checksum as well so that
+           a corrupted ack cannot acknowledge the wrong packet */
         struct packet ack_pkt;
+        int ack_checksum = receiver_hash_fn(std::to_string(0) + std::to_string(sequence_number));
         ack_pkt.data[0] = 0;
         memcpy(ack_pkt.data + 1, &sequence_number, 4);
+        memcpy(ack_pkt.data + 5, &ack_checksum, 4);
         Receiver_ToLowerLayer(&ack_pkt);
 
         /* if sequence number is smaller than expected, ignore it */
@@ -163,9 +189,9 @@ void Receiver_FromLowerLayer(struct packet *pkt)
             if (msg != NULL)
                 free(msg);
         }
-        else
+        else if (!buffered)
         {
-            /* save the packet in the buffer */
+            /* save the packet in the buffer (once) */
             receiver_packet_buffer.push_back(*pkt);
             // fprintf(stdout, "At %.2fs: receiver: buffer packet %d\n", GetSimulationTime(), sequence_number);
         }
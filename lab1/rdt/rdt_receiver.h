@@ -21,6 +21,10 @@ double GetSimulationTime();
 /* pass a packet to the lower layer at the receiver */
 void Receiver_ToLowerLayer(struct packet *pkt);
 
+/* pass "n" consecutive packets to the lower layer at the receiver in one
+   call, see Sender_ToLowerLayerBatch() */
+void Receiver_ToLowerLayerBatch(struct packet *pkts, int n);
+
 /* deliver a message to the upper layer at the receiver */
 void Receiver_ToUpperLayer(struct message *msg);
 
@@ -72,6 +72,10 @@ void Sender_FromUpperLayer(struct message *msg)
     /* the cursor always points to the first unsent byte in the message */
     int cursor = 0;
 
+    /* packets that fit in the window are sent out together as one burst */
+    packet burst[WINDOW_SIZE];
+    int burst_size = 0;
+
     while (msg->size - cursor > 0)
     {
         /* calculate payload size*/
@@ -86,11 +90,10 @@ void Sender_FromUpperLayer(struct message *msg)
         memcpy(pkt.data + 5, &checksum, 4);
         memcpy(pkt.data + 9, msg->data + cursor, payload_size);
 
-        /* send it out through the lower layer */
+        /* queue it for the burst sent through the lower layer */
         if (packet_in_window < WINDOW_SIZE)
         {
-            Sender_ToLowerLayer(&pkt);
-            Sender_StartTimer(TIME_OUT_VALUE);
+            burst[burst_size++] = pkt;
             packet_in_window++;
             // fprintf(stdout, "At %.2fs: sender sending packet %d ...\n", GetSimulationTime(), sequence_number);
         }
@@ -105,6 +108,13 @@ void Sender_FromUpperLayer(struct message *msg)
         sequence_number++;
     }
 
+    /* send the burst out through the lower layer */
+    if (burst_size > 0)
+    {
+        Sender_ToLowerLayerBatch(burst, burst_size);
+        Sender_StartTimer(TIME_OUT_VALUE);
+    }
+
     send_mutex.unlock();
     // fprintf(stdout, "At %.2fs: sender unlock in Sender_FromUpperLayer\n", GetSimulationTime());
 }
@@ -118,6 +128,14 @@ void Sender_FromLowerLayer(struct packet *pkt)
 
     /* get ack number */
     int ack_number = *(int *)(pkt->data + 1);
+    int ack_checksum = *(int *)(pkt->data + 5);
+
+    /* ignore corrupted acks */
+    if (pkt->data[0] != 0 || ack_checksum != (int)hash_fn(std::to_string(0) + std::to_string(ack_number)))
+    {
+        send_mutex.unlock();
+        return;
+    }
     // fprintf(stdout, "At %.2fs: sender receiving ack %d ...\n", GetSimulationTime(), ack_number);
 
     /* update the packet buffer */
@@ -156,12 +174,12 @@ void Sender_Timeout()
     send_mutex.lock();
     // fprintf(stdout, "At %.2fs: sender lock in Sender_Timeout\n", GetSimulationTime());
 
-    /* resend all packets in the window */
-    for (int i = 0; i < packet_in_window; i++)
+    /* resend all packets in the window as one burst */
+    if (packet_in_window > 0)
     {
-        Sender_ToLowerLayer(&packet_buffer[i]);
+        Sender_ToLowerLayerBatch(packet_buffer.data(), packet_in_window);
         Sender_StartTimer(TIME_OUT_VALUE);
-        // fprintf(stdout, "At %.2fs: sender resending packet %d ...\n", GetSimulationTime(), *(int *)(packet_buffer[i].data + 1));
+        // fprintf(stdout, "At %.2fs: sender resending packets %d..%d ...\n", GetSimulationTime(), *(int *)(packet_buffer[0].data + 1), *(int *)(packet_buffer[packet_in_window - 1].data + 1));
     }
 
     send_mutex.unlock();
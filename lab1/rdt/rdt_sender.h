@@ -34,6 +34,11 @@ bool Sender_isTimerSet();
 /* pass a packet to the lower layer at the sender */
 void Sender_ToLowerLayer(struct packet *pkt);
 
+/* pass "n" consecutive packets to the lower layer at the sender in one call.
+   equivalent to calling Sender_ToLowerLayer() on each of them, but the
+   channel processes the whole batch at once. */
+void Sender_ToLowerLayerBatch(struct packet *pkts, int n);
+
 
 /*[]------------------------------------------------------------------------[]
   |  routines to be changed/enhanced by you
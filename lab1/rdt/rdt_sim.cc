@@ -10,26 +10,68 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <vector>
 
 #include "rdt_struct.h"
 #include "rdt_sender.h"
 #include "rdt_receiver.h"
+#include "rdt_channel.h"
+#include "rdt_random.h"
+#include "rdt_workload.h"
+#include "rdt_protocol.h"
+#include "rdt_stream.h"
+#include "rdt_compress.h"
+#include "rdt_topology.h"
 
 
 /*[]------------------------------------------------------------------------[]
   |  generic event chain framework
   []------------------------------------------------------------------------[]*/
 
+/* simulation time is kept as a 64-bit integer number of nanoseconds, which
+   stays exact for simulated centuries; the rdt layer still sees seconds */
+typedef int64_t sim_time_t;
+
+#define NSEC_PER_SEC 1000000000LL
+
+/* later than any event */
+#define SIM_TIME_NEVER INT64_MAX
+
+static inline sim_time_t sec_to_nsec(double sec) { return llround(sec*1e9); }
+static inline double nsec_to_sec(sim_time_t nsec) { return nsec*1e-9; }
+
+/* simultaneous events occur in the order they were scheduled.  the event
+   chains of a parallel run cannot see that order across threads, and work it
+   out from the lineage of the events instead: for an event and its nearest
+   ancestors, when it occurs, which event scheduled it and its rank among the
+   events that one scheduled.  the first ancestors that differ in time, or
+   share the event that scheduled them, decide.  when none of them do, as
+   with delays that never vary, the run exits with EXIT_UNORDERED. */
+#define LINEAGE_DEPTH 6
+#define EXIT_UNORDERED 3
+
+struct event_stamp {
+    sim_time_t time;
+    uint64_t parent;        /* the event that scheduled it, 0 at the start */
+    uint64_t rank;          /* among the events scheduled by the parent */
+};
+
 /* simulation event base class */
 class Event
 {
 public:
-    double sched_time;      /* scheduled occuring time */
+    sim_time_t sched_time;  /* scheduled occuring time */
     int event_type;         /* application-specific event type */
     class Event *next;      /* next event in the chain */
+    struct event_stamp lineage[LINEAGE_DEPTH];  /* only in a stamped chain */
 
 public:
     Event() { next = NULL; }
@@ -39,31 +81,85 @@ public:
 class EventChain
 {
 public:
-    double sim_time;        /* simulation time */
+    sim_time_t sim_time;    /* simulation time */
     Event *head;            /* head event in the chain */
 
+    /* a stamped chain orders simultaneous events by their lineage, see
+       LINEAGE_DEPTH */
+    bool stamped;
+    uint64_t uid;           /* of the event being handled */
+    uint64_t next_uid;      /* of the next event handled */
+    uint64_t next_rank;     /* of the next event scheduled */
+    struct event_stamp current[LINEAGE_DEPTH];  /* lineage being handled */
+
 public:
     EventChain() {
 	sim_time = 0;
 	head = NULL;
+	stamped = false;
+	uid = 0;
+	next_uid = 1;
+	next_rank = 0;
+	for (int k=0; k<LINEAGE_DEPTH; k++) {
+	    current[k].time = -1;
+	    current[k].parent = 0;
+	    current[k].rank = 0;
+	}
     }
     
-    double time() { return sim_time; }
+    sim_time_t time() { return sim_time; }
     
     /* schedule an event - the event chain is maintained on an increasing order 
        of sched_time */
     void schedule(Event *e) {
+	stamp(e);
+	insert(e);
+    }
+
+    /* give an event scheduled by the one being handled its lineage */
+    void stamp(Event *e) {
+	if (!stamped) return;
+	e->lineage[0].time = e->sched_time;
+	e->lineage[0].parent = uid;
+	e->lineage[0].rank = next_rank++;
+	memcpy(&e->lineage[1], current,
+	       (LINEAGE_DEPTH-1)*sizeof(struct event_stamp));
+    }
+
+    /* put an event, already stamped if the chain is, in its place */
+    void insert(Event *e) {
 	/* do nothing if the event is schedule for the past */
 	if (e->sched_time<sim_time) return;
 
 	Event **ppcur = &head;
-	while ((*ppcur!=NULL) && ((*ppcur)->sched_time<=e->sched_time))
-	    ppcur = &((*ppcur)->next);
+	if (stamped) {
+	    while ((*ppcur!=NULL) &&
+		   ((*ppcur)->sched_time<e->sched_time ||
+		    ((*ppcur)->sched_time==e->sched_time &&
+		     precedes(*ppcur, e))))
+		ppcur = &((*ppcur)->next);
+	}
+	else {
+	    while ((*ppcur!=NULL) && ((*ppcur)->sched_time<=e->sched_time))
+		ppcur = &((*ppcur)->next);
+	}
 
 	e->next = *ppcur;
 	*ppcur = e;
     }
 
+    /* whether "a" occurs before "b", both stamped for the same time */
+    static bool precedes(const Event *a, const Event *b) {
+	for (int k=0; k<LINEAGE_DEPTH; k++) {
+	    const struct event_stamp &x = a->lineage[k], &y = b->lineage[k];
+	    if (x.time!=y.time) return x.time<y.time;
+	    if (x.parent==y.parent) return x.rank<y.rank;
+	}
+	fprintf(stderr, "## Parallel: cannot order simultaneous events at "
+		"%.9fs across threads\n", a->sched_time*1e-9);
+	_exit(EXIT_UNORDERED);
+    }
+
     /* cancel an event scheduled for happening in the future */
     void cancel(Event *e) {
 	Event **ppcur = &head;
@@ -81,6 +177,12 @@ public:
 	head = head->next;
 	sim_time = e->sched_time;
 
+	if (stamped) {
+	    memcpy(current, e->lineage, sizeof(current));
+	    uid = next_uid++;
+	    next_rank = 0;
+	}
+
 	return e;
     }
 };
@@ -91,22 +193,72 @@ public:
   []------------------------------------------------------------------------[]*/
 
 enum {EVENT_SENDER_FROMUPPERLAYER=0, EVENT_SENDER_FROMLOWERLAYER, 
-      EVENT_SENDER_TIMEOUT, EVENT_RECEIVER_FROMLOWERLAYER};
+      EVENT_SENDER_TIMEOUT, EVENT_RECEIVER_FROMLOWERLAYER, EVENT_REPORT};
 
 /* the event that the upper layer at the sender instructs rdt layer to send out 
    a message */
 class EventSenderFromUpperLayer : public Event
 {
 public:
-    EventSenderFromUpperLayer() { event_type = EVENT_SENDER_FROMUPPERLAYER; }
+    long long count;        /* messages the source came up with so far */
+
+public:
+    EventSenderFromUpperLayer() {
+	event_type = EVENT_SENDER_FROMUPPERLAYER;
+	count = 0;
+    }
+};
+
+/* the event that an interval report is due */
+class EventReport : public Event
+{
+public:
+    EventReport() { event_type = EVENT_REPORT; }
 };
 
-/* the event that the lower layer at the sender informs the rdt layer that a 
-   packet is received from the link */
-class EventSenderFromLowerLayer : public Event
+/* base class of the events that carry a packet across the link.  one such
+   event is created and destroyed for every packet passed on the link, so they
+   are recycled through a free list instead of going back to the heap.  over a
+   multi-hop topology, the same event is rescheduled at every hop of the
+   route, and a multicast packet goes down the tree of the routes to its
+   receivers, copied only where they split.  in a parallel run, each thread has its free list, and an event is
+   returned to the list of the thread it arrives at. */
+class PacketEvent : public Event
 {
 public:
+    int node;               /* receiver at the other end of the link */
     struct packet pkt;
+    const Route *route;     /* the hops to go through, NULL if direct */
+    int hop;                /* the hop the packet is on */
+    uint64_t group;         /* multicast over a topology: the receivers
+			       whose routes it is on, 0 if only "node" */
+
+    static thread_local PacketEvent *free_list;
+
+public:
+    PacketEvent() { route = NULL; hop = 0; group = 0; }
+
+    static void *operator new(size_t size) {
+	ASSERT(size==sizeof(PacketEvent));
+	if (free_list==NULL) return ::operator new(size);
+	PacketEvent *e = free_list;
+	free_list = (PacketEvent *) e->next;
+	return e;
+    }
+
+    static void operator delete(void *p) {
+	PacketEvent *e = (PacketEvent *) p;
+	e->next = free_list;
+	free_list = e;
+    }
+};
+
+thread_local PacketEvent *PacketEvent::free_list = NULL;
+
+/* the event that the lower layer at the sender informs the rdt layer that a 
+   packet is received from the link */
+class EventSenderFromLowerLayer : public PacketEvent
+{
 public:
     EventSenderFromLowerLayer() { event_type = EVENT_SENDER_FROMLOWERLAYER; }
 };
@@ -114,16 +266,17 @@ public:
 /* the event that the timer at the sender expires */
 class EventSenderTimeout : public Event
 {
+public:
+    int node;               /* session of the sender */
+
 public:
     EventSenderTimeout() { event_type = EVENT_SENDER_TIMEOUT; }
 };
 
 /* the event that the lower layer at the receiver informs the rdt layer that a 
    packet is received from the link */
-class EventReceiverFromLowerLayer : public Event
+class EventReceiverFromLowerLayer : public PacketEvent
 {
-public:
-    struct packet pkt;
 public:
     EventReceiverFromLowerLayer() { event_type = EVENT_RECEIVER_FROMLOWERLAYER; }
 };
@@ -160,6 +313,126 @@ double loss_rate;
    packet can be corrupted */
 double corrupt_rate;
 
+/* channel model applied to both directions of the link:
+   "bernoulli" (independent loss, the default), "ge" (Gilbert-Elliott bursty
+   loss) or "trace" (replayed from a trace file) */
+const char *channel_model = "bernoulli";
+
+/* delay distribution ("fixed", "uniform", "normal" or "pareto") and its
+   jitter (in seconds).  the "fixed" distribution uses "outoforder_rate". */
+const char *delay_dist = "fixed";
+double delay_jitter = 0.0;
+
+/* Gilbert-Elliott parameters.  unless p and r are given explicitly, they are
+   derived from "loss_rate" and the mean burst length so that the long-run
+   loss rate matches "loss_rate". */
+double ge_p = -1;
+double ge_r = -1;
+double ge_burst = 5.0;
+double ge_loss_good = 0.0;
+double ge_loss_bad = 1.0;
+
+/* trace files for the trace-driven channel; the acknowledgement direction
+   replays "data_trace_path" as well unless "ack_trace_path" is given */
+const char *data_trace_path = NULL;
+const char *ack_trace_path = NULL;
+
+/* workload: message arrival process, size distribution and, optionally, a
+   file whose content is replayed as the message payload */
+const char *arrival_dist = "uniform";
+const char *size_dist = "uniform";
+double onoff_on_time = 1.0;
+double onoff_off_time = 1.0;
+double pareto_shape = 1.5;
+const char *payload_path = NULL;
+
+/* long-run mode: interval between periodic reports (in seconds, 0 turns
+   them off), warm-up time excluded from the steady-state throughput (in
+   seconds), and the bound on bytes accepted from the upper layer but not yet
+   delivered (0 means unbounded).  when the bound is reached, new messages are
+   refused at the source, which keeps the protocol buffers bounded however
+   long the simulation runs. */
+double report_interval = 0;
+double warmup_time = 0;
+long long max_backlog = 0;
+
+/* protocol engine driving the sender and the receiver, see rdt_protocol.h.
+   in comparison mode every protocol of "compare_list" (comma separated, or
+   all registered ones) runs on the same seeded workload and channels. */
+const char *protocol_name = "rdt";
+bool compare_mode = false;
+const char *compare_list = NULL;
+
+/* sweep branching: when the simulation gets to "fork_time" (in seconds,
+   negative when not branching), it forks a copy-on-write child for every
+   branch, which changes some parameters and runs on from there, while the
+   trunk runs on unchanged.  they all share the same history up to then,
+   random number generators included, so the warm-up is simulated once and
+   the branches differ by their parameters only.  a branch is given as
+   "key=value,..." with the keys loss, corrupt, outoforder, jitter (the
+   channels), bottleneck, queue (the bottleneck), interval and size (the
+   workload). */
+#define MAX_BRANCHES 16
+
+struct branch {
+    const char *spec;       /* as given */
+    double loss_rate;       /* the new values, negative if unchanged */
+    double corrupt_rate;
+    double outoforder_rate;
+    double jitter;
+    double bottleneck_rate;
+    int bottleneck_queue;
+    double arrival_int;
+    int msg_size;
+    pid_t pid;              /* of the child */
+    int fd;                 /* the pipe the child reports through */
+};
+
+double fork_time = -1;
+int nb_branches = 0;
+struct branch branches[MAX_BRANCHES];
+
+/* when the branches were forked, -1 until then, and the branch of a child
+   (NULL in the trunk) */
+int64_t branch_time = -1;
+struct branch *this_branch = NULL;
+
+/* number of logical streams the messages are spread over (round robin) */
+int nb_streams = 1;
+
+/* compress messages before the protocol packetizes them, see
+   rdt_compress.h */
+bool compress_mode = false;
+
+/* number of receivers of the data.  a multicast protocol serves them all
+   from one sender; any other protocol runs one session per receiver. */
+int nb_receivers = 1;
+
+/* bottleneck in front of the data channel of every receiver: its rate (in
+   bytes per second, 0 means no bottleneck) and its queue (in packets) */
+double bottleneck_rate = 0;
+int bottleneck_queue = 16;
+
+/* multi-hop topology between the sender and the receivers, which replaces
+   the direct channels when a topology file is given, see rdt_topology.h */
+const char *topology_path = NULL;
+Topology topology;
+
+/* seed of the random number generators, 0 picks one from the process id */
+unsigned long long sim_seed = 0;
+
+/* threads the receivers are spread over, see "parallel simulation"; 0 runs
+   on one without saying how long it took */
+int nb_threads = 0;
+
+/* number of packets handled by the channel in one go */
+#define LINK_BATCH 64
+
+/* largest number of receivers, and the distance between the seeds of the
+   channels of consecutive receivers */
+#define MAX_RECEIVERS 64
+#define PEER_SEED_STRIDE 1000003ULL
+
 /* tracing levels (higher level always prints out more information):
    a tracing level of 0 turns off all traces while a tracing, 
    a tracing level of 1 turns on regular traces,
@@ -167,49 +440,223 @@ double corrupt_rate;
 */
 int tracing_level;
 
-/* simulation event chain core */
-EventChain sim_core;
+/* simulation event chain core, that of the thread in a parallel run */
+EventChain main_core;
+thread_local EventChain *sim_core = &main_core;
+
+/* trace files of the sender->receiver and the receiver->sender directions,
+   shared by the channels of all receivers */
+TraceFile data_trace, ack_trace;
+
+/* random number generator of the message source.  each channel direction
+   has its own, seeded independently, so the messages are the same whatever
+   number of packets a protocol pushes through the channels. */
+RdtRandom workload_rng;
+
+/* the simulator services seen by the protocol engines; the routines of
+   rdt_sender.h and rdt_receiver.h lead to the hosts of the original engine,
+   see rdt_protocol.h */
+class SimSenderHost : public RdtSenderHost
+{
+public:
+    int index;              /* session of the sender */
+    EventSenderTimeout *timer;  /* timer event, NULL if the timer is not set */
+
+public:
+    SimSenderHost() { index = 0; timer = NULL; }
+
+    double time();
+    int receivers();
+    void to_lower_layer(struct packet *pkts, int n);
+    void start_timer(double timeout);
+    void stop_timer();
+    bool is_timer_set() { return timer!=NULL; }
+};
+
+class SimReceiverHost : public RdtReceiverHost
+{
+public:
+    int index;              /* the receiver */
 
-/* sender timer event */
-Event *sender_timer = NULL;
+public:
+    SimReceiverHost() { index = 0; }
+
+    double time();
+    int id() { return index; }
+    void to_lower_layer(struct packet *pkts, int n);
+    void to_upper_layer(struct message *msg);
+    void to_upper_layer_stream(int stream, struct message *msg);
+};
+
+/* a sender engine and its services: the only one, or one per receiver when
+   a unicast protocol serves several receivers */
+struct session {
+    RdtSender *sender;
+    SimSenderHost host;
+    int part;               /* partition it runs in */
+};
+
+/* a receiver engine, its services, the two channel directions between it
+   and the sender, and its statistics */
+struct peer {
+    RdtReceiver *receiver;
+    SimReceiverHost host;
+    Channel *data_channel;
+    Channel *ack_channel;
+    Bottleneck *bottleneck; /* before the data channel, NULL if none */
+    Route data_route;       /* over a topology, instead of the channels */
+    Route ack_route;
+    RdtRandom data_rng;
+    RdtRandom ack_rng;
+    StreamTable *streams;   /* per-stream offsets and message latencies */
+    long long chars_delivered;
+    long long pkts_received;    /* data packets arrived, corrupted or not */
+    long long pkts_sent;        /* packets passed to the lower layer */
+    bool verification_passed;
+    int part;               /* partition it runs in */
+    long long marked_chars[2];  /* see mark_delivered() */
+};
 
-/* general statistics */
-int tot_chars_sent = 0;
-int tot_chars_delivered = 0;
-int tot_pkts_passed = 0;
+/* the protocol, its sessions and the receivers */
+const struct rdt_protocol *protocol = NULL;
+int nb_sessions = 0;
+struct session *sessions = NULL;
+struct peer *peers = NULL;
+
+/* the workload driving the upper layer at the sender, the copy of the
+   thread in a parallel run */
+thread_local Workload *workload = NULL;
+
+/* general statistics; with several receivers, a character is delivered
+   once every receiver has it.  the counters of this section marked
+   thread_local are added up over the threads of a parallel run at the end. */
+thread_local long long tot_chars_sent = 0;
+long long tot_chars_delivered = 0;
+thread_local long long tot_pkts_passed = 0;
+
+/* packets handed to the lower layer by the senders and the receivers,
+   including the ones the channel then loses; a multicast packet counts
+   once */
+thread_local long long tot_data_pkts_sent = 0;
+thread_local long long tot_ack_pkts_sent = 0;
+
+/* data packets dropped at the bottleneck queues */
+thread_local long long tot_queue_drops = 0;
+
+/* messages and bytes refused at the source because of "max_backlog" */
+long long tot_msgs_blocked = 0;
+long long tot_chars_blocked = 0;
+
+/* what the compression stage of the (first) sender did */
+struct compress_stats tot_compress;
+
+/* statistics at the last interval report and at the end of the warm-up */
+sim_time_t last_report_time = 0;
+long long last_report_chars = 0;
+long long last_report_pkts = 0;
+thread_local sim_time_t warmup_end_time = -1;
+long long warmup_chars_delivered = 0;
+
+/* statistics when the message source stops; the steady state spans from the
+   end of the warm-up to this point and excludes the final drain */
+thread_local sim_time_t source_end_time = -1;
+long long source_end_chars_delivered = 0;
 
 /* error flag set by message verification at the receiver */
 bool message_verfication_passed = true;
 
+/* a share of a parallel run, handled by a thread of its own: some of the
+   receivers, the sessions serving them (a multicast session goes to the
+   first partition), an event chain and a copy of the message source, which
+   draws the same messages at the same times as every other copy.  the
+   packets for other partitions are left in "outbox", one mailbox per
+   partition, which only this thread fills during a window and only the
+   other one empties between windows. */
+struct partition {
+    int index;
+    int first_peer;         /* the receiver whose streams pick the stream */
+    EventChain *core;
+    RdtRandom workload_rng;
+    Workload *workload;
+    std::vector<PacketEvent *> *outbox;
+    sim_time_t next_time;   /* of the earliest event after a window */
+    sim_time_t sim_end;     /* when the message source stops */
+    pthread_t thread;
+
+    /* what the thread counted, see above */
+    long long pkts_passed;
+    long long data_pkts_sent;
+    long long ack_pkts_sent;
+    long long queue_drops;
+    sim_time_t mark_time[2];
+
+    /* how the run went */
+    long long events;
+    long long windows;
+    double busy;            /* processor time handling events (in seconds) */
+};
+
+int nb_partitions = 1;
+struct partition *partitions = NULL;
+
+/* how far ahead of the others a partition can run: packets between
+   partitions take at least that long */
+sim_time_t lookahead = SIM_TIME_NEVER;
+
+/* the partition of the thread, NULL when the run is not parallel */
+thread_local struct partition *self = NULL;
+
+pthread_barrier_t window_barrier;
+
 
 /*[]------------------------------------------------------------------------[]
   |  simulation routines
   []------------------------------------------------------------------------[]*/
 
-/* generate a random number in [0,1] */
+/* generate a random number in [0,1) */
 static double myrandom()
 {
-    return(rand()*1.0/RAND_MAX);
+    return workload_rng.uniform();
 }
 
-/* generate a message 
-   NOTE: change this part if you want to generate different messages for 
-         testing.  we will certainly use different messages in our grading! */
-static struct message *generate_msg()
+/* whether a session or a receiver in partition "part" is handled by the
+   calling thread */
+static inline bool is_local(int part)
+{
+    return self==NULL || part==self->index;
+}
+
+/* schedule a packet arrival in partition "part": right away if it is that
+   of the calling thread, otherwise by its mailbox at the end of the
+   window */
+static void post_event(PacketEvent *e, int part)
 {
-    static char cnt = 0;
+    if (is_local(part)) {
+	sim_core->schedule(e);
+	return;
+    }
+    sim_core->stamp(e);
+    self->outbox[part].push_back(e);
+}
 
+/* generate a message 
+   NOTE: the size, arrival time and content of messages come from the
+         workload, see rdt_workload.h. */
+static struct message *generate_msg(int stream, int size)
+{
     struct message *msg = (struct message*) malloc(sizeof(struct message));
     ASSERT(msg!=NULL);
-    msg->size = (int)(myrandom()*2.0*msg_size);
-    if (msg->size==0) msg->size=1;
+    msg->size = size;
     msg->data = (char*) malloc(msg->size);
     ASSERT(msg->data!=NULL);
 
-    for (int i=0; i<msg->size; i+=1) {
-	msg->data[i] = '0' + cnt;
-	cnt = (cnt+1) % 10;
+    /* every receiver expects the message at the same stream offset */
+    uint64_t offset = 0;
+    for (int i=0; i<nb_receivers; i++) {
+	if (is_local(peers[i].part))
+	    offset = peers[i].streams->send(stream, msg->size, sim_core->time());
     }
+    workload->payload.fill(msg->data, offset, msg->size);
 
     tot_chars_sent += msg->size;
 
@@ -226,7 +673,7 @@ static void free_msg(struct message *msg)
 /* get simulation time (in seconds) - for both the sender and the receiver */
 double GetSimulationTime()
 {
-    return sim_core.time();
+    return nsec_to_sec(sim_core->time());
 }
 
 /* start the sender timer with a specified timeout (in seconds).
@@ -235,244 +682,681 @@ double GetSimulationTime()
    Sender_Timeout() will be called when the timer expires. */
 void Sender_StartTimer(double timeout)
 {
-    if (tracing_level>=1)
-	fprintf(stdout, "Time %.2fs (Sender): the timer is started (expires at %.2fs).\n",
-		sim_core.time(), sim_core.time() + timeout);
-
-    if (sender_timer!=NULL) {
-	sim_core.cancel(sender_timer);
-	delete sender_timer;
-	sender_timer = NULL;
-    }
-
-    EventSenderTimeout *e = new EventSenderTimeout;
-    e->sched_time = sim_core.time() + timeout;
-    sim_core.schedule(e);
-
-    sender_timer = e;
+    rdt_legacy_sender_host->start_timer(timeout);
 }
 
 /* stop the sender timer */
 void Sender_StopTimer()
 {
-    if (tracing_level>=1)
-	fprintf(stdout, "Time %.2fs (Sender): the timer is stopped.\n", 
-		sim_core.time());
-
-    if (sender_timer!=NULL) {
-	sim_core.cancel(sender_timer);
-	delete sender_timer;
-	sender_timer = NULL;
-    }
+    rdt_legacy_sender_host->stop_timer();
 }
 
 /* check whether the sender timer is being set,
    return true if the timer is set, return false otherwise */
 bool Sender_isTimerSet()
 {
-    return (sender_timer!=NULL);
+    return rdt_legacy_sender_host->is_timer_set();
 }
 
-/* pass a packet to the lower layer at the sender */
-void Sender_ToLowerLayer(struct packet *pkt)
+/* pass a batch of packets through one direction of the link: the channel
+   decides the fates of the whole batch at once, the surviving packets are
+   copied into recycled arrival events, the corrupted ones are damaged in
+   bulk, and the events are scheduled at the other side.  "Ev" is the arrival
+   event type at the other side, "node" the receiver on the link, "part" the
+   partition of the other side, and "queue" the bottleneck the packets go
+   through first (NULL if none). */
+template <class Ev>
+static void transmit_batch(Channel *channel, RdtRandom *rng,
+			   Bottleneck *queue, struct packet *pkts, int n,
+			   int node, int part)
 {
-    /* packet lost at rate "loss_rate" */
-    if (myrandom()<loss_rate) return;
+    struct channel_fate fates[LINK_BATCH];
+    struct packet *corrupted[LINK_BATCH];
+
+    while (n>0) {
+	int m = (n<LINK_BATCH) ? n : LINK_BATCH;
+	int nb_corrupted = 0;
+
+	channel->next_fates(fates, m);
+
+	for (int i=0; i<m; i++) {
+	    /* packet dropped at the bottleneck, then for the time it spends
+	       in the queue and on the link */
+	    sim_time_t departure = sim_core->time();
+	    if (queue!=NULL) {
+		departure = queue->enqueue(sim_core->time(), RDT_PKTSIZE);
+		if (departure<0) {
+		    tot_queue_drops ++;
+		    continue;
+		}
+	    }
 
-    EventReceiverFromLowerLayer *e = new EventReceiverFromLowerLayer;
-    memcpy(&e->pkt.data, pkt->data, RDT_PKTSIZE);
+	    /* packet lost on the channel */
+	    if (fates[i].lost) continue;
 
-    /* packet corrupted at rate "corrupt_rate" */
-    if (myrandom()<corrupt_rate) {
-	for (int i=0; i<RDT_PKTSIZE; i++) {
-	    e->pkt.data[i] = e->pkt.data[i] + (char)(myrandom()*20) - 10;
+	    Ev *e = new Ev;
+	    e->node = node;
+	    memcpy(&e->pkt.data, pkts[i].data, RDT_PKTSIZE);
+
+	    /* packet corrupted on the channel */
+	    if (fates[i].corrupted) corrupted[nb_corrupted++] = &e->pkt;
+
+	    /* schedule the packet arrival event at the other side */
+	    e->sched_time = departure + sec_to_nsec(fates[i].delay);
+	    post_event(e, part);
+
+	    tot_pkts_passed ++;
 	}
-    }
 
-    /* schedule the packet arrival event at the other side */
-    if (myrandom()<outoforder_rate)
-	e->sched_time = sim_core.time() + pkt_latency*2.0*myrandom();
-    else
-	e->sched_time = sim_core.time() + pkt_latency;
-    sim_core.schedule(e);
+	/* events are only inspected when they fire, so the payload can be
+	   damaged after scheduling */
+	if (nb_corrupted>0) corrupt_packets(corrupted, nb_corrupted, rng);
 
-    tot_pkts_passed ++;
+	pkts += m;
+	n -= m;
+    }
 }
 
+/* put a packet on the current hop of its route, free the event if the
+   packet is dropped or lost there */
+static void transmit_hop(PacketEvent *e)
+{
+    Hop *h = (*e->route)[e->hop];
+    sim_time_t arrival;
+    if (!h->transmit(sim_core->time(), &e->pkt, &arrival)) {
+	delete e;
+	return;
+    }
+    e->sched_time = arrival;
+    sim_core->schedule(e);
+}
 
-/* pass a packet to the lower layer at the receiver */
-void Receiver_ToLowerLayer(struct packet *pkt)
+/* pass a batch of packets to the first hop of a route */
+template <class Ev>
+static void transmit_route(const Route *route, struct packet *pkts, int n,
+			   int node)
 {
-    /* packet lost at rate "loss_rate" */
-    if (myrandom()<loss_rate) return;
+    for (int i=0; i<n; i++) {
+	Ev *e = new Ev;
+	e->node = node;
+	e->route = route;
+	memcpy(&e->pkt.data, pkts[i].data, RDT_PKTSIZE);
+	transmit_hop(e);
+    }
+}
 
-    EventSenderFromLowerLayer *e = new EventSenderFromLowerLayer;
-    memcpy(&e->pkt.data, pkt->data, RDT_PKTSIZE);
+/* pass a multicast packet on from the end of hop "e->hop - 1" of the routes
+   of its group (from the sender if "e->hop" is 0): one copy per hop the
+   routes go on to, one per receiver they end at.  the routes from the sender
+   form a tree, so those of the group are the same up to there.  a shared
+   queue thus sees each packet once, as with replication in the network. */
+static void multicast_hop(PacketEvent *e)
+{
+    uint64_t left = e->group;
+
+    while (left!=0) {
+	int first = __builtin_ctzll(left);
+	const Route *r = &peers[first].data_route;
+
+	EventReceiverFromLowerLayer *c = new EventReceiverFromLowerLayer;
+	c->node = first;
+	memcpy(&c->pkt.data, e->pkt.data, RDT_PKTSIZE);
+
+	if ((int) r->size()==e->hop) {
+	    /* arrived: hand it to the receiver right away */
+	    left &= ~(1ULL << first);
+	    tot_pkts_passed ++;
+	    c->sched_time = sim_core->time();
+	    sim_core->schedule(c);
+	    continue;
+	}
 
-    /* packet corrupted at rate "corrupt_rate" */
-    if (myrandom()<corrupt_rate) {
-	for (int i=0; i<RDT_PKTSIZE; i++) {
-	    e->pkt.data[i] = e->pkt.data[i] + (char)(myrandom()*20) - 10;
+	/* the receivers whose routes take the same next hop */
+	uint64_t sub = 0;
+	for (uint64_t m=left; m!=0; m&=m-1) {
+	    const Route &q = peers[__builtin_ctzll(m)].data_route;
+	    if ((int) q.size()>e->hop && q[e->hop]==(*r)[e->hop])
+		sub |= m & -m;
 	}
+	left &= ~sub;
+
+	c->route = r;
+	c->hop = e->hop;
+	c->group = sub;
+	transmit_hop(c);
     }
+    delete e;
+}
 
-    /* schedule the packet arrival event at the other side */
-    if (myrandom()<outoforder_rate)
-	e->sched_time = sim_core.time() + pkt_latency*2.0*myrandom();
-    else
-	e->sched_time = sim_core.time() + pkt_latency;	
-    sim_core.schedule(e);
+/* pass a batch of multicast packets to the tree of routes to every
+   receiver */
+static void transmit_tree(struct packet *pkts, int n)
+{
+    uint64_t all = (nb_receivers==64) ? ~0ULL : (1ULL << nb_receivers) - 1;
+
+    for (int i=0; i<n; i++) {
+	PacketEvent *e = new EventReceiverFromLowerLayer;
+	e->group = all;
+	memcpy(&e->pkt.data, pkts[i].data, RDT_PKTSIZE);
+	multicast_hop(e);
+    }
+}
 
-    tot_pkts_passed ++;
+/* a packet has arrived at the end of its current hop: pass it on to the next
+   one unless it has reached its destination.  return true if the packet is
+   still on its way. */
+static bool forward_packet(PacketEvent *e)
+{
+    if (e->route==NULL) return false;
+    if (e->group!=0) {
+	e->hop++;
+	multicast_hop(e);
+	return true;
+    }
+    if (e->hop+1==(int) e->route->size()) {
+	tot_pkts_passed ++;
+	return false;
+    }
+    e->hop++;
+    transmit_hop(e);
+    return true;
 }
 
-/* deliver a message to the upper layer at the receiver 
-   NOTE: change the message verification in this function if you changed 
-         generate_msg() for testing. */
-void Receiver_ToUpperLayer(struct message *msg)
+/* pass a packet to the lower layer at the sender */
+void Sender_ToLowerLayer(struct packet *pkt)
 {
-    static char cnt = 0;
+    Sender_ToLowerLayerBatch(pkt, 1);
+}
 
-    for (int i=0; i<msg->size; i++) {
-	/* message verification */
-	if (msg->data[i] != '0' + cnt) {
-	    message_verfication_passed = false;
-	}
-	cnt = (cnt+1) % 10;
+/* pass a batch of packets to the lower layer at the sender */
+void Sender_ToLowerLayerBatch(struct packet *pkts, int n)
+{
+    rdt_legacy_sender_host->to_lower_layer(pkts, n);
+}
 
-	if (tracing_level>=2)
-	    fputc(msg->data[i], stdout);
-    }
+/* pass a packet to the lower layer at the receiver */
+void Receiver_ToLowerLayer(struct packet *pkt)
+{
+    Receiver_ToLowerLayerBatch(pkt, 1);
+}
+
+/* pass a batch of packets to the lower layer at the receiver */
+void Receiver_ToLowerLayerBatch(struct packet *pkts, int n)
+{
+    rdt_legacy_receiver_host->to_lower_layer(pkts, n);
+}
 
-    tot_chars_delivered += msg->size;
+/* deliver a message to the upper layer at the receiver 
+   NOTE: the delivered bytes are verified against the workload content at the
+         same offset of their stream; with several streams, the bytes are
+         taken to belong to the streams in the order the messages were
+         sent. */
+void Receiver_ToUpperLayer(struct message *msg)
+{
+    rdt_legacy_receiver_host->to_upper_layer(msg);
 }
 
 
 /*[]------------------------------------------------------------------------[]
-  |  main simulation control routine
+  |  services of the simulator to the protocol engines
   []------------------------------------------------------------------------[]*/
 
-int main(int argc, char *argv[])
+double SimSenderHost::time()
 {
-    if (argc!=8) {
-	fprintf(stderr, "usage: %s <sim_time> <mean_msg_arrivalint> <mean_msg_size> "
-		"<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level>\n", 
-		argv[0]);
-	exit(-1);
-    }
+    return GetSimulationTime();
+}
 
-    sim_time = atof(argv[1]);
-    if (sim_time<=0) {
-	fprintf(stderr, "invalid <sim_time>\n");
-	exit(-1);
-    }
-    msg_arrivalint = atof(argv[2]);
-    if (msg_arrivalint<=0) {
-	fprintf(stderr, "invalid <msg_arrivalint>\n");
-	exit(-1);
-    }
-    msg_size = atoi(argv[3]);
-    if (msg_size<=0) {
-	fprintf(stderr, "invalid <msg_size>\n");
-	exit(-1);
-    }
-    outoforder_rate = atof(argv[4]);
-    if (outoforder_rate<0 || outoforder_rate>1) {
-	fprintf(stderr, "invalid <outoforder_rate>\n");
-	exit(-1);
-    }
-    loss_rate = atof(argv[5]);
-    if (loss_rate<0 || loss_rate>1) {
-	fprintf(stderr, "invalid <loss_rate>\n");
-	exit(-1);
-    }
-    corrupt_rate = atof(argv[6]);
-    if (corrupt_rate<0 || corrupt_rate>1) {
-	fprintf(stderr, "invalid <corrupt_rate>\n");
-	exit(-1);
-    }
-    tracing_level = atoi(argv[7]);
-    if (tracing_level<0 || tracing_level>2) {
-	fprintf(stderr, "invalid <tracing_level>\n");
-	exit(-1);
+int SimSenderHost::receivers()
+{
+    return protocol->multicast ? nb_receivers : 1;
+}
+
+void SimSenderHost::to_lower_layer(struct packet *pkts, int n)
+{
+    tot_data_pkts_sent += n;
+
+    /* a multicast sender reaches every receiver over its own channel, or
+       down the tree of its routes through the topology, where a link shared
+       by several routes carries a single copy */
+    if (protocol->multicast && topology_path!=NULL)
+	transmit_tree(pkts, n);
+    else if (protocol->multicast) {
+	for (int i=0; i<nb_receivers; i++) {
+	    transmit_batch<EventReceiverFromLowerLayer>(peers[i].data_channel,
+							&peers[i].data_rng,
+							peers[i].bottleneck,
+							pkts, n, i,
+							peers[i].part);
+	}
     }
-    
-    fprintf(stdout, "## Reliable data transfer simulation with:\n"
-	    "\tsimulation time is %.3f seconds\n"
-	    "\taverage message arrival interval is %.3f seconds\n"
-	    "\taverage message size is %d bytes\n"
-	    "\taverage out-of-order delivery rate is %.2f%%\n"
-	    "\taverage loss rate is %.2f%%\n"
-	    "\taverage corrupt rate is %.2f%%\n"
-	    "\ttracing level is %d\n"
-	    "Please review these inputs and press <enter> to proceed.\n",
-	    sim_time, msg_arrivalint, msg_size, outoforder_rate*100.0, 
-	    loss_rate*100.0, corrupt_rate*100.0, tracing_level);
-    fgetc(stdin);
+    else if (topology_path!=NULL)
+	transmit_route<EventReceiverFromLowerLayer>(&peers[index].data_route,
+						    pkts, n, index);
+    else
+	transmit_batch<EventReceiverFromLowerLayer>(peers[index].data_channel,
+						    &peers[index].data_rng,
+						    peers[index].bottleneck,
+						    pkts, n, index,
+						    peers[index].part);
+}
 
-    /* initialize the random number generator */
-    srand(getpid()+getppid());
+void SimSenderHost::start_timer(double timeout)
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Sender): the timer is started (expires at %.2fs).\n",
+		GetSimulationTime(), GetSimulationTime() + timeout);
 
-    /* test the random number generator */
-    double randtest_sum = 0.0;
-    for (int i=0; i<1000; i++)
-	randtest_sum += myrandom();
-    double randtest_avg = randtest_sum/1000;
-    if (randtest_avg<0.25 || randtest_avg>0.75) {
-	fprintf(stderr, 
-		"It appears that something is wrong with the random number.\n"
-		"Please try to run this again.\n"  
-		"Please report to me if the problem PERSISTS.\n");
-	exit(-1);
+    if (timer!=NULL) {
+	sim_core->cancel(timer);
+	delete timer;
+	timer = NULL;
     }
 
-    /* intialize the sender and the receiver */
-    Sender_Init();
-    Receiver_Init();
+    EventSenderTimeout *e = new EventSenderTimeout;
+    e->node = index;
+    e->sched_time = sim_core->time() + sec_to_nsec(timeout);
+    sim_core->schedule(e);
 
-    /* scheduling a recurring message arrival event */
-    EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
-    e->sched_time = 0;
-    sim_core.schedule(e);
+    timer = e;
+}
 
-    /* main simulation cycle */
-    for (;;) {
-	Event *e = sim_core.next_event();
-	if (e==NULL) break;
+void SimSenderHost::stop_timer()
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Sender): the timer is stopped.\n", 
+		GetSimulationTime());
 
-	switch (e->event_type) {
-	case EVENT_SENDER_FROMUPPERLAYER:
-	    {
-		if (tracing_level>=1) {
-		    fprintf(stdout, "Time %.2fs (Sender): the upper layer instructs rdt layer to send out a message.\n", sim_core.time());
-		}
+    if (timer!=NULL) {
+	sim_core->cancel(timer);
+	delete timer;
+	timer = NULL;
+    }
+}
 
-		EventSenderFromUpperLayer *real_e = (EventSenderFromUpperLayer*) e;
+double SimReceiverHost::time()
+{
+    return GetSimulationTime();
+}
 
-		struct message *msg = generate_msg();
-		Sender_FromUpperLayer(msg);
-		free_msg(msg);
+void SimReceiverHost::to_lower_layer(struct packet *pkts, int n)
+{
+    struct peer &p = peers[index];
+    tot_ack_pkts_sent += n;
+    p.pkts_sent += n;
+    if (topology_path!=NULL)
+	transmit_route<EventSenderFromLowerLayer>(&p.ack_route, pkts, n, index);
+    else
+	transmit_batch<EventSenderFromLowerLayer>(p.ack_channel, &p.ack_rng,
+						  NULL, pkts, n, index,
+						  sessions[protocol->multicast
+							   ? 0 : index].part);
+}
 
-		/* schedule the recurring event */
-		if (sim_core.time() < sim_time) {
-		    real_e->sched_time = 
-			sim_core.time() + msg_arrivalint*2.0*myrandom();
-		    sim_core.schedule(real_e);
-		}
-		else
-		    delete real_e;
-	    }
-	    break;
+/* account for bytes delivered at a receiver.  the totals over the receivers
+   of a parallel run are only worked out at the end, see run_parallel(). */
+static void delivered(struct peer &p, const struct message *msg, bool ok)
+{
+    if (!ok) p.verification_passed = false;
 
-	case EVENT_SENDER_FROMLOWERLAYER:
+    if (tracing_level>=2 && p.host.index==0)
+	fwrite(msg->data, 1, msg->size, stdout);
+
+    p.chars_delivered += msg->size;
+    if (self!=NULL) return;
+
+    if (!ok) message_verfication_passed = false;
+    if (nb_receivers==1)
+	tot_chars_delivered = p.chars_delivered;
+    else {
+	long long least = p.chars_delivered;
+	for (int i=0; i<nb_receivers; i++) {
+	    if (peers[i].chars_delivered<least) least = peers[i].chars_delivered;
+	}
+	tot_chars_delivered = least;
+    }
+}
+
+void SimReceiverHost::to_upper_layer(struct message *msg)
+{
+    struct peer &p = peers[index];
+    delivered(p, msg, p.streams->deliver_ordered(msg->data, msg->size,
+						 sim_core->time(),
+						 workload->payload));
+}
+
+void SimReceiverHost::to_upper_layer_stream(int stream, struct message *msg)
+{
+    struct peer &p = peers[index];
+    delivered(p, msg, p.streams->deliver(stream, msg->data, msg->size,
+					 sim_core->time(), workload->payload));
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main simulation control routine
+  []------------------------------------------------------------------------[]*/
+
+/* print an interval report: one line of "key=value" pairs covering the
+   period since the previous report */
+static void report_interval_stats()
+{
+    sim_time_t now = sim_core->time();
+    double span = nsec_to_sec(now - last_report_time);
+
+    fprintf(stdout, "## report time=%.3f delivered=%lld sent=%lld pkts=%lld "
+	    "interval_goodput=%.1f interval_pkts=%lld backlog=%lld "
+	    "blocked_msgs=%lld\n",
+	    nsec_to_sec(now), tot_chars_delivered, tot_chars_sent,
+	    tot_pkts_passed,
+	    (span>0) ? (tot_chars_delivered-last_report_chars)/span : 0.0,
+	    tot_pkts_passed-last_report_pkts,
+	    tot_chars_sent-tot_chars_delivered, tot_msgs_blocked);
+    fflush(stdout);
+
+    last_report_time = now;
+    last_report_chars = tot_chars_delivered;
+    last_report_pkts = tot_pkts_passed;
+}
+
+/* return the value of an optional "--name=value" argument, or NULL if the
+   argument is not the named option */
+static const char *option_value(const char *arg, const char *name)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len)!=0 || arg[len]!='=') return NULL;
+    return arg + len + 1;
+}
+
+/* the Gilbert-Elliott P(good->bad) that, with P(bad->good) "r", makes the
+   stationary loss p/(p+r)*loss_bad + r/(p+r)*loss_good match loss_rate */
+static double ge_derived_p(double r)
+{
+    double p;
+    if (loss_rate<=ge_loss_good) p = 0;
+    else if (loss_rate>=ge_loss_bad) p = 1;
+    else p = r*(loss_rate-ge_loss_good)/(ge_loss_bad-loss_rate);
+    return (p>1) ? 1 : p;
+}
+
+/* create the channel model of one direction of the link */
+static Channel *create_channel(TraceFile *trace, const char *trace_path,
+			       RdtRandom *rng, int node)
+{
+    DelayModel delay(delay_kind_from_name(delay_dist), pkt_latency,
+		     delay_jitter, outoforder_rate, rng);
+
+    if (strcmp(channel_model, "bernoulli")==0)
+	return new BernoulliChannel(loss_rate, corrupt_rate, delay, rng);
+
+    if (strcmp(channel_model, "ge")==0) {
+	double r = (ge_r<0) ? 1.0/ge_burst : ge_r;
+	double p = (ge_p<0) ? ge_derived_p(r) : ge_p;
+	return new GilbertElliottChannel(p, r, ge_loss_good, ge_loss_bad,
+					 corrupt_rate, delay, rng);
+    }
+
+    if (strcmp(channel_model, "trace")==0) {
+	/* receivers replay the trace from evenly spaced records */
+	if (trace->base==NULL && !trace->open(trace_path)) exit(-1);
+	return new TraceChannel(trace,
+				(uint32_t) ((uint64_t) trace->count*node/
+					    nb_receivers));
+    }
+
+    fprintf(stderr, "invalid channel model %s\n", channel_model);
+    exit(-1);
+}
+
+/* create the message source, drawing from "rng" */
+static Workload *create_workload(RdtRandom *rng)
+{
+    Workload *w = new Workload(arrival_kind_from_name(arrival_dist),
+			       size_kind_from_name(size_dist), msg_arrivalint,
+			       msg_size, rng);
+    w->on_time = onoff_on_time;
+    w->off_time = onoff_off_time;
+    w->pareto_shape = pareto_shape;
+    if (payload_path!=NULL) {
+	if (!w->payload.use_file(payload_path)) exit(-1);
+    }
+    else
+	w->payload.use_pattern();
+    return w;
+}
+
+/* read a branch "key=value,..." into "b", return false if it is invalid */
+static bool parse_branch(const char *spec, struct branch *b)
+{
+    b->spec = spec;
+    b->loss_rate = b->corrupt_rate = b->outoforder_rate = b->jitter = -1;
+    b->bottleneck_rate = -1;
+    b->bottleneck_queue = -1;
+    b->arrival_int = -1;
+    b->msg_size = -1;
+
+    char buf[256];
+    if (strlen(spec)>=sizeof(buf)) return false;
+    strcpy(buf, spec);
+    for (char *key=strtok(buf, ","); key!=NULL; key=strtok(NULL, ",")) {
+	char *v = strchr(key, '=');
+	if (v==NULL) return false;
+	*v++ = 0;
+	double x = atof(v);
+
+	if (strcmp(key, "loss")==0 && x>=0 && x<=1)
+	    b->loss_rate = x;
+	else if (strcmp(key, "corrupt")==0 && x>=0 && x<=1)
+	    b->corrupt_rate = x;
+	else if (strcmp(key, "outoforder")==0 && x>=0 && x<=1)
+	    b->outoforder_rate = x;
+	else if (strcmp(key, "jitter")==0 && x>=0)
+	    b->jitter = x;
+	else if (strcmp(key, "bottleneck")==0 && x>=0)
+	    b->bottleneck_rate = x;
+	else if (strcmp(key, "queue")==0 && x>=1)
+	    b->bottleneck_queue = (int) x;
+	else if (strcmp(key, "interval")==0 && x>0)
+	    b->arrival_int = x;
+	else if (strcmp(key, "size")==0 && x>=1)
+	    b->msg_size = (int) x;
+	else
+	    return false;
+    }
+    return true;
+}
+
+/* bring a channel in line with the channel parameters; a trace replays what
+   it recorded whatever they are */
+static void retune_channel(Channel *c)
+{
+    DelayModel *delay;
+
+    if (strcmp(channel_model, "bernoulli")==0) {
+	BernoulliChannel *bc = (BernoulliChannel *) c;
+	bc->loss_rate = loss_rate;
+	bc->corrupt_rate = corrupt_rate;
+	delay = &bc->delay;
+    }
+    else if (strcmp(channel_model, "ge")==0) {
+	GilbertElliottChannel *gc = (GilbertElliottChannel *) c;
+	if (ge_p<0) gc->p = ge_derived_p(gc->r);
+	gc->corrupt_rate = corrupt_rate;
+	delay = &gc->delay;
+    }
+    else
+	return;
+
+    delay->outoforder_rate = outoforder_rate;
+    delay->jitter = delay_jitter;
+}
+
+/* switch the simulation in progress over to the parameters of a branch */
+static void apply_branch(const struct branch *b)
+{
+    if (b->loss_rate>=0) {
+	/* the loss of the branch takes over from an explicit --ge-p */
+	loss_rate = b->loss_rate;
+	ge_p = -1;
+    }
+    if (b->corrupt_rate>=0) corrupt_rate = b->corrupt_rate;
+    if (b->outoforder_rate>=0) outoforder_rate = b->outoforder_rate;
+    if (b->jitter>=0) delay_jitter = b->jitter;
+    if (b->bottleneck_rate>=0) bottleneck_rate = b->bottleneck_rate;
+    if (b->bottleneck_queue>=0) bottleneck_queue = b->bottleneck_queue;
+
+    for (int i=0; i<nb_receivers; i++) {
+	struct peer &p = peers[i];
+	if (topology_path==NULL) {
+	    retune_channel(p.data_channel);
+	    retune_channel(p.ack_channel);
+	}
+	if (b->bottleneck_rate<0 && b->bottleneck_queue<0) continue;
+	if (p.bottleneck==NULL)
+	    p.bottleneck = new Bottleneck(bottleneck_rate, bottleneck_queue);
+	else {
+	    p.bottleneck->rate = bottleneck_rate;
+	    p.bottleneck->limit = bottleneck_queue;
+	}
+    }
+
+    if (b->arrival_int>0) workload->mean_interval = msg_arrivalint = b->arrival_int;
+    if (b->msg_size>0) workload->mean_size = msg_size = b->msg_size;
+}
+
+/* fork a child for every branch, which takes up the parameters of the branch
+   and runs on silently to report to the trunk in the end, see main() */
+static void fork_branches()
+{
+    branch_time = sim_core->time();
+    fflush(stdout);
+
+    for (int i=0; i<nb_branches; i++) {
+	int fds[2];
+	ASSERT(pipe(fds)==0);
+
+	pid_t pid = fork();
+	ASSERT(pid>=0);
+	if (pid==0) {
+	    close(fds[0]);
+	    for (int j=0; j<i; j++) close(branches[j].fd);
+	    ASSERT(freopen("/dev/null", "w", stdout)!=NULL);
+	    this_branch = &branches[i];
+	    this_branch->fd = fds[1];
+	    apply_branch(this_branch);
+	    return;
+	}
+	close(fds[1]);
+	branches[i].pid = pid;
+	branches[i].fd = fds[0];
+    }
+}
+
+/* note what has been delivered at the end of the warm-up (mark 0) or when
+   the source stops (mark 1) into "chars".  in a parallel run, the threads
+   leave "chars" alone: the receivers of the partition note what they have
+   delivered instead, and merge_mark() takes the least of these over the
+   receivers, which is what a run on one thread takes since what a receiver
+   delivered by then, it delivered before the mark. */
+static void mark_delivered(int mark, long long *chars)
+{
+    if (self==NULL) {
+	*chars = tot_chars_delivered;
+	return;
+    }
+    for (int i=0; i<nb_receivers; i++) {
+	if (peers[i].part==self->index)
+	    peers[i].marked_chars[mark] = peers[i].chars_delivered;
+    }
+}
+
+/* the events of the message source are the same in every partition, and
+   the next one ranks after whatever the sessions scheduled */
+#define SOURCE_UID (1ULL<<63)
+#define SOURCE_RANK (1ULL<<62)
+
+/* handle the events of the chain of the calling thread in order, until none
+   is left before "until"; the message source stops at "sim_end".  return the
+   number of events handled. */
+static long long run_events(sim_time_t until, sim_time_t sim_end)
+{
+    long long handled = 0;
+
+    while (sim_core->head!=NULL && sim_core->head->sched_time<until) {
+	Event *e = sim_core->next_event();
+	handled++;
+
+	/* take the steady-state baseline once the warm-up is over */
+	if (warmup_end_time<0 && sim_core->time()>=sec_to_nsec(warmup_time)) {
+	    warmup_end_time = sim_core->time();
+	    mark_delivered(0, &warmup_chars_delivered);
+	}
+	if (source_end_time<0 && sim_core->time()>=sim_end) {
+	    source_end_time = sim_core->time();
+	    mark_delivered(1, &source_end_chars_delivered);
+	}
+
+	/* the sweep branches off once the trunk gets there */
+	if (nb_branches>0 && branch_time<0 &&
+	    sim_core->time()>=sec_to_nsec(fork_time))
+	    fork_branches();
+
+	switch (e->event_type) {
+	case EVENT_SENDER_FROMUPPERLAYER:
 	    {
 		if (tracing_level>=1) {
-		    fprintf(stdout, "Time %.2fs (Sender): the lower layer informs the rdt layer that a packet is received from the link.\n", sim_core.time());
+		    fprintf(stdout, "Time %.2fs (Sender): the upper layer instructs rdt layer to send out a message.\n", GetSimulationTime());
+		}
+
+		EventSenderFromUpperLayer *real_e = (EventSenderFromUpperLayer*) e;
+		sim_core->uid = SOURCE_UID + real_e->count++;
+
+		int size = workload->next_size();
+		if (max_backlog>0 &&
+		    tot_chars_sent-tot_chars_delivered >= max_backlog) {
+		    /* the rdt layer is too far behind, refuse the message */
+		    tot_msgs_blocked ++;
+		    tot_chars_blocked += size;
+		}
+		else {
+		    int first = (self!=NULL) ? self->first_peer : 0;
+		    int stream = peers[first].streams->pick();
+		    struct message *msg = generate_msg(stream, size);
+		    for (int i=0; i<nb_sessions; i++) {
+			if (!is_local(sessions[i].part)) continue;
+			if (protocol->multistream)
+			    sessions[i].sender->from_upper_layer_stream(stream,
+									msg);
+			else
+			    sessions[i].sender->from_upper_layer(msg);
+		    }
+		    free_msg(msg);
+		}
+
+		/* schedule the recurring event */
+		if (sim_core->time() < sim_end) {
+		    real_e->sched_time = 
+			sim_core->time() + sec_to_nsec(workload->next_interval());
+		    sim_core->next_rank = SOURCE_RANK;
+		    sim_core->schedule(real_e);
+		}
+		else
+		    delete real_e;
+	    }
+	    break;
+
+	case EVENT_SENDER_FROMLOWERLAYER:
+	    {
+		/* still on its way through the topology */
+		if (forward_packet((PacketEvent *) e)) break;
+
+		if (tracing_level>=1) {
+		    fprintf(stdout, "Time %.2fs (Sender): the lower layer informs the rdt layer that a packet is received from the link.\n", GetSimulationTime());
 		}
 
 		EventSenderFromLowerLayer *real_e = (EventSenderFromLowerLayer*) e;
 
-		Sender_FromLowerLayer(&real_e->pkt);
+		int node = protocol->multicast ? 0 : real_e->node;
+		sessions[node].sender->from_lower_layer(&real_e->pkt);
 
 		delete real_e;
 	    }
@@ -481,49 +1365,998 @@ int main(int argc, char *argv[])
 	case EVENT_SENDER_TIMEOUT:
 	    {
 		if (tracing_level>=1) {
-		    fprintf(stdout, "Time %.2fs (Sender): the timer expires.\n", sim_core.time());
+		    fprintf(stdout, "Time %.2fs (Sender): the timer expires.\n", GetSimulationTime());
 		}
 
 		EventSenderTimeout *real_e = (EventSenderTimeout*) e;
+		struct session &se = sessions[real_e->node];
 		delete real_e;
-		sender_timer = NULL;
+		se.host.timer = NULL;
 
-		Sender_Timeout();
+		se.sender->timeout();
 	    }
 	    break;
 
 	case EVENT_RECEIVER_FROMLOWERLAYER:
 	    {
+		if (forward_packet((PacketEvent *) e)) break;
+
 		if (tracing_level>=1) {
-		    fprintf(stdout, "Time %.2fs (Receiver): the lower layer informs the rdt layer that a packet is received from the link.\n", sim_core.time());
+		    fprintf(stdout, "Time %.2fs (Receiver): the lower layer informs the rdt layer that a packet is received from the link.\n", GetSimulationTime());
 		}
 
 		EventReceiverFromLowerLayer *real_e = (EventReceiverFromLowerLayer*) e;
 		
-		Receiver_FromLowerLayer(&real_e->pkt);
+		struct peer &p = peers[real_e->node];
+		p.pkts_received ++;
+		p.receiver->from_lower_layer(&real_e->pkt);
 
 		delete real_e;
 	    }
 	    break;
 
+	case EVENT_REPORT:
+	    {
+		report_interval_stats();
+
+		/* keep reporting as long as the simulation goes on */
+		if (sim_core->head!=NULL) {
+		    e->sched_time = sim_core->time() + sec_to_nsec(report_interval);
+		    sim_core->schedule(e);
+		}
+		else
+		    delete e;
+	    }
+	    break;
+
 	default:
 	    fprintf(stderr, "undefined event %d\n", e->event_type);
 	    break;
 	}
     }
 
-    /* finalize the sender and the receiver */
-    Sender_Final();
-    Receiver_Final();
+    return handled;
+}
+
+/*[]------------------------------------------------------------------------[]
+  |  parallel simulation
+  []------------------------------------------------------------------------[]*/
+
+/* with --threads, the receivers are split into partitions of consecutive
+   receivers, one per thread, and a unicast session goes along with its
+   receiver.  the threads run in windows: a window starts at the earliest
+   event of all partitions and spans the lookahead, the least delay of the
+   channels, so that nothing sent during a window can arrive in another
+   partition before it is over.  the packets for other partitions wait in
+   the mailboxes until then; the threads meet at a barrier, take in their
+   packets and agree on the next window.  unicast partitions never send each
+   other anything and run to the end in a single window.
+
+   every thread draws the same messages from its own copy of the source, and
+   the chains of a multicast run are stamped, see LINEAGE_DEPTH.  events are
+   thus handled at the same times and in the same order as on one thread,
+   and the results are the same to the bit. */
+
+static double clock_seconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* spread the receivers and the sessions over the partitions and, if there
+   are several, set them up; the message source stops at "sim_end" */
+static void split_partitions(sim_time_t sim_end)
+{
+    nb_partitions = (nb_threads<nb_receivers) ? nb_threads : nb_receivers;
+    if (nb_partitions<1) nb_partitions = 1;
+
+    /* the packets of a multicast session go to every partition */
+    lookahead = SIM_TIME_NEVER;
+    if (protocol->multicast && nb_partitions>1) {
+	for (int i=0; i<nb_receivers; i++) {
+	    sim_time_t d = sec_to_nsec(peers[i].data_channel->min_delay());
+	    if (d<lookahead) lookahead = d;
+	    d = sec_to_nsec(peers[i].ack_channel->min_delay());
+	    if (d<lookahead) lookahead = d;
+	}
+	if (lookahead==0) {
+	    fprintf(stderr, "## Parallel: packets may take no time at all, "
+		    "running on one thread\n");
+	    nb_partitions = 1;
+	}
+    }
+
+    for (int i=0; i<nb_receivers; i++) {
+	peers[i].part = (int) ((long long) i*nb_partitions/nb_receivers);
+	peers[i].marked_chars[0] = peers[i].marked_chars[1] = -1;
+    }
+    for (int i=0; i<nb_sessions; i++)
+	sessions[i].part = protocol->multicast ? 0 : peers[i].part;
+    if (nb_partitions==1) return;
+
+    partitions = new struct partition[nb_partitions];
+    for (int i=0; i<nb_partitions; i++) {
+	struct partition &pt = partitions[i];
+	pt.index = i;
+	pt.first_peer = nb_receivers;
+	for (int j=nb_receivers-1; j>=0; j--) {
+	    if (peers[j].part==i) pt.first_peer = j;
+	}
+	pt.core = (i==0) ? &main_core : new EventChain;
+	pt.core->stamped = protocol->multicast;
+	pt.core->next_uid = ((uint64_t) i+1) << 40;
+	if (i==0)
+	    pt.workload = workload;
+	else {
+	    pt.workload_rng.seed(sim_seed);
+	    pt.workload = create_workload(&pt.workload_rng);
+	}
+	pt.outbox = new std::vector<PacketEvent *>[nb_partitions];
+	pt.sim_end = sim_end;
+	pt.pkts_passed = 0;
+	pt.data_pkts_sent = 0;
+	pt.ack_pkts_sent = 0;
+	pt.queue_drops = 0;
+	pt.mark_time[0] = pt.mark_time[1] = -1;
+	pt.events = 0;
+	pt.windows = 0;
+	pt.busy = 0;
+    }
+}
+
+/* the thread of a partition */
+static void *run_partition(void *arg)
+{
+    struct partition *pt = (struct partition *) arg;
+    self = pt;
+    sim_core = pt->core;
+    workload = pt->workload;
+    if (warmup_time==0) warmup_end_time = 0;
+
+    for (;;) {
+	/* take in the packets sent to the partition during the last window */
+	pthread_barrier_wait(&window_barrier);
+	for (int i=0; i<nb_partitions; i++) {
+	    std::vector<PacketEvent *> &box = partitions[i].outbox[pt->index];
+	    for (size_t j=0; j<box.size(); j++) sim_core->insert(box[j]);
+	    box.clear();
+	}
+	pt->next_time = (sim_core->head!=NULL)
+	    ? sim_core->head->sched_time : SIM_TIME_NEVER;
+	pthread_barrier_wait(&window_barrier);
+
+	/* every thread works out the same window */
+	sim_time_t start = SIM_TIME_NEVER;
+	for (int i=0; i<nb_partitions; i++) {
+	    if (partitions[i].next_time<start) start = partitions[i].next_time;
+	}
+	if (start==SIM_TIME_NEVER) break;
+	sim_time_t end = (lookahead<SIM_TIME_NEVER-start)
+	    ? start + lookahead : SIM_TIME_NEVER;
+
+	double t = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+	pt->events += run_events(end, pt->sim_end);
+	pt->busy += clock_seconds(CLOCK_THREAD_CPUTIME_ID) - t;
+	pt->windows++;
+    }
+
+    pt->pkts_passed = tot_pkts_passed;
+    pt->data_pkts_sent = tot_data_pkts_sent;
+    pt->ack_pkts_sent = tot_ack_pkts_sent;
+    pt->queue_drops = tot_queue_drops;
+    pt->mark_time[0] = warmup_end_time;
+    pt->mark_time[1] = source_end_time;
+    return NULL;
+}
+
+/* the time and the characters delivered at a mark, see mark_delivered() */
+static void merge_mark(int mark, sim_time_t *time, long long *chars)
+{
+    *time = -1;
+    for (int i=0; i<nb_partitions; i++) {
+	sim_time_t t = partitions[i].mark_time[mark];
+	if (t>=0 && (*time<0 || t<*time)) *time = t;
+    }
+
+    *chars = 0;
+    if (*time<0) return;
+    for (int i=0; i<nb_receivers; i++) {
+	const struct peer &p = peers[i];
+	long long c = (p.marked_chars[mark]>=0)
+	    ? p.marked_chars[mark] : p.chars_delivered;
+	if (i==0 || c<*chars) *chars = c;
+    }
+}
+
+/* run every partition on a thread of its own, the first on the calling
+   one, and put the statistics of the threads together */
+static void run_parallel()
+{
+    ASSERT(pthread_barrier_init(&window_barrier, NULL, nb_partitions)==0);
+    for (int i=1; i<nb_partitions; i++) {
+	ASSERT(pthread_create(&partitions[i].thread, NULL, run_partition,
+			      &partitions[i])==0);
+    }
+    run_partition(&partitions[0]);
+    for (int i=1; i<nb_partitions; i++)
+	pthread_join(partitions[i].thread, NULL);
+    pthread_barrier_destroy(&window_barrier);
+    self = NULL;
+
+    /* the calling thread kept the counters of the first partition, and the
+       copy of its source counted the characters sent */
+    for (int i=1; i<nb_partitions; i++) {
+	const struct partition &pt = partitions[i];
+	tot_pkts_passed += pt.pkts_passed;
+	tot_data_pkts_sent += pt.data_pkts_sent;
+	tot_ack_pkts_sent += pt.ack_pkts_sent;
+	tot_queue_drops += pt.queue_drops;
+	if (pt.core->sim_time>main_core.sim_time)
+	    main_core.sim_time = pt.core->sim_time;
+    }
+    if (warmup_time>0)
+	merge_mark(0, &warmup_end_time, &warmup_chars_delivered);
+    merge_mark(1, &source_end_time, &source_end_chars_delivered);
+
+    tot_chars_delivered = peers[0].chars_delivered;
+    for (int i=0; i<nb_receivers; i++) {
+	if (peers[i].chars_delivered<tot_chars_delivered)
+	    tot_chars_delivered = peers[i].chars_delivered;
+	if (!peers[i].verification_passed) message_verfication_passed = false;
+    }
+}
+
+/* print how a run with --threads went, on stderr so that the output stays
+   that of a run on one thread.  the wall clock time against that of the same
+   run with --threads=1 is the speedup. */
+static void report_parallel(long long events, double wall)
+{
+    if (nb_partitions==1) {
+	fprintf(stderr, "## Parallel: 1 thread, %lld events, %.3fs wall "
+		"clock\n", events, wall);
+	return;
+    }
+
+    long long least = partitions[0].events, most = partitions[0].events;
+    double busy = 0;
+    for (int i=0; i<nb_partitions; i++) {
+	const struct partition &pt = partitions[i];
+	events += pt.events;
+	if (pt.events<least) least = pt.events;
+	if (pt.events>most) most = pt.events;
+	busy += pt.busy;
+    }
+    fprintf(stderr, "## Parallel: %d threads, ", nb_partitions);
+    if (lookahead==SIM_TIME_NEVER)
+	fprintf(stderr, "independent partitions, ");
+    else
+	fprintf(stderr, "lookahead %.3fs over %lld windows, ",
+		nsec_to_sec(lookahead), partitions[0].windows);
+    fprintf(stderr, "%lld events (%lld to %lld per thread), %.3fs wall "
+	    "clock, %.2fx parallelism\n", events, least, most, wall,
+	    (wall>0) ? busy/wall : 0.0);
+}
+
+/* run one simulation from time 0 until no event is left */
+static void simulate()
+{
+    /* set up the receivers and the channel models of both directions, or
+       their routes through the topology */
+    workload_rng.seed(sim_seed);
+    if (topology_path!=NULL)
+	topology.start((sim_seed + MAX_RECEIVERS*PEER_SEED_STRIDE)*3);
+    peers = new struct peer[nb_receivers];
+    for (int i=0; i<nb_receivers; i++) {
+	struct peer &p = peers[i];
+	p.host.index = i;
+	p.data_rng.seed((sim_seed + i*PEER_SEED_STRIDE)*3+1);
+	p.ack_rng.seed((sim_seed + i*PEER_SEED_STRIDE)*3+2);
+	if (topology_path!=NULL) {
+	    char name[32];
+	    snprintf(name, sizeof(name), "receiver%d", i);
+	    int sender = topology.find_node("sender");
+	    int receiver = topology.find_node(name);
+	    if (receiver<0 || !topology.route(sender, receiver, &p.data_route) ||
+		!topology.route(receiver, sender, &p.ack_route)) {
+		fprintf(stderr, "%s: no route from sender to %s\n",
+			topology_path, name);
+		exit(-1);
+	    }
+	    p.data_channel = p.ack_channel = NULL;
+	}
+	else {
+	    p.data_channel = create_channel(&data_trace, data_trace_path,
+					    &p.data_rng, i);
+	    p.ack_channel = create_channel(&ack_trace, ack_trace_path,
+					   &p.ack_rng, i);
+	}
+	p.bottleneck = (bottleneck_rate>0)
+	    ? new Bottleneck(bottleneck_rate, bottleneck_queue) : NULL;
+	p.streams = new StreamTable(nb_streams, !protocol->multistream);
+	p.chars_delivered = 0;
+	p.pkts_received = 0;
+	p.pkts_sent = 0;
+	p.verification_passed = true;
+    }
+    if (topology_path!=NULL) {
+	fprintf(stdout, "## Topology: %s (%d nodes, %d links)\n", topology_path,
+		(int) topology.nodes.size(), (int) topology.links.size());
+	for (int i=0; i<nb_receivers; i++) {
+	    fprintf(stdout, "## Route to receiver%d: ", i);
+	    topology.describe_route(stdout, peers[i].data_route);
+	}
+    }
+    else {
+	fprintf(stdout, "## Data channel: ");
+	peers[0].data_channel->describe(stdout);
+	fprintf(stdout, "## Ack channel: ");
+	peers[0].ack_channel->describe(stdout);
+    }
+    if (peers[0].bottleneck!=NULL) {
+	fprintf(stdout, "## Bottleneck: ");
+	peers[0].bottleneck->describe(stdout);
+    }
+    if (nb_receivers>1 && topology_path==NULL)
+	fprintf(stdout, "## Receivers: %d, each over channels of its own\n",
+		nb_receivers);
+
+    /* set up the workload */
+    workload = create_workload(&workload_rng);
+    fprintf(stdout, "## Workload: ");
+    workload->describe(stdout);
+
+    /* intialize the senders and the receivers */
+    fprintf(stdout, "## Protocol: %s (%s)\n", protocol->name,
+	    protocol->description);
+    nb_sessions = protocol->multicast ? 1 : nb_receivers;
+    sessions = new struct session[nb_sessions];
+    for (int i=0; i<nb_sessions; i++) {
+	sessions[i].host.index = i;
+	sessions[i].sender = protocol->create_sender(&sessions[i].host);
+	if (compress_mode)
+	    sessions[i].sender = new CompressSender(&sessions[i].host,
+						    sessions[i].sender);
+	sessions[i].sender->init();
+    }
+    for (int i=0; i<nb_receivers; i++) {
+	if (compress_mode)
+	    peers[i].receiver = new CompressReceiver(&peers[i].host, protocol);
+	else
+	    peers[i].receiver = protocol->create_receiver(&peers[i].host);
+	peers[i].receiver->init();
+    }
+
+    /* the message source stops at the end of the simulation time */
+    sim_time_t sim_end = sec_to_nsec(sim_time);
+    split_partitions(sim_end);
+
+    /* scheduling a recurring message arrival event, in every partition */
+    for (int i=0; i<nb_partitions; i++) {
+	EventChain *core = (partitions!=NULL) ? partitions[i].core : sim_core;
+	EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
+	e->sched_time = 0;
+	core->schedule(e);
+    }
+
+    /* scheduling the recurring interval report and the end of the warm-up */
+    if (report_interval>0) {
+	EventReport *r = new EventReport;
+	r->sched_time = sec_to_nsec(report_interval);
+	sim_core->schedule(r);
+    }
+    if (warmup_time==0) warmup_end_time = 0;
+
+    /* main simulation cycle */
+    long long events = 0;
+    double wall = clock_seconds(CLOCK_MONOTONIC);
+    if (partitions!=NULL)
+	run_parallel();
+    else
+	events = run_events(SIM_TIME_NEVER, sim_end);
+    wall = clock_seconds(CLOCK_MONOTONIC) - wall;
+    if (nb_threads>0) report_parallel(events, wall);
+
+    /* finalize the senders and the receivers */
+    if (compress_mode)
+	tot_compress = ((CompressSender *) sessions[0].sender)->stats;
+    for (int i=0; i<nb_sessions; i++) {
+	sessions[i].sender->final();
+	delete sessions[i].sender;
+    }
+    for (int i=0; i<nb_receivers; i++) {
+	peers[i].receiver->final();
+	delete peers[i].receiver;
+	delete peers[i].data_channel;
+	delete peers[i].ack_channel;
+	delete peers[i].bottleneck;
+    }
+    for (size_t i=0; i<topology.hops.size(); i++)
+	tot_queue_drops += topology.hops[i]->queue.drops;
+    delete[] sessions;
+    delete workload;
+    if (partitions!=NULL) {
+	for (int i=0; i<nb_partitions; i++) {
+	    if (i>0) {
+		delete partitions[i].core;
+		delete partitions[i].workload;
+	    }
+	    delete[] partitions[i].outbox;
+	}
+	delete[] partitions;
+	partitions = NULL;
+    }
+}
+
+/* whether every receiver got all data intact */
+static bool session_passed()
+{
+    for (int i=0; i<nb_receivers; i++) {
+	if (peers[i].chars_delivered!=tot_chars_sent) return false;
+    }
+    return message_verfication_passed;
+}
+
+/* the latency of the messages at all receivers: the overall mean and the
+   worst p99 */
+static void latency_summary(double *mean, double *p99)
+{
+    long long count = 0;
+    double sum = 0;
+    *p99 = 0;
+    for (int i=0; i<nb_receivers; i++) {
+	const LatencyHistogram &h = peers[i].streams->latency;
+	count += h.count;
+	sum += h.sum;
+	double q = (double) h.quantile(0.99)/NSEC_PER_SEC;
+	if (q>*p99) *p99 = q;
+    }
+    *mean = (count>0) ? sum/count/NSEC_PER_SEC : 0.0;
+}
+
+/* the outcome of one simulation in comparison mode */
+struct compare_result {
+    double completion_time;
+    long long chars_sent;
+    long long chars_delivered;
+    long long data_pkts;
+    long long ack_pkts;
+    long long queue_drops;
+    double latency_mean;
+    double latency_p99;
+    bool passed;
+};
+
+/* the outcome of the simulation just run */
+static void collect_result(struct compare_result *r)
+{
+    r->completion_time = GetSimulationTime();
+    r->chars_sent = tot_chars_sent;
+    r->chars_delivered = tot_chars_delivered;
+    r->data_pkts = tot_data_pkts_sent;
+    r->ack_pkts = tot_ack_pkts_sent;
+    r->queue_drops = tot_queue_drops;
+    latency_summary(&r->latency_mean, &r->latency_p99);
+    r->passed = session_passed();
+}
+
+/* the header of the comparison table, the first column being "what" */
+static void print_result_header(const char *what)
+{
+    fprintf(stdout, "%-10s %12s %14s %14s %12s %12s %10s %10s %10s %10s  %s\n",
+	    what, "completed", "delivered", "goodput(B/s)", "data pkts",
+	    "ack pkts", "q drops", "pkts/KB", "mean lat", "p99 lat", "verdict");
+}
+
+/* one row of the comparison table */
+static void print_result(const char *name, const struct compare_result &r)
+{
+    fprintf(stdout, "%-10s %11.2fs %14lld %14.1f %12lld %12lld %10lld "
+	    "%10.2f %9.3fs %9.3fs  %s\n",
+	    name, r.completion_time, r.chars_delivered,
+	    (r.completion_time>0) ? r.chars_delivered/r.completion_time : 0.0,
+	    r.data_pkts, r.ack_pkts, r.queue_drops,
+	    (r.chars_delivered>0)
+	    ? (r.data_pkts+r.ack_pkts)*1024.0/r.chars_delivered : 0.0,
+	    r.latency_mean, r.latency_p99, r.passed ? "ok" : "FAILED");
+}
+
+/* run every protocol on the same seed, each in a child process so that it
+   starts from a clean simulator, and print one line per protocol */
+static void compare_protocols()
+{
+    fprintf(stdout, "## Comparing protocols with seed %llu\n", sim_seed);
+    print_result_header("protocol");
+
+    for (const struct rdt_protocol *p = rdt_protocols; p->name!=NULL; p++) {
+	if (compare_list!=NULL) {
+	    /* only the listed protocols */
+	    size_t len = strlen(p->name);
+	    const char *c = compare_list;
+	    bool listed = false;
+	    while (c!=NULL && *c) {
+		if (strncmp(c, p->name, len)==0 && (c[len]==',' || c[len]==0))
+		    listed = true;
+		c = strchr(c, ',');
+		if (c!=NULL) c++;
+	    }
+	    if (!listed) continue;
+	}
+	if (nb_receivers>1 && p->single_instance) {
+	    fprintf(stdout, "%-10s (single receiver only)\n", p->name);
+	    continue;
+	}
+
+	int fds[2];
+	ASSERT(pipe(fds)==0);
+	fflush(stdout);
+
+	pid_t pid = fork();
+	ASSERT(pid>=0);
+	if (pid==0) {
+	    /* child: run silently and send the statistics back */
+	    close(fds[0]);
+	    ASSERT(freopen("/dev/null", "w", stdout)!=NULL);
+	    protocol = p;
+	    simulate();
+
+	    struct compare_result r;
+	    collect_result(&r);
+	    ASSERT(write(fds[1], &r, sizeof(r))==(ssize_t)sizeof(r));
+	    _exit(0);
+	}
+
+	close(fds[1]);
+	struct compare_result r;
+	bool ok = (read(fds[0], &r, sizeof(r))==(ssize_t)sizeof(r));
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+
+	if (!ok) {
+	    fprintf(stdout, "%-10s (simulation failed)\n", p->name);
+	    continue;
+	}
+	print_result(p->name, r);
+    }
+}
+
+/* print the outcome of the trunk and of every branch side by side */
+static void report_branches()
+{
+    if (branch_time<0) {
+	fprintf(stdout, "## Branches: the simulation ended before %.2fs\n",
+		fork_time);
+	return;
+    }
+
+    fprintf(stdout, "## Branches from %.2fs:\n",
+	    (double) branch_time/NSEC_PER_SEC);
+    for (int i=0; i<nb_branches; i++)
+	fprintf(stdout, "\tbranch%d: %s\n", i+1, branches[i].spec);
+    print_result_header("run");
+
+    struct compare_result r;
+    collect_result(&r);
+    print_result("trunk", r);
+
+    for (int i=0; i<nb_branches; i++) {
+	char name[24];
+	snprintf(name, sizeof(name), "branch%d", i+1);
+	bool ok = (read(branches[i].fd, &r, sizeof(r))==(ssize_t)sizeof(r));
+	close(branches[i].fd);
+	waitpid(branches[i].pid, NULL, 0);
+	if (ok)
+	    print_result(name, r);
+	else
+	    fprintf(stdout, "%-10s (simulation failed)\n", name);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc<8) {
+	fprintf(stderr, "usage: %s <sim_time> <mean_msg_arrivalint> <mean_msg_size> "
+		"<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level> "
+		"[options]\n"
+		"options:\n"
+		"\t--channel=bernoulli|ge|trace\n"
+		"\t--delay=fixed|uniform|normal|pareto  --jitter=<seconds>\n"
+		"\t--ge-burst=<mean burst length in packets>\n"
+		"\t--ge-p=<P(good->bad)>  --ge-r=<P(bad->good)>\n"
+		"\t--ge-loss-good=<rate>  --ge-loss-bad=<rate>\n"
+		"\t--trace=<file>  --ack-trace=<file>\n"
+		"\t--arrival=uniform|poisson|onoff|pareto\n"
+		"\t--size=uniform|fixed|poisson|pareto\n"
+		"\t--on-time=<seconds>  --off-time=<seconds>\n"
+		"\t--pareto-shape=<shape>  --payload=<file>\n"
+		"\t--report-interval=<seconds>  --warmup=<seconds>\n"
+		"\t--max-backlog=<bytes>\n"
+		"\t--protocol=rdt|gbn|sr|tcp-lite|tcp-pace|mux|nak  --seed=<n>\n"
+		"\t--streams=<n>  --receivers=<n>  --compress\n"
+		"\t--bottleneck=<bytes/s>  --queue=<packets>  --topology=<file>\n"
+		"\t--compare[=<protocol>,...]  --threads=<n>\n"
+		"\t--fork-at=<seconds>  --branch=<key>=<value>,...\n",
+		argv[0]);
+	exit(-1);
+    }
+
+    sim_time = atof(argv[1]);
+    if (sim_time<=0) {
+	fprintf(stderr, "invalid <sim_time>\n");
+	exit(-1);
+    }
+    msg_arrivalint = atof(argv[2]);
+    if (msg_arrivalint<=0) {
+	fprintf(stderr, "invalid <msg_arrivalint>\n");
+	exit(-1);
+    }
+    msg_size = atoi(argv[3]);
+    if (msg_size<=0) {
+	fprintf(stderr, "invalid <msg_size>\n");
+	exit(-1);
+    }
+    outoforder_rate = atof(argv[4]);
+    if (outoforder_rate<0 || outoforder_rate>1) {
+	fprintf(stderr, "invalid <outoforder_rate>\n");
+	exit(-1);
+    }
+    loss_rate = atof(argv[5]);
+    if (loss_rate<0 || loss_rate>1) {
+	fprintf(stderr, "invalid <loss_rate>\n");
+	exit(-1);
+    }
+    corrupt_rate = atof(argv[6]);
+    if (corrupt_rate<0 || corrupt_rate>1) {
+	fprintf(stderr, "invalid <corrupt_rate>\n");
+	exit(-1);
+    }
+    tracing_level = atoi(argv[7]);
+    if (tracing_level<0 || tracing_level>2) {
+	fprintf(stderr, "invalid <tracing_level>\n");
+	exit(-1);
+    }
+
+    for (int i=8; i<argc; i++) {
+	const char *v;
+	if ((v=option_value(argv[i], "--channel"))!=NULL)
+	    channel_model = v;
+	else if ((v=option_value(argv[i], "--delay"))!=NULL)
+	    delay_dist = v;
+	else if ((v=option_value(argv[i], "--jitter"))!=NULL)
+	    delay_jitter = atof(v);
+	else if ((v=option_value(argv[i], "--ge-burst"))!=NULL)
+	    ge_burst = atof(v);
+	else if ((v=option_value(argv[i], "--ge-p"))!=NULL)
+	    ge_p = atof(v);
+	else if ((v=option_value(argv[i], "--ge-r"))!=NULL)
+	    ge_r = atof(v);
+	else if ((v=option_value(argv[i], "--ge-loss-good"))!=NULL)
+	    ge_loss_good = atof(v);
+	else if ((v=option_value(argv[i], "--ge-loss-bad"))!=NULL)
+	    ge_loss_bad = atof(v);
+	else if ((v=option_value(argv[i], "--trace"))!=NULL)
+	    data_trace_path = v;
+	else if ((v=option_value(argv[i], "--ack-trace"))!=NULL)
+	    ack_trace_path = v;
+	else if ((v=option_value(argv[i], "--arrival"))!=NULL)
+	    arrival_dist = v;
+	else if ((v=option_value(argv[i], "--size"))!=NULL)
+	    size_dist = v;
+	else if ((v=option_value(argv[i], "--on-time"))!=NULL)
+	    onoff_on_time = atof(v);
+	else if ((v=option_value(argv[i], "--off-time"))!=NULL)
+	    onoff_off_time = atof(v);
+	else if ((v=option_value(argv[i], "--pareto-shape"))!=NULL)
+	    pareto_shape = atof(v);
+	else if ((v=option_value(argv[i], "--payload"))!=NULL)
+	    payload_path = v;
+	else if ((v=option_value(argv[i], "--report-interval"))!=NULL)
+	    report_interval = atof(v);
+	else if ((v=option_value(argv[i], "--warmup"))!=NULL)
+	    warmup_time = atof(v);
+	else if ((v=option_value(argv[i], "--max-backlog"))!=NULL)
+	    max_backlog = atoll(v);
+	else if ((v=option_value(argv[i], "--protocol"))!=NULL)
+	    protocol_name = v;
+	else if ((v=option_value(argv[i], "--streams"))!=NULL)
+	    nb_streams = atoi(v);
+	else if (strcmp(argv[i], "--compress")==0)
+	    compress_mode = true;
+	else if ((v=option_value(argv[i], "--receivers"))!=NULL)
+	    nb_receivers = atoi(v);
+	else if ((v=option_value(argv[i], "--bottleneck"))!=NULL)
+	    bottleneck_rate = atof(v);
+	else if ((v=option_value(argv[i], "--queue"))!=NULL)
+	    bottleneck_queue = atoi(v);
+	else if ((v=option_value(argv[i], "--topology"))!=NULL)
+	    topology_path = v;
+	else if ((v=option_value(argv[i], "--seed"))!=NULL)
+	    sim_seed = strtoull(v, NULL, 10);
+	else if ((v=option_value(argv[i], "--threads"))!=NULL)
+	    nb_threads = atoi(v);
+	else if (strcmp(argv[i], "--compare")==0)
+	    compare_mode = true;
+	else if ((v=option_value(argv[i], "--compare"))!=NULL) {
+	    compare_mode = true;
+	    compare_list = v;
+	}
+	else if ((v=option_value(argv[i], "--fork-at"))!=NULL)
+	    fork_time = atof(v);
+	else if ((v=option_value(argv[i], "--branch"))!=NULL) {
+	    if (nb_branches==MAX_BRANCHES) {
+		fprintf(stderr, "too many --branch (at most %d)\n", MAX_BRANCHES);
+		exit(-1);
+	    }
+	    if (!parse_branch(v, &branches[nb_branches])) {
+		fprintf(stderr, "invalid --branch %s\n", v);
+		exit(-1);
+	    }
+	    nb_branches++;
+	}
+	else {
+	    fprintf(stderr, "unknown option %s\n", argv[i]);
+	    exit(-1);
+	}
+    }
+    if (delay_kind_from_name(delay_dist)<0) {
+	fprintf(stderr, "invalid --delay %s\n", delay_dist);
+	exit(-1);
+    }
+    if (delay_jitter<0) {
+	fprintf(stderr, "invalid --jitter\n");
+	exit(-1);
+    }
+    if (ge_burst<1 || ge_p>1 || ge_r>1 || ge_r==0 ||
+	ge_loss_good<0 || ge_loss_good>1 || ge_loss_bad<ge_loss_good ||
+	ge_loss_bad>1) {
+	fprintf(stderr, "invalid Gilbert-Elliott parameters\n");
+	exit(-1);
+    }
+    if (strcmp(channel_model, "trace")==0 && data_trace_path==NULL) {
+	fprintf(stderr, "--channel=trace requires --trace=<file>\n");
+	exit(-1);
+    }
+    if (ack_trace_path==NULL) ack_trace_path = data_trace_path;
+    if (arrival_kind_from_name(arrival_dist)<0) {
+	fprintf(stderr, "invalid --arrival %s\n", arrival_dist);
+	exit(-1);
+    }
+    if (size_kind_from_name(size_dist)<0) {
+	fprintf(stderr, "invalid --size %s\n", size_dist);
+	exit(-1);
+    }
+    if (onoff_on_time<=0 || onoff_off_time<0) {
+	fprintf(stderr, "invalid --on-time/--off-time\n");
+	exit(-1);
+    }
+    if (report_interval<0 || warmup_time<0 || warmup_time>=sim_time ||
+	max_backlog<0) {
+	fprintf(stderr, "invalid long-run parameters\n");
+	exit(-1);
+    }
+    if (nb_streams<1 || nb_streams>1024) {
+	fprintf(stderr, "invalid --streams (must be in [1, 1024])\n");
+	exit(-1);
+    }
+    if (nb_receivers<1 || nb_receivers>MAX_RECEIVERS) {
+	fprintf(stderr, "invalid --receivers (must be in [1, %d])\n",
+		MAX_RECEIVERS);
+	exit(-1);
+    }
+    if (bottleneck_rate<0 || bottleneck_queue<1) {
+	fprintf(stderr, "invalid --bottleneck/--queue\n");
+	exit(-1);
+    }
+    if (topology_path!=NULL) {
+	if (bottleneck_rate>0) {
+	    fprintf(stderr, "--bottleneck does not apply to a topology, give "
+		    "the links their own rates\n");
+	    exit(-1);
+	}
+	if (!topology.load(topology_path)) exit(-1);
+    }
+    protocol = rdt_find_protocol(protocol_name);
+    if (protocol==NULL) {
+	fprintf(stderr, "unknown protocol %s\n", protocol_name);
+	exit(-1);
+    }
+    if (nb_receivers>1 && protocol->single_instance && !compare_mode) {
+	fprintf(stderr, "protocol %s supports a single receiver\n",
+		protocol_name);
+	exit(-1);
+    }
+    if (pareto_shape<=1) {
+	fprintf(stderr, "invalid --pareto-shape (must be larger than 1)\n");
+	exit(-1);
+    }
+    if (nb_threads<0 || nb_threads>MAX_RECEIVERS) {
+	fprintf(stderr, "invalid --threads (must be in [0, %d], 0 being "
+		"sequential)\n",
+		MAX_RECEIVERS);
+	exit(-1);
+    }
+    if (nb_threads>1 && (topology_path!=NULL || report_interval>0 ||
+			 max_backlog>0 || tracing_level>0)) {
+	/* shared hops, reports and the backlog need every receiver at once,
+	   traces would interleave */
+	fprintf(stderr, "--threads does not go with --topology, "
+		"--report-interval, --max-backlog or tracing\n");
+	exit(-1);
+    }
+    if ((fork_time>=0) != (nb_branches>0)) {
+	fprintf(stderr, "--fork-at and --branch go together\n");
+	exit(-1);
+    }
+    if (nb_branches>0 && (compare_mode || nb_threads>1)) {
+	fprintf(stderr, "--branch does not go with --compare or --threads\n");
+	exit(-1);
+    }
+    for (int i=0; i<nb_branches; i++) {
+	const struct branch &b = branches[i];
+	bool channel = (b.loss_rate>=0 || b.corrupt_rate>=0 ||
+			b.outoforder_rate>=0 || b.jitter>=0);
+	if (channel && (topology_path!=NULL ||
+			strcmp(channel_model, "trace")==0)) {
+	    /* the hops and the traces have impairments of their own */
+	    fprintf(stderr, "--branch cannot change the channels of a "
+		    "--topology or a trace\n");
+	    exit(-1);
+	}
+	if ((b.bottleneck_rate>=0 || b.bottleneck_queue>=0) &&
+	    topology_path!=NULL) {
+	    fprintf(stderr, "--branch cannot change the bottleneck of a "
+		    "--topology\n");
+	    exit(-1);
+	}
+    }
+    
+    fprintf(stdout, "## Reliable data transfer simulation with:\n"
+	    "\tsimulation time is %.3f seconds\n"
+	    "\taverage message arrival interval is %.3f seconds\n"
+	    "\taverage message size is %d bytes\n"
+	    "\taverage out-of-order delivery rate is %.2f%%\n"
+	    "\taverage loss rate is %.2f%%\n"
+	    "\taverage corrupt rate is %.2f%%\n"
+	    "\ttracing level is %d\n"
+	    "Please review these inputs and press <enter> to proceed.\n",
+	    sim_time, msg_arrivalint, msg_size, outoforder_rate*100.0, 
+	    loss_rate*100.0, corrupt_rate*100.0, tracing_level);
+    fgetc(stdin);
+
+    /* initialize the random number generators */
+    if (sim_seed==0) sim_seed = getpid()+getppid();
+
+    /* test the random number generator */
+    workload_rng.seed(sim_seed);
+    double randtest_sum = 0.0;
+    for (int i=0; i<1000; i++)
+	randtest_sum += myrandom();
+    double randtest_avg = randtest_sum/1000;
+    if (randtest_avg<0.25 || randtest_avg>0.75) {
+	fprintf(stderr, 
+		"It appears that something is wrong with the random number.\n"
+		"Please try to run this again.\n"  
+		"Please report to me if the problem PERSISTS.\n");
+	exit(-1);
+    }
+
+    if (compare_mode) {
+	compare_protocols();
+	return 0;
+    }
+
+    /* a parallel run goes to a child process whose output is held back, so
+       that it can start over on one thread if it cannot order its events */
+    if (nb_threads>1) {
+	FILE *out = tmpfile();
+	ASSERT(out!=NULL);
+	fflush(stdout);
+
+	pid_t pid = fork();
+	ASSERT(pid>=0);
+	if (pid==0) {
+	    ASSERT(dup2(fileno(out), STDOUT_FILENO)>=0);
+	}
+	else {
+	    int status;
+	    waitpid(pid, &status, 0);
+	    if (!WIFEXITED(status) || WEXITSTATUS(status)!=EXIT_UNORDERED) {
+		char buf[4096];
+		size_t n;
+		rewind(out);
+		while ((n=fread(buf, 1, sizeof(buf), out))>0)
+		    fwrite(buf, 1, n, stdout);
+		fclose(out);
+		return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	    }
+	    fclose(out);
+	    fprintf(stderr, "## Parallel: running on one thread instead\n");
+	    nb_threads = 1;
+	}
+    }
+
+    simulate();
+
+    /* a branch only reports back to the trunk */
+    if (this_branch!=NULL) {
+	struct compare_result r;
+	collect_result(&r);
+	ASSERT(write(this_branch->fd, &r, sizeof(r))==(ssize_t)sizeof(r));
+	_exit(0);
+    }
 
     fprintf(stdout, "\n");
     fprintf(stdout, "## Simulation completed at time %.2fs with\n" 
-	    "\t%d characters sent\n" 
-	    "\t%d characters delivered\n"
-	    "\t%d packets passed between the sender and the receiver\n", 
-	    sim_core.time(), tot_chars_sent, tot_chars_delivered, tot_pkts_passed);
+	    "\t%lld characters sent\n" 
+	    "\t%lld characters delivered\n"
+	    "\t%lld packets passed between the sender and the receiver\n", 
+	    GetSimulationTime(), tot_chars_sent, tot_chars_delivered,
+	    tot_pkts_passed);
+
+    if (max_backlog>0)
+	fprintf(stdout, "\t%lld messages (%lld characters) refused at the "
+		"source\n", tot_msgs_blocked, tot_chars_blocked);
+
+    if (bottleneck_rate>0)
+	fprintf(stdout, "\t%lld data packets sent, %lld dropped at the "
+		"bottleneck queue\n", tot_data_pkts_sent, tot_queue_drops);
+
+    if (topology_path!=NULL) topology.report(stdout);
+
+    if (compress_mode) {
+	const struct compress_stats &c = tot_compress;
+	fprintf(stdout, "\t%.2f compression ratio (%lld characters in %lld "
+		"bytes), %lld of %lld messages sent raw\n",
+		(c.chars_lz_out>0) ? (double) c.chars_lz_in/c.chars_lz_out : 1.0,
+		c.chars_lz_in, c.chars_lz_out, c.msgs_raw, c.msgs);
+	fprintf(stdout, "\t%.2fx effective goodput gain (%lld characters "
+		"carried as %lld bytes of frames)\n",
+		(c.chars_out>0) ? (double) c.chars_in/c.chars_out : 1.0,
+		c.chars_in, c.chars_out);
+    }
+
+    if (report_interval>0 || warmup_time>0) {
+	double span = nsec_to_sec(source_end_time - warmup_end_time);
+	fprintf(stdout, "\t%.1f characters/s steady-state throughput "
+		"(from %.2fs to %.2fs)\n",
+		(span>0) ? (source_end_chars_delivered-warmup_chars_delivered)/span
+		: 0.0,
+		nsec_to_sec(warmup_end_time), nsec_to_sec(source_end_time));
+    }
+
+    if (nb_receivers>1) {
+	fprintf(stdout, "\t%lld data packets sent for %d receivers (%.2f per "
+		"receiver)\n", tot_data_pkts_sent, nb_receivers,
+		(double) tot_data_pkts_sent/nb_receivers);
+	fprintf(stdout, "## Receivers:\n");
+	fprintf(stdout, "\t%8s %12s %12s %12s %10s %10s  %s\n", "receiver",
+		"delivered", "pkts in", "pkts out", "mean lat", "p99 lat",
+		"verdict");
+	for (int i=0; i<nb_receivers; i++) {
+	    const struct peer &p = peers[i];
+	    const LatencyHistogram &h = p.streams->latency;
+	    fprintf(stdout, "\t%8d %12lld %12lld %12lld %9.3fs %9.3fs  %s\n",
+		    i, p.chars_delivered, p.pkts_received, p.pkts_sent,
+		    h.mean()/NSEC_PER_SEC,
+		    (double) h.quantile(0.99)/NSEC_PER_SEC,
+		    (p.verification_passed && p.chars_delivered==tot_chars_sent)
+		    ? "ok" : "FAILED");
+	}
+    }
+
+    if (nb_branches>0) report_branches();
+
+    for (int i=0; i<nb_receivers; i++) {
+	if (nb_streams>1) {
+	    if (nb_receivers>1) fprintf(stdout, "## Receiver %d:\n", i);
+	    peers[i].streams->report(stdout);
+	}
+	delete peers[i].streams;
+    }
+    bool passed = session_passed();
+    delete[] peers;
 
-    if (message_verfication_passed && (tot_chars_sent==tot_chars_delivered))
+    if (passed)
 	fprintf(stdout, "## Congratulations! This session is error-free, loss-free, and in order.\n");
     else
 	fprintf(stdout, "## Something is wrong! This session is NOT error-free, loss-free, and in order.\n");
@@ -0,0 +1,198 @@
+/*
+ * FILE: rdt_sr.cc
+ * DESCRIPTION: Reference selective-repeat engine.  Every packet in flight has
+ *              its own retransmission deadline, emulated on top of the single
+ *              sender timer, which is always armed for the earliest one.  The
+ *              receiver buffers out-of-order packets within its window and
+ *              acknowledges every packet individually.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+
+#include "rdt_struct.h"
+#include "rdt_protocol.h"
+
+
+#define SR_WINDOW_SIZE 16
+#define SR_TIMEOUT 0.3
+
+
+class SrSender : public RdtSender
+{
+public:
+    struct entry {
+	struct packet pkt;
+	bool acked;
+	double deadline;    /* retransmission time, valid while in flight */
+    };
+
+    /* packets from "base" on: the first next_seq-base are in flight, the rest
+       wait for the window to open */
+    std::deque<struct entry> queue;
+    uint32_t base;
+    uint32_t next_seq;
+
+public:
+    SrSender(RdtSenderHost *host) : RdtSender(host) {
+	base = 0;
+	next_seq = 0;
+    }
+
+    void from_upper_layer(struct message *msg) {
+	uint32_t seq = base + queue.size();
+	for (int cursor=0; cursor<msg->size; cursor+=RDT_MAX_PAYLOAD) {
+	    int size = msg->size - cursor;
+	    if (size>RDT_MAX_PAYLOAD) size = RDT_MAX_PAYLOAD;
+
+	    struct entry e;
+	    rdt_make_packet(&e.pkt, seq++, msg->data + cursor, size);
+	    e.acked = false;
+	    e.deadline = 0;
+	    queue.push_back(e);
+	}
+	send_window();
+	arm_timer();
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t ack;
+	int size;
+	if (!rdt_parse_packet(pkt, &ack, &size) || size!=0) return;
+
+	/* only packets in flight can be acknowledged */
+	if ((int32_t)(ack-base)<0 || (int32_t)(ack-next_seq)>=0) return;
+	queue[ack-base].acked = true;
+
+	/* slide the window over the acknowledged prefix */
+	while (next_seq!=base && queue.front().acked) {
+	    queue.pop_front();
+	    base++;
+	}
+
+	send_window();
+	arm_timer();
+    }
+
+    void timeout() {
+	double now = host->time();
+	struct packet burst[SR_WINDOW_SIZE];
+	int n = 0;
+
+	/* resend every packet whose own deadline has passed */
+	for (uint32_t i=0; i<next_seq-base; i++) {
+	    struct entry &e = queue[i];
+	    if (!e.acked && e.deadline<=now+1e-9) {
+		burst[n++] = e.pkt;
+		e.deadline = now + SR_TIMEOUT;
+	    }
+	}
+	if (n>0) host->to_lower_layer(burst, n);
+
+	arm_timer();
+    }
+
+private:
+    void send_window() {
+	double now = host->time();
+	struct packet burst[SR_WINDOW_SIZE];
+	int n = 0;
+
+	while (next_seq-base<SR_WINDOW_SIZE && next_seq-base<queue.size()) {
+	    struct entry &e = queue[next_seq-base];
+	    burst[n++] = e.pkt;
+	    e.deadline = now + SR_TIMEOUT;
+	    next_seq++;
+	}
+	if (n>0) host->to_lower_layer(burst, n);
+    }
+
+    /* arm the timer for the earliest deadline in flight */
+    void arm_timer() {
+	double earliest = -1;
+	for (uint32_t i=0; i<next_seq-base; i++) {
+	    const struct entry &e = queue[i];
+	    if (!e.acked && (earliest<0 || e.deadline<earliest))
+		earliest = e.deadline;
+	}
+
+	if (earliest<0) {
+	    host->stop_timer();
+	    return;
+	}
+
+	double wait = earliest - host->time();
+	host->start_timer((wait>0) ? wait : 0);
+    }
+};
+
+class SrReceiver : public RdtReceiver
+{
+public:
+    struct slot {
+	bool valid;
+	struct packet pkt;
+    };
+
+    /* slot of sequence number s is slots[s % SR_WINDOW_SIZE] */
+    struct slot slots[SR_WINDOW_SIZE];
+    uint32_t rcv_base;
+
+public:
+    SrReceiver(RdtReceiverHost *host) : RdtReceiver(host) {
+	rcv_base = 0;
+	for (int i=0; i<SR_WINDOW_SIZE; i++) slots[i].valid = false;
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t seq;
+	int size;
+	if (!rdt_parse_packet(pkt, &seq, &size) || size==0) return;
+
+	int32_t offset = (int32_t)(seq-rcv_base);
+
+	/* beyond the window: the sender cannot have sent it yet */
+	if (offset>=SR_WINDOW_SIZE) return;
+
+	/* acknowledge in-window and already delivered packets alike, the ack
+	   of the latter may have been lost */
+	struct packet ack;
+	rdt_make_packet(&ack, seq, NULL, 0);
+	host->to_lower_layer(&ack, 1);
+
+	if (offset<0) return;
+
+	struct slot &s = slots[seq % SR_WINDOW_SIZE];
+	if (!s.valid) {
+	    s.valid = true;
+	    s.pkt = *pkt;
+	}
+
+	/* deliver the in-order prefix */
+	for (;;) {
+	    struct slot &head = slots[rcv_base % SR_WINDOW_SIZE];
+	    if (!head.valid) break;
+
+	    struct message msg;
+	    msg.size = (unsigned char) head.pkt.data[0];
+	    msg.data = head.pkt.data + RDT_HEADER_SIZE;
+	    host->to_upper_layer(&msg);
+
+	    head.valid = false;
+	    rcv_base++;
+	}
+    }
+};
+
+RdtSender *sr_create_sender(RdtSenderHost *host)
+{
+    return new SrSender(host);
+}
+
+RdtReceiver *sr_create_receiver(RdtReceiverHost *host)
+{
+    return new SrReceiver(host);
+}
@@ -0,0 +1,179 @@
+/*
+ * FILE: rdt_stream.cc
+ * DESCRIPTION: Logical streams of the reliable data transfer simulator.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdt_struct.h"
+#include "rdt_stream.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  latency histogram
+  []------------------------------------------------------------------------[]*/
+
+LatencyHistogram::LatencyHistogram()
+{
+    count = 0;
+    sum = 0;
+    max = 0;
+    memset(buckets, 0, sizeof(buckets));
+}
+
+static int latency_bucket(int64_t latency)
+{
+    uint64_t us = (latency>0) ? latency/1000 : 0;
+    if (us<LATENCY_SUB_BUCKETS) return (int) us;
+
+    int octave = 63 - __builtin_clzll(us);
+    if (octave>=LATENCY_OCTAVES) return LATENCY_BUCKETS-1;
+    int sub = (int) (us >> (octave-4)) - LATENCY_SUB_BUCKETS;
+    return LATENCY_SUB_BUCKETS*(octave-3) + sub;
+}
+
+/* first latency (in nanoseconds) past bucket "b" */
+static int64_t latency_bucket_end(int b)
+{
+    if (b<LATENCY_SUB_BUCKETS) return (int64_t) (b+1)*1000;
+
+    int octave = b/LATENCY_SUB_BUCKETS + 3;
+    int sub = b%LATENCY_SUB_BUCKETS;
+    return ((int64_t) (LATENCY_SUB_BUCKETS+sub+1) << (octave-4))*1000;
+}
+
+void LatencyHistogram::add(int64_t latency)
+{
+    count++;
+    sum += latency;
+    if (latency>max) max = latency;
+    buckets[latency_bucket(latency)]++;
+}
+
+double LatencyHistogram::mean() const
+{
+    return (count>0) ? (double) sum/count : 0.0;
+}
+
+int64_t LatencyHistogram::quantile(double q) const
+{
+    if (count==0) return 0;
+
+    long long rank = (long long) (q*count);
+    if (rank>=count) rank = count-1;
+    long long seen = 0;
+    for (int b=0; b<LATENCY_BUCKETS; b++) {
+	seen += buckets[b];
+	if (seen>rank) {
+	    int64_t end = latency_bucket_end(b);
+	    return (end<max) ? end : max;
+	}
+    }
+    return max;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  stream table
+  []------------------------------------------------------------------------[]*/
+
+StreamTable::StreamTable(int nb_streams, bool ordered)
+{
+    streams.resize(nb_streams);
+    for (int i=0; i<nb_streams; i++) {
+	streams[i].chars_sent = 0;
+	streams[i].chars_delivered = 0;
+    }
+    this->ordered = ordered;
+    next_stream = 0;
+}
+
+int StreamTable::pick()
+{
+    int s = next_stream;
+    next_stream = (next_stream+1) % streams.size();
+    return s;
+}
+
+uint64_t StreamTable::send(int s, int size, int64_t now)
+{
+    struct stream &st = streams[s];
+    uint64_t offset = st.chars_sent;
+    st.chars_sent += size;
+
+    struct pending p;
+    p.sent_time = now;
+    p.left = size;
+    st.pending.push_back(p);
+    if (ordered) order.push_back(s);
+
+    return offset;
+}
+
+bool StreamTable::deliver(int s, const char *data, int len, int64_t now,
+			  const PayloadSource &payload)
+{
+    if (s<0 || s>=(int) streams.size()) return false;
+    struct stream &st = streams[s];
+
+    /* more bytes than the stream ever carried */
+    if (st.chars_delivered+len > st.chars_sent) return false;
+
+    bool ok = payload.verify(data, st.chars_delivered, len);
+    st.chars_delivered += len;
+
+    /* complete the messages whose last byte has arrived */
+    while (len>0) {
+	struct pending &p = st.pending.front();
+	int take = (len<p.left) ? len : p.left;
+	p.left -= take;
+	len -= take;
+	if (p.left==0) {
+	    st.latency.add(now - p.sent_time);
+	    latency.add(now - p.sent_time);
+	    st.pending.pop_front();
+	    if (ordered) order.pop_front();
+	}
+    }
+    return ok;
+}
+
+bool StreamTable::deliver_ordered(const char *data, int len, int64_t now,
+				  const PayloadSource &payload)
+{
+    bool ok = true;
+
+    /* split the bytes along the messages they belong to */
+    while (len>0) {
+	if (order.empty()) return false;
+	int s = order.front();
+	int left = streams[s].pending.front().left;
+	int take = (len<left) ? len : left;
+	if (!deliver(s, data, take, now, payload)) ok = false;
+	data += take;
+	len -= take;
+    }
+    return ok;
+}
+
+void StreamTable::report(FILE *fp)
+{
+    fprintf(fp, "## Message latency (in seconds):\n");
+    fprintf(fp, "\t%8s %10s %10s %10s %10s %10s\n",
+	    "stream", "messages", "mean", "p50", "p99", "max");
+    for (int i=0; i<=(int) streams.size(); i++) {
+	const LatencyHistogram &h =
+	    (i<(int) streams.size()) ? streams[i].latency : latency;
+	char name[16];
+	if (i<(int) streams.size())
+	    snprintf(name, sizeof(name), "%d", i);
+	else
+	    snprintf(name, sizeof(name), "all");
+	fprintf(fp, "\t%8s %10lld %10.3f %10.3f %10.3f %10.3f\n",
+		name, h.count, h.mean()/1e9, h.quantile(0.5)/1e9,
+		h.quantile(0.99)/1e9, h.max/1e9);
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * FILE: rdt_stream.h
+ * DESCRIPTION: Logical streams of the reliable data transfer simulator.  The
+ *              upper layer at the sender spreads its messages over several
+ *              streams, each with its own byte offsets; the stream table
+ *              verifies delivered bytes stream by stream and measures how
+ *              long every message took from the upper layer at the sender to
+ *              the upper layer at the receiver.
+ */
+
+
+#ifndef _RDT_STREAM_H_
+#define _RDT_STREAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include "rdt_workload.h"
+
+
+/* log-linear histogram of latencies: exact below 16us, then 16 buckets per
+   power of two (about 6% resolution) up to 2^40us */
+#define LATENCY_SUB_BUCKETS 16
+#define LATENCY_OCTAVES 40
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS*(LATENCY_OCTAVES-3))
+
+class LatencyHistogram
+{
+public:
+    long long count;
+    int64_t sum;            /* (in nanoseconds) */
+    int64_t max;
+    long long buckets[LATENCY_BUCKETS];
+
+public:
+    LatencyHistogram();
+
+    /* record one latency (in nanoseconds) */
+    void add(int64_t latency);
+
+    /* mean latency and the q-quantile (0<=q<=1), both in nanoseconds; the
+       quantile is the upper bound of its bucket */
+    double mean() const;
+    int64_t quantile(double q) const;
+};
+
+class StreamTable
+{
+public:
+    /* a message some of whose bytes are not delivered yet */
+    struct pending {
+	int64_t sent_time;  /* (in nanoseconds) */
+	int left;           /* bytes not delivered yet */
+    };
+
+    struct stream {
+	uint64_t chars_sent;
+	uint64_t chars_delivered;
+	std::deque<struct pending> pending;
+	LatencyHistogram latency;
+    };
+
+    std::vector<struct stream> streams;
+    LatencyHistogram latency;       /* all streams together */
+
+    /* protocols that deliver everything in one order hand the bytes of all
+       streams back in sending order; "order" remembers the stream of every
+       pending message for them */
+    bool ordered;
+    std::deque<int> order;
+
+    int next_stream;
+
+public:
+    StreamTable(int nb_streams, bool ordered);
+
+    /* the stream of the next message (round robin) */
+    int pick();
+
+    /* account for a message of "size" bytes sent on stream "s" at time
+       "now", return the stream offset of its first byte */
+    uint64_t send(int s, int size, int64_t now);
+
+    /* account for "len" delivered bytes of stream "s" (or, for ordered
+       protocols, of the streams in sending order) at time "now"; return false
+       if they do not match the payload */
+    bool deliver(int s, const char *data, int len, int64_t now,
+		 const PayloadSource &payload);
+    bool deliver_ordered(const char *data, int len, int64_t now,
+			 const PayloadSource &payload);
+
+    /* print the latency of every stream and of all of them */
+    void report(FILE *fp);
+};
+
+#endif  /* _RDT_STREAM_H_ */
@@ -0,0 +1,357 @@
+/*
+ * FILE: rdt_tcplite.cc
+ * DESCRIPTION: Reference TCP-like engine.  Sequence numbers count packets
+ *              instead of bytes, but otherwise the sender behaves like a
+ *              Reno TCP: cumulative acks, a congestion window with slow start
+ *              and congestion avoidance, fast retransmit and recovery on three
+ *              duplicate acks, and a retransmission timeout estimated from
+ *              RTT samples (Jacobson/Karels, Karn's rule, exponential
+ *              backoff).  The receiver buffers out-of-order packets and acks
+ *              the next packet it expects.
+ *
+ *              The paced variant (tcp-pace) does not send what the window
+ *              allows in one burst: once an RTT has been measured, it spreads
+ *              the packets at cwnd/srtt, so that a window opening all at once
+ *              does not overflow the queue of a bottleneck link.  The release
+ *              of the next packet shares the one sender timer with the
+ *              retransmission timeout.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+
+#include "rdt_struct.h"
+#include "rdt_protocol.h"
+
+
+/* largest window, which is also the receiver buffer */
+#define TCPLITE_MAX_WINDOW 64
+
+#define TCPLITE_INITIAL_RTO 1.0
+#define TCPLITE_MIN_RTO 0.2
+#define TCPLITE_MAX_RTO 8.0
+
+#define TCPLITE_DUPACK_THRESHOLD 3
+
+/* the pacing rate is cwnd/srtt times these: faster in slow start, so that
+   the pacer does not hold back the growth of the window, and a little
+   faster in congestion avoidance to absorb the jitter of the acks */
+#define TCPLITE_PACING_SS_RATIO 2.0
+#define TCPLITE_PACING_CA_RATIO 1.2
+
+
+class TcpLiteSender : public RdtSender
+{
+public:
+    /* packets from "base" on: the first next_seq-base are in flight, the rest
+       wait for the window to open */
+    std::deque<struct packet> queue;
+    uint32_t base;
+    uint32_t next_seq;
+    uint32_t high_seq;      /* highest number sent so far, plus one */
+
+    double cwnd;            /* congestion window (in packets) */
+    double ssthresh;
+    int dupacks;
+    bool recovering;        /* in fast recovery */
+    uint32_t recover;       /* leave fast recovery once this is acked */
+
+    double srtt, rttvar, rto;
+    bool timing;            /* an RTT sample is being taken */
+    uint32_t timed_seq;
+    double timed_at;
+
+    /* the timer serves two deadlines (in seconds, negative if unset): the
+       retransmission timeout and, when pacing, the release of the next
+       packet; it is armed for the earlier one */
+    bool paced;
+    double next_send;       /* the pacer lets no packet out before this */
+    double rto_deadline;
+    double pace_deadline;
+    double armed;           /* deadline the timer is armed for */
+
+public:
+    TcpLiteSender(RdtSenderHost *host, bool paced) : RdtSender(host) {
+	base = next_seq = high_seq = 0;
+	cwnd = 1;
+	ssthresh = TCPLITE_MAX_WINDOW;
+	dupacks = 0;
+	recovering = false;
+	recover = 0;
+	srtt = rttvar = 0;
+	rto = TCPLITE_INITIAL_RTO;
+	timing = false;
+	timed_seq = 0;
+	timed_at = 0;
+	this->paced = paced;
+	next_send = 0;
+	rto_deadline = pace_deadline = armed = -1;
+    }
+
+    void from_upper_layer(struct message *msg) {
+	uint32_t seq = base + queue.size();
+	for (int cursor=0; cursor<msg->size; cursor+=RDT_MAX_PAYLOAD) {
+	    int size = msg->size - cursor;
+	    if (size>RDT_MAX_PAYLOAD) size = RDT_MAX_PAYLOAD;
+
+	    struct packet pkt;
+	    rdt_make_packet(&pkt, seq++, msg->data + cursor, size);
+	    queue.push_back(pkt);
+	}
+	send_window();
+	arm_timer();
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t ack;
+	int size;
+	if (!rdt_parse_packet(pkt, &ack, &size) || size!=0) return;
+	if ((int32_t)(ack-high_seq)>0) return;
+
+	if ((int32_t)(ack-base)>0) {
+	    uint32_t acked = ack - base;
+	    queue.erase(queue.begin(), queue.begin() + acked);
+	    base = ack;
+	    if ((int32_t)(next_seq-base)<0) next_seq = base;
+
+	    /* RTT sample, only from packets that were never retransmitted */
+	    if (timing && (int32_t)(ack-timed_seq)>0) {
+		update_rto(host->time() - timed_at);
+		timing = false;
+	    }
+
+	    if (recovering) {
+		if ((int32_t)(ack-recover)>=0) {
+		    /* full ack: deflate the window */
+		    recovering = false;
+		    cwnd = ssthresh;
+		}
+		else {
+		    /* partial ack: the next hole is lost as well */
+		    retransmit_base();
+		    cwnd -= acked;
+		    if (cwnd<1) cwnd = 1;
+		    cwnd += 1;
+		}
+	    }
+	    else if (cwnd<ssthresh)
+		cwnd += acked;              /* slow start */
+	    else
+		cwnd += acked/cwnd;         /* congestion avoidance */
+	    if (cwnd>TCPLITE_MAX_WINDOW) cwnd = TCPLITE_MAX_WINDOW;
+
+	    dupacks = 0;
+	    rto_deadline = (base==high_seq) ? -1 : host->time() + rto;
+	}
+	else if (ack==base && base!=high_seq) {
+	    dupacks++;
+	    if (!recovering && dupacks==TCPLITE_DUPACK_THRESHOLD) {
+		/* fast retransmit */
+		ssthresh = flight()/2.0;
+		if (ssthresh<2) ssthresh = 2;
+		cwnd = ssthresh + TCPLITE_DUPACK_THRESHOLD;
+		recovering = true;
+		recover = high_seq;
+		retransmit_base();
+	    }
+	    else if (recovering) {
+		/* every duplicate ack means a packet has left the network */
+		cwnd += 1;
+		if (cwnd>TCPLITE_MAX_WINDOW) cwnd = TCPLITE_MAX_WINDOW;
+	    }
+	}
+
+	send_window();
+	arm_timer();
+    }
+
+    void timeout() {
+	double now = host->time();
+	armed = -1;
+	if (pace_deadline>=0 && pace_deadline<=now+1e-9) pace_deadline = -1;
+	if (rto_deadline<0 || rto_deadline>now+1e-9) {
+	    /* only the pacer: release what the window allows */
+	    send_window();
+	    arm_timer();
+	    return;
+	}
+	rto_deadline = -1;
+	if (base==high_seq) {
+	    arm_timer();
+	    return;
+	}
+
+	ssthresh = flight()/2.0;
+	if (ssthresh<2) ssthresh = 2;
+	cwnd = 1;
+	dupacks = 0;
+	recovering = false;
+	timing = false;
+
+	rto *= 2;
+	if (rto>TCPLITE_MAX_RTO) rto = TCPLITE_MAX_RTO;
+
+	/* restart from the oldest unacknowledged packet in slow start */
+	next_seq = base;
+	send_window();
+	if (rto_deadline<0) rto_deadline = now + rto;
+	arm_timer();
+    }
+
+private:
+    uint32_t flight() { return high_seq - base; }
+
+    void update_rto(double rtt) {
+	if (srtt==0) {
+	    srtt = rtt;
+	    rttvar = rtt/2;
+	}
+	else {
+	    double err = rtt - srtt;
+	    srtt += err/8;
+	    rttvar += ((err<0 ? -err : err) - rttvar)/4;
+	}
+	rto = srtt + 4*rttvar;
+	if (rto<TCPLITE_MIN_RTO) rto = TCPLITE_MIN_RTO;
+	if (rto>TCPLITE_MAX_RTO) rto = TCPLITE_MAX_RTO;
+    }
+
+    void retransmit_base() {
+	host->to_lower_layer(&queue[0], 1);
+	if (timing && timed_seq==base) timing = false;
+	rto_deadline = host->time() + rto;
+    }
+
+    /* time between two packets at the pacing rate */
+    double pacing_interval() {
+	double ratio = (cwnd<ssthresh) ? TCPLITE_PACING_SS_RATIO
+				       : TCPLITE_PACING_CA_RATIO;
+	return srtt/(cwnd*ratio);
+    }
+
+    void arm_timer() {
+	double deadline = rto_deadline;
+	if (pace_deadline>=0 && (deadline<0 || pace_deadline<deadline))
+	    deadline = pace_deadline;
+	if (deadline==armed) return;
+
+	armed = deadline;
+	if (deadline<0) {
+	    host->stop_timer();
+	    return;
+	}
+	double wait = deadline - host->time();
+	host->start_timer((wait>0) ? wait : 0);
+    }
+
+    void send_window() {
+	/* the window counts everything between base and next_seq; during fast
+	   recovery the duplicate acks have inflated it by the packets that left
+	   the network */
+	uint32_t window = (uint32_t) cwnd;
+	struct packet burst[TCPLITE_MAX_WINDOW];
+	int n = 0;
+	double now = host->time();
+
+	/* nothing to pace by before the first RTT sample */
+	bool pacing = paced && srtt>0;
+
+	while (next_seq-base<window && next_seq-base<queue.size()) {
+	    if (pacing) {
+		if (next_send>now+1e-9) {
+		    /* come back when the pacer allows the next packet */
+		    if (pace_deadline<0) pace_deadline = next_send;
+		    break;
+		}
+		next_send = ((next_send>now) ? next_send : now)
+		    + pacing_interval();
+	    }
+	    burst[n++] = queue[next_seq-base];
+
+	    /* time one packet sent for the first time (Karn's rule) */
+	    if (!timing && (int32_t)(next_seq-high_seq)>=0) {
+		timing = true;
+		timed_seq = next_seq;
+		timed_at = host->time();
+	    }
+	    next_seq++;
+	}
+	if ((int32_t)(next_seq-high_seq)>0) high_seq = next_seq;
+	if (n==0) return;
+
+	host->to_lower_layer(burst, n);
+	if (rto_deadline<0) rto_deadline = now + rto;
+    }
+};
+
+class TcpLiteReceiver : public RdtReceiver
+{
+public:
+    struct slot {
+	bool valid;
+	struct packet pkt;
+    };
+
+    /* slot of sequence number s is slots[s % TCPLITE_MAX_WINDOW] */
+    struct slot slots[TCPLITE_MAX_WINDOW];
+    uint32_t rcv_base;
+
+public:
+    TcpLiteReceiver(RdtReceiverHost *host) : RdtReceiver(host) {
+	rcv_base = 0;
+	for (int i=0; i<TCPLITE_MAX_WINDOW; i++) slots[i].valid = false;
+    }
+
+    void from_lower_layer(struct packet *pkt) {
+	uint32_t seq;
+	int size;
+	if (!rdt_parse_packet(pkt, &seq, &size) || size==0) return;
+
+	int32_t offset = (int32_t)(seq-rcv_base);
+	if (offset>=0 && offset<TCPLITE_MAX_WINDOW) {
+	    struct slot &s = slots[seq % TCPLITE_MAX_WINDOW];
+	    if (!s.valid) {
+		s.valid = true;
+		s.pkt = *pkt;
+	    }
+
+	    /* deliver the in-order prefix */
+	    for (;;) {
+		struct slot &head = slots[rcv_base % TCPLITE_MAX_WINDOW];
+		if (!head.valid) break;
+
+		struct message msg;
+		msg.size = (unsigned char) head.pkt.data[0];
+		msg.data = head.pkt.data + RDT_HEADER_SIZE;
+		host->to_upper_layer(&msg);
+
+		head.valid = false;
+		rcv_base++;
+	    }
+	}
+
+	/* cumulative ack of everything delivered; out-of-order arrivals
+	   produce the duplicate acks that drive fast retransmit */
+	struct packet ack;
+	rdt_make_packet(&ack, rcv_base, NULL, 0);
+	host->to_lower_layer(&ack, 1);
+    }
+};
+
+RdtSender *tcplite_create_sender(RdtSenderHost *host)
+{
+    return new TcpLiteSender(host, false);
+}
+
+RdtSender *tcppace_create_sender(RdtSenderHost *host)
+{
+    return new TcpLiteSender(host, true);
+}
+
+RdtReceiver *tcplite_create_receiver(RdtReceiverHost *host)
+{
+    return new TcpLiteReceiver(host);
+}
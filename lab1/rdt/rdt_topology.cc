@@ -0,0 +1,204 @@
+/*
+ * FILE: rdt_topology.cc
+ * DESCRIPTION: Multi-hop topologies for the reliable data transfer
+ *              simulator.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <deque>
+
+#include "rdt_topology.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  hops
+  []------------------------------------------------------------------------[]*/
+
+Hop::Hop(int from, int to, double latency, double rate, int limit,
+	 double loss_rate, double corrupt_rate, uint64_t seed)
+    : queue(rate, limit)
+{
+    this->from = from;
+    this->to = to;
+    rng.seed(seed);
+    channel = new BernoulliChannel(loss_rate, corrupt_rate,
+				   DelayModel(DELAY_FIXED, latency, 0, 0, &rng),
+				   &rng);
+    pkts_in = 0;
+    pkts_lost = 0;
+    pkts_corrupted = 0;
+}
+
+Hop::~Hop()
+{
+    delete channel;
+}
+
+bool Hop::transmit(int64_t now, struct packet *pkt, int64_t *arrival)
+{
+    pkts_in++;
+    int64_t departure = queue.enqueue(now, RDT_PKTSIZE);
+    if (departure<0) return false;
+
+    struct channel_fate fate;
+    channel->next_fate(&fate);
+    if (fate.lost) {
+	pkts_lost++;
+	return false;
+    }
+    if (fate.corrupted) {
+	pkts_corrupted++;
+	corrupt_packets(&pkt, 1, &rng);
+    }
+
+    *arrival = departure + llround(fate.delay*1e9);
+    return true;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  topology
+  []------------------------------------------------------------------------[]*/
+
+Topology::Topology()
+{
+    path = NULL;
+}
+
+Topology::~Topology()
+{
+    clear_hops();
+}
+
+void Topology::clear_hops()
+{
+    for (size_t i=0; i<hops.size(); i++) delete hops[i];
+    hops.clear();
+}
+
+int Topology::find_node(const char *name) const
+{
+    for (size_t i=0; i<nodes.size(); i++) {
+	if (nodes[i]==name) return (int) i;
+    }
+    return -1;
+}
+
+int Topology::add_node(const char *name)
+{
+    int n = find_node(name);
+    if (n>=0) return n;
+    nodes.push_back(name);
+    return (int) nodes.size() - 1;
+}
+
+bool Topology::load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp==NULL) {
+	fprintf(stderr, "cannot open topology %s\n", path);
+	return false;
+    }
+    this->path = path;
+
+    char line[512];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp)!=NULL) {
+	lineno++;
+	char *comment = strchr(line, '#');
+	if (comment!=NULL) *comment = 0;
+
+	char keyword[64], a[64], b[64];
+	struct link l;
+	int n = sscanf(line, "%63s %63s %63s %lf %lf %d %lf %lf", keyword,
+		       a, b, &l.latency, &l.rate, &l.limit, &l.loss_rate,
+		       &l.corrupt_rate);
+	if (n<=0) continue;
+	if (n!=8 || strcmp(keyword, "link")!=0 || strcmp(a, b)==0 ||
+	    l.latency<0 || l.rate<0 || l.limit<1 ||
+	    l.loss_rate<0 || l.loss_rate>1 ||
+	    l.corrupt_rate<0 || l.corrupt_rate>1) {
+	    fprintf(stderr, "%s:%d: invalid link\n", path, lineno);
+	    fclose(fp);
+	    return false;
+	}
+	l.a = add_node(a);
+	l.b = add_node(b);
+	links.push_back(l);
+    }
+    fclose(fp);
+
+    if (find_node("sender")<0) {
+	fprintf(stderr, "%s: no node named sender\n", path);
+	return false;
+    }
+    return true;
+}
+
+void Topology::start(uint64_t seed)
+{
+    clear_hops();
+    for (size_t i=0; i<links.size(); i++) {
+	const struct link &l = links[i];
+	hops.push_back(new Hop(l.a, l.b, l.latency, l.rate, l.limit,
+			       l.loss_rate, l.corrupt_rate, seed + 2*i));
+	hops.push_back(new Hop(l.b, l.a, l.latency, l.rate, l.limit,
+			       l.loss_rate, l.corrupt_rate, seed + 2*i + 1));
+    }
+}
+
+bool Topology::route(int from, int to, Route *r) const
+{
+    /* breadth-first search; the hop that first reaches a node is kept, so
+       ties go to the link listed first */
+    std::vector<int> via(nodes.size(), -1);
+    std::vector<bool> seen(nodes.size(), false);
+    std::deque<int> frontier;
+    seen[from] = true;
+    frontier.push_back(from);
+
+    while (!frontier.empty() && !seen[to]) {
+	int n = frontier.front();
+	frontier.pop_front();
+	for (size_t h=0; h<hops.size(); h++) {
+	    if (hops[h]->from!=n || seen[hops[h]->to]) continue;
+	    seen[hops[h]->to] = true;
+	    via[hops[h]->to] = (int) h;
+	    frontier.push_back(hops[h]->to);
+	}
+    }
+    if (!seen[to]) return false;
+
+    r->clear();
+    for (int n=to; n!=from; n=hops[via[n]]->from)
+	r->insert(r->begin(), hops[via[n]]);
+    return true;
+}
+
+void Topology::describe_route(FILE *fp, const Route &r) const
+{
+    if (r.empty()) return;
+    fprintf(fp, "%s", nodes[r[0]->from].c_str());
+    for (size_t i=0; i<r.size(); i++)
+	fprintf(fp, " -> %s", nodes[r[i]->to].c_str());
+    fprintf(fp, "\n");
+}
+
+void Topology::report(FILE *fp) const
+{
+    fprintf(fp, "## Hops:\n");
+    fprintf(fp, "\t%12s %12s %10s %10s %10s %10s %8s %8s\n", "from", "to",
+	    "pkts in", "q drops", "lost", "corrupted", "mean q", "max q");
+    for (size_t i=0; i<hops.size(); i++) {
+	const Hop *h = hops[i];
+	if (h->pkts_in==0) continue;
+	fprintf(fp, "\t%12s %12s %10lld %10lld %10lld %10lld %8.2f %8d\n",
+		nodes[h->from].c_str(), nodes[h->to].c_str(), h->pkts_in,
+		h->queue.drops, h->pkts_lost, h->pkts_corrupted,
+		h->queue.mean_occupancy(), h->queue.max_occupancy);
+    }
+}
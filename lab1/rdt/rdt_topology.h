@@ -0,0 +1,113 @@
+/*
+ * FILE: rdt_topology.h
+ * DESCRIPTION: Multi-hop topologies for the reliable data transfer
+ *              simulator.  Instead of the single direct channel, the sender
+ *              and the receivers are placed in a small graph of nodes joined
+ *              by links, each with its own latency, bandwidth, drop-tail
+ *              queue, loss and corruption.  The nodes in between store and
+ *              forward: a packet is fully received before it is queued on the
+ *              next link of its route.
+ *
+ *              A topology file has one link per line (a '#' starts a
+ *              comment):
+ *
+ *                  link <node> <node> <latency> <bytes/s> <queue> <loss> <corrupt>
+ *
+ *              where the latency is in seconds, a rate of 0 never queues,
+ *              and the queue is in packets.  Links carry both directions,
+ *              each with its own queue and impairments.  The sender is the
+ *              node "sender" and the receivers are "receiver0",
+ *              "receiver1", ...; every other name is a forwarding node.
+ *              Packets follow the route with the fewest hops.
+ */
+
+
+#ifndef _RDT_TOPOLOGY_H_
+#define _RDT_TOPOLOGY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_random.h"
+#include "rdt_channel.h"
+
+
+/* one direction of a link: the queue in front of it and the channel model
+   of the wire, with its own random number generator */
+class Hop
+{
+public:
+    int from, to;           /* the nodes at both ends */
+    Bottleneck queue;
+    BernoulliChannel *channel;
+    RdtRandom rng;
+
+    /* packets offered to the hop, then lost or corrupted on the wire */
+    long long pkts_in;
+    long long pkts_lost;
+    long long pkts_corrupted;
+
+public:
+    Hop(int from, int to, double latency, double rate, int limit,
+	double loss_rate, double corrupt_rate, uint64_t seed);
+    ~Hop();
+
+    /* pass a packet through the hop at time "now" (in nanoseconds): return
+       false if it is dropped at the queue or lost, otherwise damage it if it
+       is corrupted and set "arrival" to when it reaches the far end */
+    bool transmit(int64_t now, struct packet *pkt, int64_t *arrival);
+};
+
+/* the hops a packet goes through, in order */
+typedef std::vector<Hop *> Route;
+
+class Topology
+{
+public:
+    struct link {
+	int a, b;               /* the nodes it joins */
+	double latency;         /* (in seconds) */
+	double rate;            /* (in bytes per second), 0 never queues */
+	int limit;              /* queue (in packets) */
+	double loss_rate;
+	double corrupt_rate;
+    };
+
+    const char *path;
+    std::vector<std::string> nodes;
+    std::vector<struct link> links;
+    std::vector<Hop *> hops;    /* a->b and b->a of every link, in order */
+
+public:
+    Topology();
+    ~Topology();
+
+    /* read a topology file, return false (with a message on stderr) if it
+       cannot be read or is malformed */
+    bool load(const char *path);
+
+    /* create the hops afresh, with generators seeded from "seed" */
+    void start(uint64_t seed);
+
+    /* the node of a name, -1 if there is none */
+    int find_node(const char *name) const;
+
+    /* the route with the fewest hops between two nodes, return false if they
+       are not connected */
+    bool route(int from, int to, Route *r) const;
+
+    /* print a route as "a -> b -> c" */
+    void describe_route(FILE *fp, const Route &r) const;
+
+    /* print the counters of every hop */
+    void report(FILE *fp) const;
+
+private:
+    int add_node(const char *name);
+    void clear_hops();
+};
+
+#endif  /* _RDT_TOPOLOGY_H_ */
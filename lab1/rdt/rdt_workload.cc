@@ -0,0 +1,256 @@
+/*
+ * FILE: rdt_workload.cc
+ * DESCRIPTION: Workload generators for the reliable data transfer simulator.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rdt_workload.h"
+
+
+/* period of the rolling digit pattern */
+#define PATTERN_PERIOD 10
+
+/* the pattern buffer holds this many bytes past one period, so that most
+   messages are filled and verified with a single memcpy()/memcmp() */
+#define PATTERN_CHUNK 4096
+
+/* pareto sizes are capped to keep single messages allocatable */
+#define PARETO_SIZE_CAP 1000
+
+static const char *arrival_names[] = {"uniform", "poisson", "onoff", "pareto"};
+static const char *size_names[] = {"uniform", "fixed", "poisson", "pareto"};
+
+int arrival_kind_from_name(const char *name)
+{
+    for (int i=0; i<(int)(sizeof(arrival_names)/sizeof(arrival_names[0])); i++) {
+	if (strcmp(name, arrival_names[i])==0) return i;
+    }
+    return -1;
+}
+
+int size_kind_from_name(const char *name)
+{
+    for (int i=0; i<(int)(sizeof(size_names)/sizeof(size_names[0])); i++) {
+	if (strcmp(name, size_names[i])==0) return i;
+    }
+    return -1;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  payload content
+  []------------------------------------------------------------------------[]*/
+
+PayloadSource::PayloadSource()
+{
+    base = NULL;
+    period = 0;
+    span = 0;
+    mapping = NULL;
+    mapping_length = 0;
+}
+
+PayloadSource::~PayloadSource()
+{
+    if (mapping!=NULL) munmap(mapping, mapping_length);
+}
+
+void PayloadSource::use_pattern()
+{
+    static char pattern[PATTERN_PERIOD + PATTERN_CHUNK];
+
+    for (int i=0; i<PATTERN_PERIOD + PATTERN_CHUNK; i++)
+	pattern[i] = '0' + i % PATTERN_PERIOD;
+
+    base = pattern;
+    period = PATTERN_PERIOD;
+    span = PATTERN_PERIOD + PATTERN_CHUNK;
+}
+
+bool PayloadSource::use_file(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd<0) {
+	fprintf(stderr, "cannot open payload file %s\n", path);
+	return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)<0 || st.st_size==0) {
+	fprintf(stderr, "payload file %s is empty\n", path);
+	close(fd);
+	return false;
+    }
+
+    mapping_length = st.st_size;
+    mapping = mmap(NULL, mapping_length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping==MAP_FAILED) {
+	fprintf(stderr, "cannot map payload file %s\n", path);
+	mapping = NULL;
+	return false;
+    }
+    madvise(mapping, mapping_length, MADV_SEQUENTIAL);
+
+    base = (const char *) mapping;
+    period = mapping_length;
+    span = mapping_length;
+    return true;
+}
+
+void PayloadSource::fill(char *dst, uint64_t offset, int len) const
+{
+    uint64_t phase = offset % period;
+
+    while (len>0) {
+	int n = (span-phase < (uint64_t)len) ? (int)(span-phase) : len;
+	memcpy(dst, base + phase, n);
+	dst += n;
+	len -= n;
+	phase = (phase + n) % period;
+    }
+}
+
+bool PayloadSource::verify(const char *src, uint64_t offset, int len) const
+{
+    uint64_t phase = offset % period;
+
+    while (len>0) {
+	int n = (span-phase < (uint64_t)len) ? (int)(span-phase) : len;
+	if (memcmp(src, base + phase, n)!=0) return false;
+	src += n;
+	len -= n;
+	phase = (phase + n) % period;
+    }
+    return true;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  arrival and size distributions
+  []------------------------------------------------------------------------[]*/
+
+Workload::Workload(int arrival_kind, int size_kind, double mean_interval,
+		   int mean_size, RdtRandom *rng)
+{
+    this->arrival_kind = arrival_kind;
+    this->size_kind = size_kind;
+    this->mean_interval = mean_interval;
+    this->mean_size = mean_size;
+    this->rng = rng;
+    on_time = 1.0;
+    off_time = 1.0;
+    pareto_shape = 1.5;
+    on_left = -1;
+}
+
+double Workload::exponential(double mean)
+{
+    return -mean*log(1.0 - rng->uniform());
+}
+
+double Workload::pareto(double mean)
+{
+    /* scale chosen so that the distribution has the requested mean (shape
+       must be larger than 1) */
+    double xm = mean*(pareto_shape-1.0)/pareto_shape;
+    return xm*pow(1.0 - rng->uniform(), -1.0/pareto_shape);
+}
+
+double Workload::next_interval()
+{
+    switch (arrival_kind) {
+    case ARRIVAL_POISSON:
+	return exponential(mean_interval);
+
+    case ARRIVAL_ONOFF:
+	{
+	    /* messages only arrive during "on" periods, at a rate raised so that
+	       the long-run mean interval is unchanged */
+	    if (on_left<0) on_left = exponential(on_time);
+	    double gap = exponential(mean_interval*on_time/(on_time+off_time));
+	    double t = 0;
+	    while (gap>on_left) {
+		gap -= on_left;
+		t += on_left + exponential(off_time);
+		on_left = exponential(on_time);
+	    }
+	    on_left -= gap;
+	    return t + gap;
+	}
+
+    case ARRIVAL_PARETO:
+	return pareto(mean_interval);
+
+    case ARRIVAL_UNIFORM:
+    default:
+	return mean_interval*2.0*rng->uniform();
+    }
+}
+
+int Workload::next_size()
+{
+    double size;
+
+    switch (size_kind) {
+    case SIZE_FIXED:
+	size = mean_size;
+	break;
+
+    case SIZE_POISSON:
+	if (mean_size<64) {
+	    /* Knuth's multiplication method */
+	    double limit = exp(-(double)mean_size), prod = rng->uniform();
+	    size = 0;
+	    while (prod>limit) {
+		prod *= rng->uniform();
+		size++;
+	    }
+	}
+	else {
+	    /* normal approximation for large means */
+	    double u1 = 1.0 - rng->uniform(), u2 = rng->uniform();
+	    size = mean_size +
+		sqrt((double)mean_size)*sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+	}
+	break;
+
+    case SIZE_PARETO:
+	size = pareto(mean_size);
+	if (size>(double)PARETO_SIZE_CAP*mean_size)
+	    size = (double)PARETO_SIZE_CAP*mean_size;
+	break;
+
+    case SIZE_UNIFORM:
+    default:
+	size = rng->uniform()*2.0*mean_size;
+	break;
+    }
+
+    return (size<1) ? 1 : (int)size;
+}
+
+void Workload::describe(FILE *fp)
+{
+    fprintf(fp, "%s arrivals (mean %.3fs", arrival_names[arrival_kind],
+	    mean_interval);
+    if (arrival_kind==ARRIVAL_ONOFF)
+	fprintf(fp, ", on %.3fs, off %.3fs", on_time, off_time);
+    if (arrival_kind==ARRIVAL_PARETO)
+	fprintf(fp, ", shape %.2f", pareto_shape);
+    fprintf(fp, "), %s sizes (mean %d bytes", size_names[size_kind],
+	    mean_size);
+    if (size_kind==SIZE_PARETO)
+	fprintf(fp, ", shape %.2f", pareto_shape);
+    fprintf(fp, "), payload %s\n",
+	    (payload.mapping!=NULL) ? "replayed from file" : "digit pattern");
+}
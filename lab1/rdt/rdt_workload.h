@@ -0,0 +1,105 @@
+/*
+ * FILE: rdt_workload.h
+ * DESCRIPTION: Workload generators for the reliable data transfer simulator.
+ *              A workload decides when the upper layer at the sender passes
+ *              the next message down, how large it is, and what bytes it
+ *              carries; the receiver checks delivered bytes against the same
+ *              workload.
+ */
+
+
+#ifndef _RDT_WORKLOAD_H_
+#define _RDT_WORKLOAD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rdt_random.h"
+
+
+/* message arrival processes.  all of them have the mean interval given on the
+   command line:
+     ARRIVAL_UNIFORM  intervals uniform in [0, 2*mean) (the classic behavior)
+     ARRIVAL_POISSON  exponential intervals
+     ARRIVAL_ONOFF    poisson arrivals during exponential "on" periods,
+                      silence during exponential "off" periods
+     ARRIVAL_PARETO   pareto (heavy-tailed) intervals */
+enum {ARRIVAL_UNIFORM=0, ARRIVAL_POISSON, ARRIVAL_ONOFF, ARRIVAL_PARETO};
+
+/* message size distributions, all with the mean size given on the command
+   line:
+     SIZE_UNIFORM  uniform in [0, 2*mean) (the classic behavior)
+     SIZE_FIXED    every message has the mean size
+     SIZE_POISSON  poisson distributed
+     SIZE_PARETO   pareto (heavy-tailed), capped at PARETO_SIZE_CAP*mean */
+enum {SIZE_UNIFORM=0, SIZE_FIXED, SIZE_POISSON, SIZE_PARETO};
+
+/* parse an arrival process or size distribution name, return -1 if unknown */
+int arrival_kind_from_name(const char *name);
+int size_kind_from_name(const char *name);
+
+/* the content of the byte stream carried by the messages.  the stream is
+   periodic: byte i of the stream is base[i % period].  "span" bytes starting
+   at "base" are readable, span >= period, so a copy starting at phase p can
+   take up to span-p bytes in one go. */
+class PayloadSource
+{
+public:
+    const char *base;
+    uint64_t period;
+    uint64_t span;
+    void *mapping;          /* non-NULL if the content is a mapped file */
+    size_t mapping_length;
+
+public:
+    PayloadSource();
+    ~PayloadSource();
+
+    /* the rolling digit pattern "0123456789..." */
+    void use_pattern();
+
+    /* the content of a file, mapped read-only and replayed over and over.
+       return false (with a message on stderr) if the file cannot be used. */
+    bool use_file(const char *path);
+
+    /* copy stream bytes [offset, offset+len) into "dst" */
+    void fill(char *dst, uint64_t offset, int len) const;
+
+    /* check that "src" matches stream bytes [offset, offset+len) */
+    bool verify(const char *src, uint64_t offset, int len) const;
+};
+
+class Workload
+{
+public:
+    int arrival_kind;
+    int size_kind;
+    double mean_interval;   /* mean message interval (in seconds) */
+    int mean_size;          /* mean message size (in bytes) */
+    double on_time;         /* mean "on" period of ARRIVAL_ONOFF (in seconds) */
+    double off_time;        /* mean "off" period of ARRIVAL_ONOFF */
+    double pareto_shape;    /* shape of the pareto distributions */
+    PayloadSource payload;
+    RdtRandom *rng;
+
+    double on_left;         /* time left in the current "on" period */
+
+public:
+    Workload(int arrival_kind, int size_kind, double mean_interval,
+	     int mean_size, RdtRandom *rng);
+
+    /* time until the next message arrives (in seconds) */
+    double next_interval();
+
+    /* size of the next message (in bytes, at least 1) */
+    int next_size();
+
+    /* print a one-line description of the workload */
+    void describe(FILE *fp);
+
+private:
+    double exponential(double mean);
+    double pareto(double mean);
+};
+
+#endif  /* _RDT_WORKLOAD_H_ */
@@ -5,25 +5,443 @@
 /**
  * This file is modified from emaxples/skeleton,
  * implement a DPDK application to construct and send UDP packets.
+ *
+ * Usage: basicfwd [EAL options] -- [--mode=send|gen|fwd|bench|lookup|sink]
+ *                                   [mode options]
+ *
+ *   send  construct and send a single UDP packet (the default)
+ *   gen   send UDP packets from a prebuilt template as fast as possible, or
+ *         at --rate packets per second, in bursts of --burst packets, over
+ *         --flows source ports, for --duration seconds (10 by default) or
+ *         --count packets; the payload is --size bytes, up to what a frame
+ *         of --mtu takes (1500 by default, up to 9000-odd for jumbo frames,
+ *         which are chains of mbufs beyond 2KB). With --gso the payload may
+ *         be up to 65507 bytes, each datagram sent as IP fragments. Every
+ *         payload carries the flow, a sequence number within the flow and
+ *         the TSC when it was built.
+ *   fwd   forward between port pairs (0 <-> 1, 2 <-> 3, ...) with --queues
+ *         RX/TX queue pairs per port (one per lcore by default), spread by
+ *         RSS, until interrupted or for --duration seconds.  Each lcore
+ *         has a TX queue of its own on every port, and the RX queues of a
+ *         port are spread over the lcores of its NUMA socket; the
+ *         placement, and the remote accesses it could not avoid, are
+ *         printed at start.  Packets come from a pool on the socket of
+ *         the port that receives them.  --prime=N injects N packets into every
+ *         queue at start, which keeps loopback devices busy.  Packets are
+ *         buffered per output port and sent in full bursts, or after
+ *         --drain microseconds (100 by default) when traffic is light.
+ *         With --stats=SECS, a "stats" line per port is printed on that
+ *         interval, with the counters of the forwarding lcores and of the
+ *         device (and its extended statistics with --xstats).
+ *         --workers=N runs a pipeline instead: an RX lcore receives on
+ *         every port and hands bursts over rings to N worker lcores, whose
+ *         rings a TX lcore drains; each port then has a single queue pair.
+ *         --work=CYCLES spins that long on every packet, in both models,
+ *         to stand for heavier per-packet processing.
+ *         --qos=FILE meters flows and shapes the output, on the lcores that
+ *         transmit, which share the rates evenly. The file has one item per
+ *         line ('#' starts a comment; rates in bytes/s, sizes in bytes):
+ *
+ *           meter <name> srtcm <cir> <cbs> <ebs> drop|mark
+ *           meter <name> trtcm <cir> <pir> <cbs> <pbs> drop|mark
+ *           port <rate> <burst>
+ *           class <id> <rate> <burst>
+ *           queue <class> <id> <rate> <burst> <limit in packets>
+ *           rule udp|tcp|any <dst port>|any <meter>|- <class> <queue>
+ *
+ *         A flow (an IPv4 5-tuple) gets the first rule that matches, and a
+ *         meter of its own from the rule's profile: "drop" drops red
+ *         packets, "mark" sets the DSCP to AF11/AF12/AF13 for green/yellow/
+ *         red. It is then queued in the shaper of the output port, where
+ *         class 0 has the highest priority and the queues of a class are
+ *         served in turn, each level within its token bucket (a rate of 0
+ *         does not limit). Other packets go to queue 0 of class 0.
+ *         --routes=FILE routes IPv4 packets instead of sending them to the
+ *         paired port: an exact match of the 5-tuple wins, then the
+ *         longest prefix of the destination. The next hop sets the output
+ *         port and both MAC addresses, and the TTL is decremented; packets
+ *         that are not IPv4, have no route or whose TTL expires are
+ *         dropped. The file has one item per line:
+ *
+ *           nexthop <id> <port> <dst mac> [<src mac>]
+ *           route <a.b.c.d>/<length> <nexthop>
+ *           flow <src ip> <dst ip> udp|tcp <src port> <dst port> <nexthop>
+ *
+ *         where the source MAC is the port's by default.
+ *         --power saves the CPU of idle lcores: after a run of empty
+ *         polls they pause, then sleep for growing periods, then wait for
+ *         an RX interrupt where the device has them (the workers and the
+ *         TX lcore of the pipeline keep sleeping); they poll again as
+ *         soon as packets come. The time they spent idle and the latency
+ *         it added are reported at exit.
+ *         --mtu=BYTES sets up the ports for jumbo frames, received and sent
+ *         as chains of mbufs. --gso cuts the UDP datagrams beyond the MTU
+ *         into IP fragments on the way out, and --gro (which implies it)
+ *         merges the fragments of every burst received back into
+ *         datagrams, so that the stages in between, routing and QoS
+ *         included, handle each datagram once.
+ *   bench run the forwarder offline: the main lcore feeds the packets of
+ *         the --pcap capture (or of the generator template when there is
+ *         none), --loops times over (1000 by default; a loop of the template
+ *         is 1024 packets over --flows flows), into the RX rings of port 0,
+ *         and collects them from the TX rings of port 1; the other lcores
+ *         forward, one per queue.  Both ports are made of rings by the
+ *         application, so it needs no NIC and no --vdev.  Reports packets
+ *         per second, cycles per packet and drops.
+ *   lookup time the route lookups on random tables of --sizes routes
+ *         (1000,100000,1000000 by default), with prefix lengths spread as
+ *         in an Internet routing table, and the exact-match table with as
+ *         many flows; needs no port.
+ *   sink  receive on every port, and count the packets, bytes, missing
+ *         and late sequence numbers of every UDP flow, and the one-way
+ *         latency from the TSC in the payloads of the generator, as a
+ *         histogram; --gro merges the fragments first. Given a second
+ *         lcore, it runs the generator there (with the gen options) on
+ *         port 0, and stops once the last packets arrived; otherwise it
+ *         runs for --duration seconds or until interrupted. The latency
+ *         only holds when both ends read the same TSC, as on one host.
+ *
+ * Without a NIC, the generator runs on a virtual device, e.g.
+ *   basicfwd --no-huge -m 256 --vdev=net_null0 -- --mode=gen --burst=32
+ * and the forwarder on a pair of loopback rings, e.g.
+ *   basicfwd -l 0-3 --no-huge -m 512 --vdev=net_ring0 --vdev=net_ring1 \
+ *            -- --mode=fwd --prime=256 --duration=10
+ * and the benchmark on nothing but memory, e.g.
+ *   basicfwd -l 0-2 --no-huge -m 512 -- --mode=bench --pcap=trace.pcap
+ * and the sink over a loopback ring fed by its own generator, e.g.
+ *   basicfwd -l 0-1 --no-huge -m 512 --vdev=net_ring0 \
+ *            -- --mode=sink --rate=1000000 --flows=16 --duration=10
  */
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
 #include <inttypes.h>
+#include <signal.h>
+#include <getopt.h>
+#include <arpa/inet.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_cycles.h>
 #include <rte_lcore.h>
 #include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_memcpy.h>
+#include <rte_malloc.h>
+#include <rte_ring.h>
+#include <rte_eth_ring.h>
+#include <rte_byteorder.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+#include <rte_meter.h>
+#include <rte_lpm.h>
+#include <rte_prefetch.h>
+#include <rte_interrupts.h>
+#include <rte_net.h>
+#include <rte_gso.h>
+#include <rte_gro.h>
 
 #define RX_RING_SIZE 1024
 #define TX_RING_SIZE 1024
 
-#define NUM_MBUFS 8191
-#define MBUF_CACHE_SIZE 250
 // #define BURST_SIZE 32
 #define BURST_SIZE 1 // Modify BURST_SIZE to 1
 #define PORT 777
 
+/* Largest burst the generator sends at once */
+#define MAX_BURST_SIZE 512
+
+/* Bursts the forwarder receives at once: the RX burst adapts to the load
+ * between the two, and the TX buffers send full bursts of the largest */
+#define FWD_MIN_BURST_SIZE 4
+#define FWD_BURST_SIZE 32
+
+/* Ring size of the ports of the benchmark, and how long it waits for the
+ * last packets once everything is fed */
+#define BENCH_RING_SIZE 1024
+#define BENCH_SETTLE_MS 1000
+
+/* Non-empty polls are counted by burst size in powers of two: 1, 2-3, 4-7,
+ * 8-15, 16-31 and 32 or more */
+#define BURST_HIST_SIZE 6
+
+/* RX queues one lcore can poll */
+#define MAX_RX_PER_LCORE 128
+
+/* Ring size between the stages of the pipeline */
+#define PIPE_RING_SIZE 1024
+
+/* Limits of the QoS file */
+#define QOS_MAX_METERS 16
+#define QOS_MAX_RULES 32
+#define QOS_MAX_CLASSES 8
+#define QOS_MAX_QUEUES 8
+#define QOS_MAX_QUEUE_LIMIT 65536
+#define QOS_DEFAULT_QUEUE_LIMIT 1024
+#define QOS_MAX_FLOWS 65536 /* per lcore */
+
+/* Limits of the routing file. Routes beyond the /24 of a DIR-24-8 table
+ * take a group of 256 second-level entries each */
+#define L3_MAX_NEXTHOPS 256
+#define L3_MAX_ROUTES (1 << 20)
+#define L3_MAX_FLOWS 65536
+#define L3_NUMBER_TBL8S (1 << 16)
+#define L3_DROP UINT16_MAX /* the output port of a dropped packet */
+
+/* Lookups timed at each table size by the lookup mode */
+#define L3_BENCH_LOOKUPS (1 << 22)
+#define L3_MAX_BENCH_SIZES 8
+
+/* Backoff of an idle lcore with --power, in rounds of polls of all its
+ * queues or rings that found nothing: it pauses after the first, sleeps
+ * after the second, from 1us doubling up to the longest sleep, and waits
+ * for an RX interrupt after the third, up to the timeout */
+#define POWER_PAUSE_ROUNDS 64
+#define POWER_SLEEP_ROUNDS 256
+#define POWER_INTR_ROUNDS 512
+#define POWER_MAX_SLEEP_US 256
+#define POWER_INTR_TIMEOUT_MS 10
+
+/* Largest MTU of --mtu, and most IP fragments a datagram is cut into by
+ * --gso (a 64KB datagram over a 1500-byte MTU takes 45) */
+#define MAX_MTU (RTE_ETHER_MAX_JUMBO_FRAME_LEN - RTE_ETHER_HDR_LEN - \
+				 RTE_ETHER_CRC_LEN)
+#define GSO_MAX_SEGS 128
+
+/* Flows the sink keeps apart, and lines of them in its report */
+#define SINK_MAX_FLOWS 65536
+#define SINK_REPORT_FLOWS 32
+
+/* One-way latency is counted in TSC cycles by buckets of 2^SINK_HIST_BITS
+ * per power of two (about 12% wide), from 0 up to 2^64 */
+#define SINK_HIST_BITS 3
+#define SINK_HIST_SIZE ((64 - SINK_HIST_BITS + 1) << SINK_HIST_BITS)
+
+/* How long the sink waits for the last packets of its generator */
+#define SINK_SETTLE_MS 100
+
+/* Marks the payload of the packets built by the generator */
+#define GEN_MAGIC 0x47454e32 /* "GEN2" */
+
+enum app_mode
+{
+	MODE_SEND,
+	MODE_GEN,
+	MODE_FWD,
+	MODE_BENCH,
+	MODE_LOOKUP,
+	MODE_SINK,
+};
+
+/* Application options, see the usage at the top */
+static enum app_mode app_mode = MODE_SEND;
+static double duration = -1;	/* seconds, 0 to run until interrupted */
+static uint16_t gen_burst = 32;
+static uint64_t gen_rate;	/* packets per second, 0 for as fast as possible */
+static uint64_t gen_count;	/* packets to send, 0 for no limit */
+static uint16_t gen_size = 64;	/* UDP payload bytes */
+static uint16_t gen_flows = 1;	/* source ports used, from PORT up */
+static uint16_t nb_queues;	/* RX/TX queue pairs per port, 0 for one per lcore */
+static uint16_t fwd_prime;	/* packets injected into every queue at start */
+static uint64_t fwd_drain_us = 100; /* longest wait of a buffered packet */
+static const char *bench_pcap;	/* capture the benchmark feeds, NULL for the template */
+static uint64_t bench_loops = 1000; /* times the capture is fed */
+static unsigned fwd_workers;	/* pipeline workers, 0 to run to completion */
+static uint64_t fwd_work_cycles; /* synthetic work per packet */
+static const char *qos_path;	/* QoS file, NULL for none */
+static const char *routes_path;	/* routing file, NULL to pair the ports */
+static uint32_t lookup_sizes[L3_MAX_BENCH_SIZES] = {1000, 100000, 1000000};
+static unsigned nb_lookup_sizes = 3;
+static double stats_interval;	/* seconds between stats lines, 0 for none */
+static bool stats_xstats;	/* add the extended statistics of the devices */
+static bool power_mode;		/* back off and sleep when idle */
+static uint16_t fwd_mtu = RTE_ETHER_MTU; /* IP bytes per frame */
+static bool fwd_gso;		/* cut UDP datagrams beyond the MTU into fragments */
+static bool fwd_gro;		/* merge the fragments received into datagrams */
+
+static volatile bool force_quit;
+
+/* When the forwarding lcores stop, 0 to run until interrupted */
+static uint64_t stop_tsc;
+
+/*
+ * Counters of the forwarder for one port on one lcore
+ */
+struct port_counters
+{
+	uint64_t rx_pkts;
+	uint64_t tx_pkts;
+	uint64_t polls;
+	uint64_t empty_polls;
+	uint64_t tx_dropped; /* on a full TX ring, counted at the output port */
+	uint64_t cycles;	 /* TSC cycles spent on the non-empty polls */
+	uint64_t burst_hist[BURST_HIST_SIZE];
+};
+
+/*
+ * Counters of the L3 stage on one lcore
+ */
+struct l3_counters
+{
+	uint64_t flow_hits; /* routed by the exact-match table */
+	uint64_t lpm_hits;	/* routed by a prefix */
+	uint64_t no_route;
+	uint64_t not_ipv4;
+	uint64_t ttl_expired;
+};
+
+/*
+ * Idle state of an lcore with --power, with what it saved and cost
+ */
+struct idle_counters
+{
+	uint64_t pauses;
+	uint64_t sleeps;
+	uint64_t intr_waits;	  /* waits for an RX interrupt */
+	uint64_t intr_wakeups;	  /* of those, ended by an interrupt */
+	uint64_t idle_cycles;	  /* asleep or waiting, off the CPU */
+	uint64_t wakes;			  /* sleeps or waits ended by traffic */
+	uint64_t wake_cycles;	  /* latency they added, summed */
+	uint64_t max_wake_cycles;
+};
+
+/*
+ * Counters of the segmentation and coalescing stages on one lcore
+ */
+struct seg_counters
+{
+	uint64_t gro_in;	 /* packets into GRO */
+	uint64_t gro_out;	 /* packets out of it, merged or not */
+	uint64_t gso_in;	 /* datagrams cut by GSO */
+	uint64_t gso_out;	 /* fragments they were cut into */
+	uint64_t gso_failed; /* could not be cut, dropped */
+	uint64_t too_big;	 /* beyond the MTU and not UDP/IPv4, dropped */
+};
+
+struct idle_state
+{
+	unsigned empty_rounds; /* in a row, up to POWER_INTR_ROUNDS */
+	unsigned sleep_us;	   /* of the next sleep */
+	bool intr;			   /* RX interrupts are set up on every port */
+	bool waited_intr;	   /* the last wait was for an interrupt */
+	uint64_t last_sleep;   /* cycles */
+	uint64_t wake_tsc;	   /* when the last interrupt wait ended */
+	struct idle_counters c;
+};
+
+/*
+ * Per-lcore state of the forwarder. Each lcore only writes to its own
+ * entry, and entries are cache aligned, so no cache line is shared between
+ * lcores on the forwarding path.
+ */
+enum lcore_role
+{
+	ROLE_FWD,	 /* run to completion on its queue of every port */
+	ROLE_RX,	 /* pipeline: receive on every port */
+	ROLE_WORKER, /* pipeline: process */
+	ROLE_TX,	 /* pipeline: send on every port */
+};
+
+/* Suffixes of the lcores in the exit table */
+static const char *const lcore_role_names[] = {"", "/rx", "/w", "/tx"};
+
+/* An RX queue of an lcore, with its current RX burst */
+struct rx_queue
+{
+	uint16_t port;
+	uint16_t queue;
+	uint16_t burst;
+};
+
+struct lcore_conf
+{
+	bool enabled;
+	enum lcore_role role;
+	uint16_t queue;	 /* its TX queue on every port */
+	uint16_t worker; /* the index of a pipeline worker */
+	uint16_t nb_rxq;
+	struct rx_queue rxq[MAX_RX_PER_LCORE]; /* the RX queues it polls */
+	struct rte_eth_dev_tx_buffer *tx_buffer[RTE_MAX_ETHPORTS];
+	struct port_counters port[RTE_MAX_ETHPORTS];
+	struct qos_ctx *qos; /* NULL without --qos */
+	struct l3_counters l3;
+	struct idle_state idle; /* with --power */
+	struct rte_gso_ctx gso; /* with --gso */
+	struct seg_counters seg;
+} __rte_cache_aligned;
+
+static struct lcore_conf lcore_conf[RTE_MAX_LCORE];
+
+/* Lcores that forward, whatever their role */
+static unsigned nb_fwd_lcores;
+
+/*
+ * A ring between two stages of the pipeline, with the statistics its
+ * producer keeps: the occupancy is sampled at every enqueue
+ */
+struct pipe_ring
+{
+	struct rte_ring *ring;
+	unsigned capacity;
+	uint64_t enqueued;
+	uint64_t dropped; /* the ring was full */
+	uint64_t samples;
+	uint64_t occupancy_sum;
+	unsigned max_occupancy;
+} __rte_cache_aligned;
+
+/* From the RX lcore to every worker, and from every worker to the TX lcore */
+static struct pipe_ring pipe_in[RTE_MAX_LCORE];
+static struct pipe_ring pipe_out[RTE_MAX_LCORE];
+
+/* The mbuf pool of every socket with ports, for what they receive, and
+ * with --gso the pool of the indirect mbufs that fragments are made of */
+static struct rte_mempool *socket_pools[RTE_MAX_NUMA_NODES];
+static struct rte_mempool *indirect_pools[RTE_MAX_NUMA_NODES];
+
+/* The socket of a port, that of the main lcore if the device has none */
+static int
+port_socket(uint16_t port)
+{
+	const int socket = rte_eth_dev_socket_id(port);
+
+	return socket >= 0 ? socket
+					   : (int)rte_lcore_to_socket_id(rte_get_main_lcore());
+}
+
+static struct rte_mempool *
+port_pool(uint16_t port)
+{
+	return socket_pools[port_socket(port)];
+}
+
+/* Sockets with a pool: beyond one, a TX queue frees mbufs of several */
+static unsigned
+nb_socket_pools(void)
+{
+	unsigned socket, n = 0;
+
+	for (socket = 0; socket < RTE_MAX_NUMA_NODES; socket++)
+		if (socket_pools[socket] != NULL)
+			n++;
+	return n;
+}
+
+/* The largest frame of the MTU, CRC included */
+static inline uint32_t
+fwd_frame_len(void)
+{
+	return fwd_mtu + RTE_ETHER_HDR_LEN + RTE_ETHER_CRC_LEN;
+}
+
+/* When the next stats line is due, in TSC cycles */
+static uint64_t stats_next_tsc;
+static void stats_report(uint64_t now);
+
 static const struct rte_eth_conf port_conf_default = {
 	.rxmode = {
 		.max_rx_pkt_len = RTE_ETHER_MAX_LEN,
@@ -34,13 +452,14 @@ static const struct rte_eth_conf port_conf_default = {
 
 /*
  * Initializes a given port using global settings and with the RX buffers
- * coming from the mbuf_pool passed as a parameter.
+ * coming from the mbuf_pool passed as a parameter. With more than one
+ * queue pair, RSS spreads the received packets over the RX queues.
  */
 static inline int
-port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+port_init(uint16_t port, struct rte_mempool *mbuf_pool, uint16_t nb_rings)
 {
 	struct rte_eth_conf port_conf = port_conf_default;
-	const uint16_t rx_rings = 1, tx_rings = 1;
+	const uint16_t rx_rings = nb_rings, tx_rings = nb_rings;
 	uint16_t nb_rxd = RX_RING_SIZE;
 	uint16_t nb_txd = TX_RING_SIZE;
 	int retval;
@@ -59,10 +478,69 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 		return retval;
 	}
 
-	if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
+	/* Fast free needs every mbuf of a queue from one pool with no other
+	 * reference, which GSO fragments (indirect mbufs) and the pools of
+	 * several sockets break. */
+	if ((dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) &&
+		!fwd_gso && nb_socket_pools() == 1)
 		port_conf.txmode.offloads |=
 			DEV_TX_OFFLOAD_MBUF_FAST_FREE;
 
+	/* Jumbo frames: the device must take them, and chain mbufs where a
+	 * frame does not fit in one. Software devices take anything and have
+	 * none of these offloads. */
+	if (fwd_mtu > RTE_ETHER_MTU)
+	{
+		if (dev_info.max_rx_pktlen < fwd_frame_len())
+		{
+			printf("Port %u takes frames of %u bytes at most, %u needed\n",
+			       port, dev_info.max_rx_pktlen, fwd_frame_len());
+			return -EINVAL;
+		}
+		if (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_JUMBO_FRAME)
+		{
+			port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_JUMBO_FRAME;
+			port_conf.rxmode.max_rx_pkt_len = fwd_frame_len();
+		}
+	}
+	if (fwd_frame_len() > (uint32_t)rte_pktmbuf_data_room_size(mbuf_pool) -
+							  RTE_PKTMBUF_HEADROOM)
+	{
+		if (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_SCATTER)
+			port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_SCATTER;
+		else
+			printf("Port %u cannot chain mbufs on RX: frames beyond one "
+			       "mbuf may be dropped\n", port);
+	}
+	if ((fwd_mtu > RTE_ETHER_MTU || fwd_gso) &&
+		(dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS))
+		port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+
+	if (rx_rings > dev_info.max_rx_queues || tx_rings > dev_info.max_tx_queues)
+	{
+		printf("Port %u supports %u RX and %u TX queues, %u requested\n",
+		       port, dev_info.max_rx_queues, dev_info.max_tx_queues, rx_rings);
+		return -EINVAL;
+	}
+
+	/* Hash on addresses and ports, as far as the device can. */
+	if (rx_rings > 1)
+	{
+		port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+		port_conf.rx_adv_conf.rss_conf.rss_hf =
+			(ETH_RSS_IP | ETH_RSS_UDP | ETH_RSS_TCP) &
+			dev_info.flow_type_rss_offloads;
+		if (port_conf.rx_adv_conf.rss_conf.rss_hf != 0)
+			port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+		else
+			printf("Port %u has no RSS: each RX queue only gets what "
+			       "the device puts on it\n", port);
+	}
+
+	/* Idle lcores may wait for RX interrupts. */
+	if (power_mode)
+		port_conf.intr_conf.rxq = 1;
+
 	/* Configure the Ethernet device. */
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
 	if (retval != 0)
@@ -110,200 +588,4095 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 		   addr.addr_bytes[2], addr.addr_bytes[3],
 		   addr.addr_bytes[4], addr.addr_bytes[5]);
 
-	/* Enable RX in promiscuous mode for the Ethernet device. */
+	/* Enable RX in promiscuous mode for the Ethernet device.  Virtual
+	 * devices may not support it, which does not matter to them. */
 	retval = rte_eth_promiscuous_enable(port);
-	if (retval != 0)
+	if (retval != 0 && retval != -ENOTSUP)
 		return retval;
 
 	return 0;
 }
 
+/* Add the replacement of the 16-bit word "old" by "new" to a partial
+ * one's complement sum */
+static inline uint32_t
+cksum_replace(uint32_t sum, uint16_t old, uint16_t new)
+{
+	return sum + (uint16_t)~old + new;
+}
+
+static inline uint16_t
+cksum_fold(uint32_t sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
 /*
- * The lcore main. This is the main thread that does the work, reading from
- * an input port and writing to an output port.
+ * The 5-tuple of an IPv4 packet, in network byte order; the ports are 0
+ * for other protocols and fragments
  */
-static __rte_noreturn void
-lcore_main(void)
+struct flow_key
 {
-	uint16_t port;
+	uint32_t src_ip;
+	uint32_t dst_ip;
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint8_t proto;
+	uint8_t pad[3];
+};
 
-	/*
-	 * Check that the port is on the same NUMA node as the polling thread
-	 * for best performance.
-	 */
-	RTE_ETH_FOREACH_DEV(port)
-	if (rte_eth_dev_socket_id(port) >= 0 &&
-		rte_eth_dev_socket_id(port) !=
-			(int)rte_socket_id())
-		printf("WARNING, port %u is on remote NUMA node to "
-			   "polling thread.\n\tPerformance will "
-			   "not be optimal.\n",
-			   port);
+/*
+ * Read the 5-tuple of a packet; return its IPv4 header, or NULL (and a key
+ * of zeros) if it is not IPv4
+ */
+static inline struct rte_ipv4_hdr *
+parse_flow_key(struct rte_mbuf *m, struct flow_key *key)
+{
+	struct rte_ether_hdr *eth = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
+	struct rte_ipv4_hdr *ip;
+	unsigned ihl;
 
-	printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n",
-		   rte_lcore_id());
+	memset(key, 0, sizeof(*key));
+	if (eth->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) ||
+		m->data_len < sizeof(*eth) + sizeof(struct rte_ipv4_hdr))
+		return NULL;
 
-	/* Run until the application is quit or killed. */
-	for (;;)
+	ip = (struct rte_ipv4_hdr *)(eth + 1);
+	ihl = (ip->version_ihl & 0xf) * 4;
+	key->src_ip = ip->src_addr;
+	key->dst_ip = ip->dst_addr;
+	key->proto = ip->next_proto_id;
+	if ((key->proto == IPPROTO_UDP || key->proto == IPPROTO_TCP) &&
+		m->data_len >= sizeof(*eth) + ihl + 4 &&
+		(ip->fragment_offset &
+		 rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK)) == 0)
 	{
-		/*
-		 * Receive packets on a port and forward them on the paired
-		 * port. The mapping is 0 -> 1, 1 -> 0, 2 -> 3, 3 -> 2, etc.
-		 */
-		RTE_ETH_FOREACH_DEV(port)
-		{
+		const uint8_t *l4 = (const uint8_t *)ip + ihl;
+		memcpy(&key->src_port, l4, 2);
+		memcpy(&key->dst_port, l4 + 2, 2);
+	}
+	return ip;
+}
 
-			/* Get burst of RX packets, from first port of pair. */
-			struct rte_mbuf *bufs[BURST_SIZE];
-			const uint16_t nb_rx = rte_eth_rx_burst(port, 0,
-													bufs, BURST_SIZE);
+/*
+ * Large UDP datagrams, with --gro and --gso. The IP fragments received in
+ * a burst are merged back into their datagrams, chains of mbufs that the
+ * stages after handle once instead of once per fragment, and datagrams
+ * beyond the MTU are cut into fragments again on the way out. Both only
+ * know UDP over IPv4: other packets go through as they are, or are dropped
+ * when they are too big to send.
+ */
 
-			if (unlikely(nb_rx == 0))
-				continue;
+/* Up to a burst of datagrams in a burst, of up to a burst of fragments */
+static const struct rte_gro_param gro_param = {
+	.gro_types = RTE_GRO_UDP_IPV4,
+	.max_flow_num = FWD_BURST_SIZE,
+	.max_item_per_flow = FWD_BURST_SIZE,
+};
 
-			/* Send burst of TX packets, to second port of pair. */
-			const uint16_t nb_tx = rte_eth_tx_burst(port ^ 1, 0,
-													bufs, nb_rx);
+static inline void
+ipv4_set_cksum(struct rte_mbuf *m, uint16_t l2_len)
+{
+	struct rte_ipv4_hdr *ip =
+		rte_pktmbuf_mtod_offset(m, struct rte_ipv4_hdr *, l2_len);
 
-			/* Free any unsent packets. */
-			if (unlikely(nb_tx < nb_rx))
-			{
-				uint16_t buf;
-				for (buf = nb_tx; buf < nb_rx; buf++)
-					rte_pktmbuf_free(bufs[buf]);
-			}
-		}
+	ip->hdr_checksum = 0;
+	ip->hdr_checksum = rte_ipv4_cksum(ip);
+}
+
+/*
+ * Merge the fragments of a received burst, in place; return the packets
+ * left. GRO wants the packet types and header lengths, which the devices
+ * may not set, and leaves the IP checksum of what it merged to the NIC.
+ */
+static uint16_t
+fwd_gro_burst(struct lcore_conf *conf, struct rte_mbuf **bufs, uint16_t n)
+{
+	struct rte_net_hdr_lens hdr_lens;
+	uint16_t i, nb;
+
+	for (i = 0; i < n; i++)
+	{
+		bufs[i]->packet_type =
+			rte_net_get_ptype(bufs[i], &hdr_lens, RTE_PTYPE_ALL_MASK);
+		bufs[i]->l2_len = hdr_lens.l2_len;
+		bufs[i]->l3_len = hdr_lens.l3_len;
+		bufs[i]->l4_len = hdr_lens.l4_len;
 	}
+	nb = rte_gro_reassemble_burst(bufs, n, &gro_param);
+	if (nb < n)
+		for (i = 0; i < nb; i++)
+			if (bufs[i]->nb_segs > 1 &&
+				RTE_ETH_IS_IPV4_HDR(bufs[i]->packet_type))
+				ipv4_set_cksum(bufs[i], bufs[i]->l2_len);
+	conf->seg.gro_in += n;
+	conf->seg.gro_out += nb;
+	return nb;
 }
 
-/**
- * Send UDP packet
+/* The GSO context of an lcore, on the pools of its socket, or of the
+ * socket of port 0 if it has none */
+static void
+gso_init(struct rte_gso_ctx *ctx, unsigned lcore_id)
+{
+	unsigned socket = rte_lcore_to_socket_id(lcore_id);
+
+	if (socket_pools[socket] == NULL)
+		socket = port_socket(0);
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->direct_pool = socket_pools[socket];
+	ctx->indirect_pool = indirect_pools[socket];
+	ctx->gso_types = DEV_TX_OFFLOAD_UDP_TSO;
+	ctx->gso_size = fwd_mtu + RTE_ETHER_HDR_LEN;
+}
+
+/*
+ * Cut a datagram beyond the MTU into IP fragments, each with its header
+ * checksum; return how many are in "segs", 0 if the pools ran out, or -1
+ * if it is not UDP over IPv4. Once cut, the fragments hold the only
+ * references to the datagram.
  */
-void send_udp(struct rte_mempool *mbuf_pool)
+static int
+gso_udp(struct rte_gso_ctx *ctx, struct rte_mbuf *m, struct rte_mbuf **segs)
 {
-	uint16_t port = 0;
+	struct rte_net_hdr_lens hdr_lens;
+	uint32_t ptype;
+	int nb, i;
 
-	// Send a packets to physical machine
-	printf("Start send packet\n");
-	struct rte_mbuf *bufs[BURST_SIZE];
-	int retval = rte_pktmbuf_alloc_bulk(mbuf_pool, bufs, BURST_SIZE);
-	if (retval != 0)
-		printf("mbufs alloc failed\n");
-	construct_udp_pkt(port, bufs, 0);
-	/* Send burst of TX packets. */
-	const uint16_t nb_tx = rte_eth_tx_burst(port, 0,
-											bufs, BURST_SIZE);
+	ptype = rte_net_get_ptype(m, &hdr_lens, RTE_PTYPE_ALL_MASK);
+	if (!RTE_ETH_IS_IPV4_HDR(ptype) ||
+		(ptype & RTE_PTYPE_L4_MASK) != RTE_PTYPE_L4_UDP)
+		return -1;
+	m->l2_len = hdr_lens.l2_len;
+	m->l3_len = hdr_lens.l3_len;
+	m->l4_len = hdr_lens.l4_len;
+	m->ol_flags |= PKT_TX_IPV4 | PKT_TX_UDP_SEG;
 
-	/* Free any unsent packets. */
-	if (unlikely(nb_tx < BURST_SIZE))
+	nb = rte_gso_segment(m, ctx, segs, GSO_MAX_SEGS);
+	if (nb <= 0)
 	{
-		uint16_t buf;
-		for (buf = nb_tx; buf < BURST_SIZE; buf++)
-			rte_pktmbuf_free(bufs[buf]);
+		m->ol_flags &= ~PKT_TX_UDP_SEG;
+		return 0;
 	}
-	printf("Send finished!\n");
+	for (i = 0; i < nb; i++)
+		ipv4_set_cksum(segs[i], hdr_lens.l2_len);
+	return nb;
 }
 
-/**
- * Construct UDP packet
+/*
+ * Buffer a packet for "port", cut into fragments first when it is beyond
+ * the MTU with --gso; return the packets the buffer sent
  */
-void construct_udp_pkt(int port, struct rte_mbuf **bufs, int i)
+static inline uint16_t
+fwd_tx(struct lcore_conf *conf, uint16_t port, uint16_t queue,
+	   struct rte_mbuf *m)
 {
-	char hello_msg[64];
-	memset(hello_msg, 0, 64);
-	strcpy(hello_msg, "This is a message from VM.");
-	char *content = rte_pktmbuf_append(bufs[i], 64);
-	rte_memcpy(content, hello_msg, 64);
-
-	printf("Finish create message.\n");
+	struct rte_eth_dev_tx_buffer *buffer = conf->tx_buffer[port];
+	struct rte_mbuf *segs[GSO_MAX_SEGS];
+	uint16_t sent = 0;
+	int nb, i;
 
-	// Construct UDP Header
-	/* The length contains both udp header and the length of data. */
-	unsigned int udp_pkt_len = 64 + 8;
-	struct rte_udp_hdr *udp_hdr;
-	udp_hdr = (struct rte_udp_hdr *)rte_pktmbuf_prepend(bufs[i], sizeof(struct rte_udp_hdr));
-	udp_hdr->src_port = rte_cpu_to_be_16(PORT);
-	udp_hdr->dst_port = rte_cpu_to_be_16(PORT);
-	udp_hdr->dgram_len = rte_cpu_to_be_16(udp_pkt_len);
-	udp_hdr->dgram_cksum = 0;
-	printf("Udp header part finished.\n");
+	if (likely(!fwd_gso ||
+			   m->pkt_len <= (uint32_t)(fwd_mtu + RTE_ETHER_HDR_LEN)))
+		return rte_eth_tx_buffer(port, queue, buffer, m);
 
-	// Construct IPv4 Header
-	struct rte_ipv4_hdr *ip_hdr;
-	ip_hdr = (struct rte_ipv4_hdr *)rte_pktmbuf_prepend(bufs[i], sizeof(struct rte_ipv4_hdr));
-	ip_hdr->dst_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 80, 1));
-	ip_hdr->src_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 80, 10));
-	ip_hdr->version_ihl = 0x45;
-	ip_hdr->total_length = rte_cpu_to_be_16(udp_pkt_len + sizeof(struct rte_ipv4_hdr));
-	ip_hdr->next_proto_id = IPPROTO_UDP;
-	ip_hdr->time_to_live = 0xa;
-	ip_hdr->hdr_checksum = rte_ipv4_cksum(ip_hdr);
-	printf("IPv4 header part finished.\n");
+	nb = gso_udp(&conf->gso, m, segs);
+	if (unlikely(nb <= 0))
+	{
+		if (nb < 0)
+			conf->seg.too_big++;
+		else
+			conf->seg.gso_failed++;
+		rte_pktmbuf_free(m);
+		return 0;
+	}
+	conf->seg.gso_in++;
+	conf->seg.gso_out += nb;
+	for (i = 0; i < nb; i++)
+		sent += rte_eth_tx_buffer(port, queue, buffer, segs[i]);
+	return sent;
+}
 
-	// Destination MAC address
-	// The physical address can be obtained by viewing the network adapter corresponding to the virtual machine on the physical machine.
-	struct rte_ether_addr s_addr, d_addr;
-	rte_eth_macaddr_get(port, &s_addr);
-	d_addr.addr_bytes[0] = 0x00;
-	d_addr.addr_bytes[1] = 0x50;
-	d_addr.addr_bytes[2] = 0x56;
-	d_addr.addr_bytes[3] = 0xC0;
-	d_addr.addr_bytes[4] = 0x00;
-	d_addr.addr_bytes[5] = 0x02;
+/*
+ * Append "len" bytes to a packet, chaining mbufs from its pool as each
+ * fills up; return false if the pool ran out, the packet then holds part
+ * of the data
+ */
+static bool
+mbuf_append(struct rte_mbuf *m, const void *data, uint32_t len)
+{
+	struct rte_mbuf *last = rte_pktmbuf_lastseg(m);
+	const uint8_t *p = data;
 
-	// Construct Ethernet Header
-	struct rte_ether_hdr *ether_hdr;
-	ether_hdr = (struct rte_ether_hdr *)rte_pktmbuf_prepend(bufs[i], sizeof(struct rte_ether_hdr));
-	ether_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+	while (len > 0)
+	{
+		uint16_t n = RTE_MIN(len, (uint32_t)rte_pktmbuf_tailroom(last));
 
-	// Copy
-	rte_ether_addr_copy(&ether_hdr->s_addr, &s_addr);
-	rte_ether_addr_copy(&ether_hdr->d_addr, &d_addr);
+		if (n == 0)
+		{
+			struct rte_mbuf *seg = rte_pktmbuf_alloc(m->pool);
 
-	printf("Ethernet header part finished.\n");
+			if (seg == NULL || rte_pktmbuf_chain(m, seg) != 0)
+			{
+				rte_pktmbuf_free(seg);
+				return false;
+			}
+			last = seg;
+			continue;
+		}
+		rte_memcpy(rte_pktmbuf_mtod_offset(last, uint8_t *, last->data_len),
+				   p, n);
+		last->data_len += n;
+		m->pkt_len += n;
+		p += n;
+		len -= n;
+	}
+	return true;
 }
+
 /*
- * The main function, which does initialization and calls the per-lcore
- * functions.
+ * QoS of the forwarder, see the format of --qos at the top. Every
+ * transmitting lcore has a context of its own: the meters of the flows it
+ * sees, and a shaper per output port whose rates are its share of those of
+ * the file. The meters are exact as long as RSS keeps each flow on one
+ * lcore.
  */
-int main(int argc, char *argv[])
+
+/* Token bucket: "rate" bytes per second up to "size" bytes; a rate of 0
+ * never limits. The tokens are bytes times the TSC frequency, so that a
+ * refill is a multiplication. */
+struct token_bucket
 {
-	struct rte_mempool *mbuf_pool;
-	unsigned nb_ports = 1;
-	uint16_t portid;
+	uint64_t rate;
+	uint64_t size;
+	uint64_t tokens;
+	uint64_t max;
+	uint64_t last_tsc;
+};
 
-	/* Initialize the Environment Abstraction Layer (EAL). */
-	int ret = rte_eal_init(argc, argv);
-	if (ret < 0)
-		rte_exit(EXIT_FAILURE, "Error with EAL initialization\n");
+struct qos_meter_conf
+{
+	char name[32];
+	bool trtcm;
+	bool mark; /* mark the colour in the DSCP instead of dropping red */
+	struct rte_meter_srtcm_profile srtcm;
+	struct rte_meter_trtcm_profile trtcm_profile;
+};
 
-	argc -= ret;
-	argv += ret;
+struct qos_rule
+{
+	uint8_t proto;	  /* IPPROTO_UDP or IPPROTO_TCP, 0 for any */
+	int32_t dst_port; /* -1 for any */
+	int meter;		  /* -1 for none */
+	uint8_t class_id;
+	uint8_t queue;
+};
 
-	/* Check that there is an even number of ports to send/receive on. */
-	// nb_ports = rte_eth_dev_count_avail();
-	// if (nb_ports < 2 || (nb_ports & 1))
-	// 	rte_exit(EXIT_FAILURE, "Error: number of ports must be even\n");
+struct qos_class_conf
+{
+	struct token_bucket tb;
+	unsigned nb_queues;
+	struct token_bucket queue_tb[QOS_MAX_QUEUES];
+	uint32_t queue_limit[QOS_MAX_QUEUES]; /* packets, 0 if not declared */
+};
 
-	/* Creates a new mempool in memory to hold the mbufs. */
-	mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * nb_ports,
-										MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+struct qos_conf
+{
+	struct qos_meter_conf meters[QOS_MAX_METERS];
+	unsigned nb_meters;
+	struct qos_rule rules[QOS_MAX_RULES + 1]; /* the last is the default */
+	unsigned nb_rules;
+	struct token_bucket port;
+	struct qos_class_conf classes[QOS_MAX_CLASSES];
+	unsigned nb_classes;
+};
 
-	if (mbuf_pool == NULL)
-		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+/* NULL without --qos */
+static struct qos_conf *qos_conf;
+static uint64_t qos_tsc_hz;
 
-	/* Initialize all ports. */
-	RTE_ETH_FOREACH_DEV(portid)
-	if (port_init(portid, mbuf_pool) != 0)
-		rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu16 "\n",
-				 portid);
+/* DSCP of the packets marked green, yellow and red: AF11, AF12, AF13 */
+static const uint8_t qos_dscp[RTE_COLORS] = {10, 12, 14};
 
-	if (rte_lcore_count() > 1)
-		printf("\nWARNING: Too many lcores enabled. Only 1 used.\n");
+struct qos_flow
+{
+	unsigned rule;
+	union
+	{
+		struct rte_meter_srtcm srtcm;
+		struct rte_meter_trtcm trtcm;
+	};
+};
+
+/* A FIFO of the shaper, and the buckets above it */
+struct qos_queue
+{
+	struct token_bucket tb;
+	struct rte_mbuf **slots;
+	uint32_t limit;
+	uint32_t head;
+	uint32_t count;
+};
 
-	/* Call lcore_main on the main core only. */
-	// lcore_main();
-	send_udp(mbuf_pool);
+struct qos_class
+{
+	struct token_bucket tb;
+	struct qos_queue queues[QOS_MAX_QUEUES];
+	unsigned nb_queues;
+	unsigned next; /* the queue served first next time */
+	uint32_t backlog;
+};
+
+struct qos_shaper
+{
+	struct token_bucket tb;
+	struct qos_class classes[QOS_MAX_CLASSES];
+	uint32_t backlog;
+};
+
+struct qos_counters
+{
+	uint64_t color[QOS_MAX_RULES + 1][RTE_COLORS];
+	uint64_t meter_dropped;
+	uint64_t enqueued[QOS_MAX_CLASSES][QOS_MAX_QUEUES];
+	uint64_t tail_dropped[QOS_MAX_CLASSES][QOS_MAX_QUEUES];
+	uint64_t sent[QOS_MAX_CLASSES][QOS_MAX_QUEUES];
+};
+
+struct qos_ctx
+{
+	struct rte_hash *flow_table;
+	struct qos_flow *flows; /* indexed by the position in the table */
+	struct qos_flow rule_flows[QOS_MAX_RULES + 1]; /* for the flows that do
+													* not fit in the table */
+	struct qos_shaper *shaper[RTE_MAX_ETHPORTS];
+	struct qos_counters c;
+};
+
+static void
+tb_init(struct token_bucket *tb, const struct token_bucket *conf,
+		unsigned share, uint64_t now)
+{
+	tb->rate = conf->rate / share;
+	if (conf->rate != 0 && tb->rate == 0)
+		tb->rate = 1;
+	tb->size = conf->size;
+	tb->max = tb->size * qos_tsc_hz;
+	tb->tokens = tb->max;
+	tb->last_tsc = now;
+}
+
+static inline void
+tb_refill(struct token_bucket *tb, uint64_t now)
+{
+	const uint64_t delta = now - tb->last_tsc;
+
+	tb->last_tsc = now;
+	if (tb->rate == 0)
+		return;
+	/* compare before multiplying, delta * rate can overflow */
+	if (delta >= (tb->max - tb->tokens) / tb->rate)
+		tb->tokens = tb->max;
+	else
+		tb->tokens += delta * tb->rate;
+}
+
+static inline bool
+tb_allows(const struct token_bucket *tb, uint32_t len)
+{
+	return tb->rate == 0 || tb->tokens >= (uint64_t)len * qos_tsc_hz;
+}
+
+static inline void
+tb_consume(struct token_bucket *tb, uint32_t len)
+{
+	if (tb->rate != 0)
+		tb->tokens -= (uint64_t)len * qos_tsc_hz;
+}
+
+/* The first rule that matches a flow */
+static unsigned
+qos_match(const struct flow_key *key)
+{
+	unsigned i;
+
+	for (i = 0; i < qos_conf->nb_rules; i++)
+	{
+		const struct qos_rule *r = &qos_conf->rules[i];
+		if ((r->proto == 0 || r->proto == key->proto) &&
+			(r->dst_port < 0 ||
+			 (key->proto != 0 &&
+			  r->dst_port == rte_be_to_cpu_16(key->dst_port))))
+			return i;
+	}
+	return qos_conf->nb_rules;
+}
+
+static void
+qos_flow_init(struct qos_flow *f, unsigned rule)
+{
+	const int meter = qos_conf->rules[rule].meter;
+
+	f->rule = rule;
+	if (meter < 0)
+		return;
+	if (qos_conf->meters[meter].trtcm)
+		rte_meter_trtcm_config(&f->trtcm,
+							   &qos_conf->meters[meter].trtcm_profile);
+	else
+		rte_meter_srtcm_config(&f->srtcm, &qos_conf->meters[meter].srtcm);
+}
+
+/* Set the DSCP of an IPv4 header, keeping the checksum right */
+static inline void
+qos_mark(struct rte_ipv4_hdr *ip, uint8_t dscp)
+{
+	uint16_t old, new;
+
+	memcpy(&old, ip, sizeof(old));
+	ip->type_of_service = (dscp << 2) | (ip->type_of_service & 3);
+	memcpy(&new, ip, sizeof(new));
+	ip->hdr_checksum = cksum_fold(cksum_replace((uint16_t)~ip->hdr_checksum,
+												old, new));
+}
+
+/*
+ * The flow of a packet, created on its first packet; the IPv4 header is
+ * returned in "ipp", NULL if there is none
+ */
+static inline struct qos_flow *
+qos_classify(struct qos_ctx *ctx, struct rte_mbuf *m,
+			 struct rte_ipv4_hdr **ipp)
+{
+	struct flow_key key;
+	unsigned rule;
+	int32_t pos;
+
+	*ipp = parse_flow_key(m, &key);
+	pos = rte_hash_lookup(ctx->flow_table, &key);
+	if (likely(pos >= 0))
+		return &ctx->flows[pos];
+
+	rule = qos_match(&key);
+	pos = rte_hash_add_key(ctx->flow_table, &key);
+	if (pos < 0)
+		return &ctx->rule_flows[rule];
+	qos_flow_init(&ctx->flows[pos], rule);
+	return &ctx->flows[pos];
+}
+
+/*
+ * Meter a packet and queue it in the shaper of its output port, or drop
+ * it
+ */
+static inline void
+qos_enqueue(struct qos_ctx *ctx, uint16_t port, struct rte_mbuf *m,
+			uint64_t now)
+{
+	struct rte_ipv4_hdr *ip;
+	struct qos_flow *f = qos_classify(ctx, m, &ip);
+	const struct qos_rule *r = &qos_conf->rules[f->rule];
+	struct qos_class *cl;
+	struct qos_queue *q;
+
+	if (r->meter >= 0)
+	{
+		struct qos_meter_conf *mc = &qos_conf->meters[r->meter];
+		enum rte_color color;
+
+		if (mc->trtcm)
+			color = rte_meter_trtcm_color_blind_check(&f->trtcm,
+													  &mc->trtcm_profile,
+													  now, m->pkt_len);
+		else
+			color = rte_meter_srtcm_color_blind_check(&f->srtcm, &mc->srtcm,
+													  now, m->pkt_len);
+		ctx->c.color[f->rule][color]++;
+		if (mc->mark)
+		{
+			if (ip != NULL)
+				qos_mark(ip, qos_dscp[color]);
+		}
+		else if (color == RTE_COLOR_RED)
+		{
+			ctx->c.meter_dropped++;
+			rte_pktmbuf_free(m);
+			return;
+		}
+	}
+
+	cl = &ctx->shaper[port]->classes[r->class_id];
+	q = &cl->queues[r->queue];
+	if (unlikely(q->count == q->limit))
+	{
+		ctx->c.tail_dropped[r->class_id][r->queue]++;
+		rte_pktmbuf_free(m);
+		return;
+	}
+	q->slots[(q->head + q->count) % q->limit] = m;
+	q->count++;
+	cl->backlog++;
+	ctx->shaper[port]->backlog++;
+	ctx->c.enqueued[r->class_id][r->queue]++;
+}
+
+/*
+ * Send what the shaper of a port lets go, up to a burst: classes in strict
+ * priority order (class 0 first), the queues of a class in turn. A class or
+ * queue out of tokens lets the others pass; a port out of tokens stops.
+ * Return the packets the TX buffer sent.
+ */
+static inline uint16_t
+qos_dequeue(struct lcore_conf *conf, uint16_t port, uint16_t queue,
+			uint64_t now)
+{
+	struct qos_ctx *ctx = conf->qos;
+	struct qos_shaper *s = ctx->shaper[port];
+	unsigned c = 0, nb = 0, i;
+	uint16_t sent = 0;
+
+	if (likely(s->backlog == 0))
+		return 0;
+	tb_refill(&s->tb, now);
+
+	while (c < qos_conf->nb_classes && s->backlog > 0 && nb < FWD_BURST_SIZE)
+	{
+		struct qos_class *cl = &s->classes[c];
+		bool found = false;
+
+		if (cl->backlog == 0)
+		{
+			c++;
+			continue;
+		}
+		tb_refill(&cl->tb, now);
+
+		for (i = 0; i < cl->nb_queues && !found; i++)
+		{
+			const unsigned qi = (cl->next + i) % cl->nb_queues;
+			struct qos_queue *q = &cl->queues[qi];
+			struct rte_mbuf *m;
+
+			if (q->count == 0)
+				continue;
+			tb_refill(&q->tb, now);
+			m = q->slots[q->head];
+			if (!tb_allows(&q->tb, m->pkt_len) ||
+				!tb_allows(&cl->tb, m->pkt_len))
+				continue;
+			if (!tb_allows(&s->tb, m->pkt_len))
+				return sent;
+
+			tb_consume(&q->tb, m->pkt_len);
+			tb_consume(&cl->tb, m->pkt_len);
+			tb_consume(&s->tb, m->pkt_len);
+			q->head = (q->head + 1) % q->limit;
+			q->count--;
+			cl->backlog--;
+			s->backlog--;
+			ctx->c.sent[c][qi]++;
+			sent += fwd_tx(conf, port, queue, m);
+			cl->next = (qi + 1) % cl->nb_queues;
+			nb++;
+			found = true;
+		}
+		if (!found)
+			c++;
+	}
+	return sent;
+}
+
+/* Packets an lcore's shapers hold on all ports */
+static inline uint32_t
+qos_backlog(const struct qos_ctx *ctx)
+{
+	uint32_t nb = 0;
+	uint16_t port;
+
+	RTE_ETH_FOREACH_DEV(port)
+	nb += ctx->shaper[port]->backlog;
+	return nb;
+}
+
+/* Parse a rate or a size of the QoS file */
+static bool
+qos_parse_u64(const char *s, uint64_t max, uint64_t *v)
+{
+	char *end;
+
+	*v = strtoull(s, &end, 10);
+	return end != s && *end == 0 && *v <= max;
+}
+
+/* A bucket that limits must hold the largest packet, or it never sends
+ * it: a frame of the MTU, or a whole datagram merged by --gro */
+static bool
+qos_bucket_ok(uint64_t rate, uint64_t size)
+{
+	return rate == 0 ||
+		   size >= (fwd_gro ? RTE_ETHER_HDR_LEN + RTE_IPV4_MAX_PKT_LEN
+							: fwd_frame_len());
+}
+
+/*
+ * Read the QoS file; exit with a message if it is malformed
+ */
+static void
+qos_load(const char *path)
+{
+	const uint64_t max_rate = 10000000000ULL, max_size = 1000000000ULL;
+	struct qos_conf *conf;
+	char line[256];
+	int lineno = 0;
+	unsigned i;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot open %s\n", path);
+	conf = calloc(1, sizeof(*conf));
+	if (conf == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate the QoS configuration\n");
+	qos_tsc_hz = rte_get_tsc_hz();
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char *tok[10], *comment, *save;
+		uint64_t v[5];
+		int n = 0;
+		bool ok = false;
+
+		lineno++;
+		comment = strchr(line, '#');
+		if (comment != NULL)
+			*comment = 0;
+		for (tok[n] = strtok_r(line, " \t\r\n", &save);
+			 tok[n] != NULL && n < 9;
+			 tok[n] = strtok_r(NULL, " \t\r\n", &save))
+			n++;
+		if (n == 0)
+			continue;
+
+		if (strcmp(tok[0], "meter") == 0 && n >= 7 &&
+			conf->nb_meters < QOS_MAX_METERS)
+		{
+			struct qos_meter_conf *mc = &conf->meters[conf->nb_meters];
+			const bool trtcm = strcmp(tok[2], "trtcm") == 0;
+			const char *action = tok[trtcm ? 7 : 6];
+
+			snprintf(mc->name, sizeof(mc->name), "%s", tok[1]);
+			mc->trtcm = trtcm;
+			mc->mark = (n == (trtcm ? 8 : 7) && strcmp(action, "mark") == 0);
+			if (trtcm && n == 8 && (mc->mark || strcmp(action, "drop") == 0) &&
+				qos_parse_u64(tok[3], max_rate, &v[0]) &&
+				qos_parse_u64(tok[4], max_rate, &v[1]) &&
+				qos_parse_u64(tok[5], max_size, &v[2]) &&
+				qos_parse_u64(tok[6], max_size, &v[3]) && v[0] <= v[1])
+			{
+				struct rte_meter_trtcm_params params = {
+					.cir = v[0], .pir = v[1], .cbs = v[2], .pbs = v[3]};
+				ok = rte_meter_trtcm_profile_config(&mc->trtcm_profile,
+													&params) == 0;
+			}
+			else if (!trtcm && strcmp(tok[2], "srtcm") == 0 && n == 7 &&
+					 (mc->mark || strcmp(action, "drop") == 0) &&
+					 qos_parse_u64(tok[3], max_rate, &v[0]) &&
+					 qos_parse_u64(tok[4], max_size, &v[1]) &&
+					 qos_parse_u64(tok[5], max_size, &v[2]))
+			{
+				struct rte_meter_srtcm_params params = {
+					.cir = v[0], .cbs = v[1], .ebs = v[2]};
+				ok = rte_meter_srtcm_profile_config(&mc->srtcm, &params) == 0;
+			}
+			if (ok)
+				conf->nb_meters++;
+		}
+		else if (strcmp(tok[0], "port") == 0 && n == 3 &&
+				 qos_parse_u64(tok[1], max_rate, &v[0]) &&
+				 qos_parse_u64(tok[2], max_size, &v[1]) &&
+				 qos_bucket_ok(v[0], v[1]))
+		{
+			conf->port.rate = v[0];
+			conf->port.size = v[1];
+			ok = true;
+		}
+		else if (strcmp(tok[0], "class") == 0 && n == 4 &&
+				 qos_parse_u64(tok[1], QOS_MAX_CLASSES - 1, &v[0]) &&
+				 qos_parse_u64(tok[2], max_rate, &v[1]) &&
+				 qos_parse_u64(tok[3], max_size, &v[2]) &&
+				 qos_bucket_ok(v[1], v[2]))
+		{
+			conf->classes[v[0]].tb.rate = v[1];
+			conf->classes[v[0]].tb.size = v[2];
+			conf->nb_classes = RTE_MAX(conf->nb_classes, (unsigned)v[0] + 1);
+			ok = true;
+		}
+		else if (strcmp(tok[0], "queue") == 0 && n == 6 &&
+				 qos_parse_u64(tok[1], QOS_MAX_CLASSES - 1, &v[0]) &&
+				 qos_parse_u64(tok[2], QOS_MAX_QUEUES - 1, &v[1]) &&
+				 qos_parse_u64(tok[3], max_rate, &v[2]) &&
+				 qos_parse_u64(tok[4], max_size, &v[3]) &&
+				 qos_parse_u64(tok[5], QOS_MAX_QUEUE_LIMIT, &v[4]) && v[4] > 0 &&
+				 qos_bucket_ok(v[2], v[3]))
+		{
+			struct qos_class_conf *cc = &conf->classes[v[0]];
+			cc->queue_tb[v[1]].rate = v[2];
+			cc->queue_tb[v[1]].size = v[3];
+			cc->queue_limit[v[1]] = v[4];
+			cc->nb_queues = RTE_MAX(cc->nb_queues, (unsigned)v[1] + 1);
+			conf->nb_classes = RTE_MAX(conf->nb_classes, (unsigned)v[0] + 1);
+			ok = true;
+		}
+		else if (strcmp(tok[0], "rule") == 0 && n == 6 &&
+				 conf->nb_rules < QOS_MAX_RULES &&
+				 qos_parse_u64(tok[4], QOS_MAX_CLASSES - 1, &v[0]) &&
+				 qos_parse_u64(tok[5], QOS_MAX_QUEUES - 1, &v[1]))
+		{
+			struct qos_rule *r = &conf->rules[conf->nb_rules];
+
+			ok = true;
+			if (strcmp(tok[1], "udp") == 0)
+				r->proto = IPPROTO_UDP;
+			else if (strcmp(tok[1], "tcp") == 0)
+				r->proto = IPPROTO_TCP;
+			else if (strcmp(tok[1], "any") == 0)
+				r->proto = 0;
+			else
+				ok = false;
+			if (strcmp(tok[2], "any") == 0)
+				r->dst_port = -1;
+			else if (qos_parse_u64(tok[2], 65535, &v[2]))
+				r->dst_port = v[2];
+			else
+				ok = false;
+			r->meter = -1;
+			if (strcmp(tok[3], "-") != 0)
+			{
+				for (i = 0; i < conf->nb_meters; i++)
+					if (strcmp(conf->meters[i].name, tok[3]) == 0)
+						r->meter = i;
+				if (r->meter < 0)
+					ok = false;
+			}
+			r->class_id = v[0];
+			r->queue = v[1];
+			if (ok)
+				conf->nb_rules++;
+		}
+		if (!ok)
+			rte_exit(EXIT_FAILURE, "%s:%d: invalid QoS line\n", path, lineno);
+	}
+	fclose(fp);
+
+	/* Everything no rule matches goes to queue 0 of class 0, unshaped
+	 * unless the file says otherwise. */
+	conf->rules[conf->nb_rules].meter = -1;
+	conf->rules[conf->nb_rules].dst_port = -1;
+	conf->nb_classes = RTE_MAX(conf->nb_classes, 1u);
+	if (conf->classes[0].queue_limit[0] == 0)
+		conf->classes[0].queue_limit[0] = QOS_DEFAULT_QUEUE_LIMIT;
+	conf->classes[0].nb_queues = RTE_MAX(conf->classes[0].nb_queues, 1u);
+
+	for (i = 0; i < conf->nb_rules; i++)
+	{
+		const struct qos_rule *r = &conf->rules[i];
+		if (conf->classes[r->class_id].queue_limit[r->queue] == 0)
+			rte_exit(EXIT_FAILURE, "%s: a rule uses queue %u of class %u, "
+								   "which is not declared\n",
+					 path, r->queue, r->class_id);
+	}
+	for (i = 0; i < conf->nb_classes; i++)
+	{
+		unsigned q;
+		for (q = 0; q < conf->classes[i].nb_queues; q++)
+			if (conf->classes[i].queue_limit[q] == 0)
+				rte_exit(EXIT_FAILURE, "%s: queue %u of class %u is not "
+									   "declared\n",
+						 path, q, i);
+	}
+	qos_conf = conf;
+}
+
+/* Packets the shaper of a port can hold */
+static unsigned
+qos_backlog_limit(void)
+{
+	unsigned c, q, n = 0;
+
+	if (qos_conf == NULL)
+		return 0;
+	for (c = 0; c < qos_conf->nb_classes; c++)
+		for (q = 0; q < qos_conf->classes[c].nb_queues; q++)
+			n += qos_conf->classes[c].queue_limit[q];
+	return n;
+}
+
+/*
+ * The QoS context of a transmitting lcore, with its share of the rates
+ */
+static struct qos_ctx *
+qos_create_ctx(unsigned lcore_id, unsigned share)
+{
+	const int socket = rte_lcore_to_socket_id(lcore_id);
+	const uint64_t now = rte_rdtsc();
+	struct rte_hash_parameters params;
+	struct qos_ctx *ctx;
+	char name[RTE_HASH_NAMESIZE];
+	unsigned i, c, q;
+	uint16_t port;
+
+	ctx = rte_zmalloc_socket("qos_ctx", sizeof(*ctx), RTE_CACHE_LINE_SIZE,
+							 socket);
+	if (ctx == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate the QoS of lcore %u\n",
+				 lcore_id);
+
+	snprintf(name, sizeof(name), "qos_flows_%u", lcore_id);
+	memset(&params, 0, sizeof(params));
+	params.name = name;
+	params.entries = QOS_MAX_FLOWS;
+	params.key_len = sizeof(struct flow_key);
+	params.hash_func = rte_hash_crc;
+	params.socket_id = socket;
+	ctx->flow_table = rte_hash_create(&params);
+	ctx->flows = rte_zmalloc_socket("qos_flows",
+									QOS_MAX_FLOWS * sizeof(*ctx->flows),
+									RTE_CACHE_LINE_SIZE, socket);
+	if (ctx->flow_table == NULL || ctx->flows == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate the flows of lcore %u\n",
+				 lcore_id);
+	for (i = 0; i <= qos_conf->nb_rules; i++)
+		qos_flow_init(&ctx->rule_flows[i], i);
+
+	RTE_ETH_FOREACH_DEV(port)
+	{
+		struct qos_shaper *s;
+
+		s = rte_zmalloc_socket("qos_shaper", sizeof(*s), RTE_CACHE_LINE_SIZE,
+							   socket);
+		if (s == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate the shaper of lcore %u\n",
+					 lcore_id);
+		tb_init(&s->tb, &qos_conf->port, share, now);
+		for (c = 0; c < qos_conf->nb_classes; c++)
+		{
+			const struct qos_class_conf *cc = &qos_conf->classes[c];
+			struct qos_class *cl = &s->classes[c];
+
+			tb_init(&cl->tb, &cc->tb, share, now);
+			cl->nb_queues = cc->nb_queues;
+			for (q = 0; q < cc->nb_queues; q++)
+			{
+				tb_init(&cl->queues[q].tb, &cc->queue_tb[q], share, now);
+				cl->queues[q].limit = cc->queue_limit[q];
+				cl->queues[q].slots = rte_zmalloc_socket(
+					"qos_queue", cc->queue_limit[q] * sizeof(struct rte_mbuf *),
+					0, socket);
+				if (cl->queues[q].slots == NULL)
+					rte_exit(EXIT_FAILURE, "Cannot allocate the shaper of "
+										   "lcore %u\n",
+							 lcore_id);
+			}
+		}
+		ctx->shaper[port] = s;
+	}
+	return ctx;
+}
+
+/* Free the packets left in the shapers once the lcores stopped */
+static void
+qos_drain(void)
+{
+	unsigned lcore_id, c, q;
+	uint16_t port;
+
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		struct qos_ctx *ctx = lcore_conf[lcore_id].qos;
+
+		if (ctx == NULL)
+			continue;
+		RTE_ETH_FOREACH_DEV(port)
+		for (c = 0; c < qos_conf->nb_classes; c++)
+			for (q = 0; q < qos_conf->classes[c].nb_queues; q++)
+			{
+				struct qos_queue *qq = &ctx->shaper[port]->classes[c].queues[q];
+				while (qq->count > 0)
+				{
+					rte_pktmbuf_free(qq->slots[qq->head]);
+					qq->head = (qq->head + 1) % qq->limit;
+					qq->count--;
+				}
+			}
+	}
+}
+
+/* Packets the meters and the shapers dropped so far */
+static uint64_t
+qos_dropped(void)
+{
+	uint64_t nb = 0;
+	unsigned lcore_id, c, q;
+
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		const struct qos_ctx *ctx = lcore_conf[lcore_id].qos;
+
+		if (ctx == NULL)
+			continue;
+		nb += ctx->c.meter_dropped;
+		for (c = 0; c < QOS_MAX_CLASSES; c++)
+			for (q = 0; q < QOS_MAX_QUEUES; q++)
+				nb += ctx->c.tail_dropped[c][q];
+	}
+	return nb;
+}
+
+/* Print the counters of the meters and of the shapers, over all lcores */
+static void
+qos_report(void)
+{
+	struct qos_counters sum;
+	unsigned lcore_id, r, c, q, k;
+
+	memset(&sum, 0, sizeof(sum));
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		const struct qos_ctx *ctx = lcore_conf[lcore_id].qos;
+
+		if (ctx == NULL)
+			continue;
+		for (r = 0; r <= qos_conf->nb_rules; r++)
+			for (k = 0; k < RTE_COLORS; k++)
+				sum.color[r][k] += ctx->c.color[r][k];
+		sum.meter_dropped += ctx->c.meter_dropped;
+		for (c = 0; c < QOS_MAX_CLASSES; c++)
+			for (q = 0; q < QOS_MAX_QUEUES; q++)
+			{
+				sum.enqueued[c][q] += ctx->c.enqueued[c][q];
+				sum.tail_dropped[c][q] += ctx->c.tail_dropped[c][q];
+				sum.sent[c][q] += ctx->c.sent[c][q];
+			}
+	}
+
+	printf("\n%-6s %-12s %14s %14s %14s\n", "rule", "meter", "green",
+	       "yellow", "red");
+	for (r = 0; r < qos_conf->nb_rules; r++)
+	{
+		const struct qos_rule *rule = &qos_conf->rules[r];
+		if (rule->meter < 0)
+			continue;
+		printf("%-6u %-12s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n", r,
+		       qos_conf->meters[rule->meter].name,
+		       sum.color[r][RTE_COLOR_GREEN], sum.color[r][RTE_COLOR_YELLOW],
+		       sum.color[r][RTE_COLOR_RED]);
+	}
+	printf("%" PRIu64 " packets dropped by the meters\n", sum.meter_dropped);
+
+	printf("\n%-6s %-6s %14s %14s %14s\n", "class", "queue", "enqueued",
+	       "tail drops", "sent");
+	for (c = 0; c < qos_conf->nb_classes; c++)
+		for (q = 0; q < qos_conf->classes[c].nb_queues; q++)
+			printf("%-6u %-6u %14" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n",
+			       c, q, sum.enqueued[c][q], sum.tail_dropped[c][q],
+			       sum.sent[c][q]);
+}
+
+/*
+ * L3 forwarding, see the format of --routes at the top. The tables are
+ * built before the lcores start and only read afterwards, so they are
+ * shared.
+ */
+struct l3_nexthop
+{
+	bool used;
+	uint16_t port;
+	struct rte_ether_addr dst_mac;
+	struct rte_ether_addr src_mac;
+};
+
+static struct l3_nexthop l3_nexthops[L3_MAX_NEXTHOPS];
+static struct rte_lpm *l3_lpm; /* NULL without --routes */
+static struct rte_hash *l3_flows;
+static uint8_t l3_flow_nexthop[L3_MAX_FLOWS]; /* by position in l3_flows */
+
+/*
+ * Route a burst: parse the headers, look up the 5-tuples in the exact
+ * match table, the others' destination in the LPM table, and rewrite the
+ * MAC addresses and the TTL. "out" receives the output port of every
+ * packet, or L3_DROP.
+ */
+static inline void
+l3_route_burst(struct lcore_conf *conf, struct rte_mbuf **bufs, uint16_t n,
+			   uint16_t *out)
+{
+	struct flow_key keys[FWD_BURST_SIZE];
+	const void *key_ptrs[FWD_BURST_SIZE];
+	struct rte_ipv4_hdr *ips[FWD_BURST_SIZE];
+	int32_t pos[FWD_BURST_SIZE];
+	int hop[FWD_BURST_SIZE];
+	uint32_t dst[FWD_BURST_SIZE], res[FWD_BURST_SIZE];
+	uint16_t lpm_idx[FWD_BURST_SIZE];
+	uint16_t i, nb_lpm = 0;
+
+	/* Start loading the headers of the whole burst before reading any. */
+	for (i = 0; i < n; i++)
+		rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void *));
+
+	for (i = 0; i < n; i++)
+	{
+		ips[i] = parse_flow_key(bufs[i], &keys[i]);
+		key_ptrs[i] = &keys[i];
+	}
+	if (l3_flows == NULL || rte_hash_lookup_bulk(l3_flows, key_ptrs, n, pos) != 0)
+		for (i = 0; i < n; i++)
+			pos[i] = -1;
+
+	for (i = 0; i < n; i++)
+	{
+		hop[i] = -1;
+		if (unlikely(ips[i] == NULL))
+		{
+			conf->l3.not_ipv4++;
+			continue;
+		}
+		if (unlikely(ips[i]->time_to_live <= 1))
+		{
+			conf->l3.ttl_expired++;
+			continue;
+		}
+		if (pos[i] >= 0)
+		{
+			hop[i] = l3_flow_nexthop[pos[i]];
+			conf->l3.flow_hits++;
+			continue;
+		}
+		dst[nb_lpm] = rte_be_to_cpu_32(keys[i].dst_ip);
+		lpm_idx[nb_lpm++] = i;
+	}
+
+	if (nb_lpm > 0)
+	{
+		rte_lpm_lookup_bulk(l3_lpm, dst, res, nb_lpm);
+		for (i = 0; i < nb_lpm; i++)
+		{
+			if (res[i] & RTE_LPM_LOOKUP_SUCCESS)
+			{
+				hop[lpm_idx[i]] = res[i] & 0x00ffffff;
+				conf->l3.lpm_hits++;
+			}
+			else
+				conf->l3.no_route++;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		const struct l3_nexthop *nh;
+		struct rte_ether_hdr *eth;
+		uint16_t old, new;
+
+		if (hop[i] < 0)
+		{
+			out[i] = L3_DROP;
+			continue;
+		}
+		nh = &l3_nexthops[hop[i]];
+		eth = rte_pktmbuf_mtod(bufs[i], struct rte_ether_hdr *);
+		rte_ether_addr_copy(&nh->dst_mac, &eth->d_addr);
+		rte_ether_addr_copy(&nh->src_mac, &eth->s_addr);
+
+		memcpy(&old, &ips[i]->time_to_live, sizeof(old));
+		ips[i]->time_to_live--;
+		memcpy(&new, &ips[i]->time_to_live, sizeof(new));
+		ips[i]->hdr_checksum =
+			cksum_fold(cksum_replace((uint16_t)~ips[i]->hdr_checksum, old, new));
+		out[i] = nh->port;
+	}
+}
+
+/* Parse a dotted IPv4 address into host byte order */
+static bool
+l3_parse_ip(const char *s, uint32_t *ip)
+{
+	struct in_addr addr;
+
+	if (inet_pton(AF_INET, s, &addr) != 1)
+		return false;
+	*ip = rte_be_to_cpu_32(addr.s_addr);
+	return true;
+}
+
+static struct rte_lpm *
+l3_create_lpm(const char *name, uint32_t max_rules)
+{
+	struct rte_lpm_config config;
+
+	memset(&config, 0, sizeof(config));
+	config.max_rules = max_rules;
+	config.number_tbl8s = L3_NUMBER_TBL8S;
+	return rte_lpm_create(name, rte_socket_id(), &config);
+}
+
+static struct rte_hash *
+l3_create_flows(const char *name, uint32_t entries)
+{
+	struct rte_hash_parameters params;
+
+	memset(&params, 0, sizeof(params));
+	params.name = name;
+	params.entries = entries;
+	params.key_len = sizeof(struct flow_key);
+	params.hash_func = rte_hash_crc;
+	params.socket_id = rte_socket_id();
+	return rte_hash_create(&params);
+}
+
+/*
+ * Read the routing file; exit with a message if it is malformed
+ */
+static void
+l3_load(const char *path)
+{
+	unsigned nb_routes = 0, nb_flows = 0;
+	char line[256];
+	int lineno = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot open %s\n", path);
+	l3_lpm = l3_create_lpm("l3_routes", L3_MAX_ROUTES);
+	l3_flows = l3_create_flows("l3_flows", L3_MAX_FLOWS);
+	if (l3_lpm == NULL || l3_flows == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot create the routing tables\n");
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char *tok[9], *comment, *save;
+		unsigned long id, v[3];
+		uint32_t ip, ip2;
+		bool ok = false;
+		int n = 0;
+
+		lineno++;
+		comment = strchr(line, '#');
+		if (comment != NULL)
+			*comment = 0;
+		for (tok[n] = strtok_r(line, " \t\r\n", &save);
+			 tok[n] != NULL && n < 8;
+			 tok[n] = strtok_r(NULL, " \t\r\n", &save))
+			n++;
+		if (n == 0)
+			continue;
+
+		if (strcmp(tok[0], "nexthop") == 0 && (n == 4 || n == 5) &&
+			sscanf(tok[1], "%lu", &id) == 1 && id < L3_MAX_NEXTHOPS &&
+			sscanf(tok[2], "%lu", &v[0]) == 1 &&
+			rte_eth_dev_is_valid_port(v[0]))
+		{
+			struct l3_nexthop *nh = &l3_nexthops[id];
+
+			nh->port = v[0];
+			ok = rte_ether_unformat_addr(tok[3], &nh->dst_mac) == 0;
+			if (n == 5)
+				ok = ok && rte_ether_unformat_addr(tok[4], &nh->src_mac) == 0;
+			else
+				ok = ok && rte_eth_macaddr_get(nh->port, &nh->src_mac) == 0;
+			nh->used = ok;
+		}
+		else if (strcmp(tok[0], "route") == 0 && n == 3)
+		{
+			char *slash = strchr(tok[1], '/');
+
+			if (slash != NULL)
+				*slash = 0;
+			if (slash != NULL && l3_parse_ip(tok[1], &ip) &&
+				sscanf(slash + 1, "%lu", &v[0]) == 1 &&
+				v[0] <= RTE_LPM_MAX_DEPTH &&
+				sscanf(tok[2], "%lu", &id) == 1 && id < L3_MAX_NEXTHOPS &&
+				l3_nexthops[id].used)
+			{
+				ok = rte_lpm_add(l3_lpm, ip, v[0], id) == 0;
+				nb_routes += ok;
+			}
+		}
+		else if (strcmp(tok[0], "flow") == 0 && n == 7 &&
+				 l3_parse_ip(tok[1], &ip) && l3_parse_ip(tok[2], &ip2) &&
+				 (strcmp(tok[3], "udp") == 0 || strcmp(tok[3], "tcp") == 0) &&
+				 sscanf(tok[4], "%lu", &v[0]) == 1 && v[0] <= 65535 &&
+				 sscanf(tok[5], "%lu", &v[1]) == 1 && v[1] <= 65535 &&
+				 sscanf(tok[6], "%lu", &id) == 1 && id < L3_MAX_NEXTHOPS &&
+				 l3_nexthops[id].used)
+		{
+			struct flow_key key;
+			int32_t pos;
+
+			memset(&key, 0, sizeof(key));
+			key.src_ip = rte_cpu_to_be_32(ip);
+			key.dst_ip = rte_cpu_to_be_32(ip2);
+			key.proto = strcmp(tok[3], "udp") == 0 ? IPPROTO_UDP : IPPROTO_TCP;
+			key.src_port = rte_cpu_to_be_16(v[0]);
+			key.dst_port = rte_cpu_to_be_16(v[1]);
+			pos = rte_hash_add_key(l3_flows, &key);
+			if (pos >= 0)
+			{
+				l3_flow_nexthop[pos] = id;
+				nb_flows++;
+				ok = true;
+			}
+		}
+		if (!ok)
+			rte_exit(EXIT_FAILURE, "%s:%d: invalid routing line\n", path,
+					 lineno);
+	}
+	fclose(fp);
+	printf("L3: %u routes and %u flows from %s\n", nb_routes, nb_flows, path);
+}
+
+/* Packets the L3 stage dropped so far */
+static uint64_t
+l3_dropped(void)
+{
+	uint64_t nb = 0;
+	unsigned lcore_id;
+
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		const struct l3_counters *c = &lcore_conf[lcore_id].l3;
+		nb += c->not_ipv4 + c->ttl_expired + c->no_route;
+	}
+	return nb;
+}
+
+/* Print the counters of the L3 stage, over all lcores */
+static void
+l3_report(void)
+{
+	struct l3_counters sum;
+	unsigned lcore_id;
+
+	memset(&sum, 0, sizeof(sum));
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		const struct l3_counters *c = &lcore_conf[lcore_id].l3;
+		sum.flow_hits += c->flow_hits;
+		sum.lpm_hits += c->lpm_hits;
+		sum.no_route += c->no_route;
+		sum.not_ipv4 += c->not_ipv4;
+		sum.ttl_expired += c->ttl_expired;
+	}
+	printf("L3: %" PRIu64 " exact matches, %" PRIu64 " prefix matches, "
+		   "dropped %" PRIu64 " without route, %" PRIu64 " not IPv4, %" PRIu64
+		   " TTL expired\n",
+		   sum.flow_hits, sum.lpm_hits, sum.no_route, sum.not_ipv4,
+		   sum.ttl_expired);
+}
+
+/* xorshift64*, for tables that are the same from run to run */
+static inline uint64_t
+bench_rand(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+/*
+ * A prefix length drawn after the shape of a BGP table: mostly /24, then
+ * /16 to /23, a few shorter and a few longer
+ */
+static uint8_t
+bench_depth(uint64_t *state)
+{
+	const unsigned r = bench_rand(state) % 100;
+
+	if (r < 55)
+		return 24;
+	if (r < 93)
+		return 16 + bench_rand(state) % 8;
+	if (r < 98)
+		return 8 + bench_rand(state) % 8;
+	return 25 + bench_rand(state) % 8;
+}
+
+/**
+ * Lookup benchmark: build tables of each size and time their lookups in
+ * bursts, as the forwarder does
+ */
+static void
+lookup_main(void)
+{
+	const uint64_t hz = rte_get_tsc_hz();
+	uint32_t *addrs, *prefixes, res[FWD_BURST_SIZE];
+	uint8_t *depths;
+	struct flow_key *keys;
+	unsigned s, i, j;
+
+	addrs = malloc(L3_BENCH_LOOKUPS * sizeof(*addrs));
+	if (addrs == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate the lookups\n");
+
+	printf("%10s %14s %14s %8s %14s %14s\n", "routes", "add cyc/route",
+	       "LPM cyc/lookup", "hits", "flows", "hash cyc/lookup");
+	for (s = 0; s < nb_lookup_sizes; s++)
+	{
+		const uint32_t nb = lookup_sizes[s];
+		uint64_t state = 0x9e3779b97f4a7c15ULL, start, add_cycles, lpm_cycles,
+				 hash_cycles, hits = 0;
+		const void *key_ptrs[FWD_BURST_SIZE];
+		int32_t pos[FWD_BURST_SIZE];
+		struct rte_hash *flows;
+		struct rte_lpm *lpm;
+		char name[32];
+
+		snprintf(name, sizeof(name), "lookup_lpm_%u", s);
+		lpm = l3_create_lpm(name, nb);
+		snprintf(name, sizeof(name), "lookup_flows_%u", s);
+		flows = l3_create_flows(name, nb);
+		prefixes = malloc(nb * sizeof(*prefixes));
+		depths = malloc(nb * sizeof(*depths));
+		keys = malloc(nb * sizeof(*keys));
+		if (lpm == NULL || flows == NULL || prefixes == NULL ||
+			depths == NULL || keys == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot create tables of %u entries\n", nb);
+
+		/* Random prefixes, so that the longer ones need tbl8 groups. */
+		start = rte_rdtsc();
+		for (i = 0; i < nb; i++)
+		{
+			depths[i] = bench_depth(&state);
+			prefixes[i] = (uint32_t)bench_rand(&state) &
+						  (uint32_t)(~0ULL << (32 - depths[i]));
+			if (rte_lpm_add(lpm, prefixes[i], depths[i],
+							i % L3_MAX_NEXTHOPS) != 0)
+				rte_exit(EXIT_FAILURE, "Cannot add route %u: out of tbl8 "
+									   "groups?\n",
+						 i);
+		}
+		add_cycles = rte_rdtsc() - start;
+
+		/* Half of the addresses fall in a prefix, half anywhere. */
+		for (i = 0; i < L3_BENCH_LOOKUPS; i++)
+		{
+			const uint32_t r = bench_rand(&state) % nb;
+			addrs[i] = (uint32_t)bench_rand(&state);
+			if (!(i & 1))
+				addrs[i] = prefixes[r] |
+						   (addrs[i] & (uint32_t)(0xffffffffULL >> depths[r]));
+		}
+
+		start = rte_rdtsc();
+		for (i = 0; i < L3_BENCH_LOOKUPS; i += FWD_BURST_SIZE)
+		{
+			rte_lpm_lookup_bulk(lpm, &addrs[i], res, FWD_BURST_SIZE);
+			for (j = 0; j < FWD_BURST_SIZE; j++)
+				hits += (res[j] & RTE_LPM_LOOKUP_SUCCESS) != 0;
+		}
+		lpm_cycles = rte_rdtsc() - start;
+
+		/* The same number of flows in the exact-match table, all hit. */
+		for (i = 0; i < nb; i++)
+		{
+			memset(&keys[i], 0, sizeof(keys[i]));
+			keys[i].src_ip = (uint32_t)bench_rand(&state);
+			keys[i].dst_ip = (uint32_t)bench_rand(&state);
+			keys[i].src_port = (uint16_t)bench_rand(&state);
+			keys[i].dst_port = (uint16_t)bench_rand(&state);
+			keys[i].proto = IPPROTO_UDP;
+			if (rte_hash_add_key(flows, &keys[i]) < 0)
+				rte_exit(EXIT_FAILURE, "Cannot add flow %u\n", i);
+		}
+		start = rte_rdtsc();
+		for (i = 0; i < L3_BENCH_LOOKUPS; i += FWD_BURST_SIZE)
+		{
+			for (j = 0; j < FWD_BURST_SIZE; j++)
+				key_ptrs[j] = &keys[(addrs[i + j] >> 1) % nb];
+			rte_hash_lookup_bulk(flows, key_ptrs, FWD_BURST_SIZE, pos);
+		}
+		hash_cycles = rte_rdtsc() - start;
+
+		printf("%10u %14.1f %14.1f %7.1f%% %14u %14.1f\n", nb,
+		       (double)add_cycles / nb,
+		       (double)lpm_cycles / L3_BENCH_LOOKUPS,
+		       100.0 * hits / L3_BENCH_LOOKUPS, nb,
+		       (double)hash_cycles / L3_BENCH_LOOKUPS);
+
+		rte_lpm_free(lpm);
+		rte_hash_free(flows);
+		free(prefixes);
+		free(depths);
+		free(keys);
+	}
+	printf("(%u lookups of each, in bursts of %u, at %.2f GHz)\n",
+	       L3_BENCH_LOOKUPS, FWD_BURST_SIZE, hz / 1e9);
+	free(addrs);
+}
+
+/*
+ * Receive a burst on an RX queue of an lcore, keeping its counters and
+ * adapting its RX burst size; return the number of packets
+ */
+static inline uint16_t
+fwd_rx_burst(struct lcore_conf *conf, struct rx_queue *rxq,
+			 struct rte_mbuf **bufs)
+{
+	struct port_counters *pc = &conf->port[rxq->port];
+	const uint16_t burst = rxq->burst;
+	uint16_t nb_rx;
+
+	nb_rx = rte_eth_rx_burst(rxq->port, rxq->queue, bufs, burst);
+	pc->polls++;
+	if (unlikely(nb_rx == 0))
+	{
+		pc->empty_polls++;
+		return 0;
+	}
+	pc->rx_pkts += nb_rx;
+	pc->burst_hist[RTE_MIN(31 - __builtin_clz(nb_rx),
+						   BURST_HIST_SIZE - 1)]++;
+
+	/*
+	 * Ask for more while full bursts keep coming, and for less when the
+	 * queue no longer fills them.
+	 */
+	if (nb_rx == burst && burst < FWD_BURST_SIZE)
+		rxq->burst = burst * 2;
+	else if (nb_rx < burst / 2 && burst > FWD_MIN_BURST_SIZE)
+		rxq->burst = burst / 2;
+	return nb_rx;
+}
+
+/*
+ * The periodic work of a forwarding lcore, once every --drain microseconds:
+ * flush the partial bursts that waited long enough, so that light traffic
+ * is not held back until a buffer fills up, stop when the time is up and,
+ * on the main lcore, print the stats when they are due.
+ */
+static void
+fwd_drain(struct lcore_conf *conf, uint16_t queue, uint64_t cur_tsc)
+{
+	uint16_t port;
+
+	RTE_ETH_FOREACH_DEV(port)
+	conf->port[port].tx_pkts +=
+		rte_eth_tx_buffer_flush(port, queue, conf->tx_buffer[port]);
+
+	if (stop_tsc != 0 && cur_tsc >= stop_tsc)
+		force_quit = true;
+	if (stats_interval > 0 && cur_tsc >= stats_next_tsc &&
+		rte_lcore_id() == rte_get_main_lcore())
+		stats_report(cur_tsc);
+}
+
+/* The drain interval in TSC cycles */
+static uint64_t
+fwd_drain_tsc(void)
+{
+	return (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * fwd_drain_us;
+}
+
+/* The synthetic per-packet work of --work */
+static inline void
+fwd_work(uint16_t nb)
+{
+	if (fwd_work_cycles != 0)
+	{
+		const uint64_t end = rte_rdtsc() + fwd_work_cycles * nb;
+		while (rte_rdtsc() < end)
+			rte_pause();
+	}
+}
+
+/*
+ * Set up the RX interrupts of the queues an lcore polls. This runs
+ * on the lcore itself, as the epoll instance is per thread. Without
+ * interrupts, as on the workers and the TX lcore of the pipeline, which
+ * poll rings, the lcore keeps sleeping when it is idle.
+ */
+static void
+idle_init(struct lcore_conf *conf)
+{
+	unsigned i;
+	int ret;
+
+	conf->idle.sleep_us = 1;
+	conf->idle.intr = conf->nb_rxq > 0;
+	for (i = 0; i < conf->nb_rxq; i++)
+	{
+		const struct rx_queue *rxq = &conf->rxq[i];
+
+		ret = rte_eth_dev_rx_intr_ctl_q(rxq->port, rxq->queue,
+										RTE_EPOLL_PER_THREAD,
+										RTE_INTR_EVENT_ADD, NULL);
+		if (ret != 0)
+		{
+			printf("Port %u has no RX interrupt on queue %u (%s): lcore %u "
+				   "only sleeps when idle\n",
+				   rxq->port, rxq->queue, strerror(-ret), rte_lcore_id());
+			conf->idle.intr = false;
+			break;
+		}
+	}
+}
+
+/* Wait for an RX interrupt on any queue the lcore polls, or for the timeout */
+static void
+idle_wait_intr(struct lcore_conf *conf)
+{
+	struct rte_epoll_event events[MAX_RX_PER_LCORE];
+	struct idle_state *st = &conf->idle;
+	uint64_t start;
+	unsigned i;
+	int n;
+
+	for (i = 0; i < conf->nb_rxq; i++)
+		rte_eth_dev_rx_intr_enable(conf->rxq[i].port, conf->rxq[i].queue);
+	start = rte_rdtsc();
+	n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, MAX_RX_PER_LCORE,
+					   POWER_INTR_TIMEOUT_MS);
+	st->wake_tsc = rte_rdtsc();
+	for (i = 0; i < conf->nb_rxq; i++)
+		rte_eth_dev_rx_intr_disable(conf->rxq[i].port, conf->rxq[i].queue);
+
+	st->c.intr_waits++;
+	if (n > 0)
+		st->c.intr_wakeups++;
+	st->c.idle_cycles += st->wake_tsc - start;
+}
+
+/*
+ * With --power, the end of every round of polls of an lcore, which
+ * received or dequeued "nb_rx" packets in it. While its queues or rings
+ * stay empty, it spins, then pauses, then sleeps for longer and longer,
+ * then waits for an interrupt. The first packets after a sleep may have
+ * waited as long as the sleep. After an interrupt, only the time since the
+ * wake-up can be measured, not the delivery of the interrupt.
+ */
+static inline void
+idle_round(struct lcore_conf *conf, uint16_t queue, unsigned nb_rx,
+		   uint64_t now)
+{
+	struct idle_state *st = &conf->idle;
+	uint64_t start, added;
+
+	if (likely(nb_rx > 0))
+	{
+		if (unlikely(st->empty_rounds >= POWER_SLEEP_ROUNDS))
+		{
+			added = st->waited_intr ? now - st->wake_tsc : st->last_sleep;
+			st->c.wakes++;
+			st->c.wake_cycles += added;
+			if (added > st->c.max_wake_cycles)
+				st->c.max_wake_cycles = added;
+			st->sleep_us = 1;
+		}
+		st->empty_rounds = 0;
+		return;
+	}
+
+	/* Packets held by the shapers are due without any RX. */
+	if (conf->qos != NULL && qos_backlog(conf->qos) > 0)
+		return;
+
+	if (st->empty_rounds < POWER_INTR_ROUNDS)
+		st->empty_rounds++;
+	if (st->empty_rounds < POWER_PAUSE_ROUNDS)
+		return;
+	if (st->empty_rounds < POWER_SLEEP_ROUNDS)
+	{
+		rte_pause();
+		st->c.pauses++;
+		return;
+	}
+
+	/* Nothing buffered waits on the sleep. */
+	if (st->empty_rounds == POWER_SLEEP_ROUNDS)
+		fwd_drain(conf, queue, now);
+
+	st->waited_intr = st->intr && st->empty_rounds == POWER_INTR_ROUNDS;
+	if (st->waited_intr)
+	{
+		idle_wait_intr(conf);
+		return;
+	}
+	start = rte_rdtsc();
+	rte_delay_us_sleep(st->sleep_us);
+	st->last_sleep = rte_rdtsc() - start;
+	st->c.sleeps++;
+	st->c.idle_cycles += st->last_sleep;
+	if (st->sleep_us < POWER_MAX_SLEEP_US)
+		st->sleep_us *= 2;
+}
+
+/*
+ * Send a packet on "port", through the shaper with QoS; unsent packets are
+ * freed and counted by the callback of the TX buffer
+ */
+static inline void
+fwd_send(struct lcore_conf *conf, uint16_t port, uint16_t queue,
+		 struct rte_mbuf *m, uint64_t now)
+{
+	if (conf->qos != NULL)
+		qos_enqueue(conf->qos, port, m, now);
+	else
+		conf->port[port].tx_pkts += fwd_tx(conf, port, queue, m);
+}
+
+/*
+ * The lcore main. This is the thread that does the work, reading from
+ * an input port and writing to an output port. Every lcore runs it on the
+ * queue pair it was given on every port.
+ */
+static int
+lcore_main(struct lcore_conf *conf)
+{
+	const uint16_t queue = conf->queue;
+	const uint64_t drain_tsc = fwd_drain_tsc();
+	uint64_t prev_tsc = 0, cur_tsc, now;
+	unsigned nb_round, i;
+	uint16_t port;
+
+	if (power_mode)
+		idle_init(conf);
+
+	/* Run until the application is quit, killed or its time is up. */
+	while (!force_quit)
+	{
+		cur_tsc = rte_rdtsc();
+		if (unlikely(cur_tsc - prev_tsc > drain_tsc))
+		{
+			fwd_drain(conf, queue, cur_tsc);
+			prev_tsc = cur_tsc;
+		}
+		nb_round = 0;
+
+		/*
+		 * Receive packets on a port and forward them on the paired
+		 * port. The mapping is 0 -> 1, 1 -> 0, 2 -> 3, 3 -> 2, etc.
+		 * With --routes, the next hop decides instead.
+		 */
+		for (i = 0; i < conf->nb_rxq; i++)
+		{
+			struct rte_mbuf *bufs[FWD_BURST_SIZE];
+			uint16_t nb_rx, buf;
+
+			/* Get burst of RX packets, from first port of pair. */
+			port = conf->rxq[i].port;
+			nb_rx = fwd_rx_burst(conf, &conf->rxq[i], bufs);
+			if (unlikely(nb_rx == 0))
+				continue;
+			nb_round += nb_rx;
+			if (fwd_gro)
+				nb_rx = fwd_gro_burst(conf, bufs, nb_rx);
+			fwd_work(nb_rx);
+
+			/*
+			 * Buffer them for the output port, which sends a burst as
+			 * soon as FWD_BURST_SIZE packets are buffered. With QoS,
+			 * they are metered and shaped first.
+			 */
+			if (l3_lpm != NULL)
+			{
+				uint16_t out[FWD_BURST_SIZE];
+
+				l3_route_burst(conf, bufs, nb_rx, out);
+				for (buf = 0; buf < nb_rx; buf++)
+					if (out[buf] == L3_DROP)
+						rte_pktmbuf_free(bufs[buf]);
+					else
+						fwd_send(conf, out[buf], queue, bufs[buf], cur_tsc);
+			}
+			else
+				for (buf = 0; buf < nb_rx; buf++)
+					fwd_send(conf, port ^ 1, queue, bufs[buf], cur_tsc);
+
+			/*
+			 * One more TSC read per non-empty poll: the cycles since the
+			 * previous one (or the top of the loop) go to this port, which
+			 * charges the empty polls before it to the traffic as well.
+			 */
+			now = rte_rdtsc();
+			conf->port[port].cycles += now - cur_tsc;
+			cur_tsc = now;
+		}
+
+		/* Send what the shapers let go. */
+		if (conf->qos != NULL)
+			RTE_ETH_FOREACH_DEV(port)
+			conf->port[port].tx_pkts +=
+				qos_dequeue(conf, port, queue, cur_tsc);
+
+		if (power_mode)
+			idle_round(conf, queue, nb_round, cur_tsc);
+	}
+
+	/* Send what is left in the buffers. */
+	fwd_drain(conf, queue, rte_rdtsc());
+	return 0;
+}
+
+/*
+ * Hand a burst to the next stage of the pipeline: packets that do not fit
+ * in the ring are dropped, as a NIC drops what does not fit in its RX ring
+ */
+static inline void
+pipe_enqueue(struct pipe_ring *r, struct rte_mbuf **bufs, uint16_t n)
+{
+	unsigned free_space, nb;
+
+	nb = rte_ring_enqueue_burst(r->ring, (void **)bufs, n, &free_space);
+	r->enqueued += nb;
+	r->samples++;
+	r->occupancy_sum += r->capacity - free_space;
+	if (r->capacity - free_space > r->max_occupancy)
+		r->max_occupancy = r->capacity - free_space;
+	if (unlikely(nb < n))
+	{
+		r->dropped += n - nb;
+		rte_pktmbuf_free_bulk(&bufs[nb], n - nb);
+	}
+}
+
+/*
+ * RX stage of the pipeline: receive on queue 0 of every port and hand the
+ * bursts to the workers in turn, which may reorder packets of a flow
+ * across workers
+ */
+static int
+pipeline_rx(struct lcore_conf *conf)
+{
+	const uint64_t drain_tsc = fwd_drain_tsc();
+	uint64_t prev_tsc = 0, cur_tsc, now;
+	unsigned worker = 0, nb_round, i;
+	uint16_t port;
+
+	if (power_mode)
+		idle_init(conf);
+
+	while (!force_quit)
+	{
+		cur_tsc = rte_rdtsc();
+		if (unlikely(cur_tsc - prev_tsc > drain_tsc))
+		{
+			fwd_drain(conf, 0, cur_tsc);
+			prev_tsc = cur_tsc;
+		}
+		nb_round = 0;
+
+		for (i = 0; i < conf->nb_rxq; i++)
+		{
+			struct rte_mbuf *bufs[FWD_BURST_SIZE];
+			uint16_t nb_rx;
+
+			port = conf->rxq[i].port;
+			nb_rx = fwd_rx_burst(conf, &conf->rxq[i], bufs);
+			if (unlikely(nb_rx == 0))
+				continue;
+			nb_round += nb_rx;
+			if (fwd_gro)
+				nb_rx = fwd_gro_burst(conf, bufs, nb_rx);
+			pipe_enqueue(&pipe_in[worker], bufs, nb_rx);
+			if (++worker == fwd_workers)
+				worker = 0;
+
+			now = rte_rdtsc();
+			conf->port[port].cycles += now - cur_tsc;
+			cur_tsc = now;
+		}
+
+		if (power_mode)
+			idle_round(conf, 0, nb_round, cur_tsc);
+	}
+	return 0;
+}
+
+/*
+ * Worker stage of the pipeline: process what its RX ring brings. With
+ * --routes, the workers route, and leave the output port of each packet
+ * in its hash.usr field for the TX stage.
+ */
+static int
+pipeline_worker(struct lcore_conf *conf)
+{
+	struct pipe_ring *in = &pipe_in[conf->worker];
+	struct pipe_ring *out = &pipe_out[conf->worker];
+	struct rte_mbuf *bufs[FWD_BURST_SIZE];
+	unsigned nb;
+
+	if (power_mode)
+		idle_init(conf);
+
+	while (!force_quit)
+	{
+		nb = rte_ring_dequeue_burst(in->ring, (void **)bufs, FWD_BURST_SIZE,
+									NULL);
+		if (power_mode)
+			idle_round(conf, 0, nb, rte_rdtsc());
+		if (unlikely(nb == 0))
+			continue;
+		fwd_work(nb);
+		if (l3_lpm != NULL)
+		{
+			uint16_t ports[FWD_BURST_SIZE];
+			unsigned i, kept = 0;
+
+			l3_route_burst(conf, bufs, nb, ports);
+			for (i = 0; i < nb; i++)
+			{
+				if (ports[i] == L3_DROP)
+				{
+					rte_pktmbuf_free(bufs[i]);
+					continue;
+				}
+				bufs[i]->hash.usr = ports[i];
+				bufs[kept++] = bufs[i];
+			}
+			nb = kept;
+		}
+		pipe_enqueue(out, bufs, nb);
+	}
+	return 0;
+}
+
+/*
+ * TX stage of the pipeline: drain the rings of the workers into the TX
+ * buffers of the ports paired with those the packets came in on, or of
+ * the ports the workers routed them to
+ */
+static int
+pipeline_tx(struct lcore_conf *conf)
+{
+	const uint64_t drain_tsc = fwd_drain_tsc();
+	struct rte_mbuf *bufs[FWD_BURST_SIZE];
+	uint64_t prev_tsc = 0, cur_tsc;
+	unsigned worker, nb, nb_round, i;
+
+	if (power_mode)
+		idle_init(conf);
+
+	while (!force_quit)
+	{
+		cur_tsc = rte_rdtsc();
+		if (unlikely(cur_tsc - prev_tsc > drain_tsc))
+		{
+			fwd_drain(conf, 0, cur_tsc);
+			prev_tsc = cur_tsc;
+		}
+		nb_round = 0;
+
+		for (worker = 0; worker < fwd_workers; worker++)
+		{
+			nb = rte_ring_dequeue_burst(pipe_out[worker].ring, (void **)bufs,
+										FWD_BURST_SIZE, NULL);
+			nb_round += nb;
+			for (i = 0; i < nb; i++)
+			{
+				const uint16_t port = l3_lpm != NULL ? bufs[i]->hash.usr
+													 : bufs[i]->port ^ 1;
+				fwd_send(conf, port, 0, bufs[i], cur_tsc);
+			}
+		}
+
+		if (conf->qos != NULL)
+		{
+			uint16_t port;
+			RTE_ETH_FOREACH_DEV(port)
+			conf->port[port].tx_pkts +=
+				qos_dequeue(conf, port, 0, cur_tsc);
+		}
+
+		if (power_mode)
+			idle_round(conf, 0, nb_round, cur_tsc);
+	}
+
+	fwd_drain(conf, 0, rte_rdtsc());
+	return 0;
+}
+
+/*
+ * What every forwarding lcore runs: the loop of its role
+ */
+static int
+lcore_entry(__rte_unused void *arg)
+{
+	struct lcore_conf *conf = &lcore_conf[rte_lcore_id()];
+
+	/* The remote NUMA accesses were reported with the placement. */
+	switch (conf->role)
+	{
+	case ROLE_RX:
+		printf("\nCore %u receiving for %u workers. [Ctrl+C to quit]\n",
+			   rte_lcore_id(), fwd_workers);
+		return pipeline_rx(conf);
+	case ROLE_WORKER:
+		printf("\nCore %u is worker %u. [Ctrl+C to quit]\n",
+			   rte_lcore_id(), conf->worker);
+		return pipeline_worker(conf);
+	case ROLE_TX:
+		printf("\nCore %u sending for %u workers. [Ctrl+C to quit]\n",
+			   rte_lcore_id(), fwd_workers);
+		return pipeline_tx(conf);
+	default:
+		printf("\nCore %u forwarding packets from %u RX queues. "
+			   "[Ctrl+C to quit]\n",
+			   rte_lcore_id(), conf->nb_rxq);
+		return lcore_main(conf);
+	}
+}
+
+/*
+ * Allocate the TX buffers of an lcore, one per output port, on the socket
+ * of the port
+ */
+static void
+fwd_init_lcore(unsigned lcore_id)
+{
+	struct lcore_conf *conf = &lcore_conf[lcore_id];
+	uint16_t port;
+
+	RTE_ETH_FOREACH_DEV(port)
+	{
+		struct rte_eth_dev_tx_buffer *buffer;
+
+		buffer = rte_zmalloc_socket("tx_buffer",
+									RTE_ETH_TX_BUFFER_SIZE(FWD_BURST_SIZE), 0,
+									rte_lcore_to_socket_id(lcore_id));
+		if (buffer == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate the TX buffer of "
+								   "lcore %u for port %u\n",
+					 lcore_id, port);
+		rte_eth_tx_buffer_init(buffer, FWD_BURST_SIZE);
+		if (rte_eth_tx_buffer_set_err_callback(buffer,
+											   rte_eth_tx_buffer_count_callback,
+											   &conf->port[port].tx_dropped) < 0)
+			rte_exit(EXIT_FAILURE, "Cannot set the error callback of the "
+								   "TX buffer of port %u\n",
+					 port);
+		conf->tx_buffer[port] = buffer;
+	}
+
+	/* The lcores that transmit share the rates of the shapers. */
+	if (qos_conf != NULL &&
+		(conf->role == ROLE_FWD || conf->role == ROLE_TX))
+		conf->qos = qos_create_ctx(lcore_id, fwd_workers ? 1 : nb_fwd_lcores);
+	if (fwd_gso)
+		gso_init(&conf->gso, lcore_id);
+}
+
+/* Add the counters "c" to "sum" */
+static void
+counters_add(struct port_counters *sum, const struct port_counters *c)
+{
+	int i;
+
+	sum->rx_pkts += c->rx_pkts;
+	sum->tx_pkts += c->tx_pkts;
+	sum->polls += c->polls;
+	sum->empty_polls += c->empty_polls;
+	sum->tx_dropped += c->tx_dropped;
+	sum->cycles += c->cycles;
+	for (i = 0; i < BURST_HIST_SIZE; i++)
+		sum->burst_hist[i] += c->burst_hist[i];
+}
+
+/*
+ * The counters of a port, summed over the forwarding lcores. The lcores
+ * keep counting meanwhile; every 64-bit counter is read whole, which is
+ * all the report needs.
+ */
+static void
+port_counters_get(uint16_t port, struct port_counters *sum)
+{
+	unsigned lcore_id;
+
+	memset(sum, 0, sizeof(*sum));
+	RTE_LCORE_FOREACH(lcore_id)
+	if (lcore_conf[lcore_id].enabled)
+		counters_add(sum, &lcore_conf[lcore_id].port[port]);
+}
+
+/* Print the non-zero extended statistics of a port, as " name=value" */
+static void
+print_xstats(uint16_t port)
+{
+	struct rte_eth_xstat_name *names;
+	struct rte_eth_xstat *xstats;
+	int i, n;
+
+	n = rte_eth_xstats_get_names(port, NULL, 0);
+	if (n <= 0)
+		return;
+	names = malloc(n * sizeof(*names));
+	xstats = malloc(n * sizeof(*xstats));
+	if (names != NULL && xstats != NULL &&
+		rte_eth_xstats_get_names(port, names, n) == n &&
+		rte_eth_xstats_get(port, xstats, n) == n)
+	{
+		for (i = 0; i < n; i++)
+			if (xstats[i].value != 0)
+				printf(" %s=%" PRIu64, names[xstats[i].id].name,
+					   xstats[i].value);
+	}
+	free(names);
+	free(xstats);
+}
+
+/*
+ * Print a stats line per port: the time, the forwarder counters with the
+ * rates since the previous line, and the device statistics, all as
+ * key=value
+ */
+static void
+stats_report(uint64_t now)
+{
+	static struct port_counters last[RTE_MAX_ETHPORTS];
+	static uint64_t start_tsc, last_tsc;
+	const double hz = rte_get_tsc_hz();
+	uint16_t port;
+	double secs;
+	int i;
+
+	if (start_tsc == 0)
+		start_tsc = last_tsc = now;
+	secs = (now - last_tsc) / hz;
+
+	RTE_ETH_FOREACH_DEV(port)
+	{
+		struct port_counters c;
+		struct rte_eth_stats hw;
+		uint64_t d_rx, d_cycles;
+
+		port_counters_get(port, &c);
+		if (rte_eth_stats_get(port, &hw) != 0)
+			memset(&hw, 0, sizeof(hw));
+		d_rx = c.rx_pkts - last[port].rx_pkts;
+		d_cycles = c.cycles - last[port].cycles;
+
+		printf("stats t=%.3f port=%u rx=%" PRIu64 " tx=%" PRIu64
+			   " rx_pps=%.0f tx_pps=%.0f polls=%" PRIu64 " empty=%" PRIu64
+			   " tx_full=%" PRIu64 " cpp=%.1f burst=",
+			   (now - start_tsc) / hz, port, c.rx_pkts, c.tx_pkts,
+			   secs > 0 ? d_rx / secs : 0.0,
+			   secs > 0 ? (c.tx_pkts - last[port].tx_pkts) / secs : 0.0,
+			   c.polls, c.empty_polls, c.tx_dropped,
+			   d_rx ? (double)d_cycles / d_rx : 0.0);
+		for (i = 0; i < BURST_HIST_SIZE; i++)
+			printf("%s%" PRIu64, i ? "/" : "", c.burst_hist[i]);
+		printf(" ipackets=%" PRIu64 " opackets=%" PRIu64 " imissed=%" PRIu64
+			   " ierrors=%" PRIu64 " oerrors=%" PRIu64 " rx_nombuf=%" PRIu64,
+			   hw.ipackets, hw.opackets, hw.imissed, hw.ierrors, hw.oerrors,
+			   hw.rx_nombuf);
+		if (stats_xstats)
+			print_xstats(port);
+		printf("\n");
+		last[port] = c;
+	}
+	fflush(stdout);
+
+	last_tsc = now;
+	stats_next_tsc = now + (uint64_t)(stats_interval * hz);
+}
+
+void construct_udp_pkt(int port, struct rte_mbuf **bufs, int i);
+
+/**
+ * Send UDP packet
+ */
+void send_udp(struct rte_mempool *mbuf_pool)
+{
+	uint16_t port = 0;
+
+	// Send a packets to physical machine
+	printf("Start send packet\n");
+	struct rte_mbuf *bufs[BURST_SIZE];
+	int retval = rte_pktmbuf_alloc_bulk(mbuf_pool, bufs, BURST_SIZE);
+	if (retval != 0)
+		printf("mbufs alloc failed\n");
+	construct_udp_pkt(port, bufs, 0);
+	/* Send burst of TX packets. */
+	const uint16_t nb_tx = rte_eth_tx_burst(port, 0,
+											bufs, BURST_SIZE);
+
+	/* Free any unsent packets. */
+	if (unlikely(nb_tx < BURST_SIZE))
+	{
+		uint16_t buf;
+		for (buf = nb_tx; buf < BURST_SIZE; buf++)
+			rte_pktmbuf_free(bufs[buf]);
+	}
+	printf("Send finished!\n");
+}
+
+/**
+ * Construct UDP packet
+ */
+void construct_udp_pkt(int port, struct rte_mbuf **bufs, int i)
+{
+	char hello_msg[64];
+	memset(hello_msg, 0, 64);
+	strcpy(hello_msg, "This is a message from VM.");
+	char *content = rte_pktmbuf_append(bufs[i], 64);
+	rte_memcpy(content, hello_msg, 64);
+
+	printf("Finish create message.\n");
+
+	// Construct UDP Header
+	/* The length contains both udp header and the length of data. */
+	unsigned int udp_pkt_len = 64 + 8;
+	struct rte_udp_hdr *udp_hdr;
+	udp_hdr = (struct rte_udp_hdr *)rte_pktmbuf_prepend(bufs[i], sizeof(struct rte_udp_hdr));
+	udp_hdr->src_port = rte_cpu_to_be_16(PORT);
+	udp_hdr->dst_port = rte_cpu_to_be_16(PORT);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(udp_pkt_len);
+	udp_hdr->dgram_cksum = 0;
+	printf("Udp header part finished.\n");
+
+	// Construct IPv4 Header
+	struct rte_ipv4_hdr *ip_hdr;
+	ip_hdr = (struct rte_ipv4_hdr *)rte_pktmbuf_prepend(bufs[i], sizeof(struct rte_ipv4_hdr));
+	ip_hdr->dst_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 80, 1));
+	ip_hdr->src_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 80, 10));
+	ip_hdr->version_ihl = 0x45;
+	ip_hdr->total_length = rte_cpu_to_be_16(udp_pkt_len + sizeof(struct rte_ipv4_hdr));
+	ip_hdr->next_proto_id = IPPROTO_UDP;
+	ip_hdr->time_to_live = 0xa;
+	ip_hdr->hdr_checksum = rte_ipv4_cksum(ip_hdr);
+	printf("IPv4 header part finished.\n");
+
+	// Destination MAC address
+	// The physical address can be obtained by viewing the network adapter corresponding to the virtual machine on the physical machine.
+	struct rte_ether_addr s_addr, d_addr;
+	rte_eth_macaddr_get(port, &s_addr);
+	d_addr.addr_bytes[0] = 0x00;
+	d_addr.addr_bytes[1] = 0x50;
+	d_addr.addr_bytes[2] = 0x56;
+	d_addr.addr_bytes[3] = 0xC0;
+	d_addr.addr_bytes[4] = 0x00;
+	d_addr.addr_bytes[5] = 0x02;
+
+	// Construct Ethernet Header
+	struct rte_ether_hdr *ether_hdr;
+	ether_hdr = (struct rte_ether_hdr *)rte_pktmbuf_prepend(bufs[i], sizeof(struct rte_ether_hdr));
+	ether_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+	// Copy
+	rte_ether_addr_copy(&ether_hdr->s_addr, &s_addr);
+	rte_ether_addr_copy(&ether_hdr->d_addr, &d_addr);
+
+	printf("Ethernet header part finished.\n");
+}
+
+/*
+ * Packet template of the generator. The whole frame is built once, with
+ * its checksums; each packet is a copy in which only the sequence number,
+ * the timestamp, the IP id and the source port are patched, and the
+ * checksums adjusted incrementally (RFC 1624).
+ */
+struct gen_payload
+{
+	rte_be32_t magic;
+	rte_be32_t flow;
+	uint64_t seq; /* big endian, from 0 in every flow */
+	uint64_t tsc; /* big endian, TSC of the sender when it was built */
+} __attribute__((packed));
+
+struct udp_template
+{
+	uint8_t data[RTE_ETHER_HDR_LEN + RTE_IPV4_MAX_PKT_LEN];
+	uint32_t len;
+	uint16_t ip_cksum;  /* as stored, with packet_id 0 */
+	uint16_t udp_cksum; /* as stored, with src_port PORT and seq 0 */
+};
+
+#define TMPL_IP_OFF sizeof(struct rte_ether_hdr)
+#define TMPL_UDP_OFF (TMPL_IP_OFF + sizeof(struct rte_ipv4_hdr))
+#define TMPL_PAYLOAD_OFF (TMPL_UDP_OFF + sizeof(struct rte_udp_hdr))
+#define GEN_MIN_SIZE sizeof(struct gen_payload)
+
+static struct udp_template gen_tmpl;
+
+/* The largest payload: that of a frame of the MTU, or with --gso that of
+ * a whole datagram, sent as fragments */
+static uint32_t
+gen_max_size(void)
+{
+	return (fwd_gso ? RTE_IPV4_MAX_PKT_LEN : fwd_mtu) -
+		   sizeof(struct rte_ipv4_hdr) - sizeof(struct rte_udp_hdr);
+}
+
+/**
+ * Build the generator template: the same headers as construct_udp_pkt, a
+ * payload of "size" bytes starting with struct gen_payload, and a real UDP
+ * checksum.
+ */
+static void
+build_udp_template(uint16_t port, uint16_t size)
+{
+	struct udp_template *t = &gen_tmpl;
+	struct rte_ether_hdr *eth = (struct rte_ether_hdr *)t->data;
+	struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(t->data + TMPL_IP_OFF);
+	struct rte_udp_hdr *udp = (struct rte_udp_hdr *)(t->data + TMPL_UDP_OFF);
+	struct gen_payload *gp = (struct gen_payload *)(t->data + TMPL_PAYLOAD_OFF);
+	static const char hello_msg[] = "This is a message from VM.";
+	uint16_t i;
+
+	memset(t, 0, sizeof(*t));
+	t->len = TMPL_PAYLOAD_OFF + size;
+
+	rte_eth_macaddr_get(port, &eth->s_addr);
+	eth->d_addr.addr_bytes[0] = 0x00;
+	eth->d_addr.addr_bytes[1] = 0x50;
+	eth->d_addr.addr_bytes[2] = 0x56;
+	eth->d_addr.addr_bytes[3] = 0xC0;
+	eth->d_addr.addr_bytes[4] = 0x00;
+	eth->d_addr.addr_bytes[5] = 0x02;
+	eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+	ip->version_ihl = 0x45;
+	ip->total_length = rte_cpu_to_be_16(size + sizeof(struct rte_udp_hdr) +
+					    sizeof(struct rte_ipv4_hdr));
+	ip->time_to_live = 0xa;
+	ip->next_proto_id = IPPROTO_UDP;
+	ip->src_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 80, 10));
+	ip->dst_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 80, 1));
+	ip->hdr_checksum = rte_ipv4_cksum(ip);
+
+	udp->src_port = rte_cpu_to_be_16(PORT);
+	udp->dst_port = rte_cpu_to_be_16(PORT);
+	udp->dgram_len = rte_cpu_to_be_16(size + sizeof(struct rte_udp_hdr));
+
+	gp->magic = rte_cpu_to_be_32(GEN_MAGIC);
+	for (i = GEN_MIN_SIZE; i < size; i++)
+		t->data[TMPL_PAYLOAD_OFF + i] =
+			hello_msg[(i - GEN_MIN_SIZE) % (sizeof(hello_msg) - 1)];
+
+	udp->dgram_cksum = rte_ipv4_udptcp_cksum(ip, udp);
+	t->ip_cksum = ip->hdr_checksum;
+	t->udp_cksum = udp->dgram_cksum;
+}
+
+/**
+ * Fill a fresh mbuf with packet "seq" of flow "flow", stamped with "tsc",
+ * chaining more from its pool if it does not fit; return false if the pool
+ * ran out
+ */
+static inline bool
+gen_fill(struct rte_mbuf *m, uint64_t seq, uint16_t flow, uint64_t tsc)
+{
+	const struct udp_template *t = &gen_tmpl;
+	struct rte_ipv4_hdr *ip;
+	struct rte_udp_hdr *udp;
+	struct gen_payload *gp;
+	uint8_t *p;
+	/* the IP id counts the packets of all flows, which are sent in turn */
+	uint16_t id = rte_cpu_to_be_16((uint16_t)(seq * gen_flows + flow));
+	uint16_t src_port = rte_cpu_to_be_16(PORT + flow);
+	uint64_t be_seq = rte_cpu_to_be_64(seq);
+	uint64_t be_tsc = rte_cpu_to_be_64(tsc);
+	uint16_t seq_words[4], tsc_words[4], flow_words[2];
+	uint32_t be_flow = rte_cpu_to_be_32(flow);
+	uint32_t sum;
+	uint16_t cksum;
+	int i;
+
+	/* the headers and struct gen_payload are in the first mbuf */
+	if (unlikely(!mbuf_append(m, t->data, t->len)))
+		return false;
+	p = rte_pktmbuf_mtod(m, uint8_t *);
+	ip = (struct rte_ipv4_hdr *)(p + TMPL_IP_OFF);
+	udp = (struct rte_udp_hdr *)(p + TMPL_UDP_OFF);
+	gp = (struct gen_payload *)(p + TMPL_PAYLOAD_OFF);
+
+	ip->packet_id = id;
+	ip->hdr_checksum = cksum_fold(cksum_replace((uint16_t)~t->ip_cksum, 0, id));
+
+	udp->src_port = src_port;
+	gp->flow = be_flow;
+	gp->seq = be_seq;
+	gp->tsc = be_tsc;
+
+	/* the template has zeros in place of the flow, the sequence and the
+	 * timestamp */
+	sum = cksum_replace((uint16_t)~t->udp_cksum, rte_cpu_to_be_16(PORT),
+			    src_port);
+	memcpy(flow_words, &be_flow, sizeof(flow_words));
+	memcpy(seq_words, &be_seq, sizeof(seq_words));
+	memcpy(tsc_words, &be_tsc, sizeof(tsc_words));
+	for (i = 0; i < 2; i++)
+		sum = cksum_replace(sum, 0, flow_words[i]);
+	for (i = 0; i < 4; i++)
+	{
+		sum = cksum_replace(sum, 0, seq_words[i]);
+		sum = cksum_replace(sum, 0, tsc_words[i]);
+	}
+	cksum = cksum_fold(sum);
+	/* a computed UDP checksum of 0 is sent as all ones */
+	udp->dgram_cksum = (cksum == 0) ? 0xffff : cksum;
+	return true;
+}
+
+/*
+ * Send a burst of datagrams beyond the MTU as IP fragments; return the
+ * datagrams sent whole. The fragments that do not fit in the TX ring are
+ * freed, and so are the datagrams the pools have no fragments for,
+ * counted in "nb_fail".
+ */
+static uint16_t
+gen_tx_gso(struct rte_gso_ctx *ctx, uint16_t port, struct rte_mbuf **bufs,
+		   uint16_t n, uint16_t *nb_fail)
+{
+	struct rte_mbuf *segs[GSO_MAX_SEGS];
+	uint16_t i, nb_tx, sent = 0;
+	int nb;
+
+	for (i = 0; i < n; i++)
+	{
+		nb = gso_udp(ctx, bufs[i], segs);
+		if (unlikely(nb <= 0))
+		{
+			rte_pktmbuf_free(bufs[i]);
+			(*nb_fail)++;
+			continue;
+		}
+		nb_tx = rte_eth_tx_burst(port, 0, segs, nb);
+		if (likely(nb_tx == nb))
+			sent++;
+		else
+			rte_pktmbuf_free_bulk(&segs[nb_tx], nb - nb_tx);
+	}
+	return sent;
+}
+
+/**
+ * Generator: send template packets in bursts, paced by the TSC when a rate
+ * is given, and report the achieved rate every second
+ */
+static void
+gen_main(struct rte_mempool *mbuf_pool)
+{
+	const uint16_t port = 0;
+	const uint64_t hz = rte_get_tsc_hz();
+	/* cycles between two bursts at the requested rate */
+	const uint64_t burst_cycles = gen_rate ? hz * gen_burst / gen_rate : 0;
+	const uint64_t start = rte_rdtsc();
+	const uint64_t end = start + (uint64_t)(duration * hz);
+	uint64_t now, next_burst = start, last_report = start;
+	uint64_t seq = 0, nb_sent = 0, last_sent = 0;
+	uint64_t flow_seq = 0; /* the sequence of the current flow */
+	uint64_t nb_tx_full = 0, nb_alloc_fail = 0;
+	struct rte_mbuf *bufs[MAX_BURST_SIZE];
+	struct rte_gso_ctx gso;
+	uint16_t flow = 0;
+	bool fragment;
+
+	build_udp_template(port, gen_size);
+	fragment = gen_tmpl.len > (uint32_t)(fwd_mtu + RTE_ETHER_HDR_LEN);
+	if (fragment)
+		gso_init(&gso, rte_lcore_id());
+	printf("\nCore %u generating %u-byte UDP packets on port %u, "
+	       "%u flows, bursts of %u, %s\n",
+	       rte_lcore_id(), gen_tmpl.len, port, gen_flows, gen_burst,
+	       gen_rate ? "rate limited" : "unlimited rate");
+
+	while (!force_quit)
+	{
+		uint16_t n = gen_burst, nb_tx, i;
+
+		now = rte_rdtsc();
+		if ((duration > 0 && now >= end) || (gen_count && seq >= gen_count))
+			break;
+
+		if (now - last_report >= hz)
+		{
+			double secs = (double)(now - last_report) / hz;
+			printf("gen: %.3f Mpps, %" PRIu64 " sent, %" PRIu64
+			       " tx full, %" PRIu64 " alloc failures\n",
+			       (nb_sent - last_sent) / secs / 1e6, nb_sent,
+			       nb_tx_full, nb_alloc_fail);
+			last_report = now;
+			last_sent = nb_sent;
+		}
+
+		if (burst_cycles)
+		{
+			if (now < next_burst)
+			{
+				rte_pause();
+				continue;
+			}
+			/* do not try to catch up after a stall; only when behind,
+			 * as now - next_burst wraps when on schedule */
+			next_burst += burst_cycles;
+			if (now > next_burst + hz / 100)
+				next_burst = now;
+		}
+
+		if (gen_count && gen_count - seq < n)
+			n = gen_count - seq;
+		if (rte_pktmbuf_alloc_bulk(mbuf_pool, bufs, n) != 0)
+		{
+			nb_alloc_fail++;
+			continue;
+		}
+		for (i = 0; i < n; i++)
+		{
+			if (unlikely(!gen_fill(bufs[i], flow_seq, flow, now)))
+				break;
+			seq++;
+			if (++flow == gen_flows)
+			{
+				flow = 0;
+				flow_seq++;
+			}
+		}
+
+		/* The pool ran out in a chain: send what is complete. */
+		if (unlikely(i < n))
+		{
+			nb_alloc_fail++;
+			rte_pktmbuf_free_bulk(&bufs[i], n - i);
+			n = i;
+		}
+
+		if (fragment)
+		{
+			uint16_t nb_fail = 0;
+
+			nb_tx = gen_tx_gso(&gso, port, bufs, n, &nb_fail);
+			nb_alloc_fail += nb_fail;
+			n -= nb_fail;
+		}
+		else
+		{
+			nb_tx = rte_eth_tx_burst(port, 0, bufs, n);
+			/* The TX ring is full: drop the rest of the burst. */
+			if (unlikely(nb_tx < n))
+				rte_pktmbuf_free_bulk(&bufs[nb_tx], n - nb_tx);
+		}
+		nb_sent += nb_tx;
+		nb_tx_full += n - nb_tx;
+	}
+
+	now = rte_rdtsc();
+	{
+		double secs = (double)(now - start) / hz;
+		printf("gen: %" PRIu64 " packets sent in %.3fs: %.3f Mpps, "
+		       "%.3f Gbps, %" PRIu64 " dropped on a full TX ring\n",
+		       nb_sent, secs, nb_sent / secs / 1e6,
+		       nb_sent * (gen_tmpl.len + RTE_ETHER_CRC_LEN) * 8 / secs / 1e9,
+		       seq - nb_sent);
+	}
+}
+
+/*
+ * Sink: count what the generator sent. Every UDP flow (5-tuple) has a
+ * cache line of counters in a hash table, where the sequence numbers of
+ * the generator show the packets missing, and the TSC it stamped the
+ * one-way latency. That latency only means something when both ends read
+ * the same TSC: on one host with an invariant TSC, as over net_ring.
+ */
+struct sink_flow
+{
+	uint64_t pkts;
+	uint64_t bytes;
+	uint64_t next_seq; /* counted from the first stamped packet */
+	uint64_t window;   /* bit i: next_seq - 1 - i came in */
+	uint64_t missing;  /* skipped, less those that came late */
+	uint64_t late;	   /* reordered or duplicated */
+	uint64_t stamped;  /* packets with the payload of the generator */
+	uint64_t timed;	   /* of those, with a usable timestamp */
+	uint64_t lat_sum;  /* cycles, over those */
+	uint64_t lat_max;
+} __rte_cache_aligned;
+
+struct sink_counters
+{
+	uint64_t pkts;
+	uint64_t bytes;
+	uint64_t not_udp;  /* not UDP over IPv4, or a fragment past the first */
+	uint64_t untimed;  /* UDP without the payload of the generator */
+	uint64_t no_flow;  /* the flow table was full */
+	uint64_t skewed;   /* stamped in the future: another TSC */
+	uint64_t lat_min;
+	uint64_t lat_hist[SINK_HIST_SIZE];
+};
+
+static struct rte_hash *sink_table;
+static struct sink_flow *sink_flows; /* by position in sink_table */
+static struct sink_counters sink;
+static volatile bool sink_gen_done; /* set when the paired generator returns */
+
+static inline unsigned
+sink_hist_bucket(uint64_t cycles)
+{
+	unsigned octave;
+
+	if (cycles < (1u << SINK_HIST_BITS))
+		return cycles;
+	octave = 63 - __builtin_clzll(cycles);
+	return ((octave - SINK_HIST_BITS + 1) << SINK_HIST_BITS) |
+		   ((cycles >> (octave - SINK_HIST_BITS)) &
+			((1u << SINK_HIST_BITS) - 1));
+}
+
+/* The first latency (in cycles) of the buckets after "b" */
+static uint64_t
+sink_hist_limit(unsigned b)
+{
+	unsigned octave;
+
+	b++;
+	if (b < (2u << SINK_HIST_BITS))
+		return b;
+	octave = (b >> SINK_HIST_BITS) + SINK_HIST_BITS - 1;
+	if (octave > 63)
+		return UINT64_MAX;
+	return (uint64_t)((1u << SINK_HIST_BITS) | (b & ((1u << SINK_HIST_BITS) - 1)))
+		   << (octave - SINK_HIST_BITS);
+}
+
+/* The latency below which a share "q" of the packets were, in cycles */
+static uint64_t
+sink_quantile(double q, uint64_t total)
+{
+	uint64_t seen = 0;
+	unsigned b;
+
+	for (b = 0; b < SINK_HIST_SIZE; b++)
+	{
+		seen += sink.lat_hist[b];
+		if (seen > 0 && seen >= q * total)
+			return sink_hist_limit(b);
+	}
+	return 0;
+}
+
+static void
+sink_create_table(void)
+{
+	struct rte_hash_parameters params;
+
+	memset(&params, 0, sizeof(params));
+	params.name = "sink_flows";
+	params.entries = SINK_MAX_FLOWS;
+	params.key_len = sizeof(struct flow_key);
+	params.hash_func = rte_hash_crc;
+	params.socket_id = rte_socket_id();
+	sink_table = rte_hash_create(&params);
+	sink_flows = rte_zmalloc_socket("sink_flows",
+									SINK_MAX_FLOWS * sizeof(*sink_flows),
+									RTE_CACHE_LINE_SIZE, rte_socket_id());
+	if (sink_table == NULL || sink_flows == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate the flows of the sink\n");
+}
+
+/* Account for the sequence number and the timestamp of a packet */
+static inline void
+sink_track(struct sink_flow *f, const struct gen_payload *gp, uint64_t now)
+{
+	uint64_t seq = rte_be_to_cpu_64(gp->seq);
+	uint64_t tsc = rte_be_to_cpu_64(gp->tsc);
+	uint64_t lat, gap;
+
+	/*
+	 * A packet behind next_seq fills a gap, and is no longer missing, if
+	 * its bit in the window is clear; otherwise it is a duplicate. Gaps
+	 * further back than the window stay missing.
+	 */
+	if (unlikely(f->stamped++ == 0))
+	{
+		/* Nothing before the first counts as missing. */
+		f->next_seq = seq + 1;
+		f->window = UINT64_MAX;
+	}
+	else if (likely(seq == f->next_seq))
+	{
+		f->next_seq++;
+		f->window = (f->window << 1) | 1;
+	}
+	else if (seq > f->next_seq)
+	{
+		gap = seq - f->next_seq;
+		f->missing += gap;
+		f->next_seq = seq + 1;
+		f->window = gap < 63 ? (f->window << (gap + 1)) | 1 : 1;
+	}
+	else
+	{
+		gap = f->next_seq - 1 - seq;
+		f->late++;
+		if (gap < 64 && !(f->window & (UINT64_C(1) << gap)))
+		{
+			f->window |= UINT64_C(1) << gap;
+			f->missing--;
+		}
+	}
+
+	if (unlikely(tsc > now))
+	{
+		sink.skewed++;
+		return;
+	}
+	lat = now - tsc;
+	f->timed++;
+	f->lat_sum += lat;
+	if (lat > f->lat_max)
+		f->lat_max = lat;
+	if (lat < sink.lat_min)
+		sink.lat_min = lat;
+	sink.lat_hist[sink_hist_bucket(lat)]++;
+}
+
+/*
+ * Count a burst received at "now": parse the 5-tuples, look the flows up
+ * together, and add the flows seen for the first time
+ */
+static void
+sink_burst(struct rte_mbuf **bufs, uint16_t n, uint64_t now)
+{
+	struct flow_key keys[FWD_BURST_SIZE];
+	const void *key_ptrs[FWD_BURST_SIZE];
+	struct rte_ipv4_hdr *ips[FWD_BURST_SIZE];
+	int32_t pos[FWD_BURST_SIZE];
+	uint16_t i;
+
+	/* Start loading the headers of the whole burst before reading any. */
+	for (i = 0; i < n; i++)
+		rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void *));
+
+	for (i = 0; i < n; i++)
+	{
+		ips[i] = parse_flow_key(bufs[i], &keys[i]);
+		key_ptrs[i] = &keys[i];
+	}
+	if (rte_hash_lookup_bulk(sink_table, key_ptrs, n, pos) != 0)
+		for (i = 0; i < n; i++)
+			pos[i] = -1;
+
+	for (i = 0; i < n; i++)
+	{
+		struct rte_mbuf *m = bufs[i];
+		const struct gen_payload *gp;
+		struct sink_flow *f;
+		uint32_t off;
+
+		sink.pkts++;
+		sink.bytes += m->pkt_len;
+		if (ips[i] == NULL || keys[i].proto != IPPROTO_UDP ||
+			(ips[i]->fragment_offset &
+			 rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK)) != 0)
+		{
+			sink.not_udp++;
+			continue;
+		}
+
+		/*
+		 * A flow missed by the bulk lookup may have been added by an
+		 * earlier packet of the burst: only a new one starts from zero.
+		 */
+		if (unlikely(pos[i] < 0))
+			pos[i] = rte_hash_lookup(sink_table, &keys[i]);
+		if (unlikely(pos[i] < 0))
+		{
+			pos[i] = rte_hash_add_key(sink_table, &keys[i]);
+			if (pos[i] < 0)
+			{
+				sink.no_flow++;
+				continue;
+			}
+			memset(&sink_flows[pos[i]], 0, sizeof(*f));
+		}
+		f = &sink_flows[pos[i]];
+		f->pkts++;
+		f->bytes += m->pkt_len;
+
+		/* The payload of the generator is in the first mbuf. */
+		off = (const uint8_t *)ips[i] - rte_pktmbuf_mtod(m, const uint8_t *) +
+			  (ips[i]->version_ihl & 0xf) * 4 + sizeof(struct rte_udp_hdr);
+		gp = rte_pktmbuf_mtod_offset(m, const struct gen_payload *, off);
+		if (m->data_len < off + sizeof(*gp) ||
+			gp->magic != rte_cpu_to_be_32(GEN_MAGIC))
+		{
+			sink.untimed++;
+			continue;
+		}
+		sink_track(f, gp, now);
+	}
+}
+
+/* What the sink counted over "secs" seconds */
+static void
+sink_report(double secs)
+{
+	const double us_per_cycle = 1e6 / rte_get_tsc_hz();
+	uint64_t timed = 0, missing = 0, late = 0, lat_sum = 0, lat_max = 0;
+	const void *key;
+	void *data;
+	uint32_t iter = 0;
+	unsigned nb_flows = 0, b, j;
+	int32_t pos;
+
+	printf("\n%-15s %-15s %6s %6s %14s %16s %12s %10s %8s %9s %9s\n",
+	       "src", "dst", "sport", "dport", "packets", "bytes", "missing",
+	       "late", "loss%", "mean us", "max us");
+	while ((pos = rte_hash_iterate(sink_table, &key, &data, &iter)) >= 0)
+	{
+		const struct flow_key *k = key;
+		const struct sink_flow *f = &sink_flows[pos];
+		char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+
+		nb_flows++;
+		missing += f->missing;
+		late += f->late;
+		timed += f->timed;
+		lat_sum += f->lat_sum;
+		lat_max = RTE_MAX(lat_max, f->lat_max);
+		if (nb_flows > SINK_REPORT_FLOWS)
+			continue;
+		inet_ntop(AF_INET, &k->src_ip, src, sizeof(src));
+		inet_ntop(AF_INET, &k->dst_ip, dst, sizeof(dst));
+		printf("%-15s %-15s %6u %6u %14" PRIu64 " %16" PRIu64 " %12" PRIu64
+		       " %10" PRIu64 " %7.3f%% %9.1f %9.1f\n",
+		       src, dst, rte_be_to_cpu_16(k->src_port),
+		       rte_be_to_cpu_16(k->dst_port), f->pkts, f->bytes, f->missing,
+		       f->late, 100.0 * f->missing / (f->pkts + f->missing),
+		       f->timed ? us_per_cycle * f->lat_sum / f->timed : 0.0,
+		       us_per_cycle * f->lat_max);
+	}
+	if (nb_flows > SINK_REPORT_FLOWS)
+		printf("... and %u more flows\n", nb_flows - SINK_REPORT_FLOWS);
+
+	printf("\nsink: %" PRIu64 " packets in %.3fs: %.3f Mpps, %.3f Gbps, "
+	       "%u flows\n",
+	       sink.pkts, secs, sink.pkts / secs / 1e6,
+	       (sink.bytes + sink.pkts * RTE_ETHER_CRC_LEN) * 8 / secs / 1e9,
+	       nb_flows);
+	printf("sink: %" PRIu64 " missing (%.3f%%), %" PRIu64 " late, %" PRIu64
+	       " not UDP, %" PRIu64 " without a timestamp, %" PRIu64
+	       " beyond the flow table, %" PRIu64 " from another clock\n",
+	       missing,
+	       (sink.pkts + missing) ? 100.0 * missing / (sink.pkts + missing) : 0.0,
+	       late, sink.not_udp, sink.untimed, sink.no_flow, sink.skewed);
+	if (timed == 0)
+		return;
+	printf("sink: one-way latency (us) min %.1f mean %.1f p50 %.1f p90 %.1f "
+	       "p99 %.1f p99.9 %.1f max %.1f\n",
+	       us_per_cycle * sink.lat_min, us_per_cycle * lat_sum / timed,
+	       us_per_cycle * sink_quantile(0.5, timed),
+	       us_per_cycle * sink_quantile(0.9, timed),
+	       us_per_cycle * sink_quantile(0.99, timed),
+	       us_per_cycle * sink_quantile(0.999, timed),
+	       us_per_cycle * lat_max);
+
+	/* The histogram by powers of two, the buckets of each summed */
+	printf("\n%14s %14s\n", "latency < us", "packets");
+	for (b = 0; b < SINK_HIST_SIZE; b += 1u << SINK_HIST_BITS)
+	{
+		uint64_t sum = 0;
+
+		for (j = 0; j < (1u << SINK_HIST_BITS); j++)
+			sum += sink.lat_hist[b + j];
+		if (sum > 0)
+			printf("%14.3f %14" PRIu64 "\n",
+			       us_per_cycle * sink_hist_limit(b + (1u << SINK_HIST_BITS) - 1),
+			       sum);
+	}
+}
+
+/* The generator paired with the sink, on another lcore */
+static int
+sink_gen_entry(void *arg)
+{
+	gen_main(arg);
+	sink_gen_done = true;
+	return 0;
+}
+
+/**
+ * Sink: receive on queue 0 of every port, merging the fragments with
+ * --gro, and count the flows. With a generator on another lcore, it stops
+ * once the generator is done and the ports are quiet, otherwise after
+ * --duration seconds or when interrupted.
+ */
+static void
+sink_main(bool paired)
+{
+	const uint64_t hz = rte_get_tsc_hz();
+	const uint64_t start = rte_rdtsc();
+	const uint64_t end = start + (uint64_t)(duration * hz);
+	struct lcore_conf *conf = &lcore_conf[rte_lcore_id()];
+	struct rte_mbuf *bufs[FWD_BURST_SIZE];
+	uint64_t now = start, last_rx = start, last_report = start;
+	uint64_t last_pkts = 0;
+	uint16_t port;
+
+	sink_create_table();
+	sink.lat_min = UINT64_MAX;
+	printf("\nCore %u counting the UDP flows of every port%s. "
+	       "[Ctrl+C to quit]\n",
+	       rte_lcore_id(), paired ? ", generated on port 0" : "");
+
+	while (!force_quit)
+	{
+		now = rte_rdtsc();
+		if (paired ? sink_gen_done && now - last_rx >= hz * SINK_SETTLE_MS / 1000
+				   : duration > 0 && now >= end)
+			break;
+
+		if (now - last_report >= hz)
+		{
+			double secs = (double)(now - last_report) / hz;
+			printf("sink: %.3f Mpps, %" PRIu64 " received\n",
+			       (sink.pkts - last_pkts) / secs / 1e6, sink.pkts);
+			last_report = now;
+			last_pkts = sink.pkts;
+		}
+
+		RTE_ETH_FOREACH_DEV(port)
+		{
+			uint16_t n = rte_eth_rx_burst(port, 0, bufs, FWD_BURST_SIZE);
+
+			if (n == 0)
+				continue;
+			if (fwd_gro)
+				n = fwd_gro_burst(conf, bufs, n);
+			sink_burst(bufs, n, now);
+			rte_pktmbuf_free_bulk(bufs, n);
+			last_rx = now;
+		}
+	}
+
+	sink_report((double)(now - start) / hz);
+	if (fwd_gro)
+		printf("sink: %" PRIu64 " packets merged by GRO into %" PRIu64 "\n",
+		       conf->seg.gro_in, conf->seg.gro_out);
+}
+
+/**
+ * Inject "nb" template packets into every TX queue of every port
+ */
+static void
+fwd_prime_queues(uint16_t nb)
+{
+	struct rte_mbuf *bufs[MAX_BURST_SIZE];
+	uint64_t seq = 0;
+	uint16_t port, q;
+
+	build_udp_template(0, gen_size);
+	RTE_ETH_FOREACH_DEV(port)
+	for (q = 0; q < nb_queues; q++)
+	{
+		uint16_t left = nb;
+		while (left > 0)
+		{
+			uint16_t n = RTE_MIN(left, MAX_BURST_SIZE), i, nb_tx;
+			if (rte_pktmbuf_alloc_bulk(port_pool(port), bufs, n) != 0)
+				rte_exit(EXIT_FAILURE, "Cannot allocate packets to prime "
+									   "the queues\n");
+			for (i = 0; i < n; i++)
+				if (!gen_fill(bufs[i], seq++, 0, rte_rdtsc()))
+					rte_exit(EXIT_FAILURE, "Cannot allocate packets to "
+										   "prime the queues\n");
+			nb_tx = rte_eth_tx_burst(port, q, bufs, n);
+			if (nb_tx < n)
+			{
+				rte_pktmbuf_free_bulk(&bufs[nb_tx], n - nb_tx);
+				break;
+			}
+			left -= n;
+		}
+	}
+}
+
+/* Print the header of the exit table */
+static void
+print_counters_header(void)
+{
+	printf("\n%-6s %6s %16s %16s %12s %8s %7s %9s %10s\n", "lcore", "rxq",
+	       "rx", "tx", "dropped", "burst", "empty%", "cyc/pkt", "Mpps");
+}
+
+/* Print a line of the exit table */
+static void
+print_counters(const char *name, unsigned nb_rxq,
+			   const struct port_counters *c, double secs)
+{
+	const uint64_t bursts = c->polls - c->empty_polls;
+
+	printf("%-6s %6u %16" PRIu64 " %16" PRIu64 " %12" PRIu64
+	       " %8.1f %7.1f %9.1f %10.3f\n", name, nb_rxq, c->rx_pkts,
+	       c->tx_pkts, c->tx_dropped,
+	       bursts ? (double)c->rx_pkts / bursts : 0.0,
+	       c->polls ? 100.0 * c->empty_polls / c->polls : 0.0,
+	       c->rx_pkts ? (double)c->cycles / c->rx_pkts : 0.0,
+	       c->tx_pkts / secs / 1e6);
+}
+
+/**
+ * Create the rings between the stages of the pipeline
+ */
+static void
+pipeline_create_rings(void)
+{
+	char name[RTE_RING_NAMESIZE];
+	unsigned worker;
+
+	for (worker = 0; worker < fwd_workers; worker++)
+	{
+		snprintf(name, sizeof(name), "pipe_in_%u", worker);
+		pipe_in[worker].ring = rte_ring_create(name, PIPE_RING_SIZE,
+											   rte_socket_id(),
+											   RING_F_SP_ENQ | RING_F_SC_DEQ);
+		snprintf(name, sizeof(name), "pipe_out_%u", worker);
+		pipe_out[worker].ring = rte_ring_create(name, PIPE_RING_SIZE,
+												rte_socket_id(),
+												RING_F_SP_ENQ | RING_F_SC_DEQ);
+		if (pipe_in[worker].ring == NULL || pipe_out[worker].ring == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot create the rings of the "
+								   "pipeline\n");
+		pipe_in[worker].capacity = rte_ring_get_capacity(pipe_in[worker].ring);
+		pipe_out[worker].capacity = rte_ring_get_capacity(pipe_out[worker].ring);
+	}
+}
+
+/* Free the packets left between the stages once the lcores stopped */
+static void
+pipeline_drain(void)
+{
+	struct rte_mbuf *bufs[MAX_BURST_SIZE];
+	unsigned worker, n;
+
+	for (worker = 0; worker < fwd_workers; worker++)
+	{
+		while ((n = rte_ring_dequeue_burst(pipe_in[worker].ring, (void **)bufs,
+										   MAX_BURST_SIZE, NULL)) > 0)
+			rte_pktmbuf_free_bulk(bufs, n);
+		while ((n = rte_ring_dequeue_burst(pipe_out[worker].ring, (void **)bufs,
+										   MAX_BURST_SIZE, NULL)) > 0)
+			rte_pktmbuf_free_bulk(bufs, n);
+	}
+}
+
+static void
+print_pipe_ring(const char *name, const struct pipe_ring *r)
+{
+	printf("%-10s %16" PRIu64 " %12" PRIu64 " %10.1f %10u %8u\n", name,
+	       r->enqueued, r->dropped,
+	       r->samples ? (double)r->occupancy_sum / r->samples : 0.0,
+	       r->max_occupancy, r->capacity);
+}
+
+/* Print the statistics of the rings of the pipeline */
+static void
+pipeline_report(void)
+{
+	char name[32];
+	unsigned worker;
+
+	printf("\n%-10s %16s %12s %10s %10s %8s\n", "ring", "enqueued",
+	       "dropped", "mean occ", "max occ", "size");
+	for (worker = 0; worker < fwd_workers; worker++)
+	{
+		snprintf(name, sizeof(name), "rx->w%u", worker);
+		print_pipe_ring(name, &pipe_in[worker]);
+		snprintf(name, sizeof(name), "w%u->tx", worker);
+		print_pipe_ring(name, &pipe_out[worker]);
+	}
+}
+
+/* The segmentation counters of every lcore, summed */
+static void
+seg_sum(struct seg_counters *sum)
+{
+	unsigned lcore_id;
+
+	memset(sum, 0, sizeof(*sum));
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		const struct seg_counters *c = &lcore_conf[lcore_id].seg;
+		sum->gro_in += c->gro_in;
+		sum->gro_out += c->gro_out;
+		sum->gso_in += c->gso_in;
+		sum->gso_out += c->gso_out;
+		sum->gso_failed += c->gso_failed;
+		sum->too_big += c->too_big;
+	}
+}
+
+static void
+seg_report(void)
+{
+	struct seg_counters sum;
+
+	seg_sum(&sum);
+	if (fwd_gro)
+		printf("GRO: %" PRIu64 " packets merged into %" PRIu64 "\n",
+			   sum.gro_in, sum.gro_out);
+	printf("GSO: %" PRIu64 " datagrams cut into %" PRIu64 " fragments, "
+		   "dropped %" PRIu64 " out of mbufs, %" PRIu64 " too big and not "
+		   "UDP/IPv4\n",
+		   sum.gso_in, sum.gso_out, sum.gso_failed, sum.too_big);
+}
+
+/*
+ * Print what --power saved and cost on every forwarding lcore over "elapsed"
+ * cycles: the share of the time off the CPU, and the latency added to
+ * the packets that ended a sleep or a wait (mean and max, in us)
+ */
+static void
+idle_report(uint64_t elapsed)
+{
+	const double us_per_cycle = 1e6 / rte_get_tsc_hz();
+	unsigned lcore_id;
+
+	printf("\n%-8s %7s %12s %12s %12s %12s %10s %10s\n", "lcore", "idle%",
+	       "pauses", "sleeps", "intr waits", "intr wakes", "mean us",
+	       "max us");
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		const struct lcore_conf *conf = &lcore_conf[lcore_id];
+		const struct idle_counters *c = &conf->idle.c;
+
+		if (!conf->enabled)
+			continue;
+		printf("%-8u %6.1f%% %12" PRIu64 " %12" PRIu64 " %12" PRIu64
+		       " %12" PRIu64 " %10.1f %10.1f\n",
+		       lcore_id, elapsed ? 100.0 * c->idle_cycles / elapsed : 0.0,
+		       c->pauses, c->sleeps, c->intr_waits, c->intr_wakeups,
+		       c->wakes ? us_per_cycle * c->wake_cycles / c->wakes : 0.0,
+		       us_per_cycle * c->max_wake_cycles);
+	}
+}
+
+/**
+ * Forwarder: one lcore per queue pair, the main lcore included unless the
+ * plan left it out
+ */
+static void
+fwd_main(void)
+{
+	struct port_counters total;
+	uint64_t start, elapsed;
+	unsigned lcore_id;
+	uint16_t port;
+	double secs;
+	int i;
+
+	if (fwd_prime)
+		fwd_prime_queues(fwd_prime);
+
+	start = rte_rdtsc();
+	if (duration > 0)
+		stop_tsc = start + (uint64_t)(duration * rte_get_tsc_hz());
+	if (stats_interval > 0)
+		stats_report(start);
+
+	RTE_LCORE_FOREACH(lcore_id)
+	if (lcore_conf[lcore_id].enabled)
+		fwd_init_lcore(lcore_id);
+
+	RTE_LCORE_FOREACH_WORKER(lcore_id)
+	if (lcore_conf[lcore_id].enabled)
+		rte_eal_remote_launch(lcore_entry, NULL, lcore_id);
+	if (lcore_conf[rte_get_main_lcore()].enabled)
+		lcore_entry(NULL);
+	else
+		/*
+		 * The plan left the main lcore out, with no TX buffers: it only
+		 * keeps the time and the stats, as fwd_drain() does otherwise.
+		 */
+		while (!force_quit)
+		{
+			const uint64_t now = rte_rdtsc();
+
+			if (stop_tsc != 0 && now >= stop_tsc)
+				force_quit = true;
+			if (stats_interval > 0 && now >= stats_next_tsc)
+				stats_report(now);
+			rte_delay_us_sleep(1000);
+		}
+	rte_eal_mp_wait_lcore();
+	pipeline_drain();
+	if (qos_conf != NULL)
+		qos_drain();
+
+	elapsed = rte_rdtsc() - start;
+	secs = (double)elapsed / rte_get_tsc_hz();
+	print_counters_header();
+	memset(&total, 0, sizeof(total));
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		const struct lcore_conf *conf = &lcore_conf[lcore_id];
+		struct port_counters c;
+		char name[16];
+
+		if (!conf->enabled)
+			continue;
+		memset(&c, 0, sizeof(c));
+		RTE_ETH_FOREACH_DEV(port)
+		counters_add(&c, &conf->port[port]);
+		snprintf(name, sizeof(name), "%u%s", lcore_id,
+				 lcore_role_names[conf->role]);
+		print_counters(name, conf->nb_rxq, &c, secs);
+		counters_add(&total, &c);
+	}
+	print_counters("total", rte_eth_dev_count_avail() * nb_queues, &total,
+				   secs);
+
+	printf("RX bursts:");
+	for (i = 0; i < BURST_HIST_SIZE; i++)
+		printf(" %s%u: %" PRIu64, i == BURST_HIST_SIZE - 1 ? ">=" : "",
+			   1u << i, total.burst_hist[i]);
+	printf("\n");
+	if (fwd_workers)
+		pipeline_report();
+	if (qos_conf != NULL)
+		qos_report();
+	if (l3_lpm != NULL)
+		l3_report();
+	if (power_mode)
+		idle_report(elapsed);
+	if (fwd_gso)
+		seg_report();
+}
+
+/*
+ * Packets of a capture, back to back in "data"
+ */
+struct bench_capture
+{
+	uint8_t *data;
+	uint32_t *offset;
+	uint16_t *len;
+	uint32_t nb;
+	uint32_t nb_skipped; /* not Ethernet frames the ports take */
+};
+
+static struct bench_capture bench_cap;
+
+/* Headers of the classic pcap format */
+struct pcap_file_hdr
+{
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec_hdr
+{
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET 1
+
+/**
+ * Read the Ethernet frames of a pcap file into memory
+ */
+static void
+bench_load_pcap(const char *path, struct bench_capture *cap)
+{
+	struct pcap_file_hdr fh;
+	struct pcap_rec_hdr rh;
+	uint32_t capacity = 1024;
+	size_t size = 0, data_capacity = 1 << 20;
+	bool swapped;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot open %s\n", path);
+	if (fread(&fh, sizeof(fh), 1, fp) != 1)
+		rte_exit(EXIT_FAILURE, "%s: not a pcap file\n", path);
+	swapped = (fh.magic == rte_bswap32(PCAP_MAGIC) ||
+			   fh.magic == rte_bswap32(PCAP_MAGIC_NSEC));
+	if (!swapped && fh.magic != PCAP_MAGIC && fh.magic != PCAP_MAGIC_NSEC)
+		rte_exit(EXIT_FAILURE, "%s: not a pcap file\n", path);
+	if ((swapped ? rte_bswap32(fh.linktype) : fh.linktype) !=
+		PCAP_LINKTYPE_ETHERNET)
+		rte_exit(EXIT_FAILURE, "%s: not an Ethernet capture\n", path);
+
+	memset(cap, 0, sizeof(*cap));
+	cap->data = malloc(data_capacity);
+	cap->offset = malloc(capacity * sizeof(*cap->offset));
+	cap->len = malloc(capacity * sizeof(*cap->len));
+	if (cap->data == NULL || cap->offset == NULL || cap->len == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate the capture\n");
+
+	while (fread(&rh, sizeof(rh), 1, fp) == 1)
+	{
+		uint32_t len = swapped ? rte_bswap32(rh.incl_len) : rh.incl_len;
+		uint32_t orig = swapped ? rte_bswap32(rh.orig_len) : rh.orig_len;
+
+		/* Truncated frames and frames the ports cannot carry are skipped. */
+		if (len != orig || len < RTE_ETHER_HDR_LEN ||
+			len > fwd_frame_len() - RTE_ETHER_CRC_LEN)
+		{
+			if (fseek(fp, len, SEEK_CUR) != 0)
+				break;
+			cap->nb_skipped++;
+			continue;
+		}
+
+		if (cap->nb == capacity)
+		{
+			capacity *= 2;
+			cap->offset = realloc(cap->offset, capacity * sizeof(*cap->offset));
+			cap->len = realloc(cap->len, capacity * sizeof(*cap->len));
+		}
+		if (size + len > data_capacity)
+		{
+			data_capacity *= 2;
+			cap->data = realloc(cap->data, data_capacity);
+		}
+		if (cap->data == NULL || cap->offset == NULL || cap->len == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate the capture\n");
+
+		if (fread(cap->data + size, len, 1, fp) != 1)
+			break;
+		cap->offset[cap->nb] = size;
+		cap->len[cap->nb] = len;
+		cap->nb++;
+		size += len;
+	}
+	fclose(fp);
+
+	if (cap->nb == 0)
+		rte_exit(EXIT_FAILURE, "%s: no packet to replay\n", path);
+	printf("bench: %u packets, %zu bytes from %s (%u skipped)\n",
+		   cap->nb, size, path, cap->nb_skipped);
+}
+
+/* The rings of the two ports of the benchmark, indexed by port and queue */
+static struct rte_ring *bench_rx_rings[2][RTE_MAX_LCORE];
+static struct rte_ring *bench_tx_rings[2][RTE_MAX_LCORE];
+
+/**
+ * Make ports 0 and 1 out of rings, with a queue pair per forwarding lcore
+ */
+static void
+bench_create_ports(uint16_t nb_rings)
+{
+	char name[RTE_RING_NAMESIZE];
+	unsigned p, q;
+
+	for (p = 0; p < 2; p++)
+	{
+		for (q = 0; q < nb_rings; q++)
+		{
+			snprintf(name, sizeof(name), "bench_rx_%u_%u", p, q);
+			bench_rx_rings[p][q] = rte_ring_create(name, BENCH_RING_SIZE,
+												   rte_socket_id(),
+												   RING_F_SP_ENQ | RING_F_SC_DEQ);
+			snprintf(name, sizeof(name), "bench_tx_%u_%u", p, q);
+			bench_tx_rings[p][q] = rte_ring_create(name, BENCH_RING_SIZE,
+												   rte_socket_id(),
+												   RING_F_SP_ENQ | RING_F_SC_DEQ);
+			if (bench_rx_rings[p][q] == NULL || bench_tx_rings[p][q] == NULL)
+				rte_exit(EXIT_FAILURE, "Cannot create the rings of the "
+									   "benchmark\n");
+		}
+		snprintf(name, sizeof(name), "bench%u", p);
+		if (rte_eth_from_rings(name, bench_rx_rings[p], nb_rings,
+							   bench_tx_rings[p], nb_rings,
+							   rte_socket_id()) != (int)p)
+			rte_exit(EXIT_FAILURE, "Cannot create the port %s\n", name);
+	}
+}
+
+/**
+ * Collect what the forwarder sent on every TX ring; return the number of
+ * packets
+ */
+static uint64_t
+bench_collect(void)
+{
+	struct rte_mbuf *bufs[MAX_BURST_SIZE];
+	uint64_t nb = 0;
+	unsigned p, q, n;
+
+	for (p = 0; p < 2; p++)
+		for (q = 0; q < nb_queues; q++)
+			while ((n = rte_ring_dequeue_burst(bench_tx_rings[p][q],
+											   (void **)bufs, MAX_BURST_SIZE,
+											   NULL)) > 0)
+			{
+				rte_pktmbuf_free_bulk(bufs, n);
+				nb += n;
+			}
+	return nb;
+}
+
+/* Packets the forwarding lcores dropped so far, on TX or between stages */
+static uint64_t
+bench_dropped(void)
+{
+	uint64_t nb = 0;
+	unsigned lcore_id, worker;
+	uint16_t port;
+
+	RTE_LCORE_FOREACH_WORKER(lcore_id)
+	RTE_ETH_FOREACH_DEV(port)
+	nb += lcore_conf[lcore_id].port[port].tx_dropped;
+	for (worker = 0; worker < fwd_workers; worker++)
+		nb += pipe_in[worker].dropped + pipe_out[worker].dropped;
+	if (qos_conf != NULL)
+		nb += qos_dropped();
+	if (l3_lpm != NULL)
+		nb += l3_dropped();
+	if (fwd_gso)
+	{
+		struct seg_counters sum;
+
+		seg_sum(&sum);
+		nb += sum.gso_failed + sum.too_big;
+	}
+	return nb;
+}
+
+/* The packets "fed" become through GRO and GSO so far */
+static uint64_t
+bench_expected(uint64_t fed)
+{
+	struct seg_counters sum;
+
+	if (!fwd_gso)
+		return fed;
+	seg_sum(&sum);
+	return fed - sum.gro_in + sum.gro_out - sum.gso_in + sum.gso_out;
+}
+
+/**
+ * Benchmark: feed and collect on the main lcore, forward on the others
+ */
+static void
+bench_main(struct rte_mempool *mbuf_pool)
+{
+	const uint64_t hz = rte_get_tsc_hz();
+	struct rte_mbuf *bufs[FWD_BURST_SIZE];
+	uint64_t nb_pkts, fed = 0, collected = 0, stalls = 0;
+	uint64_t start, end, last_progress;
+	uint16_t queue = 0;
+	unsigned lcore_id;
+	double secs;
+
+	/* A loop of the template is BENCH_RING_SIZE packets over the flows. */
+	if (bench_pcap)
+	{
+		bench_load_pcap(bench_pcap, &bench_cap);
+		nb_pkts = bench_loops * bench_cap.nb;
+	}
+	else
+	{
+		build_udp_template(0, gen_size);
+		nb_pkts = bench_loops * BENCH_RING_SIZE;
+	}
+
+	RTE_LCORE_FOREACH_WORKER(lcore_id)
+	if (lcore_conf[lcore_id].enabled)
+	{
+		fwd_init_lcore(lcore_id);
+		rte_eal_remote_launch(lcore_entry, NULL, lcore_id);
+	}
+
+	printf("bench: feeding %" PRIu64 " packets over %u queues\n", nb_pkts,
+		   nb_queues);
+	start = rte_rdtsc();
+	if (stats_interval > 0)
+		stats_report(start);
+	while (fed < nb_pkts && !force_quit)
+	{
+		if (stats_interval > 0 && rte_rdtsc() >= stats_next_tsc)
+			stats_report(rte_rdtsc());
+
+		uint16_t n = RTE_MIN(nb_pkts - fed, (uint64_t)FWD_BURST_SIZE);
+		uint16_t i, nb_enq = 0;
+		uint64_t now = rte_rdtsc();
+
+		if (rte_pktmbuf_alloc_bulk(mbuf_pool, bufs, n) != 0)
+		{
+			/* Everything is in flight: let the forwarder catch up. */
+			collected += bench_collect();
+			stalls++;
+			continue;
+		}
+		for (i = 0; i < n; i++)
+		{
+			bool ok;
+
+			if (bench_pcap)
+			{
+				uint32_t k = (fed + i) % bench_cap.nb;
+				ok = mbuf_append(bufs[i], bench_cap.data + bench_cap.offset[k],
+								 bench_cap.len[k]);
+			}
+			else
+				ok = gen_fill(bufs[i], (fed + i) / gen_flows,
+							  (fed + i) % gen_flows, now);
+			if (unlikely(!ok))
+				break;
+		}
+		if (unlikely(i < n))
+		{
+			/* No mbufs left for a chain: the same as above. */
+			rte_pktmbuf_free_bulk(bufs, n);
+			collected += bench_collect();
+			stalls++;
+			continue;
+		}
+
+		/* Spread the bursts over the queues, as RSS would flows. */
+		while (nb_enq < n && !force_quit)
+		{
+			nb_enq += rte_ring_enqueue_burst(bench_rx_rings[0][queue],
+											 (void **)&bufs[nb_enq],
+											 n - nb_enq, NULL);
+			if (nb_enq < n)
+			{
+				collected += bench_collect();
+				stalls++;
+			}
+		}
+		if (nb_enq < n)
+			rte_pktmbuf_free_bulk(&bufs[nb_enq], n - nb_enq);
+		fed += nb_enq;
+		queue = (queue + 1) % nb_queues;
+		collected += bench_collect();
+	}
+
+	/* Wait for the packets still in the forwarder, as long as they come. */
+	last_progress = rte_rdtsc();
+	while (collected + bench_dropped() < bench_expected(fed) &&
+		   !force_quit &&
+		   rte_rdtsc() - last_progress < hz / 1000 * BENCH_SETTLE_MS)
+	{
+		uint64_t n = bench_collect();
+		if (n > 0)
+		{
+			collected += n;
+			last_progress = rte_rdtsc();
+		}
+	}
+	end = rte_rdtsc();
+
+	force_quit = true;
+	rte_eal_mp_wait_lcore();
+	pipeline_drain();
+	if (qos_conf != NULL)
+		qos_drain();
+	collected += bench_collect();
+
+	secs = (double)(end - start) / hz;
+	if (fwd_workers)
+		pipeline_report();
+	if (qos_conf != NULL)
+		qos_report();
+	if (l3_lpm != NULL)
+		l3_report();
+	if (power_mode)
+		idle_report(end - start);
+	if (fwd_gso)
+		seg_report();
+	printf("bench: %" PRIu64 " packets fed, %" PRIu64 " forwarded, %" PRIu64
+		   " dropped, %" PRIu64 " lost, %" PRIu64 " feeder stalls\n",
+		   fed, collected, bench_dropped(),
+		   bench_expected(fed) -
+			   RTE_MIN(bench_expected(fed), collected + bench_dropped()),
+		   stalls);
+	printf("bench: %s, %.3fs, %.3f Mpps, %.1f cycles/pkt on %u forwarding "
+		   "lcores\n",
+		   fwd_workers ? "pipeline" : "run to completion",
+		   secs, collected / secs / 1e6,
+		   collected ? (double)(end - start) * nb_fwd_lcores / collected : 0.0,
+		   nb_fwd_lcores);
+}
+
+static void
+signal_handler(int signum)
+{
+	if (signum == SIGINT || signum == SIGTERM)
+		force_quit = true;
+}
+
+static void
+usage(const char *prgname)
+{
+	printf("%s [EAL options] -- [--mode=send|gen|fwd|bench|lookup|sink]\n"
+	       "                       [--duration=SECS]\n"
+	       "  gen: [--burst=N] [--rate=PPS] [--count=N] [--size=BYTES]\n"
+	       "       [--flows=N] [--mtu=BYTES] [--gso]\n"
+	       "  fwd: [--queues=N | --workers=N] [--work=CYCLES] [--qos=FILE]\n"
+	       "       [--routes=FILE] [--power] [--prime=N] [--drain=US]\n"
+	       "       [--mtu=BYTES] [--gso] [--gro] [--stats=SECS] [--xstats]\n"
+	       "  bench: [--pcap=FILE] [--loops=N] [--queues=N | --workers=N]\n"
+	       "         [--work=CYCLES] [--qos=FILE] [--routes=FILE] [--power]\n"
+	       "         [--drain=US] [--size=BYTES] [--flows=N] [--mtu=BYTES]\n"
+	       "         [--gso] [--gro] [--stats=SECS] [--xstats]\n"
+	       "  lookup: [--sizes=N,N,...]\n"
+	       "  sink: [--gro] [gen options, with a second lcore]\n",
+	       prgname);
+}
+
+/* Parse the application arguments, those after the EAL ones */
+static int
+parse_args(int argc, char **argv)
+{
+	static const struct option lgopts[] = {
+		{"mode", required_argument, 0, 'm'},
+		{"burst", required_argument, 0, 'b'},
+		{"rate", required_argument, 0, 'r'},
+		{"count", required_argument, 0, 'c'},
+		{"duration", required_argument, 0, 'd'},
+		{"size", required_argument, 0, 's'},
+		{"flows", required_argument, 0, 'f'},
+		{"queues", required_argument, 0, 'q'},
+		{"prime", required_argument, 0, 'p'},
+		{"drain", required_argument, 0, 'D'},
+		{"pcap", required_argument, 0, 'P'},
+		{"loops", required_argument, 0, 'l'},
+		{"stats", required_argument, 0, 'S'},
+		{"xstats", no_argument, 0, 'x'},
+		{"workers", required_argument, 0, 'w'},
+		{"work", required_argument, 0, 'W'},
+		{"qos", required_argument, 0, 'Q'},
+		{"routes", required_argument, 0, 'R'},
+		{"sizes", required_argument, 0, 'z'},
+		{"power", no_argument, 0, 'I'},
+		{"mtu", required_argument, 0, 'M'},
+		{"gso", no_argument, 0, 'G'},
+		{"gro", no_argument, 0, 'g'},
+		{NULL, 0, 0, 0}};
+	char *tok, *save;
+	int opt, n;
+
+	while ((opt = getopt_long(argc, argv, "", lgopts, NULL)) != EOF)
+	{
+		switch (opt)
+		{
+		case 'm':
+			if (strcmp(optarg, "send") == 0)
+				app_mode = MODE_SEND;
+			else if (strcmp(optarg, "gen") == 0)
+				app_mode = MODE_GEN;
+			else if (strcmp(optarg, "fwd") == 0)
+				app_mode = MODE_FWD;
+			else if (strcmp(optarg, "bench") == 0)
+				app_mode = MODE_BENCH;
+			else if (strcmp(optarg, "lookup") == 0)
+				app_mode = MODE_LOOKUP;
+			else if (strcmp(optarg, "sink") == 0)
+				app_mode = MODE_SINK;
+			else
+				return -1;
+			break;
+		case 'b':
+			gen_burst = atoi(optarg);
+			if (gen_burst < 1 || gen_burst > MAX_BURST_SIZE)
+				return -1;
+			break;
+		case 'r':
+			gen_rate = strtoull(optarg, NULL, 10);
+			break;
+		case 'c':
+			gen_count = strtoull(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			if (duration < 0)
+				return -1;
+			break;
+		case 's':
+			n = atoi(optarg);
+			if (n < (int)GEN_MIN_SIZE || n > UINT16_MAX)
+				return -1;
+			gen_size = n;
+			break;
+		case 'f':
+			gen_flows = atoi(optarg);
+			if (gen_flows < 1 || PORT + gen_flows > 65536)
+				return -1;
+			break;
+		case 'q':
+			nb_queues = atoi(optarg);
+			if (nb_queues < 1 || nb_queues > RTE_MAX_LCORE)
+				return -1;
+			break;
+		case 'p':
+			fwd_prime = atoi(optarg);
+			break;
+		case 'D':
+			fwd_drain_us = strtoull(optarg, NULL, 10);
+			if (fwd_drain_us == 0)
+				return -1;
+			break;
+		case 'P':
+			bench_pcap = optarg;
+			break;
+		case 'l':
+			bench_loops = strtoull(optarg, NULL, 10);
+			if (bench_loops == 0)
+				return -1;
+			break;
+		case 'S':
+			stats_interval = atof(optarg);
+			if (stats_interval <= 0)
+				return -1;
+			break;
+		case 'x':
+			stats_xstats = true;
+			break;
+		case 'w':
+			fwd_workers = atoi(optarg);
+			if (fwd_workers > RTE_MAX_LCORE - 2)
+				return -1;
+			break;
+		case 'W':
+			fwd_work_cycles = strtoull(optarg, NULL, 10);
+			break;
+		case 'Q':
+			qos_path = optarg;
+			break;
+		case 'R':
+			routes_path = optarg;
+			break;
+		case 'I':
+			power_mode = true;
+			break;
+		case 'M':
+			n = atoi(optarg);
+			if (n < RTE_ETHER_MIN_MTU || n > MAX_MTU)
+				return -1;
+			fwd_mtu = n;
+			break;
+		case 'G':
+			fwd_gso = true;
+			break;
+		case 'g':
+			/* what is merged must be cut again on the way out */
+			fwd_gro = fwd_gso = true;
+			break;
+		case 'z':
+			nb_lookup_sizes = 0;
+			for (tok = strtok_r(optarg, ",", &save); tok != NULL;
+				 tok = strtok_r(NULL, ",", &save))
+			{
+				if (nb_lookup_sizes == L3_MAX_BENCH_SIZES)
+					return -1;
+				lookup_sizes[nb_lookup_sizes] = strtoul(tok, NULL, 10);
+				if (lookup_sizes[nb_lookup_sizes] == 0 ||
+					lookup_sizes[nb_lookup_sizes] > L3_MAX_ROUTES)
+					return -1;
+				nb_lookup_sizes++;
+			}
+			if (nb_lookup_sizes == 0)
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	/* The payload fits the MTU, or a datagram with --gso. */
+	if (gen_size > gen_max_size())
+		return -1;
+
+	/* The generator stops by itself, also when paired with the sink, the
+	 * forwarder and the sink alone when interrupted. */
+	if (duration < 0)
+		duration = (app_mode == MODE_GEN ||
+					(app_mode == MODE_SINK && rte_lcore_count() > 1))
+					   ? 10
+					   : 0;
+	return 0;
+}
+
+/* Give an lcore one more RX queue to poll */
+static void
+add_rx_queue(struct lcore_conf *conf, uint16_t port, uint16_t queue)
+{
+	struct rx_queue *rxq = &conf->rxq[conf->nb_rxq];
+
+	if (conf->nb_rxq == MAX_RX_PER_LCORE)
+		rte_exit(EXIT_FAILURE, "An lcore polls at most %u RX queues\n",
+				 MAX_RX_PER_LCORE);
+	rxq->port = port;
+	rxq->queue = queue;
+	rxq->burst = FWD_MIN_BURST_SIZE;
+	conf->nb_rxq++;
+}
+
+/*
+ * Give the stages of the pipeline their lcores, RX first (the main lcore
+ * unless it is kept for other work), then the workers, then TX; return the
+ * number of queue pairs, one
+ */
+static uint16_t
+assign_pipeline(bool use_main)
+{
+	const unsigned needed = fwd_workers + 2;
+	unsigned lcore_id, n = 0;
+	uint16_t port;
+
+	if (rte_lcore_count() - (use_main ? 0 : 1) < needed)
+		rte_exit(EXIT_FAILURE, "A pipeline with %u workers needs %u "
+							   "forwarding lcores\n",
+				 fwd_workers, needed);
+
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		struct lcore_conf *conf = &lcore_conf[lcore_id];
+
+		if (!use_main && lcore_id == rte_get_main_lcore())
+			continue;
+		if (n == needed)
+			break;
+		conf->enabled = true;
+		conf->queue = 0;
+		if (n == 0)
+		{
+			conf->role = ROLE_RX;
+			RTE_ETH_FOREACH_DEV(port)
+			add_rx_queue(conf, port, 0);
+		}
+		else if (n == needed - 1)
+			conf->role = ROLE_TX;
+		else
+		{
+			conf->role = ROLE_WORKER;
+			conf->worker = n - 1;
+		}
+		n++;
+	}
+	pipeline_create_rings();
+	nb_fwd_lcores = needed;
+	nb_queues = 1;
+	return 1;
+}
+
+/*
+ * Plan the run to completion: take --queues lcores, those on the sockets
+ * of the ports first, the main lcore first unless it is kept for other
+ * work. Each has a TX queue of its own on every port, and every RX queue
+ * of a port goes to the least loaded of them on the port's socket, or of
+ * all of them if that socket has none. An lcore left without RX queue
+ * does not run. Return the number of queue pairs.
+ */
+static uint16_t
+assign_queues(bool use_main)
+{
+	const unsigned nb_lcores = rte_lcore_count() - (use_main ? 0 : 1);
+	bool port_socket_used[RTE_MAX_NUMA_NODES] = {false};
+	unsigned lcores[RTE_MAX_LCORE], nb = 0, lcore_id, i, pass;
+	uint16_t port, q;
+
+	if (fwd_workers)
+		return assign_pipeline(use_main);
+
+	if (nb_queues == 0)
+		nb_queues = nb_lcores;
+	if (nb_queues == 0 || nb_queues > nb_lcores)
+		rte_exit(EXIT_FAILURE, "%u queues need as many forwarding lcores, "
+							   "%u available\n",
+				 nb_queues, nb_lcores);
+
+	RTE_ETH_FOREACH_DEV(port)
+	port_socket_used[port_socket(port)] = true;
+	for (pass = 0; pass < 2; pass++)
+		RTE_LCORE_FOREACH(lcore_id)
+		{
+			if (!use_main && lcore_id == rte_get_main_lcore())
+				continue;
+			if (port_socket_used[rte_lcore_to_socket_id(lcore_id)] ==
+				(pass == 0))
+				lcores[nb++] = lcore_id;
+		}
+	for (i = 0; i < nb_queues; i++)
+		lcore_conf[lcores[i]].queue = i;
+
+	RTE_ETH_FOREACH_DEV(port)
+	{
+		const unsigned socket = port_socket(port);
+		bool local = false;
+
+		for (i = 0; i < nb_queues; i++)
+			local = local || rte_lcore_to_socket_id(lcores[i]) == socket;
+		for (q = 0; q < nb_queues; q++)
+		{
+			struct lcore_conf *best = NULL;
+
+			for (i = 0; i < nb_queues; i++)
+			{
+				struct lcore_conf *conf = &lcore_conf[lcores[i]];
+
+				if (local && rte_lcore_to_socket_id(lcores[i]) != socket)
+					continue;
+				if (best == NULL || conf->nb_rxq < best->nb_rxq)
+					best = conf;
+			}
+			add_rx_queue(best, port, q);
+		}
+	}
+
+	nb_fwd_lcores = 0;
+	for (i = 0; i < nb_queues; i++)
+	{
+		struct lcore_conf *conf = &lcore_conf[lcores[i]];
+
+		conf->enabled = conf->nb_rxq > 0;
+		nb_fwd_lcores += conf->enabled;
+		if (!conf->enabled)
+			printf("Lcore %u has no port on its socket %u, it does not "
+				   "forward\n",
+				   lcores[i], rte_lcore_to_socket_id(lcores[i]));
+	}
+	return nb_queues;
+}
+
+/*
+ * Print the RX queues of every lcore, and the remote memory accesses the
+ * placement could not avoid: RX queues polled from another socket, TX
+ * from the pipeline on another socket, and port pairs that span two
+ * sockets, whose packets are then sent from the memory of the other one
+ */
+static void
+placement_report(void)
+{
+	unsigned lcore_id, i, remote = 0;
+	uint16_t port;
+
+	RTE_LCORE_FOREACH(lcore_id)
+	{
+		const struct lcore_conf *conf = &lcore_conf[lcore_id];
+		const int socket = rte_lcore_to_socket_id(lcore_id);
+
+		if (!conf->enabled)
+			continue;
+		printf("Lcore %u%s on socket %d polls:", lcore_id,
+			   lcore_role_names[conf->role], socket);
+		for (i = 0; i < conf->nb_rxq; i++)
+			printf(" %u/%u", conf->rxq[i].port, conf->rxq[i].queue);
+		printf("%s\n", conf->nb_rxq ? "" : " nothing");
+
+		for (i = 0; i < conf->nb_rxq; i++)
+			if (port_socket(conf->rxq[i].port) != socket)
+			{
+				printf("WARNING, lcore %u polls port %u on remote socket "
+					   "%d\n",
+					   lcore_id, conf->rxq[i].port,
+					   port_socket(conf->rxq[i].port));
+				remote++;
+			}
+		if (conf->role != ROLE_TX)
+			continue;
+		RTE_ETH_FOREACH_DEV(port)
+		{
+			if (port_socket(port) == socket)
+				continue;
+			printf("WARNING, lcore %u sends on port %u on remote socket "
+				   "%d\n",
+				   lcore_id, port, port_socket(port));
+			remote++;
+		}
+	}
+	RTE_ETH_FOREACH_DEV(port)
+	{
+		if (routes_path != NULL || (port & 1) != 0 ||
+			port_socket(port) == port_socket(port ^ 1))
+			continue;
+		printf("WARNING, ports %u and %u are on sockets %d and %d\n", port,
+			   port ^ 1, port_socket(port), port_socket(port ^ 1));
+		remote++;
+	}
+	if (remote == 0)
+		printf("Every port is served from its own socket\n");
+}
+
+/*
+ * Create the mbuf pool of every socket with ports, for the packets they
+ * receive. It holds their RX and TX rings full and the primed packets,
+ * and what every lcore may have in flight: a generator burst, its TX
+ * buffers and shapers, and the pipeline rings. The per-lcore cache takes
+ * at most half the pool over all lcores, which may all free packets of
+ * any pool, and the pool grows by what the caches hold. Packets in
+ * flight count for every mbuf of their chain. With --gso, every socket
+ * also gets a pool of indirect mbufs for the fragments.
+ */
+static void
+create_pools(uint16_t nb_rings)
+{
+	const unsigned nb_lcores = rte_lcore_count();
+	const unsigned nb_ports = rte_eth_dev_count_avail();
+	/* Mbufs a packet takes: jumbo frames, and generated datagrams beyond
+	 * the MTU, are chains (64 bytes cover the headers) */
+	const unsigned segs = (RTE_MAX(fwd_frame_len(), gen_size + 64u) +
+						   RTE_MBUF_DEFAULT_DATAROOM - 1) /
+						  RTE_MBUF_DEFAULT_DATAROOM;
+	/* With --gso, a TX ring of fragments also holds the datagrams they
+	 * refer to, and the fragments in flight take indirect mbufs, two
+	 * where they straddle mbufs of the datagram */
+	const unsigned nb_indirect =
+		2 * (nb_ports * nb_rings * TX_RING_SIZE +
+			 nb_lcores * (GSO_MAX_SEGS +
+						  nb_ports * (FWD_BURST_SIZE + qos_backlog_limit())));
+	unsigned need[RTE_MAX_NUMA_NODES] = {0};
+	char name[RTE_MEMPOOL_NAMESIZE];
+	unsigned socket, n, cache;
+	uint16_t port;
+
+	RTE_ETH_FOREACH_DEV(port)
+	need[port_socket(port)] +=
+		nb_rings * (RX_RING_SIZE + TX_RING_SIZE * (fwd_gso ? 2 : 1) +
+					fwd_prime * segs);
+
+	for (socket = 0; socket < RTE_MAX_NUMA_NODES; socket++)
+	{
+		if (need[socket] == 0)
+			continue;
+		n = need[socket] +
+			segs * (fwd_workers * 2 * PIPE_RING_SIZE +
+					nb_lcores * (MAX_BURST_SIZE +
+								 nb_ports * (FWD_BURST_SIZE +
+											 qos_backlog_limit())));
+		cache = RTE_MIN((unsigned)RTE_MEMPOOL_CACHE_MAX_SIZE,
+						n / (2 * nb_lcores));
+		n += nb_lcores * cache * 3 / 2; /* a cache fills up to 1.5 times */
+
+		snprintf(name, sizeof(name), "MBUF_POOL_%u", socket);
+		socket_pools[socket] = rte_pktmbuf_pool_create(name, n, cache, 0,
+													   RTE_MBUF_DEFAULT_BUF_SIZE,
+													   socket);
+		if (socket_pools[socket] == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot create the mbuf pool of socket "
+								   "%u\n",
+					 socket);
+		printf("Socket %u: %u mbufs, caches of %u\n", socket, n, cache);
+
+		if (!fwd_gso)
+			continue;
+		snprintf(name, sizeof(name), "INDIRECT_POOL_%u", socket);
+		indirect_pools[socket] = rte_pktmbuf_pool_create(name, nb_indirect,
+														 cache, 0, 0, socket);
+		if (indirect_pools[socket] == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot create the indirect mbuf pool of "
+								   "socket %u\n",
+					 socket);
+	}
+}
+
+/*
+ * The main function, which does initialization and calls the per-lcore
+ * functions.
+ */
+int main(int argc, char *argv[])
+{
+	unsigned nb_ports;
+	uint16_t nb_rings = 1;
+	uint16_t portid;
+
+	/* Initialize the Environment Abstraction Layer (EAL). */
+	int ret = rte_eal_init(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, "Error with EAL initialization\n");
+
+	argc -= ret;
+	argv += ret;
+
+	if (parse_args(argc, argv) < 0)
+	{
+		usage(argv[0]);
+		rte_exit(EXIT_FAILURE, "Invalid arguments\n");
+	}
+	if (qos_path != NULL)
+		qos_load(qos_path);
+
+	force_quit = false;
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	/* The lookup benchmark needs no port. */
+	if (app_mode == MODE_LOOKUP)
+	{
+		lookup_main();
+		rte_eal_cleanup();
+		return 0;
+	}
+
+	/* The benchmark makes its own pair of ports out of rings. */
+	if (app_mode == MODE_BENCH)
+	{
+		if (rte_eth_dev_count_avail() != 0)
+			rte_exit(EXIT_FAILURE, "Error: bench mode makes its own ports, "
+								   "remove the devices\n");
+		if (nb_queues == 0)
+			nb_queues = RTE_MAX(rte_lcore_count() - 1, 1u);
+		bench_create_ports(fwd_workers ? 1 : nb_queues);
+		nb_rings = assign_queues(false);
+		placement_report();
+	}
+
+	nb_ports = rte_eth_dev_count_avail();
+	if (nb_ports == 0)
+		rte_exit(EXIT_FAILURE, "Error: no Ethernet port\n");
+
+	/* Check that there is an even number of ports to send/receive on. */
+	if (app_mode == MODE_FWD)
+	{
+		if (nb_ports < 2 || (nb_ports & 1))
+			rte_exit(EXIT_FAILURE, "Error: number of ports must be even\n");
+		nb_rings = assign_queues(true);
+		placement_report();
+	}
+
+	/* Creates the mempools in memory to hold the mbufs, on the sockets of
+	 * the ports. */
+	create_pools(nb_rings);
+
+	/* Initialize all ports. */
+	RTE_ETH_FOREACH_DEV(portid)
+	if (port_init(portid, port_pool(portid), nb_rings) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu16 "\n",
+				 portid);
+
+	/* The next hops take the MAC addresses of the ports by default. */
+	if (routes_path != NULL)
+		l3_load(routes_path);
+
+	if (rte_lcore_count() > 1 && (app_mode == MODE_SEND || app_mode == MODE_GEN))
+		printf("\nWARNING: Too many lcores enabled. Only 1 used.\n");
+	if (rte_lcore_count() > 2 && app_mode == MODE_SINK)
+		printf("\nWARNING: Too many lcores enabled. Only 2 used.\n");
+
+	if (app_mode == MODE_BENCH)
+		bench_main(port_pool(0));
+	else if (app_mode == MODE_FWD)
+		fwd_main();
+	else if (app_mode == MODE_GEN)
+		gen_main(port_pool(0));
+	else if (app_mode == MODE_SINK)
+	{
+		/* The generator sends on port 0 from the next lcore. */
+		bool paired = rte_lcore_count() > 1;
+
+		if (paired)
+			rte_eal_remote_launch(sink_gen_entry, port_pool(0),
+								  rte_get_next_lcore(-1, 1, 0));
+		sink_main(paired);
+		rte_eal_mp_wait_lcore();
+	}
+	else
+		send_udp(port_pool(0));
 
 	/* clean up the EAL */
 	rte_eal_cleanup();